@@ -0,0 +1,32 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The benchmarks count the allocations with the counters of the
+ * instrumentation, see core/allocation_counter.hpp */
+
+#include "core/allocation_counter.hpp"
+
+#include "harness.hpp"
+
+yaourt::bench::allocation_count
+yaourt::bench::allocations()
+{
+    auto ac = yaourt::instrumentation::counted_allocations();
+    return { ac.count, ac.bytes };
+}
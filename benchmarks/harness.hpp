@@ -0,0 +1,190 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* Minimal benchmark harness: each benchmark is a function timed over
+ * repeated runs, with a model of the work it does to compute the rates.
+ * The results are printed as they come and written as JSON at the end. */
+
+namespace yaourt::bench {
+
+/* Allocations since the start of the process, counted by alloc_counter.cpp */
+struct allocation_count
+{
+    size_t  count;
+    size_t  bytes;
+};
+
+allocation_count allocations();
+
+/* Work of one run of a benchmark, zero where not meaningful. 'dofs' are
+ * the degrees of freedom processed, or the values computed for the bases
+ * and the quadratures. 'flops' and 'bytes' are models of the arithmetic
+ * and of the memory traffic, they are not measured. */
+struct work_model
+{
+    double  dofs;
+    double  flops;
+    double  bytes;
+};
+
+struct result
+{
+    std::string     name, mesh;
+    size_t          level, degree, threads, runs;
+    double          time_min, time_median;      /* Seconds per run */
+    work_model      work;
+    double          allocations, allocated_bytes;   /* Per run */
+};
+
+class suite
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<result>     results;
+    double                  min_time;
+    size_t                  min_runs, max_runs;
+    std::string             filter;
+
+    static double rate(double amount, double time)
+    {
+        return (time > 0.0) ? amount/time : 0.0;
+    }
+
+    static void write_string(std::ostream& os, const std::string& s)
+    {
+        os << '"';
+        for (auto c : s)
+        {
+            if (c == '"' or c == '\\')
+                os << '\\';
+            os << c;
+        }
+        os << '"';
+    }
+
+public:
+    /* Each benchmark runs for at least 'p_min_time' seconds, only the
+     * ones whose name contains 'p_filter' are run */
+    suite(double p_min_time = 0.2, const std::string& p_filter = "")
+        : min_time(p_min_time), min_runs(3), max_runs(10000), filter(p_filter)
+    {}
+
+    bool enabled(const std::string& name) const
+    {
+        return filter.empty() or name.find(filter) != std::string::npos;
+    }
+
+    /* Run 'f' once to warm up, then time it until min_time has passed.
+     * The allocations are the ones of the timed runs. */
+    template<typename Function>
+    void run(const std::string& name, const std::string& mesh, size_t level,
+             size_t degree, size_t threads, const work_model& work, Function&& f)
+    {
+        if ( !enabled(name) )
+            return;
+
+        f();
+
+        std::vector<double> times;
+        times.reserve(max_runs);
+
+        double total = 0.0;
+        auto alloc_start = allocations();
+        while ((total < min_time or times.size() < min_runs) and times.size() < max_runs)
+        {
+            auto start = clock::now();
+            f();
+            auto end = clock::now();
+
+            double t = std::chrono::duration<double>(end - start).count();
+            times.push_back(t);
+            total += t;
+        }
+        auto alloc_end = allocations();
+
+        std::sort(times.begin(), times.end());
+
+        result r;
+        r.name = name;
+        r.mesh = mesh;
+        r.level = level;
+        r.degree = degree;
+        r.threads = threads;
+        r.runs = times.size();
+        r.time_min = times.front();
+        r.time_median = times[times.size()/2];
+        r.work = work;
+        r.allocations = double(alloc_end.count - alloc_start.count)/r.runs;
+        r.allocated_bytes = double(alloc_end.bytes - alloc_start.bytes)/r.runs;
+
+        std::cout << std::left << std::setw(24) << name << " " << mesh;
+        std::cout << " level " << level << " degree " << degree << ": ";
+        std::cout << r.time_min << " s";
+        if (work.dofs > 0)
+            std::cout << ", " << rate(work.dofs, r.time_min) << " DoFs/s";
+        if (work.flops > 0)
+            std::cout << ", " << rate(work.flops, r.time_min)*1e-9 << " GFLOP/s";
+        if (work.bytes > 0)
+            std::cout << ", " << rate(work.bytes, r.time_min)*1e-9 << " GB/s";
+        std::cout << ", " << r.allocations << " allocations" << std::endl;
+
+        results.push_back(r);
+    }
+
+    /* The rates are computed on the fastest run */
+    void write_json(std::ostream& os) const
+    {
+        os << std::setprecision(8);
+        os << "{\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto& r = results[i];
+            os << "    {\"name\": ";
+            write_string(os, r.name);
+            os << ", \"mesh\": ";
+            write_string(os, r.mesh);
+            os << ", \"level\": " << r.level;
+            os << ", \"degree\": " << r.degree;
+            os << ", \"threads\": " << r.threads;
+            os << ", \"runs\": " << r.runs;
+            os << ", \"time_min\": " << r.time_min;
+            os << ", \"time_median\": " << r.time_median;
+            os << ", \"dofs\": " << r.work.dofs;
+            os << ", \"dofs_per_s\": " << rate(r.work.dofs, r.time_min);
+            os << ", \"gflops\": " << rate(r.work.flops, r.time_min)*1e-9;
+            os << ", \"gbytes_per_s\": " << rate(r.work.bytes, r.time_min)*1e-9;
+            os << ", \"allocations\": " << r.allocations;
+            os << ", \"allocated_bytes\": " << r.allocated_bytes << "}";
+            os << (i+1 < results.size() ? ",\n" : "\n");
+        }
+        os << "  ]\n}\n";
+    }
+};
+
+} // namespace yaourt::bench
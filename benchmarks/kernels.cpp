@@ -0,0 +1,488 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Benchmarks of the kernels of the solvers, swept over the mesh types,
+ * the refinement levels and the degrees. Everything runs the code of the
+ * library used by the drivers:
+ *
+ *  - basis_eval, basis_grads: evaluation of the bases at the quadrature
+ *    points of the cells
+ *  - tabulated_basis: tabulation of the bases on a cell and its faces
+ *  - quadrature: quadrature points of the cells and of the faces
+ *  - assembly_sip, assembly_sip_triplets, assembly_advection: assembly of
+ *    the systems of dg2d_diffusion and dg2d_advection, finalize() included
+ *  - init_from_triplets: sort and reduction of the triplets of a DG matrix
+ *  - spmv_csr, spmv_bsr, sip_matrix_free: product with the SIP matrix
+ *  - cg: fixed number of CG iterations on the SIP system
+ *  - assembly_maxwell, maxwell_timestep: setup and RK4 timestep of the
+ *    Maxwell solver
+ *
+ * The FLOP and byte counts are models of the minimum work of the kernels,
+ * see the benchmark functions. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/quadratures.hpp"
+#include "core/bases.hpp"
+#include "core/tabulation.hpp"
+#include "core/solvers.hpp"
+#include "core/blaze_sparse_init.hpp"
+#include "methods/dg.hpp"
+#include "methods/dg_assembly.hpp"
+#include "methods/dg_matrix_free.hpp"
+#include "methods/dg_maxwell_2D.hpp"
+
+#include "harness.hpp"
+
+using yaourt::bench::suite;
+using yaourt::bench::work_model;
+
+/* Keeps the results of the benchmarks that return nothing alive */
+static volatile double sink;
+
+struct bench_config
+{
+    std::vector<size_t>     levels;
+    std::vector<size_t>     degrees;
+    bool                    tri, quad;
+    size_t                  num_threads;
+    size_t                  cg_iterations;
+
+    bench_config()
+        : levels({3, 4, 5}), degrees({1, 2, 3, 4}), tri(true), quad(true),
+          num_threads(1), cg_iterations(50)
+    {}
+};
+
+template<typename Mesh>
+void
+bench_bases(suite& s, const Mesh& msh, const std::string& mesh_name,
+            size_t level, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    auto bs = yb::scalar_basis_size(degree, 2);
+
+    /* The points are the ones of the mass matrix */
+    std::vector<std::vector<point_type>> pts(msh.cells.size());
+    size_t num_pts = 0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        for (auto& qp : yq::integrate(msh, msh.cells[cl_id], 2*degree))
+            pts[cl_id].push_back( qp.point() );
+        num_pts += pts[cl_id].size();
+    }
+
+    std::vector<decltype(yb::make_basis(msh, msh.cells[0], degree))> bases;
+    for (auto& cl : msh.cells)
+        bases.push_back( yb::make_basis(msh, cl, degree) );
+
+    blaze::DynamicVector<T> phi(bs);
+    blaze::DynamicMatrix<T> dphi(bs, 2);
+
+    work_model values{ double(num_pts*bs), 0.0, 0.0 };
+    s.run("basis_eval", mesh_name, level, degree, 1, values, [&]() {
+        T acc = 0.0;
+        for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+            for (auto& pt : pts[cl_id])
+            {
+                bases[cl_id].eval(pt, phi);
+                acc += phi[bs-1];
+            }
+        sink = acc;
+    });
+
+    work_model grads{ double(2*num_pts*bs), 0.0, 0.0 };
+    s.run("basis_grads", mesh_name, level, degree, 1, grads, [&]() {
+        T acc = 0.0;
+        for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+            for (auto& pt : pts[cl_id])
+            {
+                bases[cl_id].eval_grads(pt, dphi);
+                acc += dphi(bs-1, 1);
+            }
+        sink = acc;
+    });
+
+    work_model cells{ double(msh.cells.size()*bs), 0.0, 0.0 };
+    s.run("tabulated_basis", mesh_name, level, degree, 1, cells, [&]() {
+        size_t acc = 0;
+        for (auto& cl : msh.cells)
+        {
+            auto tbasis = yb::make_tabulated_basis(msh, cl, degree, 2*degree);
+            acc += tbasis.cell_quadrature().size();
+        }
+        sink = acc;
+    });
+
+    std::vector<yq::quadrature_point<T,2>> qps;
+    size_t num_qps = 0;
+    for (auto& cl : msh.cells)
+        num_qps += yq::integrate(msh, cl, 2*degree).size();
+    for (auto& fc : msh.faces)
+        num_qps += yq::integrate(msh, fc, 2*degree).size();
+
+    work_model points{ double(num_qps), 0.0, 0.0 };
+    s.run("quadrature", mesh_name, level, degree, 1, points, [&]() {
+        T acc = 0.0;
+        for (auto& cl : msh.cells)
+        {
+            yq::integrate(msh, cl, 2*degree, qps);
+            acc += qps.back().weight();
+        }
+        for (auto& fc : msh.faces)
+        {
+            yq::integrate(msh, fc, 2*degree, qps);
+            acc += qps.back().weight();
+        }
+        sink = acc;
+    });
+}
+
+/* Same triplets the TRIPLETS assembly produces for the matrix 'A': one
+ * contribution per nonzero, plus one more to the diagonal block for each
+ * face of the cell, in the order of the cells */
+template<typename Mesh>
+std::vector<blaze::triplet<typename Mesh::coordinate_type>>
+dg_triplets(const Mesh& msh, const blaze::CompressedMatrix<typename Mesh::coordinate_type>& A,
+            size_t bs)
+{
+    using T = typename Mesh::coordinate_type;
+
+    std::vector<blaze::triplet<T>> ret;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        auto num_faces = face_ids(msh, msh.cells[cl_id]).size();
+        for (size_t i = cl_id*bs; i < (cl_id+1)*bs; i++)
+        {
+            for (auto itor = A.begin(i); itor != A.end(i); ++itor)
+            {
+                ret.push_back({i, itor->index(), itor->value()});
+                if (itor->index()/bs != cl_id)
+                    continue;
+
+                for (size_t f = 0; f < num_faces; f++)
+                    ret.push_back({i, itor->index(), itor->value()/num_faces});
+            }
+        }
+    }
+
+    return ret;
+}
+
+template<typename Mesh>
+void
+bench_dg(suite& s, const Mesh& msh, const std::string& mesh_name, size_t level,
+         size_t degree, const bench_config& cfg)
+{
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+    namespace yb = yaourt::bases;
+
+    auto nt = cfg.num_threads;
+    auto bs = yb::scalar_basis_size(degree, 2);
+    auto ndofs = double(msh.cells.size()*bs);
+    T eta = 3*degree*degree;
+
+    auto one = [](const point_type&) -> T { return 1.0; };
+    auto zero = [](const point_type&) -> T { return 0.0; };
+    auto beta = [](const point_type&) -> blaze::StaticVector<T,2> {
+        return blaze::StaticVector<T,2>{1.0, 0.5};
+    };
+
+    work_model dofs{ ndofs, 0.0, 0.0 };
+    s.run("assembly_sip", mesh_name, level, degree, nt, dofs, [&]() {
+        assembler<Mesh> assm(msh, degree, false, nt, dg_assembly_mode::PATTERN);
+        assemble_sip_diffusion(msh, assm, degree, eta, one, zero, nt);
+        assm.finalize();
+    });
+
+    s.run("assembly_sip_triplets", mesh_name, level, degree, nt, dofs, [&]() {
+        assembler<Mesh> assm(msh, degree, false, nt, dg_assembly_mode::TRIPLETS);
+        assemble_sip_diffusion(msh, assm, degree, eta, one, zero, nt);
+        assm.finalize();
+    });
+
+    s.run("assembly_advection", mesh_name, level, degree, nt, dofs, [&]() {
+        assembler<Mesh> assm(msh, degree, false, nt, dg_assembly_mode::PATTERN);
+        assemble_advection_reaction(msh, assm, degree, eta, true, one, beta, one, nt);
+        assm.finalize();
+    });
+
+    /* The matrices of the solver benchmarks */
+    assembler<Mesh> assm(msh, degree, false, nt, dg_assembly_mode::PATTERN);
+    assemble_sip_diffusion(msh, assm, degree, eta, one, zero, nt);
+    assm.finalize();
+    const auto& A = assm.lhs;
+
+    assembler<Mesh> assm_blocks(msh, degree, false, nt, dg_assembly_mode::BLOCKS);
+    assemble_sip_diffusion(msh, assm_blocks, degree, eta, one, zero, nt);
+    assm_blocks.finalize();
+    const auto& Ab = assm_blocks.lhs_blocks;
+
+    auto n = A.rows();
+    auto nnz = double(A.nonZeros());
+    auto vec_bytes = double(n*sizeof(T));
+
+    /* The input triplets are copied at each run, init_from_triplets()
+     * sorts them in place. The storage of the copy is reused. */
+    if ( s.enabled("init_from_triplets") )
+    {
+        auto triplets = dg_triplets(msh, A, bs);
+        auto scratch = triplets;
+        blaze::CompressedMatrix<T> M(n, n);
+
+        work_model trip{ double(triplets.size()), 0.0,
+                         double(2*triplets.size()*sizeof(blaze::triplet<T>)) };
+        s.run("init_from_triplets", mesh_name, level, degree, nt, trip, [&]() {
+            std::copy(triplets.begin(), triplets.end(), scratch.begin());
+            blaze::init_from_triplets(M, scratch.begin(), scratch.end(), nt);
+        });
+    }
+
+    blaze::DynamicVector<T> x(n, 1.0), y(n, 0.0), b(n, 1.0);
+
+    /* Each nonzero is read once with its column index, plus the row
+     * pointers and the two vectors */
+    work_model csr{ double(n), 2*nnz,
+                    nnz*(sizeof(T)+sizeof(size_t)) + (n+1)*sizeof(size_t) + 2*vec_bytes };
+    s.run("spmv_csr", mesh_name, level, degree, 1, csr, [&]() {
+        y = A*x;
+    });
+
+    auto nblocks = double(Ab.num_blocks());
+    work_model bsr{ double(n), 2*nnz,
+                    nblocks*(bs*bs*sizeof(T) + sizeof(size_t)) + 2*vec_bytes };
+    s.run("spmv_bsr", mesh_name, level, degree, 1, bsr, [&]() {
+        Ab.multiply(x.data(), y.data());
+    });
+
+    /* The matrix-free operator recomputes the local matrices, its work
+     * is not comparable with the products above */
+    auto op = yaourt::dg::make_sip_diffusion_operator(msh, degree, eta, nt);
+    s.run("sip_matrix_free", mesh_name, level, degree, nt, dofs, [&]() {
+        op.apply(x, y);
+    });
+
+    /* The CG iteration is the product plus two dot products and three
+     * AXPY-like updates, about five vectors are read or written besides
+     * the ones of the product */
+    conjugated_gradient_params<T> cgp;
+    cgp.rr_tol = 0.0;
+    cgp.max_iter = cfg.cg_iterations;
+    conjugated_gradient_solver<T> cg(cgp);
+
+    auto iters = double(cfg.cg_iterations);
+    work_model cgw{ iters*n, iters*(2*nnz + 10*n), iters*(csr.bytes + 5*vec_bytes) };
+    s.run("cg", mesh_name, level, degree, 1, cgw, [&]() {
+        x = 0.0;
+        cg.solve(A, b, x);
+    });
+}
+
+template<typename Mesh>
+void
+bench_maxwell(suite& s, const std::string& mesh_name, size_t level,
+              size_t degree, const bench_config& cfg)
+{
+    if ( !s.enabled("maxwell") )
+        return;
+
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+    namespace ymax = yaourt::maxwell_2D;
+
+    ymax::maxwell_config<T> mcfg;
+    mcfg.degree = degree;
+    mcfg.mesh_levels = level;
+    mcfg.num_threads = cfg.num_threads;
+    mcfg.upwind = true;
+
+    ymax::maxwell_context<Mesh> ctx(mcfg);
+
+    auto ndofs = double(ctx.gDofs.size());
+    work_model dofs{ ndofs, 0.0, 0.0 };
+    s.run("assembly_maxwell", mesh_name, level, degree, cfg.num_threads, dofs, [&]() {
+        assemble(ctx);
+    });
+
+    /* Well below the stability limit, the solution must not blow up
+     * while the timestep is repeated */
+    ctx.cfg.delta_t = 1e-3 * diameter(ctx.msh) / ((degree+1)*(degree+1));
+
+    auto zero = [](const point_type&, T) -> T { return 0.0; };
+    auto pulse = [](const point_type& pt, T) -> T {
+        auto x = pt[0] - 0.5;
+        auto y = pt[1] - 0.5;
+        return std::exp(-60*(x*x + y*y));
+    };
+    apply_initial_condition(ctx, zero, zero, pulse);
+
+    /* Each stage streams the operator once and reads and writes the
+     * stage vectors */
+    auto vec_bytes = ndofs*sizeof(T);
+    auto op_bytes = double(ctx.gOp_values.size()*sizeof(T) + ctx.gOp_neigh.size()*sizeof(size_t));
+    work_model ts{ ndofs, double(ymax::timestep_flops(ctx)), 4*(op_bytes + 4*vec_bytes) };
+    s.run("maxwell_timestep", mesh_name, level, degree, cfg.num_threads, ts, [&]() {
+        do_timestep(ctx);
+    });
+}
+
+template<typename Mesh>
+void
+run_benchmarks(suite& s, const std::string& mesh_name, const bench_config& cfg)
+{
+    for (auto level : cfg.levels)
+    {
+        Mesh msh;
+        auto mesher = yaourt::get_mesher(msh);
+        mesher.create_mesh(msh, level);
+
+        for (auto degree : cfg.degrees)
+        {
+            bench_bases(s, msh, mesh_name, level, degree);
+            bench_dg(s, msh, mesh_name, level, degree, cfg);
+            bench_maxwell<Mesh>(s, mesh_name, level, degree, cfg);
+        }
+    }
+}
+
+/* "3,4,5" or "3-5" */
+static std::vector<size_t>
+parse_list(const char *str)
+{
+    std::vector<size_t> ret;
+    std::stringstream ss(str);
+    std::string item;
+    while ( std::getline(ss, item, ',') )
+    {
+        auto dash = item.find('-');
+        if (dash == std::string::npos)
+        {
+            ret.push_back( std::stoul(item) );
+            continue;
+        }
+
+        auto first = std::stoul(item.substr(0, dash));
+        auto last = std::stoul(item.substr(dash+1));
+        for (auto i = first; i <= last; i++)
+            ret.push_back(i);
+    }
+
+    return ret;
+}
+
+static void
+usage(const char *progname)
+{
+    std::cout << "Usage: " << progname << " [options]" << std::endl;
+    std::cout << "  -f <name>     run only the benchmarks whose name contains <name>" << std::endl;
+    std::cout << "  -i <num>      CG iterations of the cg benchmark" << std::endl;
+    std::cout << "  -j <num>      threads of the parallel kernels" << std::endl;
+    std::cout << "  -k <list>     degrees, e.g. 1,2 or 1-4" << std::endl;
+    std::cout << "  -m tri|quad   only one mesh type" << std::endl;
+    std::cout << "  -o <file>     write the results in JSON" << std::endl;
+    std::cout << "  -r <list>     refinement levels, e.g. 3,4 or 3-5" << std::endl;
+    std::cout << "  -t <seconds>  minimum time of each benchmark" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    using T = double;
+
+    bench_config    cfg;
+    std::string     filter;
+    double          min_time = 0.2;
+    char *          json_fn = nullptr;
+
+    int     ch;
+
+    while ( (ch = getopt(argc, argv, "f:i:j:k:m:o:r:t:h")) != -1 )
+    {
+        switch(ch)
+        {
+            case 'f':
+                filter = optarg;
+                break;
+
+            case 'i':
+                cfg.cg_iterations = std::max(1, atoi(optarg));
+                break;
+
+            case 'j':
+                cfg.num_threads = std::max(1, atoi(optarg));
+                break;
+
+            case 'k':
+                cfg.degrees = parse_list(optarg);
+                break;
+
+            case 'm':
+                cfg.tri = strcmp(optarg, "tri") == 0;
+                cfg.quad = strcmp(optarg, "quad") == 0;
+                break;
+
+            case 'o':
+                json_fn = optarg;
+                break;
+
+            case 'r':
+                cfg.levels = parse_list(optarg);
+                break;
+
+            case 't':
+                min_time = atof(optarg);
+                break;
+
+            case 'h':
+            case '?':
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    suite s(min_time, filter);
+
+    if (cfg.tri)
+        run_benchmarks< yaourt::simplicial_mesh<T> >(s, "tri", cfg);
+
+    if (cfg.quad)
+        run_benchmarks< yaourt::quad_mesh<T> >(s, "quad", cfg);
+
+    if (json_fn)
+    {
+        std::ofstream ofs(json_fn);
+        s.write_json(ofs);
+    }
+
+    return 0;
+}
@@ -23,11 +23,17 @@
 
 #include <blaze/Math.h>
 
+#include <unistd.h>
+
 #include "core/mesh.hpp"
 #include "core/meshers.hpp"
 #include "core/dataio.hpp"
 #include "core/solvers.hpp"
+#include "core/parallel.hpp"
 #include "methods/cfem.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
 template<typename T>
 blaze::StaticVector<T, 3>
@@ -54,21 +60,47 @@ int main(int argc, char **argv)
 
     using T = double;
 
+    size_t  num_threads = 1;
+    int     ch;
+
+    while ( (ch = getopt(argc, argv, "j:")) != -1 )
+    {
+        switch(ch)
+        {
+            case 'j':
+                num_threads = std::max(0, atoi(optarg));
+                if (num_threads == 0)
+                    num_threads = yaourt::default_num_threads();
+                break;
+
+            case '?':
+            default:
+                std::cout << "wrong arguments" << std::endl;
+                exit(1);
+        }
+    }
+
     yaourt::simplicial_mesh<T> msh;
     auto mesher = yaourt::get_mesher(msh);
 
     mesher.create_mesh(msh, 2);
 
-    auto assembler = yaourt::cfem::get_assembler(msh, 1);
+    YAOURT_TIMED_SCOPE_VAR(asm_timer, "cfem.assembly", false);
+    auto assembler = yaourt::cfem::get_assembler(msh, 1, num_threads);
 
-    for(auto& cl : msh.cells)
-    {
-        auto local_lhs = yaourt::cfem::stiffness_matrix(msh, cl);
-        auto local_rhs = compute_rhs(msh, cl);
-        assembler.assemble(msh, cl, local_lhs, local_rhs);
-    }
+    yaourt::parallel_for_chunks(msh.cells.size(), num_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+            for (size_t cl_id = begin; cl_id < end; cl_id++)
+            {
+                const auto& cl = msh.cells[cl_id];
+                auto local_lhs = yaourt::cfem::stiffness_matrix(msh, cl);
+                auto local_rhs = compute_rhs(msh, cl);
+                assembler.assemble(msh, cl, local_lhs, local_rhs, tid);
+            }
+        });
 
     assembler.finalize();
+    asm_timer.stop();
 
     blaze::DynamicVector<T> sol(assembler.system_size());
 
@@ -0,0 +1,362 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "mesh.hpp"
+#include "quadratures.hpp"
+#include "tabulation.hpp"
+
+/* Adaptive h-refinement. The marked cells are split in four as in the
+ * uniform refinement, their neighbours are left untouched, so the mesh
+ * becomes nonconforming: a face of a coarse cell can be covered by two
+ * faces of finer cells. These faces are listed in msh.hanging_faces, in
+ * face_owners they have a single owner but they are not on the boundary.
+ * The mesh is kept 1-irregular: a face is split at most once with respect
+ * to its neighbour, so that each fine face lies on exactly one coarse
+ * face.
+ *
+ * The typical loop is solve, estimate (one squared indicator per cell),
+ * mark with doerfler_marking() and refine with refine_cells(). */
+
+namespace yaourt {
+
+namespace priv {
+
+/* Faces of a cell, in the order given by face_ids() */
+inline std::array<edge, 3>
+cell_edges(const triangle& t)
+{
+    return {{ edge(t.p[0], t.p[1]), edge(t.p[1], t.p[2]), edge(t.p[0], t.p[2]) }};
+}
+
+inline std::array<edge, 4>
+cell_edges(const quadrangle& q)
+{
+    return {{ edge(q.p[0], q.p[1]), edge(q.p[1], q.p[2]),
+              edge(q.p[2], q.p[3]), edge(q.p[0], q.p[3]) }};
+}
+
+/* Split a cell in four, 'mids' are the midpoints of its faces. The
+ * children are the same as the ones of the uniform refinement. */
+template<typename T>
+void
+split_cell(simplicial_mesh<T>&, const triangle& t,
+           const std::array<size_t, 3>& mids, std::vector<triangle>& out)
+{
+    auto [p0, p1, p2] = t.p;
+    auto [p0b, p1b, p2b] = mids;
+
+    out.push_back( triangle(p0, p0b, p2b) );
+    out.push_back( triangle(p0b, p1, p1b) );
+    out.push_back( triangle(p1b, p2, p2b) );
+    out.push_back( triangle(p0b, p1b, p2b) );
+}
+
+template<typename T>
+void
+split_cell(quad_mesh<T>& msh, const quadrangle& q,
+           const std::array<size_t, 4>& mids, std::vector<quadrangle>& out)
+{
+    auto [p0, p1, p2, p3] = q.p;
+    auto [p0b, p1b, p2b, p3b] = mids;
+
+    auto bar = msh.points.size();
+    msh.points.push_back( barycenter(msh, q) );
+
+    out.push_back( quadrangle(p0, p0b, bar, p3b) );
+    out.push_back( quadrangle(p0b, p1, p1b, bar) );
+    out.push_back( quadrangle(bar, p1b, p2, p2b) );
+    out.push_back( quadrangle(p3b, bar, p2b, p3) );
+}
+
+} //namespace priv
+
+/* Doerfler (bulk) marking: mark the smallest set of cells whose squared
+ * indicators sum to at least 'theta' times the total */
+template<typename T>
+std::vector<bool>
+doerfler_marking(const std::vector<T>& indicators, T theta)
+{
+    if (theta < 0.0 or theta > 1.0)
+        throw std::invalid_argument("Doerfler marking: theta must be in [0,1]");
+
+    std::vector<size_t> order( indicators.size() );
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+        [&](size_t a, size_t b) { return indicators[a] > indicators[b]; });
+
+    T total = std::accumulate(indicators.begin(), indicators.end(), T(0));
+
+    std::vector<bool> marked(indicators.size(), false);
+    T sum = 0.0;
+    for (auto& cl_id : order)
+    {
+        if (sum >= theta*total)
+            break;
+
+        marked[cl_id] = true;
+        sum += indicators[cl_id];
+    }
+
+    return marked;
+}
+
+/* Refine the marked cells. More cells than the marked ones can be refined
+ * to keep the mesh 1-irregular. The children of a cell take its place in
+ * the numbering, the faces are renumbered and the connectivity and the
+ * list of the hanging faces are recomputed. */
+template<typename Mesh>
+void
+refine_cells(Mesh& msh, std::vector<bool> marked)
+{
+    using T         = typename Mesh::coordinate_type;
+    using face_type = typename Mesh::face_type;
+    using cell_type = typename Mesh::cell_type;
+
+    YAOURT_TIMED_SCOPE("mesh.adapt");
+
+    if ( marked.size() != msh.cells.size() )
+        throw std::invalid_argument("refine_cells: wrong number of marks");
+
+    if ( !msh.has_connectivity() )
+        msh.compute_connectivity();
+
+    /* A fine cell can be refined only if the coarse cell on the other
+     * side of its hanging faces is refined too */
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& hf : msh.hanging_faces)
+        {
+            auto coarse_cl = msh.face_owners[ hf[0] ][0];
+            auto fine_cl = msh.face_owners[ hf[1] ][0];
+            if ( marked[fine_cl] and !marked[coarse_cl] )
+            {
+                marked[coarse_cl] = true;
+                changed = true;
+            }
+        }
+    }
+
+    /* The coarse faces are already split: their midpoint is the point
+     * shared by the two fine faces */
+    const size_t NO_POINT = NO_OWNER;
+    std::vector<size_t> face_mid(msh.faces.size(), NO_POINT);
+    for (auto& hf : msh.hanging_faces)
+    {
+        const auto& cf = msh.faces[ hf[0] ];
+        const auto& ff = msh.faces[ hf[1] ];
+        face_mid[ hf[0] ] = (ff.p0 == cf.p0 or ff.p0 == cf.p1) ? ff.p1 : ff.p0;
+    }
+
+    std::vector<cell_type> new_cells;
+    new_cells.reserve( msh.cells.size() + 3*std::count(marked.begin(), marked.end(), true) );
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        if ( !marked[cl_id] )
+        {
+            new_cells.push_back( msh.cells[cl_id] );
+            continue;
+        }
+
+        const auto& fcids = face_ids(msh, cl_id);
+        std::array<size_t, cell_type::num_faces> mids;
+        for (size_t i = 0; i < cell_type::num_faces; i++)
+        {
+            auto& m = face_mid[ fcids[i] ];
+            if (m == NO_POINT)
+            {
+                const auto& fc = msh.faces[ fcids[i] ];
+                m = msh.points.size();
+                msh.points.push_back( (msh.points[fc.p0] + msh.points[fc.p1])/T(2) );
+            }
+            mids[i] = m;
+        }
+
+        priv::split_cell(msh, msh.cells[cl_id], mids, new_cells);
+    }
+
+    /* The boundary faces and their halves keep the boundary information */
+    std::vector<face_type> bnd_faces;
+    std::vector<std::pair<face_type, size_t>> split_faces;
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fc = msh.faces[fc_id];
+        auto m = face_mid[fc_id];
+
+        if (m != NO_POINT)
+            split_faces.push_back( std::make_pair(fc, m) );
+
+        if ( !fc.is_boundary )
+            continue;
+
+        if (m == NO_POINT)
+            bnd_faces.push_back(fc);
+        else
+        {
+            bnd_faces.push_back( face_type(fc.p0, m, fc.boundary_id, true) );
+            bnd_faces.push_back( face_type(m, fc.p1, fc.boundary_id, true) );
+        }
+    }
+    std::sort(bnd_faces.begin(), bnd_faces.end());
+
+    auto face_less = [](const std::pair<face_type, size_t>& a,
+                        const std::pair<face_type, size_t>& b) {
+        return a.first < b.first;
+    };
+    std::sort(split_faces.begin(), split_faces.end(), face_less);
+
+    std::vector<face_type> new_faces;
+    new_faces.reserve( new_cells.size() * cell_type::num_faces );
+    for (auto& cl : new_cells)
+        for (auto& e : priv::cell_edges(cl))
+            new_faces.push_back(e);
+
+    priv::sort_uniq(new_faces);
+
+    for (auto& fc : new_faces)
+    {
+        auto itor = std::lower_bound(bnd_faces.begin(), bnd_faces.end(), fc);
+        if (itor != bnd_faces.end() and *itor == fc)
+        {
+            fc.is_boundary = true;
+            fc.boundary_id = itor->boundary_id;
+        }
+    }
+
+    msh.cells = std::move(new_cells);
+    msh.faces = std::move(new_faces);
+    msh.hanging_faces.clear();
+    msh.compute_connectivity();
+
+    /* A face with one owner not on the boundary is either coarse or fine.
+     * The coarse ones are split faces of the previous mesh. */
+    size_t num_nonconforming = 0;
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fc = msh.faces[fc_id];
+        if ( fc.is_boundary or msh.face_owners[fc_id][1] != NO_OWNER )
+            continue;
+
+        num_nonconforming++;
+
+        auto itor = std::lower_bound(split_faces.begin(), split_faces.end(),
+                                     std::make_pair(fc, size_t(0)), face_less);
+        if ( itor == split_faces.end() or !(itor->first == fc) )
+            continue;
+
+        auto m = itor->second;
+        for (auto& half : { face_type(fc.p0, m), face_type(m, fc.p1) })
+        {
+            auto half_id = offset(msh, half);
+            if ( !(msh.faces[half_id] == half) )
+                throw std::logic_error("BUG: hanging face without its halves");
+
+            msh.hanging_faces.push_back( {{ fc_id, half_id }} );
+        }
+    }
+
+    if ( num_nonconforming != 3*msh.hanging_faces.size()/2 )
+        throw std::logic_error("BUG: the mesh is not 1-irregular");
+}
+
+/* Jump-based error indicator of a DG solution: for each cell, the sum
+ * on its faces of |F|^-1 * ||[u]||^2, where on the boundary the jump is
+ * u - g. The terms of the internal faces are split equally between the
+ * two cells. 'sol' has the coefficients of the tabulated bases of degree
+ * 'degree', as in the DG solvers. Returns the squared indicators. */
+template<typename Mesh, typename Function>
+std::vector<typename Mesh::coordinate_type>
+jump_indicators(const Mesh& msh, size_t degree,
+                const blaze::DynamicVector<typename Mesh::coordinate_type>& sol,
+                const Function& g)
+{
+    using T = typename Mesh::coordinate_type;
+
+    if ( !msh.has_connectivity() )
+        throw std::logic_error("No connectivity information.");
+
+    auto bs = bases::scalar_basis_size(degree, 2);
+    if (sol.size() != bs * msh.cells.size())
+        throw std::invalid_argument("jump_indicators: wrong solution size");
+
+    std::vector<decltype(bases::make_tabulated_basis(msh, msh.cells[0], degree, 2*degree))> tbases;
+    tbases.reserve( msh.cells.size() );
+    for (auto& cl : msh.cells)
+        tbases.push_back( bases::make_tabulated_basis(msh, cl, degree, 2*degree) );
+
+    blaze::DynamicVector<T> phi(bs);
+    auto value = [&](size_t cl_id, const point<T,2>& pt) {
+        tbases[cl_id].eval(pt, phi);
+        T ret = 0.0;
+        for (size_t i = 0; i < bs; i++)
+            ret += sol[cl_id*bs + i] * phi[i];
+        return ret;
+    };
+
+    /* Squared jump between the cells 'a' and 'b' on the face 'fc', with
+     * b == NO_OWNER the jump is with the boundary data */
+    auto jump = [&](const typename Mesh::face_type& fc, size_t a, size_t b) {
+        T ret = 0.0;
+        for (auto& qp : quadratures::integrate(msh, fc, 2*degree))
+        {
+            T ub = (b == NO_OWNER) ? g(qp.point()) : value(b, qp.point());
+            T j = value(a, qp.point()) - ub;
+            ret += qp.weight() * j * j;
+        }
+        return ret / measure(msh, fc);
+    };
+
+    std::vector<T> ret(msh.cells.size(), 0.0);
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fc = msh.faces[fc_id];
+        const auto& fo = msh.face_owners[fc_id];
+
+        if (fo[1] != NO_OWNER)
+        {
+            auto j = jump(fc, fo[0], fo[1]);
+            ret[ fo[0] ] += 0.5*j;
+            ret[ fo[1] ] += 0.5*j;
+        }
+        else if (fc.is_boundary)
+            ret[ fo[0] ] += jump(fc, fo[0], NO_OWNER);
+    }
+
+    for (auto& hf : msh.hanging_faces)
+    {
+        auto coarse_cl = msh.face_owners[ hf[0] ][0];
+        auto fine_cl = msh.face_owners[ hf[1] ][0];
+        auto j = jump(msh.faces[ hf[1] ], fine_cl, coarse_cl);
+        ret[coarse_cl] += 0.5*j;
+        ret[fine_cl] += 0.5*j;
+    }
+
+    return ret;
+}
+
+} //namespace yaourt
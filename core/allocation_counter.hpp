@@ -0,0 +1,175 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* Allocation counters for the instrumentation and the benchmarks.
+ * operator new is replaced, so this header must be included by exactly
+ * one translation unit of the program, the one of main() for the drivers.
+ * With YAOURT_WRAP_MALLOC the allocation functions of the C library are
+ * also wrapped, the program must be linked with
+ *   -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=posix_memalign,--wrap=aligned_alloc
+ * (GNU ld): blaze allocates its aligned storage with posix_memalign(),
+ * not with operator new. */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "instrumentation.hpp"
+
+namespace {
+
+std::atomic<size_t> yaourt_alloc_count(0);
+std::atomic<size_t> yaourt_alloc_bytes(0);
+
+void count_allocation(size_t size)
+{
+    yaourt_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    yaourt_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+/* With the wrappers malloc() counts already */
+void* counted_malloc(size_t size)
+{
+#ifndef YAOURT_WRAP_MALLOC
+    count_allocation(size);
+#endif
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* counted_aligned(size_t size, size_t alignment)
+{
+#ifndef YAOURT_WRAP_MALLOC
+    count_allocation(size);
+#endif
+    void *ptr = nullptr;
+    alignment = std::max(alignment, sizeof(void*));
+    if (posix_memalign(&ptr, alignment, size == 0 ? 1 : size) != 0)
+        return nullptr;
+    return ptr;
+}
+
+} // namespace
+
+namespace yaourt::instrumentation {
+
+/* Allocations since the start of the process */
+allocation_count
+counted_allocations()
+{
+    return { yaourt_alloc_count.load(std::memory_order_relaxed),
+             yaourt_alloc_bytes.load(std::memory_order_relaxed) };
+}
+
+namespace {
+const bool allocation_source_set = (
+    registry::instance().set_allocation_source(&counted_allocations), true
+);
+} // namespace
+
+} // namespace yaourt::instrumentation
+
+#ifdef YAOURT_WRAP_MALLOC
+extern "C" {
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+int __real_posix_memalign(void **, size_t, size_t);
+void *__real_aligned_alloc(size_t, size_t);
+
+void *__wrap_malloc(size_t size)
+{
+    count_allocation(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    count_allocation(n*size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    count_allocation(size);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    count_allocation(size);
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    count_allocation(size);
+    return __real_aligned_alloc(alignment, size);
+}
+
+} // extern "C"
+#endif /* YAOURT_WRAP_MALLOC */
+
+void* operator new(size_t size)
+{
+    void *ptr = counted_malloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t al)
+{
+    void *ptr = counted_aligned(size, size_t(al));
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t al)
+{
+    return operator new(size, al);
+}
+
+void operator delete(void *ptr) noexcept                        { std::free(ptr); }
+void operator delete[](void *ptr) noexcept                      { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept                { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept              { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept      { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept    { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept      { std::free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept    { std::free(ptr); }
@@ -24,6 +24,13 @@
 #include <blaze/Math.h>
 #pragma clang diagnostic pop
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
 #include "core/mesh.hpp"
 #include "core/refelem.hpp"
 #include "core/quadratures.hpp"
@@ -60,7 +67,7 @@ iexp_pow(T x, size_t n)
 }
 
 /* Compute the size of a scalar basis of degree k in dimension d. */
-size_t
+constexpr size_t
 scalar_basis_size(size_t k, size_t d)
 {
     if (d == 1)
@@ -73,84 +80,489 @@ scalar_basis_size(size_t k, size_t d)
     throw std::invalid_argument("d must be 1,2 or 3");
 }
 
-namespace detail {
+/* Degree of the bases and of the kernels known only at runtime */
+constexpr size_t dynamic_degree = size_t(-1);
 
-template<typename T, size_t DIM>
-class cell_basis_bones;
+/* Largest degree for which the drivers instantiate the kernels with the
+ * degree fixed at compile time, see dispatch_degree(). Each degree is a
+ * full instantiation of the kernels: lower it to reduce compile times. */
+#ifndef YAOURT_MAX_STATIC_DEGREE
+#define YAOURT_MAX_STATIC_DEGREE 8
+#endif
 
-template<typename T>
-class cell_basis_bones<T,2>
+/* The polynomials spanning the bases of the cells and of the faces. Both
+ * kinds span the same space and are hierarchical: the basis of degree k is
+ * the first part of the basis of degree k+1, the first function is the
+ * constant 1.
+ *  - monomial: the monomials scaled on the element
+ *  - orthonormal: Dubiner polynomials on the triangles, tensor products
+ *    of Legendre polynomials on the bounding box of the other cells and
+ *    Legendre polynomials on the faces, orthonormal with respect to the
+ *    mean on the element. The mass matrix is the measure of the element
+ *    times the identity on the triangles, the faces and the rectangles
+ *    aligned with the axes.
+ * make_basis() uses default_basis_kind when the kind is not given, that
+ * is the orthonormal bases when YAOURT_ORTHONORMAL_BASES is defined. */
+enum class basis_kind {
+    monomial,
+    orthonormal
+};
+
+#ifdef YAOURT_ORTHONORMAL_BASES
+constexpr basis_kind default_basis_kind = basis_kind::orthonormal;
+#else
+constexpr basis_kind default_basis_kind = basis_kind::monomial;
+#endif
+
+namespace detail {
+
+/* Evaluate the monomials up to degree 'degree' in 'pt', scaled on the
+ * element of center 'center' and diameter 'elem_h'. 'ret' can be anything
+ * indexable with [], there is no heap allocation. When 'degree' is a
+ * compile-time constant the loops are unrolled by the compiler. */
+template<typename T, typename VT>
+void
+eval_monomials(const point<T,2>& center, T elem_h, const point<T,2>& pt,
+               size_t degree, VT& ret)
 {
-    typedef point<T,2>      point_type;
+    const auto b = (pt - center) / (0.5*elem_h);
 
-    point_type              center;
-    T                       elem_h;
-    size_t                  basis_degree;
+    size_t pos = 0;
+    for (size_t k = 0; k <= degree; k++)
+    {
+        for (size_t i = 0; i <= k; i++)
+        {
+            const auto pow_x = k - i;
+            const auto pow_y = i;
 
-public:
-    cell_basis_bones() = delete;
-    cell_basis_bones(const point_type& p_center, T p_elem_h, size_t p_degree)
-        : center(p_center), elem_h(p_elem_h), basis_degree(p_degree)
-    {}
+            const auto px = iexp_pow(b.x(), pow_x);
+            const auto py = iexp_pow(b.y(), pow_y);
 
-    blaze::DynamicVector<T>
-    eval(const point_type& pt) const
+            ret[pos++] = px * py;
+        }
+    }
+
+    assert(pos == scalar_basis_size(degree, 2));
+}
+
+/* Same as above for the gradients, 'ret' is indexed with (i,j) */
+template<typename T, typename MT>
+void
+eval_monomial_grads(const point<T,2>& center, T elem_h, const point<T,2>& pt,
+                    size_t degree, MT& ret)
+{
+    const auto ih = 2.0 / elem_h;
+    const auto b = (pt - center) / (0.5*elem_h);
+
+    size_t pos = 0;
+    for (size_t k = 0; k <= degree; k++)
     {
-        size_t basis_size = scalar_basis_size(basis_degree, 2);
-        blaze::DynamicVector<T> ret(basis_size);
+        for (size_t i = 0; i <= k; i++)
+        {
+            const auto pow_x = k - i;
+            const auto pow_y = i;
 
-        const auto b = (pt - center) / (0.5*elem_h);
+            const auto px = iexp_pow(b.x(), pow_x);
+            const auto py = iexp_pow(b.y(), pow_y);
+            const auto dx = (pow_x == 0) ? 0 : pow_x * ih * iexp_pow(b.x(), pow_x - 1);
+            const auto dy = (pow_y == 0) ? 0 : pow_y * ih * iexp_pow(b.y(), pow_y - 1);
 
-        size_t pos = 0;
-        for (size_t k = 0; k <= basis_degree; k++)
+            ret(pos, 0) = dx * py;
+            ret(pos, 1) = px * dy;
+            pos++;
+        }
+    }
+
+    assert(pos == scalar_basis_size(degree, 2));
+}
+
+/* Position of the polynomial of degree px in the first variable and py
+ * in the second, the order is the one of eval_monomials() */
+constexpr size_t
+hierarchical_index(size_t px, size_t py)
+{
+    return (px + py)*(px + py + 1)/2 + py;
+}
+
+/* Evaluate the Dubiner polynomials up to degree 'degree' in the point 'r'
+ * of the reference triangle (0,0), (1,0), (0,1). The polynomial (p,q) is
+ * P_p(a) * ((1-b)/2)^p * P_q^(2p+1,0)(b) in the collapsed coordinates
+ * a = 2x/(1-y) - 1, b = 2y - 1, computed with the recurrences of the
+ * Legendre and Jacobi polynomials. The first factor, Q_p, is a polynomial
+ * in x and y and is computed as such, there is no singularity in y = 1. */
+template<typename T, typename VT>
+void
+eval_dubiner(const point<T,2>& r, size_t degree, VT& ret)
+{
+    const auto as   = 2*r.x() + r.y() - 1;
+    const auto s2   = (1 - r.y())*(1 - r.y());
+    const auto b    = 2*r.y() - 1;
+
+    T Q = 1, Qm = 0;
+    for (size_t p = 0; p <= degree; p++)
+    {
+        if (p > 0)
         {
-            for (size_t i = 0; i <= k; i++)
+            T Qn = (T(2*p-1)*as*Q - T(p-1)*s2*Qm) / T(p);
+            Qm = Q;
+            Q = Qn;
+        }
+
+        const T alpha = 2*p+1;
+        T J = 1, Jm = 0;
+        for (size_t q = 0; q <= degree - p; q++)
+        {
+            if (q > 0)
             {
-                const auto pow_x = k - i;
-                const auto pow_y = i;
+                const T n = q;
+                const T c = 2*n + alpha;
+                T Jn = ( (c-1)*(c*(c-2)*b + alpha*alpha)*J
+                         - 2*(n+alpha-1)*(n-1)*c*Jm ) / (2*n*(n+alpha)*(c-2));
+                Jm = J;
+                J = Jn;
+            }
 
-                const auto px = iexp_pow(b.x(), pow_x);
-                const auto py = iexp_pow(b.y(), pow_y);
+            const T norm = std::sqrt( T((2*p+1)*(p+q+1)) );
+            ret[hierarchical_index(p,q)] = norm * Q * J;
+        }
+    }
+}
 
-                ret[pos++] = px * py;
+/* Same as above for the gradients with respect to 'r' */
+template<typename T, typename MT>
+void
+eval_dubiner_grads(const point<T,2>& r, size_t degree, MT& ret)
+{
+    const auto as   = 2*r.x() + r.y() - 1;
+    const auto s2   = (1 - r.y())*(1 - r.y());
+    const auto b    = 2*r.y() - 1;
+    const T d_as[2] = { 2, 1 };
+    const T d_s2[2] = { 0, -2*(1 - r.y()) };
+
+    T Q = 1, Qm = 0;
+    T dQ[2] = { 0, 0 }, dQm[2] = { 0, 0 };
+    for (size_t p = 0; p <= degree; p++)
+    {
+        if (p > 0)
+        {
+            const T c1 = T(2*p-1)/T(p);
+            const T c2 = T(p-1)/T(p);
+            T Qn = c1*as*Q - c2*s2*Qm;
+            T dQn[2];
+            for (size_t d = 0; d < 2; d++)
+                dQn[d] = c1*(d_as[d]*Q + as*dQ[d]) - c2*(d_s2[d]*Qm + s2*dQm[d]);
+
+            Qm = Q;
+            Q = Qn;
+            for (size_t d = 0; d < 2; d++)
+            {
+                dQm[d] = dQ[d];
+                dQ[d] = dQn[d];
             }
         }
 
-        assert(pos == basis_size);
+        /* The Jacobi polynomials depend on y only, dJ is d/db */
+        const T alpha = 2*p+1;
+        T J = 1, Jm = 0, dJ = 0, dJm = 0;
+        for (size_t q = 0; q <= degree - p; q++)
+        {
+            if (q > 0)
+            {
+                const T n = q;
+                const T c = 2*n + alpha;
+                const T A = (c-1)*c*(c-2);
+                const T B = (c-1)*alpha*alpha;
+                const T C = 2*(n+alpha-1)*(n-1)*c;
+                const T D = 2*n*(n+alpha)*(c-2);
+                T Jn = ( (A*b + B)*J - C*Jm ) / D;
+                T dJn = ( (A*b + B)*dJ + A*J - C*dJm ) / D;
+                Jm = J;
+                J = Jn;
+                dJm = dJ;
+                dJ = dJn;
+            }
 
-        return ret;
+            const T norm = std::sqrt( T((2*p+1)*(p+q+1)) );
+            const auto pos = hierarchical_index(p,q);
+            ret(pos, 0) = norm * dQ[0] * J;
+            ret(pos, 1) = norm * (dQ[1] * J + Q * 2 * dJ);
+        }
     }
+}
 
-    blaze::DynamicMatrix<T>
-    eval_grads(const point_type& pt) const
+/* Legendre polynomial of degree n in x and its derivative */
+template<typename T>
+std::pair<T,T>
+legendre(size_t n, T x)
+{
+    T P = 1, Pm = 0, dP = 0, dPm = 0;
+    for (size_t i = 1; i <= n; i++)
     {
-        size_t basis_size = scalar_basis_size(basis_degree, 2);
-        blaze::DynamicMatrix<T> ret(basis_size, 2);
+        T Pn = (T(2*i-1)*x*P - T(i-1)*Pm) / T(i);
+        T dPn = (T(2*i-1)*(P + x*dP) - T(i-1)*dPm) / T(i);
+        Pm = P;
+        P = Pn;
+        dPm = dP;
+        dP = dPn;
+    }
 
-        const auto ih = 2.0 / elem_h;
-        const auto b = (pt - center) / (0.5*elem_h);
+    return std::make_pair(P, dP);
+}
 
-        size_t pos = 0;
-        for (size_t k = 0; k <= basis_degree; k++)
+/* Evaluate the products of the Legendre polynomials of total degree up
+ * to 'degree' in the point 'r' of [-1,1]^2 */
+template<typename T, typename VT>
+void
+eval_legendre(const point<T,2>& r, size_t degree, VT& ret)
+{
+    T P = 1, Pm = 0;
+    for (size_t p = 0; p <= degree; p++)
+    {
+        if (p > 0)
         {
-            for (size_t i = 0; i <= k; i++)
+            T Pn = (T(2*p-1)*r.x()*P - T(p-1)*Pm) / T(p);
+            Pm = P;
+            P = Pn;
+        }
+
+        T Q = 1, Qm = 0;
+        for (size_t q = 0; q <= degree - p; q++)
+        {
+            if (q > 0)
             {
-                const auto pow_x = k - i;
-                const auto pow_y = i;
+                T Qn = (T(2*q-1)*r.y()*Q - T(q-1)*Qm) / T(q);
+                Qm = Q;
+                Q = Qn;
+            }
 
-                const auto px = iexp_pow(b.x(), pow_x);
-                const auto py = iexp_pow(b.y(), pow_y);
-                const auto dx = (pow_x == 0) ? 0 : pow_x * ih * iexp_pow(b.x(), pow_x - 1);
-                const auto dy = (pow_y == 0) ? 0 : pow_y * ih * iexp_pow(b.y(), pow_y - 1);
+            const T norm = std::sqrt( T((2*p+1)*(2*q+1)) );
+            ret[hierarchical_index(p,q)] = norm * P * Q;
+        }
+    }
+}
 
-                ret(pos, 0) = dx * py;
-                ret(pos, 1) = px * dy;
-                pos++;
-            }
+/* Same as above for the gradients with respect to 'r' */
+template<typename T, typename MT>
+void
+eval_legendre_grads(const point<T,2>& r, size_t degree, MT& ret)
+{
+    for (size_t p = 0; p <= degree; p++)
+    {
+        auto [P, dP] = legendre(p, r.x());
+        for (size_t q = 0; q <= degree - p; q++)
+        {
+            auto [Q, dQ] = legendre(q, r.y());
+            const T norm = std::sqrt( T((2*p+1)*(2*q+1)) );
+            const auto pos = hierarchical_index(p,q);
+            ret(pos, 0) = norm * dP * Q;
+            ret(pos, 1) = norm * P * dQ;
         }
+    }
+}
 
-        assert(pos == basis_size);
+/* Where the basis of a cell lives: the center and the diameter scaling
+ * the monomials, or the affine map to the reference element of the
+ * orthonormal bases. The reference element is the triangle (0,0), (1,0),
+ * (0,1), with the vertices of the cell in their order, or [-1,1]^2 as the
+ * bounding box of the cell. */
+template<typename T>
+class basis_frame
+{
+    typedef point<T,2>      point_type;
+
+    basis_kind                  kind;
+    bool                        simplex;
+    point_type                  center, origin;
+    T                           elem_h;
+    blaze::StaticMatrix<T,2,2>  p2r;
+
+    point_type
+    to_reference(const point_type& pt) const
+    {
+        const auto d = pt - origin;
+        return point_type(p2r(0,0)*d.x() + p2r(0,1)*d.y(),
+                          p2r(1,0)*d.x() + p2r(1,1)*d.y());
+    }
+
+public:
+    basis_frame(const point_type& p_center, T p_elem_h)
+        : kind(basis_kind::monomial), simplex(false), center(p_center),
+          origin(p_center), elem_h(p_elem_h)
+    {}
+
+    template<size_t N>
+    basis_frame(const std::array<point_type, N>& pts, const point_type& p_center,
+                T p_elem_h, basis_kind p_kind)
+        : kind(p_kind), simplex(N == 3), center(p_center), elem_h(p_elem_h)
+    {
+        if (simplex)
+        {
+            /* Inverse of the map (v1-v0, v2-v0) */
+            const auto v1 = pts[1] - pts[0];
+            const auto v2 = pts[2] - pts[0];
+            const auto det = v1.x()*v2.y() - v2.x()*v1.y();
+            origin = pts[0];
+            p2r(0,0) =  v2.y()/det;  p2r(0,1) = -v2.x()/det;
+            p2r(1,0) = -v1.y()/det;  p2r(1,1) =  v1.x()/det;
+            return;
+        }
+
+        auto xmin = pts[0].x(), xmax = pts[0].x();
+        auto ymin = pts[0].y(), ymax = pts[0].y();
+        for (auto& pt : pts)
+        {
+            xmin = std::min(xmin, pt.x());  xmax = std::max(xmax, pt.x());
+            ymin = std::min(ymin, pt.y());  ymax = std::max(ymax, pt.y());
+        }
+        origin = point_type( (xmin + xmax)/2, (ymin + ymax)/2 );
+        p2r(0,0) = 2/(xmax - xmin);     p2r(0,1) = 0;
+        p2r(1,0) = 0;                   p2r(1,1) = 2/(ymax - ymin);
+    }
+
+    template<typename VT>
+    void
+    eval(const point_type& pt, size_t degree, VT& ret) const
+    {
+        if (kind == basis_kind::monomial)
+            eval_monomials(center, elem_h, pt, degree, ret);
+        else if (simplex)
+            eval_dubiner(to_reference(pt), degree, ret);
+        else
+            eval_legendre(to_reference(pt), degree, ret);
+    }
+
+    template<typename MT>
+    void
+    eval_grads(const point_type& pt, size_t degree, MT& ret) const
+    {
+        if (kind == basis_kind::monomial)
+        {
+            eval_monomial_grads(center, elem_h, pt, degree, ret);
+            return;
+        }
+
+        if (simplex)
+            eval_dubiner_grads(to_reference(pt), degree, ret);
+        else
+            eval_legendre_grads(to_reference(pt), degree, ret);
+
+        /* Chain rule, the gradient is a row of 'ret' */
+        for (size_t i = 0; i < scalar_basis_size(degree, 2); i++)
+        {
+            const T gx = ret(i,0), gy = ret(i,1);
+            ret(i,0) = gx*p2r(0,0) + gy*p2r(1,0);
+            ret(i,1) = gx*p2r(0,1) + gy*p2r(1,1);
+        }
+    }
+};
+
+template<typename Mesh, typename Element>
+basis_frame<typename Mesh::coordinate_type>
+make_basis_frame(const Mesh& msh, const Element& elem, basis_kind kind)
+{
+    if (kind == basis_kind::monomial)
+        return basis_frame<typename Mesh::coordinate_type>(barycenter(msh, elem),
+                                                           diameter(msh, elem));
+
+    return basis_frame<typename Mesh::coordinate_type>(points(msh, elem),
+        barycenter(msh, elem), diameter(msh, elem), kind);
+}
 
+template<typename T>
+basis_frame<T>
+make_basis_frame(const refelem::reference_triangle<T>& elem, basis_kind kind)
+{
+    if (kind == basis_kind::monomial)
+        return basis_frame<T>(barycenter(elem), diameter(elem));
+
+    return basis_frame<T>(elem.points, barycenter(elem), diameter(elem), kind);
+}
+
+/* Basis of a cell, see basis_kind. With K == dynamic_degree the degree is given
+ * at runtime and the values are returned in dynamic vectors and matrices,
+ * otherwise the degree is K and they are returned in static ones. */
+template<typename T, size_t DIM, size_t K = dynamic_degree>
+class cell_basis_bones;
+
+template<typename T>
+class cell_basis_bones<T,2,dynamic_degree>
+{
+    typedef point<T,2>      point_type;
+
+    basis_frame<T>          frame;
+    size_t                  basis_degree;
+
+public:
+    typedef blaze::DynamicVector<T>     vector_type;
+    typedef blaze::DynamicMatrix<T>     gradient_type;
+
+    cell_basis_bones() = delete;
+    cell_basis_bones(const point_type& p_center, T p_elem_h, size_t p_degree)
+        : frame(p_center, p_elem_h), basis_degree(p_degree)
+    {}
+
+    cell_basis_bones(const basis_frame<T>& p_frame, size_t p_degree)
+        : frame(p_frame), basis_degree(p_degree)
+    {}
+
+    blaze::DynamicVector<T>
+    eval(const point_type& pt) const
+    {
+        blaze::DynamicVector<T> ret(size());
+        frame.eval(pt, basis_degree, ret);
+        return ret;
+    }
+
+    /* Evaluate the basis in 'pt' without allocating. 'ret' is a blaze
+     * vector of size() elements (DynamicVector, CustomVector, subvector...)
+     * or a raw buffer of size() elements. */
+    template<typename VT>
+    void
+    eval(const point_type& pt, VT&& ret) const
+    {
+        if constexpr ( !std::is_pointer<std::decay_t<VT>>::value )
+            assert(ret.size() == size());
+
+        frame.eval(pt, basis_degree, ret);
+    }
+
+    /* Compile-time degree version, 'K' must be equal to degree() */
+    template<size_t K>
+    blaze::StaticVector<T, scalar_basis_size(K,2)>
+    eval(const point_type& pt) const
+    {
+        assert(K == basis_degree);
+        blaze::StaticVector<T, scalar_basis_size(K,2)> ret;
+        frame.eval(pt, K, ret);
+        return ret;
+    }
+
+    blaze::DynamicMatrix<T>
+    eval_grads(const point_type& pt) const
+    {
+        blaze::DynamicMatrix<T> ret(size(), 2);
+        frame.eval_grads(pt, basis_degree, ret);
+        return ret;
+    }
+
+    /* Evaluate the gradients in 'pt' without allocating. 'ret' is a blaze
+     * matrix (also CustomMatrix or submatrix) of size() rows and 2 columns */
+    template<typename MT>
+    void
+    eval_grads(const point_type& pt, MT&& ret) const
+    {
+        assert(ret.rows() == size() and ret.columns() == 2);
+        frame.eval_grads(pt, basis_degree, ret);
+    }
+
+    /* Compile-time degree version, 'K' must be equal to degree() */
+    template<size_t K>
+    blaze::StaticMatrix<T, scalar_basis_size(K,2), 2>
+    eval_grads(const point_type& pt) const
+    {
+        assert(K == basis_degree);
+        blaze::StaticMatrix<T, scalar_basis_size(K,2), 2> ret;
+        frame.eval_grads(pt, K, ret);
         return ret;
     }
 
@@ -167,23 +579,110 @@ public:
     }
 };
 
-template<typename Mesh, typename Element>
+/* Degree fixed at compile time: the sizes are constants, the loops of the
+ * kernels are unrolled and the values are returned in static types. The
+ * degree can still be passed to the constructor, to have the same
+ * interface as the dynamic version, but it must be K. */
+template<typename T, size_t K>
+class cell_basis_bones<T,2,K>
+{
+    typedef point<T,2>      point_type;
+
+    basis_frame<T>          frame;
+
+public:
+    static constexpr size_t basis_size = scalar_basis_size(K,2);
+
+    typedef blaze::StaticVector<T, basis_size>      vector_type;
+    typedef blaze::StaticMatrix<T, basis_size, 2>   gradient_type;
+
+    cell_basis_bones() = delete;
+    cell_basis_bones(const point_type& p_center, T p_elem_h, size_t p_degree = K)
+        : frame(p_center, p_elem_h)
+    {
+        if (p_degree != K)
+            throw std::invalid_argument("cell_basis_bones: wrong degree");
+    }
+
+    cell_basis_bones(const basis_frame<T>& p_frame, size_t p_degree = K)
+        : frame(p_frame)
+    {
+        if (p_degree != K)
+            throw std::invalid_argument("cell_basis_bones: wrong degree");
+    }
+
+    vector_type
+    eval(const point_type& pt) const
+    {
+        vector_type ret;
+        frame.eval(pt, K, ret);
+        return ret;
+    }
+
+    template<typename VT>
+    void
+    eval(const point_type& pt, VT&& ret) const
+    {
+        if constexpr ( !std::is_pointer<std::decay_t<VT>>::value )
+            assert(ret.size() == basis_size);
+
+        frame.eval(pt, K, ret);
+    }
+
+    gradient_type
+    eval_grads(const point_type& pt) const
+    {
+        gradient_type ret;
+        frame.eval_grads(pt, K, ret);
+        return ret;
+    }
+
+    template<typename MT>
+    void
+    eval_grads(const point_type& pt, MT&& ret) const
+    {
+        assert(ret.rows() == basis_size and ret.columns() == 2);
+        frame.eval_grads(pt, K, ret);
+    }
+
+    static constexpr size_t
+    size()
+    {
+        return basis_size;
+    }
+
+    static constexpr size_t
+    degree()
+    {
+        return K;
+    }
+};
+
+template<typename Mesh, typename Element, size_t K = dynamic_degree>
 class scalar_basis;
 
 template<template<typename, size_t, typename, typename> class Mesh,
-         typename T, typename CellT, typename FaceT>
-class scalar_basis<Mesh<T,2,CellT,FaceT>, CellT>
-    : public cell_basis_bones<T,2>
+         typename T, typename CellT, typename FaceT, size_t K>
+class scalar_basis<Mesh<T,2,CellT,FaceT>, CellT, K>
+    : public cell_basis_bones<T,2,K>
 {
     typedef Mesh<T,2,CellT,FaceT>           mesh_type;
     typedef CellT                           elem_type;
     typedef typename mesh_type::point_type  point_type;
-    typedef cell_basis_bones<T,2>           base;
+    typedef cell_basis_bones<T,2,K>         base;
 
 public:
-    scalar_basis(const mesh_type& msh, const elem_type& elem, size_t degree)
-        : base(barycenter(msh, elem), diameter(msh, elem), degree)
+    scalar_basis(const mesh_type& msh, const elem_type& elem, size_t degree,
+                 basis_kind kind = default_basis_kind)
+        : base(make_basis_frame(msh, elem, kind), degree)
     {}
+
+    scalar_basis(const mesh_type& msh, const elem_type& elem,
+                 basis_kind kind = default_basis_kind)
+        : base(make_basis_frame(msh, elem, kind))
+    {
+        static_assert(K != dynamic_degree, "The degree must be specified");
+    }
 };
 
 #if 0
@@ -315,14 +814,17 @@ class scalar_basis<Mesh<T,2,CellT,FaceT>, FaceT>
     point_type      elem_bar, p0;
     size_t          basis_degree, basis_size;
     T               elem_h;
+    basis_kind      kind;
 
 public:
-    scalar_basis(const mesh_type& msh, const elem_type& elem, size_t degree)
+    scalar_basis(const mesh_type& msh, const elem_type& elem, size_t degree,
+                 basis_kind p_kind = default_basis_kind)
     {
         elem_bar        = barycenter(msh, elem);
         elem_h          = diameter(msh, elem);
         basis_degree    = degree;
         basis_size      = scalar_basis_size(degree, 1);
+        kind            = p_kind;
 
         auto pts = points(msh, elem);
         p0 = pts[0];
@@ -332,20 +834,46 @@ public:
     eval(const point_type& pt) const
     {
         blaze::DynamicVector<T> ret(basis_size);
+        eval(pt, ret);
+        return ret;
+    }
+
+    /* Evaluate the basis in 'pt' without allocating, 'ret' is a blaze
+     * vector or a raw buffer of size() elements. */
+    template<typename VT>
+    void
+    eval(const point_type& pt, VT&& ret) const
+    {
+        if constexpr ( !std::is_pointer<std::decay_t<VT>>::value )
+            assert(ret.size() == basis_size);
 
         const auto vp   = (p0 - elem_bar);
         const auto tp   = (pt - elem_bar);
-        blaze::StaticVector<T,2> v({vp.x(), vp.y()});
-        blaze::StaticVector<T,2> t({tp.x(), tp.y()});
-        const auto d = dot(v,t);
-        const auto ep  = 4.0 * d / (elem_h * elem_h);
+        const auto d    = vp.x()*tp.x() + vp.y()*tp.y();
+        const auto ep   = 4.0 * d / (elem_h * elem_h);
+
+        if (kind == basis_kind::orthonormal)
+        {
+            /* ep goes from -1 to 1 along the face */
+            T P = 1, Pm = 0;
+            for (size_t i = 0; i <= basis_degree; i++)
+            {
+                if (i > 0)
+                {
+                    T Pn = (T(2*i-1)*ep*P - T(i-1)*Pm) / T(i);
+                    Pm = P;
+                    P = Pn;
+                }
+                ret[i] = std::sqrt(T(2*i+1)) * P;
+            }
+            return;
+        }
 
         for (size_t i = 0; i <= basis_degree; i++)
         {
             const auto bv = iexp_pow(ep, i);
             ret[i]  = bv;
         }
-        return ret;
     }
 
     size_t
@@ -417,34 +945,117 @@ project(const Mesh& msh,
 
 
 
-template<typename RefElem>
+template<typename RefElem, size_t K = dynamic_degree>
 class refelement_scalar_basis;
 
-template<typename T>
-class refelement_scalar_basis<refelem::reference_triangle<T>>
-    : public cell_basis_bones<T,2>
+template<typename T, size_t K>
+class refelement_scalar_basis<refelem::reference_triangle<T>, K>
+    : public cell_basis_bones<T,2,K>
 {
     typedef refelem::reference_triangle<T>  elem_type;
-    typedef cell_basis_bones<T,2>           base;
+    typedef cell_basis_bones<T,2,K>         base;
 public:
-    refelement_scalar_basis(const elem_type& elem, size_t degree)
-        : base(barycenter(elem), diameter(elem), degree)
+    refelement_scalar_basis(const elem_type& elem, size_t degree,
+                            basis_kind kind = default_basis_kind)
+        : base(make_basis_frame(elem, kind), degree)
     {}
+
+    refelement_scalar_basis(const elem_type& elem,
+                            basis_kind kind = default_basis_kind)
+        : base(make_basis_frame(elem, kind))
+    {
+        static_assert(K != dynamic_degree, "The degree must be specified");
+    }
 };
 
 
 } // namespace detail
 
 template<typename Mesh, typename Element>
-auto make_basis(const Mesh& msh, const Element& elem, size_t degree)
+auto make_basis(const Mesh& msh, const Element& elem, size_t degree,
+                basis_kind kind = default_basis_kind)
 {
-    return detail::scalar_basis<Mesh,Element>(msh, elem, degree);
+    return detail::scalar_basis<Mesh,Element>(msh, elem, degree, kind);
 }
 
 template<typename RefElem>
-auto make_basis(const RefElem& elem, size_t degree)
+auto make_basis(const RefElem& elem, size_t degree,
+                basis_kind kind = default_basis_kind)
+{
+    return detail::refelement_scalar_basis<RefElem>(elem, degree, kind);
+}
+
+/* Bases of degree K fixed at compile time */
+template<size_t K, typename Mesh, typename Element>
+auto make_basis(const Mesh& msh, const Element& elem,
+                basis_kind kind = default_basis_kind)
+{
+    return detail::scalar_basis<Mesh,Element,K>(msh, elem, kind);
+}
+
+template<size_t K, typename RefElem>
+auto make_basis(const RefElem& elem, basis_kind kind = default_basis_kind)
+{
+    return detail::refelement_scalar_basis<RefElem,K>(elem, kind);
+}
+
+/* Types of the local vectors and matrices of a kernel of degree K: static
+ * types of the right size if K is known at compile time, dynamic types
+ * otherwise. The zero_*() functions take the basis size, which is ignored
+ * in the static case, so the kernels can be written once for both. */
+template<typename T, size_t K>
+struct local_types
+{
+    static constexpr size_t basis_size = scalar_basis_size(K,2);
+
+    typedef blaze::StaticVector<T, basis_size>              vector_type;
+    typedef blaze::StaticMatrix<T, basis_size, basis_size>  matrix_type;
+    typedef blaze::StaticMatrix<T, basis_size, 2>           gradient_type;
+
+    static vector_type   zero_vector(size_t)    { return vector_type(T(0)); }
+    static matrix_type   zero_matrix(size_t)    { return matrix_type(T(0)); }
+    static gradient_type zero_gradient(size_t)  { return gradient_type(T(0)); }
+};
+
+template<typename T>
+struct local_types<T, dynamic_degree>
+{
+    typedef blaze::DynamicVector<T>     vector_type;
+    typedef blaze::DynamicMatrix<T>     matrix_type;
+    typedef blaze::DynamicMatrix<T>     gradient_type;
+
+    static vector_type   zero_vector(size_t bs)     { return vector_type(bs, T(0)); }
+    static matrix_type   zero_matrix(size_t bs)     { return matrix_type(bs, bs, T(0)); }
+    static gradient_type zero_gradient(size_t bs)   { return gradient_type(bs, 2, T(0)); }
+};
+
+namespace detail {
+
+template<typename Function, size_t... Ks>
+void
+dispatch_degree(size_t degree, Function&& fun, std::index_sequence<Ks...>)
+{
+    bool found = ( (degree == Ks ?
+                    (fun(std::integral_constant<size_t, Ks>()), true) :
+                    false) or ... );
+
+    if (!found)
+        fun(std::integral_constant<size_t, dynamic_degree>());
+}
+
+} // namespace detail
+
+/* Runtime to compile-time dispatch of the degree: call 'fun' with an
+ * std::integral_constant<size_t, K> where K is 'degree' if it is at most
+ * YAOURT_MAX_STATIC_DEGREE, dynamic_degree otherwise. 'fun' is usually a
+ * generic lambda which gets K as decltype(arg)::value, and must handle
+ * dynamic_degree as the fallback. */
+template<typename Function>
+void
+dispatch_degree(size_t degree, Function&& fun)
 {
-    return detail::refelement_scalar_basis<RefElem>(elem, degree);
+    detail::dispatch_degree(degree, std::forward<Function>(fun),
+        std::make_index_sequence<YAOURT_MAX_STATIC_DEGREE+1>());
 }
 
 } // namespace bases
@@ -0,0 +1,545 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "blaze/Math.h"
+
+#include "mesh.hpp"
+#include "bases.hpp"
+#include "tabulation.hpp"
+#include "quadratures.hpp"
+#include "parallel.hpp"
+
+/* Dense linear algebra on the small symmetric positive definite matrices
+ * of the single cells (mass matrices, the local problems of HHO). The
+ * matrices are a few tens of rows at most, LAPACK is not worth its call
+ * overhead and the allocations of the blaze wrappers at these sizes.
+ *
+ * cholesky_factor is the factorization of a single matrix. batched_cholesky
+ * factorizes and solves many matrices of the same size together: they are
+ * stored interleaved, entry (i,j) of all the matrices is contiguous, so the
+ * loops over the matrices are vectorized by the compiler.
+ *
+ * mass_factorizations reuses the factorization of the mass matrix among
+ * the cells that have the same shape up to a translation and a scaling:
+ * the bases are monomials scaled on the diameter of the cell, so their mass
+ * matrices differ only by the ratio of the areas. The meshes made by the
+ * meshers have a handful of such shapes. The tabulated bases on triangles
+ * come from the reference triangle, all the cells share one factorization. */
+
+namespace yaourt {
+
+template<typename T>
+class batched_cholesky;
+
+/* Cholesky factorization A = L*L' of a symmetric positive definite
+ * matrix, only the lower triangle of A is read */
+template<typename T>
+class cholesky_factor
+{
+    size_t          n;
+    std::vector<T>  L;          /* Lower triangle, row-major */
+    std::vector<T>  inv_diag;
+
+    friend class batched_cholesky<T>;
+
+    template<typename VT>
+    void substitute(VT& x) const
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            T s = x[i];
+            for (size_t j = 0; j < i; j++)
+                s -= L[i*n+j] * x[j];
+            x[i] = s * inv_diag[i];
+        }
+
+        for (size_t ii = n; ii > 0; ii--)
+        {
+            auto i = ii-1;
+            T s = x[i];
+            for (size_t j = i+1; j < n; j++)
+                s -= L[j*n+i] * x[j];
+            x[i] = s * inv_diag[i];
+        }
+    }
+
+public:
+    cholesky_factor()
+        : n(0)
+    {}
+
+    template<typename MT>
+    explicit cholesky_factor(const MT& A)
+    {
+        factorize(A);
+    }
+
+    template<typename MT>
+    void factorize(const MT& A)
+    {
+        if (A.rows() != A.columns())
+            throw std::invalid_argument("cholesky_factor: matrix not square");
+
+        n = A.rows();
+        L.assign(n*n, T(0));
+        inv_diag.resize(n);
+
+        for (size_t j = 0; j < n; j++)
+        {
+            T d = A(j,j);
+            for (size_t p = 0; p < j; p++)
+                d -= L[j*n+p] * L[j*n+p];
+
+            if ( !(d > T(0)) )
+                throw std::runtime_error("cholesky_factor: matrix not positive definite");
+
+            L[j*n+j] = std::sqrt(d);
+            inv_diag[j] = T(1)/L[j*n+j];
+
+            for (size_t i = j+1; i < n; i++)
+            {
+                T s = A(i,j);
+                for (size_t p = 0; p < j; p++)
+                    s -= L[i*n+p] * L[j*n+p];
+                L[i*n+j] = s * inv_diag[j];
+            }
+        }
+    }
+
+    size_t size() const { return n; }
+
+    /* Solve A*x = b in place, 'x' is a dense vector or a dense matrix whose
+     * columns are solved one by one */
+    template<typename XT>
+    void solve_inplace(XT& x) const
+    {
+        if constexpr (blaze::IsMatrix<XT>::value)
+        {
+            assert(x.rows() == n);
+            blaze::DynamicVector<T> col(n);
+            for (size_t c = 0; c < x.columns(); c++)
+            {
+                for (size_t i = 0; i < n; i++)
+                    col[i] = x(i,c);
+                substitute(col);
+                for (size_t i = 0; i < n; i++)
+                    x(i,c) = col[i];
+            }
+        }
+        else
+        {
+            assert(x.size() == n);
+            substitute(x);
+        }
+    }
+
+    /* Return inv(A)*b, 'b' is a dense vector or a dense matrix */
+    template<typename XT>
+    auto solve(const XT& b) const
+    {
+        if constexpr (blaze::IsMatrix<XT>::value)
+        {
+            blaze::DynamicMatrix<T> x = b;
+            solve_inplace(x);
+            return x;
+        }
+        else
+        {
+            blaze::DynamicVector<T> x = b;
+            solve_inplace(x);
+            return x;
+        }
+    }
+};
+
+/* Cholesky factorizations of 'count' matrices of size n x n. Entry (i,j)
+ * of matrix k is at (i*n+j)*count + k, the same for the right hand sides:
+ * entry i of the right hand side of matrix k is at i*count + k. */
+template<typename T>
+class batched_cholesky
+{
+    size_t          n, count;
+    std::vector<T>  data;
+    std::vector<T>  inv_diag;   /* Entry j of matrix k at j*count + k */
+
+    T *entry(size_t i, size_t j) { return data.data() + (i*n+j)*count; }
+    const T *entry(size_t i, size_t j) const { return data.data() + (i*n+j)*count; }
+
+public:
+    batched_cholesky()
+        : n(0), count(0)
+    {}
+
+    batched_cholesky(size_t p_n, size_t p_count)
+        : n(p_n), count(p_count), data(p_n*p_n*p_count, T(0)),
+          inv_diag(p_n*p_count, T(0))
+    {}
+
+    size_t size() const { return n; }
+    size_t batch_size() const { return count; }
+
+    /* Only the lower triangle of A is used */
+    template<typename MT>
+    void set_matrix(size_t k, const MT& A)
+    {
+        assert(k < count and A.rows() == n and A.columns() == n);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j <= i; j++)
+                entry(i,j)[k] = A(i,j);
+    }
+
+    /* Factorize all the matrices in place. The matrices are split among
+     * 'num_threads' threads, each thread runs the factorization on all
+     * its matrices at once. */
+    void factorize(size_t num_threads = 1)
+    {
+        parallel_for_chunks(count, num_threads,
+            [&](size_t, size_t begin, size_t end) {
+                for (size_t j = 0; j < n; j++)
+                {
+                    T *ajj = entry(j,j);
+                    T *idj = inv_diag.data() + j*count;
+                    for (size_t p = 0; p < j; p++)
+                    {
+                        const T *ljp = entry(j,p);
+                        for (size_t k = begin; k < end; k++)
+                            ajj[k] -= ljp[k] * ljp[k];
+                    }
+
+                    /* Checked apart to keep the loops branch-free */
+                    bool not_spd = false;
+                    for (size_t k = begin; k < end; k++)
+                        not_spd |= !(ajj[k] > T(0));
+                    if (not_spd)
+                        throw std::runtime_error("batched_cholesky: matrix not positive definite");
+
+                    for (size_t k = begin; k < end; k++)
+                    {
+                        ajj[k] = std::sqrt(ajj[k]);
+                        idj[k] = T(1)/ajj[k];
+                    }
+
+                    for (size_t i = j+1; i < n; i++)
+                    {
+                        T *aij = entry(i,j);
+                        for (size_t p = 0; p < j; p++)
+                        {
+                            const T *lip = entry(i,p);
+                            const T *ljp = entry(j,p);
+                            for (size_t k = begin; k < end; k++)
+                                aij[k] -= lip[k] * ljp[k];
+                        }
+
+                        for (size_t k = begin; k < end; k++)
+                            aij[k] *= idj[k];
+                    }
+                }
+            });
+    }
+
+    /* Solve all the systems in place, 'b' has n*count entries laid out as
+     * described above */
+    void solve(std::vector<T>& b, size_t num_threads = 1) const
+    {
+        assert(b.size() == n*count);
+
+        parallel_for_chunks(count, num_threads,
+            [&](size_t, size_t begin, size_t end) {
+                for (size_t i = 0; i < n; i++)
+                {
+                    T *bi = b.data() + i*count;
+                    for (size_t j = 0; j < i; j++)
+                    {
+                        const T *lij = entry(i,j);
+                        const T *bj = b.data() + j*count;
+                        for (size_t k = begin; k < end; k++)
+                            bi[k] -= lij[k] * bj[k];
+                    }
+
+                    const T *idi = inv_diag.data() + i*count;
+                    for (size_t k = begin; k < end; k++)
+                        bi[k] *= idi[k];
+                }
+
+                for (size_t ii = n; ii > 0; ii--)
+                {
+                    auto i = ii-1;
+                    T *bi = b.data() + i*count;
+                    for (size_t j = i+1; j < n; j++)
+                    {
+                        const T *lji = entry(j,i);
+                        const T *bj = b.data() + j*count;
+                        for (size_t k = begin; k < end; k++)
+                            bi[k] -= lji[k] * bj[k];
+                    }
+
+                    const T *idi = inv_diag.data() + i*count;
+                    for (size_t k = begin; k < end; k++)
+                        bi[k] *= idi[k];
+                }
+            });
+    }
+
+    /* The factorization of matrix k, with its own storage */
+    cholesky_factor<T> factor(size_t k) const
+    {
+        assert(k < count);
+
+        cholesky_factor<T> ret;
+        ret.n = n;
+        ret.L.assign(n*n, T(0));
+        ret.inv_diag.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            for (size_t j = 0; j <= i; j++)
+                ret.L[i*n+j] = entry(i,j)[k];
+            ret.inv_diag[i] = inv_diag[i*count + k];
+        }
+
+        return ret;
+    }
+};
+
+/* Group the cells that are the same up to a translation and a scaling:
+ * the points relative to the barycenter and divided by the diameter are
+ * the same, in any order, up to 'tolerance' (by default a small multiple
+ * of the machine epsilon). For each cell its group and the ratio of its
+ * area to the one of the first cell of the group. */
+template<typename T>
+struct cell_shape_classes
+{
+    std::vector<size_t>     cell_class;
+    std::vector<size_t>     representative;     /* First cell of each class */
+    std::vector<T>          scale;
+};
+
+template<typename Mesh>
+cell_shape_classes<typename Mesh::coordinate_type>
+classify_cell_shapes(const Mesh& msh, typename Mesh::coordinate_type tolerance = 0)
+{
+    using T = typename Mesh::coordinate_type;
+    if (tolerance <= 0)
+        tolerance = 64 * std::numeric_limits<T>::epsilon();
+    const size_t np = Mesh::cell_type::num_faces;
+    using key_type = std::array<std::pair<long long, long long>, np>;
+
+    cell_shape_classes<T> ret;
+    ret.cell_class.resize( msh.cells.size() );
+    ret.scale.resize( msh.cells.size() );
+
+    std::map<key_type, size_t> classes;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto bar = barycenter(msh, cl);
+        auto h = diameter(msh, cl);
+        auto pts = points(msh, cl);
+
+        key_type key;
+        for (size_t i = 0; i < np; i++)
+        {
+            auto d = (pts[i] - bar)/h;
+            key[i] = { std::llround(d.x()/tolerance), std::llround(d.y()/tolerance) };
+        }
+        std::sort(key.begin(), key.end());
+
+        auto itor = classes.find(key);
+        if (itor == classes.end())
+        {
+            itor = classes.insert( {key, ret.representative.size()} ).first;
+            ret.representative.push_back(cl_id);
+        }
+
+        auto cls = itor->second;
+        ret.cell_class[cl_id] = cls;
+        ret.scale[cl_id] = measure(msh, cl) / measure(msh, msh.cells[ ret.representative[cls] ]);
+    }
+
+    return ret;
+}
+
+/* One class for all the cells, for the bases that are the pushforward of
+ * a basis of the reference element by an affine map: their mass matrices
+ * differ only by the ratio of the areas. */
+template<typename Mesh>
+cell_shape_classes<typename Mesh::coordinate_type>
+single_cell_shape(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+
+    cell_shape_classes<T> ret;
+    ret.cell_class.assign( msh.cells.size(), 0 );
+    ret.scale.resize( msh.cells.size() );
+    if (msh.cells.size() == 0)
+        return ret;
+
+    ret.representative.push_back(0);
+    auto ref_meas = measure(msh, msh.cells[0]);
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+        ret.scale[cl_id] = measure(msh, msh.cells[cl_id]) / ref_meas;
+
+    return ret;
+}
+
+/* Factorizations of the mass matrices of the cells. Only the mass matrix
+ * of the representative of each class of 'shapes' is computed, all of them
+ * are factorized together with 'num_threads' threads. */
+template<typename Mesh>
+class mass_factorizations
+{
+    using T = typename Mesh::coordinate_type;
+    using cell_type = typename Mesh::cell_type;
+
+    cell_shape_classes<T>           shapes;
+    std::vector<cholesky_factor<T>> factors;
+    T                               diagonal_measure = 0;
+
+public:
+    mass_factorizations()
+    {}
+
+    /* Mass matrices equal to the measure of the cell times the identity,
+     * as the ones of the orthonormal bases on the triangles: the solves
+     * are a scaling, nothing is factorized */
+    static mass_factorizations
+    diagonal(const Mesh& msh)
+    {
+        mass_factorizations ret;
+        ret.shapes = single_cell_shape(msh);
+        if (msh.cells.size() > 0)
+            ret.diagonal_measure = measure(msh, msh.cells[0]);
+        return ret;
+    }
+
+    /* Mass matrices of the bases of bases::make_basis() */
+    mass_factorizations(const Mesh& msh, size_t degree, size_t num_threads = 1)
+        : mass_factorizations(msh, classify_cell_shapes(msh),
+            [&](const cell_type& cl) {
+                auto basis = bases::make_basis(msh, cl, degree);
+                blaze::DynamicVector<T> phi(basis.size());
+                blaze::DynamicMatrix<T> M(basis.size(), basis.size(), 0.0);
+                auto qps = quadratures::integrate(msh, cl, 2*degree);
+                for (auto& qp : qps)
+                {
+                    basis.eval(qp.point(), phi);
+                    M += qp.weight() * phi * trans(phi);
+                }
+                return M;
+            }, num_threads)
+    {}
+
+    /* 'mass(cl)' returns the mass matrix of the cell 'cl', it is called
+     * concurrently on the representatives of 'shapes' */
+    template<typename MassFunction>
+    mass_factorizations(const Mesh& msh, const cell_shape_classes<T>& p_shapes,
+                        const MassFunction& mass, size_t num_threads = 1)
+        : shapes(p_shapes)
+    {
+        auto num_classes = shapes.representative.size();
+        std::vector<blaze::DynamicMatrix<T>> masses(num_classes);
+
+        parallel_for_chunks(num_classes, num_threads,
+            [&](size_t, size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++)
+                    masses[c] = mass( msh.cells[ shapes.representative[c] ] );
+            });
+
+        if (num_classes == 0)
+            return;
+
+        batched_cholesky<T> batch(masses[0].rows(), num_classes);
+        for (size_t c = 0; c < num_classes; c++)
+            batch.set_matrix(c, masses[c]);
+
+        batch.factorize(num_threads);
+
+        factors.resize(num_classes);
+        for (size_t c = 0; c < num_classes; c++)
+            factors[c] = batch.factor(c);
+    }
+
+    size_t num_classes() const
+    {
+        return diagonal_measure > 0 ? 1 : factors.size();
+    }
+
+    /* Return inv(M)*b, M the mass matrix of the cell 'cl_id' */
+    template<typename XT>
+    auto solve(size_t cl_id, const XT& b) const
+    {
+        using result_type = std::conditional_t<blaze::IsMatrix<XT>::value,
+            blaze::DynamicMatrix<T>, blaze::DynamicVector<T>>;
+
+        if (diagonal_measure > 0)
+        {
+            result_type x = b * ( T(1) / (diagonal_measure * shapes.scale.at(cl_id)) );
+            return x;
+        }
+
+        result_type x = factors.at( shapes.cell_class.at(cl_id) ).solve(b);
+        x *= T(1) / shapes.scale[cl_id];
+        return x;
+    }
+};
+
+/* Mass matrices of the bases of bases::make_tabulated_basis(), integrated
+ * with the tabulated quadrature of order 'order'. On triangles they are
+ * pushed forward from the reference triangle, a single factorization is
+ * enough, and none with the orthonormal bases. */
+template<typename Mesh>
+mass_factorizations<Mesh>
+tabulated_mass_factorizations(const Mesh& msh, size_t degree, size_t order,
+                              size_t num_threads = 1)
+{
+    using T = typename Mesh::coordinate_type;
+    using cell_type = typename Mesh::cell_type;
+
+    auto mass = [&](const cell_type& cl) {
+        auto basis = bases::make_tabulated_basis(msh, cl, degree, order);
+        blaze::DynamicMatrix<T> M(basis.size(), basis.size(), 0.0);
+        auto qps = basis.cell_quadrature();
+        for (size_t i = 0; i < qps.size(); i++)
+            M += qps.weight(i) * qps.phi(i) * trans( qps.phi(i) );
+        return M;
+    };
+
+    if constexpr (std::is_same<Mesh, simplicial_mesh<T>>::value)
+    {
+        if (bases::default_basis_kind == bases::basis_kind::orthonormal)
+            return mass_factorizations<Mesh>::diagonal(msh);
+
+        return mass_factorizations<Mesh>(msh, single_cell_shape(msh), mass, num_threads);
+    }
+    else
+        return mass_factorizations<Mesh>(msh, classify_cell_shapes(msh), mass, num_threads);
+}
+
+} // namespace yaourt
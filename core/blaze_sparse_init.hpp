@@ -37,8 +37,13 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
+#include <vector>
 #include <blaze/Math.h>
 
+#include "parallel.hpp"
+#include "instrumentation.hpp"
+
 namespace blaze {
 
 /* The triplet class with its basic operations */
@@ -100,13 +105,11 @@ operator<<(std::ostream& os, const triplet<T, Idx>& t)
  * accumulate them on a single triplet. */
 template<typename ForwardIterator>
 ForwardIterator
-reduce_triplets(ForwardIterator first, ForwardIterator last)
+reduce_sorted_triplets(ForwardIterator first, ForwardIterator last)
 {
     if ( first == last )
         return last;
 
-    std::sort(first, last);
-
     ForwardIterator result = first;
     while ( ++first != last )
     {
@@ -121,13 +124,95 @@ reduce_triplets(ForwardIterator first, ForwardIterator last)
     return ++result;
 }
 
-/* Do the actual initialization using the API provided by blaze-lib. */
+/* Sort the triplets and reduce them. */
+template<typename ForwardIterator>
+ForwardIterator
+reduce_triplets(ForwardIterator first, ForwardIterator last)
+{
+    if ( first == last )
+        return last;
+
+    std::sort(first, last);
+
+    return reduce_sorted_triplets(first, last);
+}
+
+/* Parallel version of reduce_triplets(). The range is split in chunks
+ * which are sorted and reduced independently, then the chunks are
+ * compacted and merged pairwise (again in parallel) and reduced again. */
+template<typename RandomIterator>
+RandomIterator
+reduce_triplets(RandomIterator first, RandomIterator last, size_t num_threads)
+{
+    size_t size = std::distance(first, last);
+    num_threads = std::min(num_threads, size);
+
+    if (num_threads <= 1)
+        return reduce_triplets(first, last);
+
+    std::vector<RandomIterator> chunk_begin(num_threads);
+    std::vector<RandomIterator> chunk_end(num_threads);
+
+    yaourt::parallel_for_chunks(size, num_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+            chunk_begin[tid] = first + begin;
+            chunk_end[tid] = reduce_triplets(first + begin, first + end);
+        });
+
+    /* Chunks shrank during the reduction, make them contiguous again */
+    std::vector<RandomIterator> bounds;
+    bounds.push_back(first);
+    auto out = first;
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        if (out == chunk_begin[i])
+            out = chunk_end[i];
+        else
+            out = std::move(chunk_begin[i], chunk_end[i], out);
+
+        bounds.push_back(out);
+    }
+
+    for (size_t width = 1; width < num_threads; width *= 2)
+    {
+        size_t num_merges = (num_threads + 2*width - 1) / (2*width);
+
+        yaourt::parallel_for_chunks(num_merges, num_merges,
+            [&](size_t, size_t begin, size_t end) {
+                for (size_t m = begin; m < end; m++)
+                {
+                    size_t lo  = 2*width*m;
+                    size_t mid = std::min(lo + width, num_threads);
+                    size_t hi  = std::min(lo + 2*width, num_threads);
+                    std::inplace_merge(bounds[lo], bounds[mid], bounds[hi]);
+                }
+            });
+    }
+
+    return reduce_sorted_triplets(first, bounds.back());
+}
+
+/* Do the actual initialization using the API provided by blaze-lib.
+ * If 'num_threads' is greater than one, the triplets are sorted and
+ * reduced in parallel. */
 template<typename T, typename ForwardIterator>
 void
 init_from_triplets(CompressedMatrix<T>& M, ForwardIterator first,
-                   ForwardIterator last)
+                   ForwardIterator last, size_t num_threads = 1)
 {
-    auto real_last = reduce_triplets(first, last);
+    YAOURT_TIMED_SCOPE("triplets.init");
+
+    /* The triplets are read and moved by the sort and the reduction */
+    YAOURT_TIMED_SCOPE_VAR(reduce_timer, "triplets.reduce", false);
+    size_t num_triplets = std::distance(first, last);
+    reduce_timer.add_bytes(2*num_triplets*sizeof(*first));
+    YAOURT_COUNT("triplets.count", num_triplets);
+
+    auto real_last = (num_threads > 1) ?
+        reduce_triplets(first, last, num_threads) :
+        reduce_triplets(first, last);
+
+    reduce_timer.stop();
 
     size_t elems = std::distance(first, real_last);
 
@@ -0,0 +1,266 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include <blaze/Math.h>
+
+namespace yaourt {
+
+/* Block compressed sparse row matrix. The matrix is made of dense square
+ * blocks of size 'block_size' and only one column index per block is
+ * stored. Each block is stored in column-major order, so that the inner
+ * loop of the product with a vector is an AXPY on contiguous memory and
+ * vectorizes well.
+ *
+ * The sparsity pattern is given at construction and cannot be changed;
+ * the values of the blocks are then accessed via block(). The products
+ * A*x and trans(A)*x are provided, so the matrix can be passed to the
+ * solvers in core/solvers.hpp in place of a blaze::CompressedMatrix. */
+template<typename T>
+class bsr_matrix
+{
+    size_t              m_block_rows, m_block_cols, m_block_size;
+    std::vector<size_t> m_row_ptr, m_col_idx;
+    std::vector<T>      m_values;
+
+public:
+    using value_type = T;
+
+    bsr_matrix()
+        : m_block_rows(0), m_block_cols(0), m_block_size(0)
+    {}
+
+    /* 'row_ptr' and 'col_idx' describe the block pattern in CSR format,
+     * the column indices of each block row must be sorted. */
+    bsr_matrix(size_t block_rows, size_t block_cols, size_t block_size,
+               const std::vector<size_t>& row_ptr,
+               const std::vector<size_t>& col_idx)
+        : m_block_rows(block_rows), m_block_cols(block_cols),
+          m_block_size(block_size), m_row_ptr(row_ptr), m_col_idx(col_idx)
+    {
+        if (m_row_ptr.size() != m_block_rows+1 or
+            m_row_ptr.back() != m_col_idx.size())
+            throw std::invalid_argument("Invalid BSR pattern");
+
+        for (size_t br = 0; br < m_block_rows; br++)
+        {
+            auto begin = m_col_idx.begin() + m_row_ptr[br];
+            auto end = m_col_idx.begin() + m_row_ptr[br+1];
+            if ( !std::is_sorted(begin, end) )
+                throw std::invalid_argument("BSR column indices not sorted");
+            if ( begin != end and *std::prev(end) >= m_block_cols )
+                throw std::invalid_argument("BSR column index out of range");
+        }
+
+        m_values.assign(m_col_idx.size() * m_block_size * m_block_size, 0.0);
+    }
+
+    size_t rows() const         { return m_block_rows * m_block_size; }
+    size_t columns() const      { return m_block_cols * m_block_size; }
+    size_t block_rows() const   { return m_block_rows; }
+    size_t block_cols() const   { return m_block_cols; }
+    size_t block_size() const   { return m_block_size; }
+    size_t num_blocks() const   { return m_col_idx.size(); }
+    size_t nonZeros() const     { return m_values.size(); }
+
+    const std::vector<size_t>& row_ptr() const { return m_row_ptr; }
+    const std::vector<size_t>& col_idx() const { return m_col_idx; }
+
+    /* Position of the block (br, bc) in the storage, throws if the block
+     * is not in the pattern. */
+    size_t find_block(size_t br, size_t bc) const
+    {
+        assert(br < m_block_rows);
+        auto begin = m_col_idx.begin() + m_row_ptr[br];
+        auto end = m_col_idx.begin() + m_row_ptr[br+1];
+        auto itor = std::lower_bound(begin, end, bc);
+        if (itor == end or *itor != bc)
+            throw std::invalid_argument("Block not in the sparsity pattern");
+
+        return std::distance(m_col_idx.begin(), itor);
+    }
+
+    /* Storage of the k-th block, column-major */
+    T* block(size_t k)
+    {
+        assert(k < num_blocks());
+        return m_values.data() + k * m_block_size * m_block_size;
+    }
+
+    const T* block(size_t k) const
+    {
+        assert(k < num_blocks());
+        return m_values.data() + k * m_block_size * m_block_size;
+    }
+
+    /* Add a dense matrix to the block (br, bc) */
+    template<typename MT>
+    void add_to_block(size_t br, size_t bc, const MT& local)
+    {
+        assert(local.rows() == m_block_size && local.columns() == m_block_size);
+        T* blk = block( find_block(br, bc) );
+        for (size_t j = 0; j < m_block_size; j++)
+            for (size_t i = 0; i < m_block_size; i++)
+                blk[j*m_block_size + i] += local(i,j);
+    }
+
+    void reset()
+    {
+        std::fill(m_values.begin(), m_values.end(), 0.0);
+    }
+
+    /* y = A*x */
+    void multiply(const T *x, T *y) const
+    {
+        const size_t bs = m_block_size;
+
+        for (size_t br = 0; br < m_block_rows; br++)
+        {
+            T *yb = y + br*bs;
+            for (size_t i = 0; i < bs; i++)
+                yb[i] = 0.0;
+
+            for (size_t k = m_row_ptr[br]; k < m_row_ptr[br+1]; k++)
+            {
+                const T *blk = block(k);
+                const T *xb = x + m_col_idx[k]*bs;
+                for (size_t j = 0; j < bs; j++)
+                {
+                    const T xj = xb[j];
+                    const T *col = blk + j*bs;
+                    for (size_t i = 0; i < bs; i++)
+                        yb[i] += col[i] * xj;
+                }
+            }
+        }
+    }
+
+    /* y = trans(A)*x */
+    void multiply_transpose(const T *x, T *y) const
+    {
+        const size_t bs = m_block_size;
+
+        std::fill(y, y + columns(), 0.0);
+
+        for (size_t br = 0; br < m_block_rows; br++)
+        {
+            const T *xb = x + br*bs;
+            for (size_t k = m_row_ptr[br]; k < m_row_ptr[br+1]; k++)
+            {
+                const T *blk = block(k);
+                T *yb = y + m_col_idx[k]*bs;
+                for (size_t j = 0; j < bs; j++)
+                {
+                    const T *col = blk + j*bs;
+                    T acc = 0.0;
+                    for (size_t i = 0; i < bs; i++)
+                        acc += col[i] * xb[i];
+                    yb[j] += acc;
+                }
+            }
+        }
+    }
+
+    /* Linear operator interface (see core/solvers.hpp), no allocations
+     * if 'y' has already the right size. */
+    void apply(const blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& y) const
+    {
+        if (x.size() != columns())
+            throw std::invalid_argument("BSR product: size mismatch");
+
+        y.resize( rows() );
+        multiply(x.data(), y.data());
+    }
+
+    void apply_transpose(const blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& y) const
+    {
+        if (x.size() != rows())
+            throw std::invalid_argument("BSR product: size mismatch");
+
+        y.resize( columns() );
+        multiply_transpose(x.data(), y.data());
+    }
+
+    /* Convert to a scalar blaze matrix, mainly for debugging */
+    blaze::CompressedMatrix<T> to_compressed() const
+    {
+        const size_t bs = m_block_size;
+        blaze::CompressedMatrix<T> ret(rows(), columns());
+        ret.reserve( nonZeros() );
+
+        for (size_t br = 0; br < m_block_rows; br++)
+        {
+            for (size_t i = 0; i < bs; i++)
+            {
+                auto row = br*bs + i;
+                for (size_t k = m_row_ptr[br]; k < m_row_ptr[br+1]; k++)
+                    for (size_t j = 0; j < bs; j++)
+                        ret.append(row, m_col_idx[k]*bs + j, block(k)[j*bs + i]);
+
+                ret.finalize(row);
+            }
+        }
+
+        return ret;
+    }
+
+    friend blaze::DynamicVector<T>
+    operator*(const bsr_matrix& A, const blaze::DynamicVector<T>& x)
+    {
+        if (x.size() != A.columns())
+            throw std::invalid_argument("BSR product: size mismatch");
+
+        blaze::DynamicVector<T> y(A.rows());
+        A.multiply(x.data(), y.data());
+        return y;
+    }
+};
+
+/* Lightweight proxy returned by trans(), only usable to compute products */
+template<typename T>
+struct bsr_transpose
+{
+    const bsr_matrix<T>& A;
+
+    friend blaze::DynamicVector<T>
+    operator*(const bsr_transpose& At, const blaze::DynamicVector<T>& x)
+    {
+        if (x.size() != At.A.rows())
+            throw std::invalid_argument("BSR product: size mismatch");
+
+        blaze::DynamicVector<T> y(At.A.columns());
+        At.A.multiply_transpose(x.data(), y.data());
+        return y;
+    }
+};
+
+template<typename T>
+bsr_transpose<T>
+trans(const bsr_matrix<T>& A)
+{
+    return bsr_transpose<T>{A};
+}
+
+} // namespace yaourt
@@ -0,0 +1,520 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <blaze/Math.h>
+
+#include "mesh.hpp"
+#include "partitioning.hpp"
+#include "instrumentation.hpp"
+
+/* Binary checkpoints, to stop a run and resume it later. A checkpoint is
+ * a sequence of named sections, each one an array of rows x columns
+ * values of the same size, stored as in memory and aligned to 64 bytes.
+ * The reader maps the file in memory and the sections are copied straight
+ * to their destination, nothing is parsed.
+ *
+ * The values are stored in the byte order of the machine: a checkpoint is
+ * meant to be read back on the same kind of machine, by the same program. */
+
+namespace yaourt {
+namespace checkpoint {
+
+namespace detail {
+
+static const char       magic[8] = { 'Y', 'A', 'O', 'U', 'R', 'T', 'C', 'K' };
+static const uint64_t   version = 1;
+static const uint64_t   alignment = 64;
+static const size_t     max_name_length = 31;
+
+/* Both headers take 64 bytes, so all the data is aligned */
+struct file_header
+{
+    char        magic[8];
+    uint64_t    version;
+    uint64_t    reserved[6];
+};
+
+struct section_header
+{
+    char        name[max_name_length+1];
+    uint64_t    value_size;
+    uint64_t    rows, columns;
+    uint64_t    data_size;      /* Including the padding */
+};
+
+} // namespace detail
+
+/* The file is written under a temporary name and renamed by close(), so
+ * a run stopped while writing leaves the previous checkpoint intact. */
+class writer
+{
+    std::string     filename, tmp_filename;
+    std::ofstream   ofs;
+
+    void write_section(const std::string& name, const void *data,
+                       size_t value_size, size_t rows, size_t columns)
+    {
+        if (name.size() > detail::max_name_length)
+            throw std::invalid_argument("checkpoint: section name too long");
+
+        YAOURT_TIMED_SCOPE_VAR(timer, "io.checkpoint.write", false);
+
+        detail::section_header sh;
+        std::memset(&sh, 0, sizeof(sh));
+        std::strncpy(sh.name, name.c_str(), detail::max_name_length);
+        sh.value_size = value_size;
+        sh.rows = rows;
+        sh.columns = columns;
+
+        auto size = value_size*rows*columns;
+        auto a = detail::alignment;
+        sh.data_size = a * ((size + a - 1)/a);
+
+        ofs.write(reinterpret_cast<const char *>(&sh), sizeof(sh));
+        ofs.write(reinterpret_cast<const char *>(data), size);
+
+        static const char zeros[detail::alignment] = {};
+        ofs.write(zeros, sh.data_size - size);
+
+        if (!ofs)
+            throw std::runtime_error("checkpoint: error writing " + tmp_filename);
+
+        timer.add_bytes(sizeof(sh) + sh.data_size);
+    }
+
+public:
+    writer(const std::string& p_filename)
+        : filename(p_filename), tmp_filename(p_filename + ".tmp")
+    {
+        ofs.open(tmp_filename, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+            throw std::runtime_error("checkpoint: can't create " + tmp_filename);
+
+        static_assert(sizeof(detail::file_header) == detail::alignment, "Unexpected padding");
+        static_assert(sizeof(detail::section_header) == detail::alignment, "Unexpected padding");
+
+        detail::file_header fh;
+        std::memset(&fh, 0, sizeof(fh));
+        std::memcpy(fh.magic, detail::magic, sizeof(fh.magic));
+        fh.version = detail::version;
+        ofs.write(reinterpret_cast<const char *>(&fh), sizeof(fh));
+    }
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    /* If close() was not called the checkpoint is discarded */
+    ~writer()
+    {
+        if (ofs.is_open())
+        {
+            ofs.close();
+            std::remove(tmp_filename.c_str());
+        }
+    }
+
+    template<typename V>
+    void write(const std::string& name, const V *data, size_t rows, size_t columns = 1)
+    {
+        static_assert(std::is_trivially_copyable<V>::value, "Values must be trivially copyable");
+        write_section(name, data, sizeof(V), rows, columns);
+    }
+
+    template<typename V>
+    void write(const std::string& name, const std::vector<V>& v)
+    {
+        write(name, v.data(), v.size());
+    }
+
+    template<typename V>
+    void write(const std::string& name, const blaze::DynamicVector<V>& v)
+    {
+        write(name, v.data(), v.size());
+    }
+
+    /* Row by row, without the padding of blaze */
+    template<typename V>
+    void write(const std::string& name, const blaze::DynamicMatrix<V>& m)
+    {
+        std::vector<V> data;
+        data.reserve(m.rows() * m.columns());
+        for (size_t i = 0; i < m.rows(); i++)
+            for (size_t j = 0; j < m.columns(); j++)
+                data.push_back( m(i,j) );
+
+        write(name, data.data(), m.rows(), m.columns());
+    }
+
+    template<typename V>
+    void write_value(const std::string& name, const V& value)
+    {
+        write(name, &value, 1);
+    }
+
+    void close()
+    {
+        ofs.close();
+        if (!ofs)
+            throw std::runtime_error("checkpoint: error writing " + tmp_filename);
+
+        if ( std::rename(tmp_filename.c_str(), filename.c_str()) != 0 )
+            throw std::runtime_error("checkpoint: can't rename " + tmp_filename);
+    }
+};
+
+class reader
+{
+    struct section
+    {
+        const char  *data;
+        size_t      value_size, rows, columns;
+    };
+
+    std::string                     filename;
+    void                            *map_base;
+    size_t                          map_size;
+    std::map<std::string, section>  sections;
+
+    template<typename V>
+    const section& get(const std::string& name) const
+    {
+        auto itor = sections.find(name);
+        if (itor == sections.end())
+            throw std::runtime_error("checkpoint: no section '" + name + "' in " + filename);
+
+        if (itor->second.value_size != sizeof(V))
+            throw std::runtime_error("checkpoint: wrong value type in section '" + name + "'");
+
+        return itor->second;
+    }
+
+    void parse()
+    {
+        const char *base = static_cast<const char *>(map_base);
+        const char *end = base + map_size;
+
+        detail::file_header fh;
+        if (map_size < sizeof(fh))
+            throw std::runtime_error("checkpoint: " + filename + " is too short");
+        std::memcpy(&fh, base, sizeof(fh));
+        if ( std::memcmp(fh.magic, detail::magic, sizeof(fh.magic)) != 0 or
+             fh.version != detail::version )
+            throw std::runtime_error("checkpoint: " + filename + " is not a checkpoint");
+
+        const char *cur = base + sizeof(fh);
+        while (cur < end)
+        {
+            detail::section_header sh;
+            if (end - cur < ptrdiff_t(sizeof(sh)))
+                throw std::runtime_error("checkpoint: " + filename + " is truncated");
+            std::memcpy(&sh, cur, sizeof(sh));
+            cur += sizeof(sh);
+
+            if (uint64_t(end - cur) < sh.data_size or
+                sh.data_size < sh.value_size*sh.rows*sh.columns)
+                throw std::runtime_error("checkpoint: " + filename + " is truncated");
+
+            sh.name[detail::max_name_length] = '\0';
+            sections[sh.name] = { cur, sh.value_size, sh.rows, sh.columns };
+            cur += sh.data_size;
+        }
+    }
+
+public:
+    reader(const std::string& p_filename)
+        : filename(p_filename), map_base(MAP_FAILED), map_size(0)
+    {
+        YAOURT_TIMED_SCOPE("io.checkpoint.open");
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("checkpoint: can't open " + filename);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+        {
+            map_size = st.st_size;
+            if (map_size > 0)
+                map_base = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+
+        if (map_base == MAP_FAILED)
+            throw std::runtime_error("checkpoint: can't map " + filename);
+
+        try {
+            parse();
+        }
+        catch (...) {
+            munmap(map_base, map_size);
+            throw;
+        }
+    }
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    ~reader()
+    {
+        if (map_base != MAP_FAILED)
+            munmap(map_base, map_size);
+    }
+
+    bool has(const std::string& name) const
+    {
+        return sections.find(name) != sections.end();
+    }
+
+    /* Pointer to the values of a section, in the mapped file */
+    template<typename V>
+    const V *data(const std::string& name, size_t& rows, size_t& columns) const
+    {
+        static_assert(std::is_trivially_copyable<V>::value, "Values must be trivially copyable");
+        auto& s = get<V>(name);
+        rows = s.rows;
+        columns = s.columns;
+        return reinterpret_cast<const V *>(s.data);
+    }
+
+    template<typename V>
+    void read(const std::string& name, std::vector<V>& v) const
+    {
+        YAOURT_TIMED_SCOPE_VAR(timer, "io.checkpoint.read", false);
+
+        size_t r, c;
+        auto d = data<V>(name, r, c);
+        timer.add_bytes(r*c*sizeof(V));
+        v.resize(r*c);
+        if (r*c > 0)
+            std::memcpy(v.data(), d, r*c*sizeof(V));
+    }
+
+    template<typename V>
+    void read(const std::string& name, blaze::DynamicVector<V>& v) const
+    {
+        YAOURT_TIMED_SCOPE_VAR(timer, "io.checkpoint.read", false);
+
+        size_t r, c;
+        auto d = data<V>(name, r, c);
+        timer.add_bytes(r*c*sizeof(V));
+        v.resize(r*c);
+        if (r*c > 0)
+            std::memcpy(v.data(), d, r*c*sizeof(V));
+    }
+
+    template<typename V>
+    void read(const std::string& name, blaze::DynamicMatrix<V>& m) const
+    {
+        YAOURT_TIMED_SCOPE_VAR(timer, "io.checkpoint.read", false);
+
+        size_t r, c;
+        auto d = data<V>(name, r, c);
+        timer.add_bytes(r*c*sizeof(V));
+        m.resize(r, c, false);
+        for (size_t i = 0; i < r; i++)
+            std::memcpy(&m(i,0), d + i*c, c*sizeof(V));
+    }
+
+    template<typename V>
+    V read_value(const std::string& name) const
+    {
+        size_t r, c;
+        auto d = data<V>(name, r, c);
+        if (r*c != 1)
+            throw std::runtime_error("checkpoint: section '" + name + "' is not a value");
+
+        V ret;
+        std::memcpy(&ret, d, sizeof(V));
+        return ret;
+    }
+};
+
+/* The mesh with its connectivity, the sections are prefixed by 'prefix' */
+template<typename Mesh>
+void
+write_mesh(writer& w, const Mesh& msh, const std::string& prefix = "mesh.")
+{
+    using T = typename Mesh::coordinate_type;
+
+    if ( !msh.has_connectivity() )
+        throw std::logic_error("No connectivity information.");
+
+    std::vector<T> pts;
+    pts.reserve(2*msh.points.size());
+    for (auto& pt : msh.points)
+    {
+        pts.push_back( pt.x() );
+        pts.push_back( pt.y() );
+    }
+    w.write(prefix + "points", pts.data(), msh.points.size(), 2);
+
+    /* p0, p1, pb, boundary_id, is_boundary, is_broken */
+    std::vector<uint64_t> fcs;
+    fcs.reserve(6*msh.faces.size());
+    for (auto& fc : msh.faces)
+    {
+        fcs.push_back( fc.p0 );
+        fcs.push_back( fc.p1 );
+        fcs.push_back( fc.pb );
+        fcs.push_back( fc.is_boundary ? fc.boundary_id : 0 );
+        fcs.push_back( fc.is_boundary );
+        fcs.push_back( fc.is_broken );
+    }
+    w.write(prefix + "faces", fcs.data(), msh.faces.size(), 6);
+
+    w.write(prefix + "cells", msh.cells);
+    w.write(prefix + "face_owners", msh.face_owners);
+    w.write(prefix + "cell_faces", msh.cell_faces);
+    w.write(prefix + "sorted_cells", msh.sorted_cells);
+    w.write(prefix + "sorted_faces", msh.sorted_faces);
+    w.write(prefix + "hanging_faces", msh.hanging_faces);
+}
+
+template<typename Mesh>
+void
+read_mesh(const reader& r, Mesh& msh, const std::string& prefix = "mesh.")
+{
+    using T = typename Mesh::coordinate_type;
+    using face_type = typename Mesh::face_type;
+
+    size_t rows, cols;
+    auto pts = r.data<T>(prefix + "points", rows, cols);
+    if (cols != 2)
+        throw std::runtime_error("checkpoint: 2D mesh expected");
+
+    msh.points.clear();
+    msh.points.reserve(rows);
+    for (size_t i = 0; i < rows; i++)
+        msh.points.push_back( typename Mesh::point_type({pts[2*i], pts[2*i+1]}) );
+
+    auto fcs = r.data<uint64_t>(prefix + "faces", rows, cols);
+    if (cols != 6)
+        throw std::runtime_error("checkpoint: wrong face format");
+
+    msh.faces.clear();
+    msh.faces.reserve(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        const uint64_t *f = fcs + 6*i;
+        face_type fc(f[0], f[1], f[3], f[4] != 0);
+        fc.pb = f[2];
+        fc.is_broken = (f[5] != 0);
+        msh.faces.push_back(fc);
+    }
+
+    r.read(prefix + "cells", msh.cells);
+    r.read(prefix + "face_owners", msh.face_owners);
+    r.read(prefix + "cell_faces", msh.cell_faces);
+    r.read(prefix + "sorted_cells", msh.sorted_cells);
+    r.read(prefix + "sorted_faces", msh.sorted_faces);
+    r.read(prefix + "hanging_faces", msh.hanging_faces);
+
+    if ( !msh.has_connectivity() )
+        throw std::runtime_error("checkpoint: inconsistent mesh");
+}
+
+/* The description of the part of a decomposed mesh. The links are stored
+ * in a single array: for each link the part, the sizes of the send and
+ * receive lists, then the lists. */
+inline void
+write_partition(writer& w, const mesh_partition& part, const std::string& prefix = "part.")
+{
+    uint64_t info[] = { part.part, part.num_parts, part.num_owned, part.num_global_cells };
+    w.write(prefix + "info", info, 4);
+    w.write(prefix + "global_cell", part.global_cell);
+    w.write(prefix + "interior_cells", part.interior_cells);
+    w.write(prefix + "interface_cells", part.interface_cells);
+
+    std::vector<size_t> links;
+    for (auto& l : part.links)
+    {
+        links.push_back( l.part );
+        links.push_back( l.send.size() );
+        links.push_back( l.recv.size() );
+        links.insert(links.end(), l.send.begin(), l.send.end());
+        links.insert(links.end(), l.recv.begin(), l.recv.end());
+    }
+    w.write(prefix + "links", links);
+}
+
+inline mesh_partition
+read_partition(const reader& r, const std::string& prefix = "part.")
+{
+    mesh_partition ret;
+
+    std::vector<uint64_t> info;
+    r.read(prefix + "info", info);
+    if (info.size() != 4)
+        throw std::runtime_error("checkpoint: wrong partition format");
+
+    ret.part = info[0];
+    ret.num_parts = info[1];
+    ret.num_owned = info[2];
+    ret.num_global_cells = info[3];
+
+    r.read(prefix + "global_cell", ret.global_cell);
+    r.read(prefix + "interior_cells", ret.interior_cells);
+    r.read(prefix + "interface_cells", ret.interface_cells);
+
+    std::vector<size_t> links;
+    r.read(prefix + "links", links);
+    for (size_t i = 0; i < links.size(); )
+    {
+        if (links.size() - i < 3)
+            throw std::runtime_error("checkpoint: wrong partition format");
+
+        mesh_partition::halo_link l;
+        l.part = links[i];
+        auto ns = links[i+1];
+        auto nr = links[i+2];
+        i += 3;
+
+        if (links.size() - i < ns + nr)
+            throw std::runtime_error("checkpoint: wrong partition format");
+
+        l.send.assign(links.begin() + i, links.begin() + i + ns);
+        i += ns;
+        l.recv.assign(links.begin() + i, links.begin() + i + nr);
+        i += nr;
+        ret.links.push_back( std::move(l) );
+    }
+
+    return ret;
+}
+
+} // namespace checkpoint
+} // namespace yaourt
@@ -17,20 +17,49 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #ifdef WITH_SILO
 
 #include <silo.h>
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
 #include <blaze/Math.h>
 #pragma clang diagnostic pop
 
 #include "mesh.hpp"
+#include "instrumentation.hpp"
 
 namespace yaourt {
 namespace dataio {
 
+namespace detail {
+
+/* Silo type of the values of type T */
+template<typename T>
+constexpr int silo_datatype()
+{
+    static_assert(std::is_same<T,double>::value || std::is_same<T,float>::value,
+                  "Silo supports only float and double");
+    return std::is_same<T,float>::value ? DB_FLOAT : DB_DOUBLE;
+}
+
+} // namespace detail
+
 class silo_database
 {
     DBfile          *m_siloDb;
@@ -39,6 +68,49 @@ class silo_database
     int             cycle;
     double          time;
 
+    /* Meshes stored in another file, see add_mesh_reference() */
+    std::vector<std::string>    m_mesh_refs;
+
+    bool is_mesh_reference(const std::string& mesh_name) const
+    {
+        return std::find(m_mesh_refs.begin(), m_mesh_refs.end(), mesh_name)
+            != m_mesh_refs.end();
+    }
+
+    /* On a referenced mesh the values go in a block in this file and the
+     * variable is a multivar made of that block */
+    template<typename T>
+    void put_variable(const std::string& mesh_name, const std::string& var_name,
+                      blaze::DynamicVector<T>& var, int centering)
+    {
+        YAOURT_TIMED_SCOPE_VAR(timer, "io.silo.variable", false);
+        timer.add_bytes(var.size()*sizeof(T));
+
+        if ( !is_mesh_reference(mesh_name) )
+        {
+            DBPutUcdvar1(m_siloDb, var_name.c_str(), mesh_name.c_str(),
+                         var.data(),
+                         var.size(), NULL, 0, detail::silo_datatype<T>(),
+                         centering, NULL);
+            return;
+        }
+
+        std::string block_name = var_name + "_block";
+        DBPutUcdvar1(m_siloDb, block_name.c_str(), mesh_name.c_str(),
+                     var.data(),
+                     var.size(), NULL, 0, detail::silo_datatype<T>(),
+                     centering, NULL);
+
+        std::string block_path = "/" + block_name;
+        const char *varnames[] = { block_path.c_str() };
+        int vartypes[] = { DB_UCDVAR };
+
+        auto optlist = DBMakeOptlist(1);
+        DBAddOption(optlist, DBOPT_MMESH_NAME, const_cast<char *>(mesh_name.c_str()));
+        DBPutMultivar(m_siloDb, var_name.c_str(), 1, varnames, vartypes, optlist);
+        DBFreeOptlist(optlist);
+    }
+
 public:
     silo_database()
         : m_siloDb(nullptr), m_optlist(nullptr)
@@ -66,6 +138,8 @@ public:
 
     bool close()
     {
+        YAOURT_TIMED_SCOPE("io.silo.close");
+
         if (m_siloDb)
         {
             DBClose(m_siloDb);
@@ -78,6 +152,7 @@ public:
             m_optlist = nullptr;
         }
 
+        m_mesh_refs.clear();
         return true;
     }
 
@@ -90,14 +165,18 @@ public:
             DBFreeOptlist(m_optlist);
     }
 
+    /* The time is stored in double whatever the type of the data */
     template<typename T>
     bool
     add_time(int p_cycle, T p_time)
     {
-        static_assert(std::is_same<T,double>::value, "Wrong type");
+        static_assert(std::is_floating_point<T>::value, "Wrong type");
 
         cycle = p_cycle;
-        time = p_time;
+        time = double(p_time);
+
+        if (m_optlist)
+            DBFreeOptlist(m_optlist);
 
         /* cycle and time must live at least until DBPutUcdMesh() */
         m_optlist = DBMakeOptlist(2);
@@ -111,7 +190,7 @@ public:
     bool
     add_mesh(const simplicial_mesh<T>& msh, const std::string& name)
     {
-        static_assert(std::is_same<T,double>::value || std::is_same<T,float>::value, "Wrong type");
+        YAOURT_TIMED_SCOPE("io.silo.mesh");
 
         std::vector<T> x_coords, y_coords;
         x_coords.reserve(msh.points.size());
@@ -155,18 +234,8 @@ public:
             nodelist.data(), lnodelist, 1, 0, 0, shapetype, shapesize,
             shapecounts, nshapetypes, NULL);
 
-        if ( std::is_same<T, float>::value )
-        {
-            DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
-                zonelist_name.c_str(), NULL, DB_FLOAT, m_optlist);
-        }
-
-        if ( std::is_same<T, double>::value )
-        {
-            DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
-                zonelist_name.c_str(), NULL, DB_DOUBLE, m_optlist);
-        }
-
+        DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
+            zonelist_name.c_str(), NULL, detail::silo_datatype<T>(), m_optlist);
 
         return true;
     }
@@ -175,7 +244,7 @@ public:
     bool
     add_mesh(const quad_mesh<T>& msh, const std::string& name)
     {
-        static_assert(std::is_same<T,double>::value || std::is_same<T,float>::value, "Wrong type");
+        YAOURT_TIMED_SCOPE("io.silo.mesh");
 
         std::vector<T> x_coords, y_coords;
         x_coords.reserve(msh.points.size());
@@ -219,19 +288,30 @@ public:
             nodelist.data(), lnodelist, 1, 0, 0, shapetype, shapesize,
             shapecounts, nshapetypes, NULL);
 
-        if ( std::is_same<T, float>::value )
-        {
-            DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
-                zonelist_name.c_str(), NULL, DB_FLOAT, m_optlist);
-        }
+        DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
+            zonelist_name.c_str(), NULL, detail::silo_datatype<T>(), m_optlist);
+
+        return true;
+    }
 
-        if ( std::is_same<T, double>::value )
+    /* Use the mesh 'name' stored in 'mesh_file', a path relative to this
+     * database, instead of writing the mesh again. This is what to do when
+     * the mesh does not change between the dumps: write it once with
+     * add_mesh() and reference it from the files of the cycles. */
+    bool add_mesh_reference(const std::string& mesh_file, const std::string& name)
+    {
+        if (!m_siloDb)
         {
-            DBPutUcdmesh(m_siloDb, name.c_str(), ndims, NULL, coords, nnodes, nzones,
-                zonelist_name.c_str(), NULL, DB_DOUBLE, m_optlist);
+            std::cout << "Silo database not opened" << std::endl;
+            return false;
         }
 
+        std::string block = mesh_file + ":/" + name;
+        const char *meshnames[] = { block.c_str() };
+        int meshtypes[] = { DB_UCDMESH };
 
+        DBPutMultimesh(m_siloDb, name.c_str(), 1, meshnames, meshtypes, m_optlist);
+        m_mesh_refs.push_back(name);
         return true;
     }
 
@@ -240,19 +320,13 @@ public:
                             const std::string& var_name,
                             blaze::DynamicVector<T>& var)
     {
-        static_assert(std::is_same<T, double>::value, "Sorry, only double for now");
-
         if (!m_siloDb)
         {
             std::cout << "Silo database not opened" << std::endl;
             return false;
         }
 
-        DBPutUcdvar1(m_siloDb, var_name.c_str(), mesh_name.c_str(),
-                     var.data(),
-                     var.size(), NULL, 0, DB_DOUBLE,
-                     DB_NODECENT, NULL);
-
+        put_variable(mesh_name, var_name, var, DB_NODECENT);
         return true;
     }
 
@@ -261,19 +335,13 @@ public:
                             const std::string& var_name,
                             blaze::DynamicVector<T>& var)
     {
-        static_assert(std::is_same<T, double>::value, "Sorry, only double for now");
-
         if (!m_siloDb)
         {
             std::cout << "Silo database not opened" << std::endl;
             return false;
         }
 
-        DBPutUcdvar1(m_siloDb, var_name.c_str(), mesh_name.c_str(),
-                     var.data(),
-                     var.size(), NULL, 0, DB_DOUBLE,
-                     DB_ZONECENT, NULL);
-
+        put_variable(mesh_name, var_name, var, DB_ZONECENT);
         return true;
     }
 
@@ -290,6 +358,176 @@ public:
     }
 };
 
+/* Output of time-dependent runs, without stopping the solver while the
+ * files are written. The mesh is written once, in <basename>_mesh.silo,
+ * and the file of each cycle, <basename>_<cycle>.silo, references it.
+ *
+ * submit() copies the data of a cycle (for example the vector of the
+ * DoFs) in one of two staging slots and returns, the computation of the
+ * output variables and the writing are done by 'write' on a background
+ * thread. submit() blocks only if the two slots are still waiting to be
+ * written. 'write' runs concurrently with the solver: anything it uses
+ * besides the data it receives, like the mesh, must not be modified until
+ * flush() returns. All the Silo calls are made by the writer thread, so
+ * no other Silo output can be done meanwhile. */
+template<typename Data>
+class async_silo_writer
+{
+public:
+    using write_function = std::function<void(silo_database&, const std::string& mesh_name,
+                                              const Data&, int cycle, double time)>;
+
+private:
+    struct staging_slot
+    {
+        Data        data;
+        int         cycle;
+        double      time;
+        bool        full;
+    };
+
+    std::string                     basename, suffix, mesh_file, mesh_name;
+    write_function                  write;
+
+    std::array<staging_slot, 2>     slots;
+    size_t                          num_submitted, num_written;
+    bool                            stop;
+    std::exception_ptr              error;
+
+    std::mutex                      mtx;
+    std::condition_variable         cv;
+    std::thread                     writer;
+
+    std::string cycle_filename(int cycle) const
+    {
+        std::stringstream ss;
+        ss << basename << "_" << cycle << suffix << ".silo";
+        return ss.str();
+    }
+
+    void writer_loop()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            auto& slot = slots[num_written % 2];
+            cv.wait(lock, [&]{ return slot.full or stop; });
+            if (!slot.full)
+                return;
+            lock.unlock();
+
+            /* The slot is not touched by submit() until it is emptied */
+            YAOURT_TIMED_SCOPE_VAR(timer, "io.silo.async_write", false);
+            try {
+                silo_database silo;
+                if ( silo.create( cycle_filename(slot.cycle) ) )
+                {
+                    silo.add_time(slot.cycle, slot.time);
+                    silo.add_mesh_reference(mesh_file, mesh_name);
+                    write(silo, mesh_name, slot.data, slot.cycle, slot.time);
+                    silo.close();
+                }
+            }
+            catch (...) {
+                lock.lock();
+                if (!error)
+                    error = std::current_exception();
+                lock.unlock();
+            }
+
+            timer.stop();
+
+            lock.lock();
+            slot.full = false;
+            num_written++;
+            cv.notify_all();
+        }
+    }
+
+    void rethrow_error()
+    {
+        if (error)
+        {
+            auto e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+public:
+    /* 'p_suffix' is appended to the file names, for example the number of
+     * the process when each process writes its part */
+    template<typename Mesh>
+    async_silo_writer(const Mesh& msh, const std::string& p_basename,
+                      const std::string& p_mesh_name, write_function p_write,
+                      const std::string& p_suffix = "")
+        : basename(p_basename), suffix(p_suffix), mesh_name(p_mesh_name),
+          write(std::move(p_write)), num_submitted(0), num_written(0),
+          stop(false)
+    {
+        for (auto& slot : slots)
+            slot.full = false;
+
+        std::string mesh_path = basename + "_mesh" + suffix + ".silo";
+
+        /* The reference is relative to the directory of the cycle files */
+        auto sep = mesh_path.find_last_of('/');
+        mesh_file = (sep == std::string::npos) ? mesh_path : mesh_path.substr(sep+1);
+
+        silo_database silo;
+        if ( !silo.create(mesh_path) )
+            throw std::runtime_error("async_silo_writer: can't create the mesh file");
+        silo.add_mesh(msh, mesh_name);
+        silo.close();
+
+        writer = std::thread(&async_silo_writer::writer_loop, this);
+    }
+
+    async_silo_writer(const async_silo_writer&) = delete;
+    async_silo_writer& operator=(const async_silo_writer&) = delete;
+
+    ~async_silo_writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        cv.notify_all();
+        writer.join();
+    }
+
+    /* Stage a copy of 'data' for the cycle 'cycle'. Once the slots have
+     * the right size the copy does not allocate. If a previous write
+     * failed, its exception is rethrown here. */
+    void submit(int cycle, double time, const Data& data)
+    {
+        YAOURT_TIMED_SCOPE("io.silo.submit");
+
+        std::unique_lock<std::mutex> lock(mtx);
+        auto& slot = slots[num_submitted % 2];
+        cv.wait(lock, [&]{ return !slot.full; });
+        rethrow_error();
+        lock.unlock();
+
+        slot.data = data;
+        slot.cycle = cycle;
+        slot.time = time;
+
+        lock.lock();
+        slot.full = true;
+        num_submitted++;
+        cv.notify_all();
+    }
+
+    /* Wait until all the submitted cycles are written */
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]{ return num_written == num_submitted; });
+        rethrow_error();
+    }
+};
+
 } // namespace dataio
 } // namespace yaourt
 
@@ -0,0 +1,296 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef WITH_MPI
+
+#include <mpi.h>
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <blaze/Math.h>
+
+#include "partitioning.hpp"
+#include "solvers.hpp"
+
+/* Distributed memory support on top of the decomposition computed in
+ * core/partitioning.hpp: process i owns the part i. The data of the cells
+ * is stored in blocks of the same size, one per local cell, the owned
+ * cells first and the ghost cells after them, as in the local mesh. The
+ * halo exchange refreshes the blocks of the ghost cells with the values
+ * of their owners.
+ *
+ * The exchange is split in begin() and end(), so that the owned cells
+ * that do not need the ghosts (mesh_partition::interior_cells) can be
+ * computed while the messages are in flight. */
+
+namespace yaourt {
+namespace mpi {
+
+template<typename T>
+MPI_Datatype datatype();
+
+template<>
+inline MPI_Datatype datatype<double>() { return MPI_DOUBLE; }
+
+template<>
+inline MPI_Datatype datatype<float>() { return MPI_FLOAT; }
+
+inline int
+comm_rank(MPI_Comm comm = MPI_COMM_WORLD)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    return rank;
+}
+
+inline int
+comm_size(MPI_Comm comm = MPI_COMM_WORLD)
+{
+    int size;
+    MPI_Comm_size(comm, &size);
+    return size;
+}
+
+/* True if MPI is initialized and there is more than one process */
+inline bool
+is_parallel(MPI_Comm comm = MPI_COMM_WORLD)
+{
+    int initialized;
+    MPI_Initialized(&initialized);
+    return initialized and comm_size(comm) > 1;
+}
+
+/* Sum of 'val' over all the processes */
+template<typename T>
+T
+allreduce_sum(T val, MPI_Comm comm = MPI_COMM_WORLD)
+{
+    T ret;
+    MPI_Allreduce(&val, &ret, 1, datatype<T>(), MPI_SUM, comm);
+    return ret;
+}
+
+/* Partition 'msh' among the processes and replace it with the local mesh
+ * of the calling process. Returns the description of the local part. */
+template<typename Mesh>
+mesh_partition
+distribute_mesh(Mesh& msh, MPI_Comm comm = MPI_COMM_WORLD)
+{
+    if ( !msh.has_connectivity() )
+        msh.compute_connectivity();
+
+    auto parts = partition_mesh(msh, comm_size(comm));
+
+    Mesh local;
+    auto ret = extract_partition(msh, parts, comm_rank(comm), local);
+    msh = std::move(local);
+    return ret;
+}
+
+/* Exchange of the ghost blocks with the neighbouring processes. The send
+ * and receive buffers are kept in the object, so an exchange does not
+ * allocate once the block size is known. Only one exchange at a time can
+ * be in progress. */
+template<typename T>
+class halo_exchange
+{
+    MPI_Comm                                comm;
+    std::vector<mesh_partition::halo_link>  links;
+    std::vector<std::vector<T>>             sendbufs, recvbufs;
+    std::vector<MPI_Request>                requests;
+
+    T               *cur_data;
+    size_t          cur_block, cur_stride, cur_vstride;
+
+    static const int tag = 4242;
+
+public:
+    halo_exchange(const mesh_partition& part, MPI_Comm p_comm = MPI_COMM_WORLD)
+        : comm(p_comm), links(part.links), sendbufs(part.links.size()),
+          recvbufs(part.links.size()), cur_data(nullptr), cur_block(0),
+          cur_stride(0), cur_vstride(0)
+    {}
+
+    halo_exchange(const halo_exchange&) = delete;
+    halo_exchange& operator=(const halo_exchange&) = delete;
+
+    ~halo_exchange()
+    {
+        if (cur_data)
+            end();
+    }
+
+    /* Start the exchange of the blocks of 'block_size' values of 'data',
+     * the block of the local cell i starting at data + i*stride, its
+     * values 'value_stride' apart. The owned blocks must not be modified
+     * until end() returns. */
+    void begin(T *data, size_t block_size, size_t stride, size_t value_stride = 1)
+    {
+        if (cur_data)
+            throw std::logic_error("halo_exchange: exchange already in progress");
+
+        YAOURT_TIMED_SCOPE_VAR(timer, "mpi.halo.begin", false);
+
+        cur_data = data;
+        cur_block = block_size;
+        cur_stride = stride;
+        cur_vstride = value_stride;
+
+        requests.resize( 2*links.size() );
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            auto& l = links[i];
+            auto& rb = recvbufs[i];
+            rb.resize( l.recv.size() * block_size );
+            MPI_Irecv(rb.data(), int(rb.size()), datatype<T>(), int(l.part),
+                      tag, comm, &requests[i]);
+        }
+
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            auto& l = links[i];
+            auto& sb = sendbufs[i];
+            sb.resize( l.send.size() * block_size );
+            for (size_t j = 0; j < l.send.size(); j++)
+            {
+                const T *src = data + l.send[j]*stride;
+                for (size_t k = 0; k < block_size; k++)
+                    sb[j*block_size + k] = src[k*value_stride];
+            }
+
+            MPI_Isend(sb.data(), int(sb.size()), datatype<T>(), int(l.part),
+                      tag, comm, &requests[links.size()+i]);
+            timer.add_bytes(sb.size()*sizeof(T));
+        }
+    }
+
+    /* Blocks of 'block_size' values stored contiguously */
+    void begin(blaze::DynamicVector<T>& v, size_t block_size)
+    {
+        begin(v.data(), block_size, block_size);
+    }
+
+    /* One row per cell */
+    void begin(blaze::DynamicMatrix<T>& m)
+    {
+        begin(m.data(), m.columns(), m.spacing());
+    }
+
+    /* One row per cell, stored by columns */
+    void begin(blaze::DynamicMatrix<T, blaze::columnMajor>& m)
+    {
+        begin(m.data(), m.columns(), 1, m.spacing());
+    }
+
+    /* Wait for the messages and store the received blocks */
+    void end()
+    {
+        if (!cur_data)
+            throw std::logic_error("halo_exchange: no exchange in progress");
+
+        /* Mostly the time waiting for the messages */
+        YAOURT_TIMED_SCOPE("mpi.halo.end");
+
+        MPI_Waitall(int(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            auto& l = links[i];
+            const auto& rb = recvbufs[i];
+            for (size_t j = 0; j < l.recv.size(); j++)
+            {
+                const T *src = rb.data() + j*cur_block;
+                T *dst = cur_data + l.recv[j]*cur_stride;
+                for (size_t k = 0; k < cur_block; k++)
+                    dst[k*cur_vstride] = src[k];
+            }
+        }
+
+        cur_data = nullptr;
+    }
+
+    template<typename... Args>
+    void exchange(Args&&... args)
+    {
+        begin(std::forward<Args>(args)...);
+        end();
+    }
+};
+
+/* Linear operator on the owned DoFs of a process, to be used with the
+ * solvers of core/solvers.hpp. 'A' is the operator assembled on the local
+ * mesh: its rows and columns are the DoFs of all the local cells, blocks
+ * of 'block_size' DoFs per cell, and the rows of the owned cells must be
+ * complete. The vectors seen by the solvers hold only the owned DoFs, the
+ * ghost DoFs are exchanged in apply(), and the dot products are summed
+ * over the processes by reduce(). */
+template<typename T, typename Op>
+class distributed_operator
+{
+    const Op&                       A;
+    size_t                          num_owned_dofs;
+    size_t                          block_size;
+    MPI_Comm                        comm;
+    mutable halo_exchange<T>        halo;
+    mutable blaze::DynamicVector<T> x_ext, y_ext;
+
+public:
+    distributed_operator(const Op& p_A, const mesh_partition& part,
+                         size_t p_block_size, MPI_Comm p_comm = MPI_COMM_WORLD)
+        : A(p_A), num_owned_dofs(part.num_owned * p_block_size),
+          block_size(p_block_size), comm(p_comm), halo(part, p_comm),
+          x_ext(part.global_cell.size() * p_block_size, 0.0)
+    {
+        if (A.rows() != x_ext.size() or A.columns() != x_ext.size())
+            throw std::invalid_argument("distributed_operator: wrong operator size");
+    }
+
+    size_t rows() const { return num_owned_dofs; }
+    size_t columns() const { return num_owned_dofs; }
+
+    void apply(const blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& y) const
+    {
+        subvector(x_ext, 0, num_owned_dofs) = x;
+        halo.exchange(x_ext, block_size);
+        yaourt::detail::apply_operator(A, x_ext, y_ext);
+        y = subvector(y_ext, 0, num_owned_dofs);
+    }
+
+    T reduce(T val) const
+    {
+        return allreduce_sum(val, comm);
+    }
+};
+
+template<typename T, typename Op>
+distributed_operator<T, Op>
+make_distributed_operator(const Op& A, const mesh_partition& part,
+                          size_t block_size, MPI_Comm comm = MPI_COMM_WORLD)
+{
+    return distributed_operator<T, Op>(A, part, block_size, comm);
+}
+
+} //namespace mpi
+} //namespace yaourt
+
+#endif /* WITH_MPI */
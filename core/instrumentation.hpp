@@ -0,0 +1,457 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Instrumentation of the hot paths. The phases of the code (meshing,
+ * assembly, solvers, timesteps, I/O...) are marked with timed scopes and
+ * the registry accumulates, for each phase, the calls, the time, the
+ * bytes moved and the allocations. Counters accumulate plain numbers, as
+ * the solver iterations.
+ *
+ *      YAOURT_TIMED_SCOPE("assembly.finalize");
+ *      YAOURT_TIMED_SCOPE_VAR(timer, "io.checkpoint", false);
+ *      timer.add_bytes(n);
+ *      YAOURT_COUNT("solver.cg.iterations", iter);
+ *
+ * Nothing is recorded unless the environment variable
+ * YAOURT_INSTRUMENTATION is set: to a file name ending in .json to write
+ * the report in that file, to anything else (but 0) to print a summary on
+ * stderr. The report is done at exit, or by calling report().
+ * When disabled a timed scope only tests a flag, the clock is not read.
+ * With YAOURT_NO_INSTRUMENTATION defined the macros compile to nothing.
+ *
+ * The times are inclusive, a phase nested in another one is counted in
+ * both. The allocations are of all the threads while the phase runs, and
+ * are counted only if the program includes core/allocation_counter.hpp. */
+
+namespace yaourt::instrumentation {
+
+struct allocation_count
+{
+    size_t  count;
+    size_t  bytes;
+};
+
+using allocation_source = allocation_count (*)();
+
+class phase
+{
+    std::string             m_name;
+    std::atomic<uint64_t>   m_calls, m_nanoseconds, m_bytes;
+    std::atomic<uint64_t>   m_allocations, m_allocated_bytes;
+
+public:
+    explicit phase(const std::string& name)
+        : m_name(name), m_calls(0), m_nanoseconds(0), m_bytes(0),
+          m_allocations(0), m_allocated_bytes(0)
+    {}
+
+    void add_call(uint64_t ns, const allocation_count& allocs)
+    {
+        m_calls.fetch_add(1, std::memory_order_relaxed);
+        m_nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+        m_allocations.fetch_add(allocs.count, std::memory_order_relaxed);
+        m_allocated_bytes.fetch_add(allocs.bytes, std::memory_order_relaxed);
+    }
+
+    void add_bytes(uint64_t bytes)
+    {
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    const std::string& name() const { return m_name; }
+    uint64_t calls() const          { return m_calls.load(std::memory_order_relaxed); }
+    double seconds() const          { return m_nanoseconds.load(std::memory_order_relaxed)*1e-9; }
+    uint64_t bytes() const          { return m_bytes.load(std::memory_order_relaxed); }
+    uint64_t allocations() const    { return m_allocations.load(std::memory_order_relaxed); }
+    uint64_t allocated_bytes() const { return m_allocated_bytes.load(std::memory_order_relaxed); }
+};
+
+class counter
+{
+    std::string             m_name;
+    std::atomic<uint64_t>   m_value;
+
+public:
+    explicit counter(const std::string& name)
+        : m_name(name), m_value(0)
+    {}
+
+    void add(uint64_t n)
+    {
+        m_value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    const std::string& name() const { return m_name; }
+    uint64_t value() const          { return m_value.load(std::memory_order_relaxed); }
+};
+
+class registry
+{
+    using clock = std::chrono::steady_clock;
+
+    /* Deques, the call sites keep references to the elements */
+    mutable std::mutex          mtx;
+    std::deque<phase>           phases;
+    std::deque<counter>         counters;
+
+    inline static std::atomic<bool>     enabled_flag{false};
+    allocation_source           alloc_source;
+    std::string                 json_fn;
+    int                         process;
+    clock::time_point           start;
+    bool                        reported;
+
+    registry()
+        : alloc_source(nullptr), process(-1), start(clock::now()), reported(false)
+    {
+#ifndef YAOURT_NO_INSTRUMENTATION
+        const char *env = std::getenv("YAOURT_INSTRUMENTATION");
+        if (!env or env[0] == '\0' or std::string(env) == "0")
+            return;
+
+        std::string val = env;
+        if (val.size() > 5 and val.compare(val.size()-5, 5, ".json") == 0)
+            json_fn = val;
+
+        enabled_flag.store(true, std::memory_order_relaxed);
+#endif /* YAOURT_NO_INSTRUMENTATION */
+    }
+
+    template<typename Elem>
+    static Elem& find_or_add(std::deque<Elem>& elems, const std::string& name)
+    {
+        for (auto& e : elems)
+            if (e.name() == name)
+                return e;
+
+        return elems.emplace_back(name);
+    }
+
+    /* Sorted by name, so that the phases "a.b" are listed under "a" */
+    template<typename Elem>
+    static std::vector<const Elem *> sorted(const std::deque<Elem>& elems)
+    {
+        std::vector<const Elem *> ret;
+        for (auto& e : elems)
+            ret.push_back(&e);
+
+        std::sort(ret.begin(), ret.end(), [](const Elem *a, const Elem *b) {
+            return a->name() < b->name();
+        });
+        return ret;
+    }
+
+    static void write_string(std::ostream& os, const std::string& s)
+    {
+        os << '"';
+        for (auto c : s)
+        {
+            if (c == '"' or c == '\\')
+                os << '\\';
+            os << c;
+        }
+        os << '"';
+    }
+
+public:
+    registry(const registry&) = delete;
+    registry& operator=(const registry&) = delete;
+
+    ~registry()
+    {
+        if (enabled() and not reported)
+            report();
+    }
+
+    static registry& instance()
+    {
+        static registry reg;
+        return reg;
+    }
+
+    static bool enabled()
+    {
+        return enabled_flag.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool en)
+    {
+        enabled_flag.store(en, std::memory_order_relaxed);
+    }
+
+    phase& get_phase(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return find_or_add(phases, name);
+    }
+
+    counter& get_counter(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return find_or_add(counters, name);
+    }
+
+    void set_allocation_source(allocation_source src)
+    {
+        alloc_source = src;
+    }
+
+    bool counts_allocations() const
+    {
+        return alloc_source != nullptr;
+    }
+
+    allocation_count allocations() const
+    {
+        return alloc_source ? alloc_source() : allocation_count{0, 0};
+    }
+
+    /* With more processes each one reports for itself, the number of the
+     * process is appended to the name of the JSON file */
+    void set_process(int rank)
+    {
+        process = rank;
+    }
+
+    double wall_time() const
+    {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    void write_summary(std::ostream& os) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto wt = wall_time();
+        auto flags = os.flags();
+        os << "Instrumentation summary";
+        if (process >= 0)
+            os << ", process " << process;
+        os << ", wall time " << wt << " s" << std::endl;
+
+        os << std::left << std::setw(32) << "phase" << std::right;
+        os << std::setw(10) << "calls" << std::setw(14) << "time [s]";
+        os << std::setw(9) << "% wall" << std::setw(16) << "bytes";
+        if (counts_allocations())
+            os << std::setw(12) << "allocs" << std::setw(16) << "alloc bytes";
+        os << std::endl;
+
+        for (auto ph : sorted(phases))
+        {
+            if (ph->calls() == 0)
+                continue;
+
+            os << std::left << std::setw(32) << ph->name() << std::right;
+            os << std::setw(10) << ph->calls();
+            os << std::setw(14) << std::fixed << std::setprecision(6) << ph->seconds();
+            os << std::setw(8) << std::setprecision(1) << 100.0*ph->seconds()/wt << "%";
+            os << std::setw(16) << ph->bytes();
+            if (counts_allocations())
+            {
+                os << std::setw(12) << ph->allocations();
+                os << std::setw(16) << ph->allocated_bytes();
+            }
+            os << std::endl;
+        }
+
+        for (auto cn : sorted(counters))
+        {
+            if (cn->value() == 0)
+                continue;
+
+            os << std::left << std::setw(32) << cn->name() << std::right;
+            os << std::setw(10) << cn->value() << std::endl;
+        }
+
+        os.flags(flags);
+    }
+
+    void write_json(std::ostream& os) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        os << std::setprecision(9);
+        os << "{\n  \"wall_time\": " << wall_time() << ",\n";
+        os << "  \"allocations_counted\": " << (counts_allocations() ? "true" : "false") << ",\n";
+        os << "  \"phases\": [\n";
+        auto ph_sorted = sorted(phases);
+        for (size_t i = 0; i < ph_sorted.size(); i++)
+        {
+            auto ph = ph_sorted[i];
+            os << "    {\"name\": ";
+            write_string(os, ph->name());
+            os << ", \"calls\": " << ph->calls();
+            os << ", \"time\": " << ph->seconds();
+            os << ", \"bytes\": " << ph->bytes();
+            os << ", \"allocations\": " << ph->allocations();
+            os << ", \"allocated_bytes\": " << ph->allocated_bytes() << "}";
+            os << (i+1 < ph_sorted.size() ? ",\n" : "\n");
+        }
+        os << "  ],\n  \"counters\": [\n";
+        auto cn_sorted = sorted(counters);
+        for (size_t i = 0; i < cn_sorted.size(); i++)
+        {
+            auto cn = cn_sorted[i];
+            os << "    {\"name\": ";
+            write_string(os, cn->name());
+            os << ", \"value\": " << cn->value() << "}";
+            os << (i+1 < cn_sorted.size() ? ",\n" : "\n");
+        }
+        os << "  ]\n}\n";
+    }
+
+    /* Report as configured by YAOURT_INSTRUMENTATION */
+    void report()
+    {
+        reported = true;
+
+        if (json_fn.empty())
+        {
+            write_summary(std::cerr);
+            return;
+        }
+
+        auto filename = json_fn;
+        if (process >= 0)
+            filename.insert(filename.size()-5, "_" + std::to_string(process));
+
+        std::ofstream ofs(filename);
+        if (!ofs.is_open())
+        {
+            std::cerr << "Instrumentation: can't open " << filename << std::endl;
+            return;
+        }
+        write_json(ofs);
+    }
+};
+
+/* Times the scope it is declared in and records it in the phase at the
+ * end. With 'always' the clock is read also when the instrumentation is
+ * disabled, for the callers printing elapsed() themselves. */
+class scoped_timer
+{
+    using clock = std::chrono::steady_clock;
+
+    phase *             ph;
+    bool                running;
+    clock::time_point   start;
+    allocation_count    alloc_start;
+
+public:
+    explicit scoped_timer(phase *p, bool always = false)
+        : ph(registry::enabled() ? p : nullptr), running(ph or always)
+    {
+        if (!running)
+            return;
+
+        if (ph)
+            alloc_start = registry::instance().allocations();
+        start = clock::now();
+    }
+
+    scoped_timer(const scoped_timer&) = delete;
+    scoped_timer& operator=(const scoped_timer&) = delete;
+
+    ~scoped_timer()
+    {
+        stop();
+    }
+
+    /* Seconds since the start, zero if the timer is not running */
+    double elapsed() const
+    {
+        if (!running)
+            return 0.0;
+
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    /* Bytes read or written by the phase */
+    void add_bytes(uint64_t bytes)
+    {
+        if (ph)
+            ph->add_bytes(bytes);
+    }
+
+    /* Record the phase before the end of the scope */
+    void stop()
+    {
+        if (!ph)
+        {
+            running = false;
+            return;
+        }
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        auto alloc_end = registry::instance().allocations();
+        ph->add_call( ns.count(), { alloc_end.count - alloc_start.count,
+                                    alloc_end.bytes - alloc_start.bytes } );
+        ph = nullptr;
+        running = false;
+    }
+};
+
+} // namespace yaourt::instrumentation
+
+#define YAOURT_INSTR_CONCAT_(a, b)  a ## b
+#define YAOURT_INSTR_CONCAT(a, b)   YAOURT_INSTR_CONCAT_(a, b)
+
+#ifndef YAOURT_NO_INSTRUMENTATION
+
+/* The phases and the counters are looked up once per call site */
+#define YAOURT_TIMED_SCOPE_VAR(var, name, always)                           \
+    static auto& YAOURT_INSTR_CONCAT(var, _phase) =                         \
+        yaourt::instrumentation::registry::instance().get_phase(name);      \
+    yaourt::instrumentation::scoped_timer var(&YAOURT_INSTR_CONCAT(var, _phase), always)
+
+#define YAOURT_TIMED_SCOPE(name)                                            \
+    YAOURT_TIMED_SCOPE_VAR(YAOURT_INSTR_CONCAT(yaourt_timer_, __LINE__), name, false)
+
+#define YAOURT_COUNT(name, n)                                               \
+    do {                                                                    \
+        static auto& yaourt_counter_ =                                      \
+            yaourt::instrumentation::registry::instance().get_counter(name);\
+        if ( yaourt::instrumentation::registry::enabled() )                 \
+            yaourt_counter_.add(n);                                         \
+    } while (0)
+
+#else /* YAOURT_NO_INSTRUMENTATION */
+
+#define YAOURT_TIMED_SCOPE_VAR(var, name, always)                           \
+    yaourt::instrumentation::scoped_timer var(nullptr, always)
+
+#define YAOURT_TIMED_SCOPE(name)    do {} while (0)
+#define YAOURT_COUNT(name, n)       do {} while (0)
+
+#endif /* YAOURT_NO_INSTRUMENTATION */
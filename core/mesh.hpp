@@ -24,6 +24,7 @@
 #include <cassert>
 #include <cmath>
 #include <tuple>
+#include <stdexcept>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -31,6 +32,7 @@
 #pragma clang diagnostic pop
 
 #include "point.hpp"
+#include "instrumentation.hpp"
 
 namespace yaourt {
 
@@ -101,6 +103,8 @@ struct edge
 
 struct triangle
 {
+    static const size_t num_faces = 3;
+
     triangle() {}
 
     triangle(size_t ap0, size_t ap1, size_t ap2)
@@ -126,6 +130,8 @@ struct triangle
 
 struct quadrangle
 {
+    static const size_t num_faces = 4;
+
     quadrangle() {}
 
     quadrangle(size_t ap0, size_t ap1, size_t ap2, size_t ap3)
@@ -168,14 +174,61 @@ public:
     std::vector<face_type>      faces;
     std::vector<cell_type>      cells;
 
-    std::vector<std::array<size_t,2>> face_owners;
+    /* Connectivity, filled by compute_connectivity(). face_owners[i] are the
+     * global numbers of the (at most two) cells sharing face i, cell_faces[i]
+     * are the global numbers of the faces of cell i. */
+    std::vector<std::array<size_t,2>>                   face_owners;
+    std::vector<std::array<size_t, CellT::num_faces>>   cell_faces;
+
+    /* Lookup indices, filled by compute_connectivity(): cells[sorted_cells[i]]
+     * and faces[sorted_faces[i]] are increasing in i. offset() searches the
+     * cells and the faces through them, so after compute_connectivity() the
+     * storage order of cells and faces is arbitrary (see reorder_mesh()). */
+    std::vector<size_t>                                 sorted_cells;
+    std::vector<size_t>                                 sorted_faces;
+
+    /* Nonconforming faces, filled by refine_cells() (see core/adaptivity.hpp):
+     * each entry is a pair {coarse, fine}, where the face 'fine' of a cell
+     * lies on the face 'coarse' of a larger cell. These faces have only one
+     * owner in face_owners, but they are not on the boundary. */
+    std::vector<std::array<size_t,2>>                   hanging_faces;
 
     mesh()
     {}
 
+    void compute_lookup()
+    {
+        auto make_index = [](const auto& elems, std::vector<size_t>& index) {
+            index.resize( elems.size() );
+            for (size_t i = 0; i < index.size(); i++)
+                index[i] = i;
+
+            std::sort(index.begin(), index.end(), [&](size_t a, size_t b) {
+                return elems[a] < elems[b];
+            });
+        };
+
+        make_index(cells, sorted_cells);
+        make_index(faces, sorted_faces);
+    }
+
+    /* True if face_owners and cell_faces match the size of the mesh. The
+     * meshers keep them up to date, after any other change to the cells
+     * or the faces compute_connectivity() must be called again. */
+    bool has_connectivity() const
+    {
+        return face_owners.size() == faces.size() and
+               cell_faces.size() == cells.size();
+    }
+
     void compute_connectivity()
     {
+        YAOURT_TIMED_SCOPE("mesh.connectivity");
+
+        compute_lookup();
+
         face_owners.resize( faces.size() );
+        cell_faces.resize( cells.size() );
 
         for (auto& fo : face_owners)
         {
@@ -187,6 +240,7 @@ public:
         for (auto& cl : cells)
         {
             auto fcids = face_ids(*this, cl);
+            cell_faces.at(cell_id) = fcids;
 
             for (auto& fcid : fcids)
             {
@@ -220,6 +274,8 @@ public:
     std::vector<cell_type>      cells;
 
     std::vector<std::array<size_t,2>> face_owners;
+    std::vector<size_t>               sorted_cells;
+    std::vector<size_t>               sorted_faces;
 
     mesh()
     {}
@@ -271,16 +327,45 @@ neighbour_via(const Mesh& msh,
     return std::make_tuple(msh.cells.at(fo[1]), true);
 }
 
+namespace priv {
+
+/* Binary search of 'elem' in 'elems'. If the lookup index is valid the
+ * search goes through it, otherwise 'elems' must be sorted (this is the
+ * case for the meshes just generated by the meshers). */
+template<typename Elem>
+size_t
+find_element(const std::vector<Elem>& elems, const std::vector<size_t>& index,
+             const Elem& elem)
+{
+    if (index.size() != elems.size())
+    {
+        auto itor = std::lower_bound(elems.begin(), elems.end(), elem);
+        if (itor == elems.end())
+            return elems.size();
+
+        return size_t(std::distance(elems.begin(), itor));
+    }
+
+    auto itor = std::lower_bound(index.begin(), index.end(), elem,
+        [&](size_t i, const Elem& e) { return elems[i] < e; });
+    if (itor == index.end())
+        return elems.size();
+
+    return *itor;
+}
+
+} //namespace priv
+
 /* Return the global number of a given cell */
 template<typename Mesh>
 size_t
 offset(const Mesh& msh, const typename Mesh::cell_type& cl)
 {
-    auto itor = std::lower_bound(msh.cells.begin(), msh.cells.end(), cl);
-    if (itor == msh.cells.end())
+    auto ofs = priv::find_element(msh.cells, msh.sorted_cells, cl);
+    if (ofs == msh.cells.size())
         throw std::invalid_argument("Mesh cell not found");
 
-    return std::distance(msh.cells.begin(), itor);
+    return ofs;
 }
 
 /* Return the global number of a given face */
@@ -288,11 +373,11 @@ template<typename Mesh>
 size_t
 offset(const Mesh& msh, const typename Mesh::face_type& fc)
 {
-    auto itor = std::lower_bound(msh.faces.begin(), msh.faces.end(), fc);
-    if (itor == msh.faces.end())
+    auto ofs = priv::find_element(msh.faces, msh.sorted_faces, fc);
+    if (ofs == msh.faces.size())
         throw std::invalid_argument("Mesh face not found");
 
-    return size_t(std::distance(msh.faces.begin(), itor));
+    return ofs;
 }
 
 /* Return all the faces of a cell, simplicial case */
@@ -352,6 +437,77 @@ face_ids(const quad_mesh<T>& msh, const typename quad_mesh<T>::cell_type& cell)
     return ret;
 }
 
+/* Index-based connectivity queries. All of them require the connectivity
+ * computed by compute_connectivity() and run in constant time, so they
+ * should be preferred to the cell/face based ones in the inner loops. */
+
+/* Return the global numbers of the faces of the cell 'cl_id'. The faces
+ * are in the same order as the ones returned by faces(msh, cl). */
+template<typename Mesh>
+const auto&
+face_ids(const Mesh& msh, size_t cl_id)
+{
+    if ( msh.cell_faces.size() != msh.cells.size() )
+        throw std::logic_error("No connectivity information.");
+
+    assert(cl_id < msh.cell_faces.size());
+    return msh.cell_faces[cl_id];
+}
+
+/* Return all the faces of the cell 'cl_id' */
+template<typename Mesh>
+auto
+faces(const Mesh& msh, size_t cl_id)
+{
+    using face_type = typename Mesh::face_type;
+    using cell_type = typename Mesh::cell_type;
+
+    const auto& fcids = face_ids(msh, cl_id);
+
+    std::array<face_type, cell_type::num_faces> ret;
+    for (size_t i = 0; i < cell_type::num_faces; i++)
+        ret[i] = msh.faces[ fcids[i] ];
+
+    return ret;
+}
+
+/* Ask for the neighbour of the cell 'cl_id' via its face 'fc_id'. Returns
+ * a pair, second element is true if the neighbour exists, first element
+ * is the global number of the neighbour (0 if the neighbour does not
+ * exist, as in the cell based version). */
+template<typename Mesh>
+std::tuple<size_t, bool>
+neighbour_via(const Mesh& msh, size_t cl_id, size_t fc_id)
+{
+    if ( msh.face_owners.size() != msh.faces.size() )
+        throw std::logic_error("No neighbour information.");
+
+    assert(fc_id < msh.face_owners.size());
+    const auto& fo = msh.face_owners[fc_id];
+
+    assert(fo[0] == cl_id or fo[1] == cl_id);
+
+    auto neigh = (fo[0] == cl_id) ? fo[1] : fo[0];
+    if (neigh == NO_OWNER)
+        return std::make_tuple(0, false);
+
+    return std::make_tuple(neigh, true);
+}
+
+/* Return the local number (position in face_ids(msh, cl_id)) of the face
+ * 'fc_id' in the cell 'cl_id' */
+template<typename Mesh>
+size_t
+offset(const Mesh& msh, size_t cl_id, size_t fc_id)
+{
+    const auto& fcids = face_ids(msh, cl_id);
+    auto itor = std::find(fcids.begin(), fcids.end(), fc_id);
+    if (itor == fcids.end())
+        throw std::invalid_argument("Face does not belong to the cell");
+
+    return std::distance(fcids.begin(), itor);
+}
+
 /* Return the points of a face, simplicial case */
 template<typename T>
 std::array<point<T,2>, 2>
@@ -0,0 +1,533 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+#include "checkpoint.hpp"
+#include "parallel.hpp"
+#include "instrumentation.hpp"
+
+/* Mesh import and export. load_gmsh() reads the 2D meshes written by Gmsh
+ * in the MSH 4.1 format, ASCII or binary, the binary dump written by
+ * save_binary_mesh() stores a mesh with its connectivity so it can be loaded
+ * back without any processing. */
+
+namespace yaourt {
+
+namespace priv {
+
+/* The Gmsh element types that can be found in a 2D mesh and the number
+ * of nodes of each one */
+inline size_t
+gmsh_element_nodes(int type)
+{
+    switch (type)
+    {
+        case 1:  return 2;      /* 2-node line */
+        case 2:  return 3;      /* 3-node triangle */
+        case 3:  return 4;      /* 4-node quadrangle */
+        case 8:  return 3;      /* 3-node line */
+        case 9:  return 6;      /* 6-node triangle */
+        case 10: return 9;      /* 9-node quadrangle */
+        case 15: return 1;      /* 1-node point */
+        case 16: return 8;      /* 8-node quadrangle */
+        case 26: return 4;      /* 4-node line */
+        case 21: return 10;     /* 10-node triangle */
+        default:
+            throw std::runtime_error("gmsh: unsupported element type " + std::to_string(type));
+    }
+}
+
+template<typename CellT>
+struct gmsh_cell_type;
+
+template<>
+struct gmsh_cell_type<triangle> { static const int value = 2; };
+
+template<>
+struct gmsh_cell_type<quadrangle> { static const int value = 3; };
+
+/* The sections of a MSH file are text lines, their content is text in
+ * ASCII files and raw values in binary files. The arrays are read with a
+ * single call in binary files. */
+class gmsh_stream
+{
+    std::ifstream   ifs;
+    std::string     filename;
+    bool            binary;
+
+public:
+    gmsh_stream(const std::string& fn)
+        : ifs(fn, std::ios::binary), filename(fn), binary(false)
+    {
+        if (!ifs)
+            throw std::runtime_error("gmsh: can't open " + filename);
+    }
+
+    void set_binary(bool b) { binary = b; }
+
+    bool next_line(std::string& line)
+    {
+        if ( !std::getline(ifs, line) )
+            return false;
+        if ( !line.empty() and line.back() == '\r' )
+            line.pop_back();
+        return true;
+    }
+
+    void check() const
+    {
+        if (!ifs)
+            throw std::runtime_error("gmsh: error reading " + filename);
+    }
+
+    template<typename V>
+    V get()
+    {
+        V ret;
+        if (binary)
+            ifs.read(reinterpret_cast<char *>(&ret), sizeof(V));
+        else
+            ifs >> ret;
+        check();
+        return ret;
+    }
+
+    template<typename V>
+    void get(std::vector<V>& v, size_t n)
+    {
+        v.resize(n);
+        if (binary)
+            ifs.read(reinterpret_cast<char *>(v.data()), n*sizeof(V));
+        else
+            for (auto& x : v)
+                ifs >> x;
+        check();
+    }
+
+    /* Skip the rest of the current section, up to its end marker */
+    void end_section(const std::string& name, bool skip_content = false)
+    {
+        std::string line;
+        while ( next_line(line) )
+        {
+            if (line == "$End" + name)
+                return;
+            if ( !skip_content and line.find_first_not_of(" \t") != std::string::npos )
+                break;
+        }
+        throw std::runtime_error("gmsh: missing $End" + name + " in " + filename);
+    }
+};
+
+/* Faces of the cells, as the pair of their points. The order of the faces
+ * of a cell is the one of face_ids(). */
+struct face_record
+{
+    size_t  p0, p1, cell, local;
+
+    friend bool operator<(const face_record& a, const face_record& b) {
+        if (a.p0 != b.p0) return a.p0 < b.p0;
+        if (a.p1 != b.p1) return a.p1 < b.p1;
+        return a.cell < b.cell;
+    }
+};
+
+/* Build the faces and the connectivity of a mesh with only points and
+ * cells. The faces of all the cells are sorted in parallel, then the
+ * equal ones are merged, so no searching is needed. 'boundary' gives the
+ * boundary ids: a sorted list of {p0, p1, id} with p0 < p1, the faces of
+ * the boundary not in the list get the id 0. */
+template<typename Mesh>
+void
+build_faces(Mesh& msh, const std::vector<std::array<size_t,3>>& boundary,
+            size_t num_threads)
+{
+    using cell_type = typename Mesh::cell_type;
+    using face_type = typename Mesh::face_type;
+    const size_t nf = cell_type::num_faces;
+
+    std::vector<face_record> recs(nf * msh.cells.size());
+    parallel_for_chunks(msh.cells.size(), num_threads,
+        [&](size_t, size_t begin, size_t end) {
+            for (size_t cl_id = begin; cl_id < end; cl_id++)
+            {
+                auto& p = msh.cells[cl_id].p;
+                for (size_t i = 0; i < nf; i++)
+                {
+                    auto a = (i < nf-1) ? p[i] : p[0];
+                    auto b = (i < nf-1) ? p[i+1] : p[nf-1];
+                    recs[nf*cl_id + i] = { std::min(a,b), std::max(a,b), cl_id, i };
+                }
+            }
+        });
+
+    parallel_sort(recs.begin(), recs.end(), num_threads, std::less<face_record>());
+
+    msh.faces.clear();
+    msh.face_owners.clear();
+    msh.cell_faces.resize( msh.cells.size() );
+    msh.hanging_faces.clear();
+
+    for (size_t i = 0; i < recs.size(); )
+    {
+        size_t j = i+1;
+        while (j < recs.size() and recs[j].p0 == recs[i].p0 and recs[j].p1 == recs[i].p1)
+            j++;
+
+        if (recs[i].p0 == recs[i].p1)
+            throw std::runtime_error("mesh: degenerate cell");
+        if (j - i > 2)
+            throw std::runtime_error("mesh: a face has more than two owners");
+
+        auto fc_id = msh.faces.size();
+        std::array<size_t,2> owners{{ recs[i].cell, NO_OWNER }};
+        if (j - i == 2)
+        {
+            owners[1] = recs[i+1].cell;
+            msh.faces.push_back( face_type(recs[i].p0, recs[i].p1, 0, false) );
+        }
+        else
+        {
+            std::array<size_t,3> key{{ recs[i].p0, recs[i].p1, 0 }};
+            auto itor = std::lower_bound(boundary.begin(), boundary.end(), key);
+            size_t bid = 0;
+            if (itor != boundary.end() and (*itor)[0] == key[0] and (*itor)[1] == key[1])
+                bid = (*itor)[2];
+            msh.faces.push_back( face_type(recs[i].p0, recs[i].p1, bid, true) );
+        }
+        msh.face_owners.push_back(owners);
+
+        for (size_t k = i; k < j; k++)
+            msh.cell_faces[ recs[k].cell ][ recs[k].local ] = fc_id;
+
+        i = j;
+    }
+
+    /* Indices for offset(), the faces are already sorted */
+    msh.compute_lookup();
+}
+
+} // namespace priv
+
+/* Read a 2D mesh in the Gmsh MSH 4.1 format, ASCII or binary. The cells
+ * are the elements of the mesh type (3-node triangles or 4-node
+ * quadrangles), the other 2D elements are not accepted, the 0D and 1D
+ * elements are ignored except for the boundary ids. The boundary id of a
+ * face is the first physical tag of the curve of the line element on it,
+ * or the tag of the curve if it has no physical tags, 0 if there is no
+ * line element on the face. The high order lines (3 and 4 nodes) are
+ * accepted, only their end points are used. The points not used by the cells are dropped
+ * and the cells are given the counterclockwise orientation. The faces are
+ * built with 'num_threads' threads and the connectivity is computed. */
+template<typename Mesh>
+void
+load_gmsh(const std::string& filename, Mesh& msh, size_t num_threads = 1)
+{
+    using T = typename Mesh::coordinate_type;
+    using cell_type = typename Mesh::cell_type;
+    const size_t nf = cell_type::num_faces;
+    const int cell_gmsh_type = priv::gmsh_cell_type<cell_type>::value;
+
+    priv::gmsh_stream gs(filename);
+
+    bool has_format = false;
+    std::map<int, size_t> curve_physical;
+
+    size_t min_node_tag = 0;
+    std::vector<size_t> node_index;             /* Node tag to coords */
+    std::vector<double> coords;
+
+    std::vector<size_t> cell_nodes;             /* Node tags, nf per cell */
+    std::vector<size_t> line_nodes, line_ids;   /* Node tags of the lines */
+
+    std::string line;
+    while ( gs.next_line(line) )
+    {
+        if ( line.empty() )
+            continue;
+        if ( line[0] != '$' )
+            throw std::runtime_error("gmsh: unexpected line '" + line + "' in " + filename);
+
+        auto section = line.substr(1);
+
+        if (section == "MeshFormat")
+        {
+            gs.next_line(line);
+            std::istringstream iss(line);
+            double version;
+            int file_type, data_size;
+            iss >> version >> file_type >> data_size;
+            if (!iss or version < 4.1 or version >= 5)
+                throw std::runtime_error("gmsh: " + filename + " is not in MSH 4.1 format");
+            if (file_type == 1 and data_size != sizeof(uint64_t))
+                throw std::runtime_error("gmsh: unsupported size_t size in " + filename);
+
+            gs.set_binary(file_type == 1);
+            if (file_type == 1 and gs.get<int32_t>() != 1)
+                throw std::runtime_error("gmsh: " + filename + " has a different byte order");
+
+            gs.end_section(section);
+            has_format = true;
+            continue;
+        }
+
+        if (!has_format)
+            throw std::runtime_error("gmsh: no $MeshFormat in " + filename);
+
+        if (section == "Entities")
+        {
+            auto num_points = gs.get<uint64_t>();
+            auto num_curves = gs.get<uint64_t>();
+            auto num_surfaces = gs.get<uint64_t>();
+            auto num_volumes = gs.get<uint64_t>();
+
+            std::vector<double> box;
+            std::vector<int32_t> tags;
+            for (size_t i = 0; i < num_points; i++)
+            {
+                gs.get<int32_t>();
+                gs.get(box, 3);
+                gs.get(tags, gs.get<uint64_t>());
+            }
+
+            for (size_t dim = 1; dim <= 3; dim++)
+            {
+                auto num = (dim == 1) ? num_curves : (dim == 2) ? num_surfaces : num_volumes;
+                for (size_t i = 0; i < num; i++)
+                {
+                    auto tag = gs.get<int32_t>();
+                    gs.get(box, 6);
+                    gs.get(tags, gs.get<uint64_t>());
+                    if (dim == 1 and !tags.empty())
+                        curve_physical[tag] = std::abs(tags[0]);
+                    gs.get(tags, gs.get<uint64_t>());
+                }
+            }
+
+            gs.end_section(section);
+            continue;
+        }
+
+        if (section == "Nodes")
+        {
+            auto num_blocks = gs.get<uint64_t>();
+            auto num_nodes = gs.get<uint64_t>();
+            min_node_tag = gs.get<uint64_t>();
+            auto max_node_tag = gs.get<uint64_t>();
+
+            if (num_nodes > 0 and max_node_tag < min_node_tag)
+                throw std::runtime_error("gmsh: invalid node tags in " + filename);
+
+            node_index.assign(num_nodes > 0 ? max_node_tag - min_node_tag + 1 : 0, NO_OWNER);
+            coords.clear();
+            coords.reserve(2*num_nodes);
+
+            std::vector<uint64_t> tags;
+            std::vector<double> xyz;
+            for (size_t b = 0; b < num_blocks; b++)
+            {
+                auto entity_dim = gs.get<int32_t>();
+                gs.get<int32_t>();
+                auto parametric = gs.get<int32_t>();
+                auto n = gs.get<uint64_t>();
+
+                gs.get(tags, n);
+                size_t stride = 3 + (parametric ? entity_dim : 0);
+                gs.get(xyz, stride*n);
+
+                for (size_t i = 0; i < n; i++)
+                {
+                    if (tags[i] < min_node_tag or tags[i] > max_node_tag)
+                        throw std::runtime_error("gmsh: invalid node tag in " + filename);
+                    node_index[ tags[i] - min_node_tag ] = coords.size()/2;
+                    coords.push_back( xyz[stride*i] );
+                    coords.push_back( xyz[stride*i+1] );
+                }
+            }
+
+            gs.end_section(section);
+            continue;
+        }
+
+        if (section == "Elements")
+        {
+            auto num_blocks = gs.get<uint64_t>();
+            auto num_elements = gs.get<uint64_t>();
+            gs.get<uint64_t>();
+            gs.get<uint64_t>();
+
+            cell_nodes.reserve(nf*num_elements);
+
+            std::vector<uint64_t> data;
+            for (size_t b = 0; b < num_blocks; b++)
+            {
+                auto entity_dim = gs.get<int32_t>();
+                auto entity_tag = gs.get<int32_t>();
+                auto type = gs.get<int32_t>();
+                auto n = gs.get<uint64_t>();
+
+                auto nn = priv::gmsh_element_nodes(type);
+                gs.get(data, (nn+1)*n);
+
+                if (type == 1 or type == 8 or type == 26)
+                {
+                    /* The end points come first also in the high order
+                     * lines, the other nodes are not used */
+                    auto itor = curve_physical.find(entity_tag);
+                    size_t bid = (itor != curve_physical.end()) ? itor->second :
+                                                                  std::abs(entity_tag);
+                    for (size_t i = 0; i < n; i++)
+                    {
+                        line_nodes.push_back( data[(nn+1)*i+1] );
+                        line_nodes.push_back( data[(nn+1)*i+2] );
+                        line_ids.push_back(bid);
+                    }
+                }
+                else if (type == cell_gmsh_type)
+                {
+                    for (size_t i = 0; i < n; i++)
+                        for (size_t k = 0; k < nf; k++)
+                            cell_nodes.push_back( data[(nf+1)*i + k + 1] );
+                }
+                else if (entity_dim == 2)
+                    throw std::runtime_error("gmsh: elements of type " + std::to_string(type) +
+                                             " can't be stored in this mesh");
+                else if (entity_dim == 3)
+                    throw std::runtime_error("gmsh: " + filename + " is a 3D mesh");
+            }
+
+            gs.end_section(section);
+            continue;
+        }
+
+        gs.end_section(section, true);
+    }
+
+    if (!has_format)
+        throw std::runtime_error("gmsh: " + filename + " is not a MSH file");
+
+    /* Point numbers of the nodes used by the cells, in the order of the
+     * file */
+    const size_t UNUSED = NO_OWNER;
+    auto node = [&](size_t tag) -> size_t& {
+        if (tag < min_node_tag or tag - min_node_tag >= node_index.size() or
+            node_index[tag - min_node_tag] == NO_OWNER)
+            throw std::runtime_error("gmsh: element with an unknown node in " + filename);
+        return node_index[tag - min_node_tag];
+    };
+
+    std::vector<size_t> point_of(coords.size()/2, UNUSED);
+    msh.points.clear();
+    msh.cells.clear();
+    msh.cells.reserve(cell_nodes.size()/nf);
+
+    for (size_t i = 0; i < cell_nodes.size(); i += nf)
+    {
+        cell_type cl;
+        for (size_t k = 0; k < nf; k++)
+        {
+            auto c = node(cell_nodes[i+k]);
+            if (point_of[c] == UNUSED)
+            {
+                point_of[c] = msh.points.size();
+                msh.points.push_back( typename Mesh::point_type({T(coords[2*c]),
+                                                                 T(coords[2*c+1])}) );
+            }
+            cl.p[k] = point_of[c];
+        }
+
+        /* Shoelace formula, the clockwise cells are reversed */
+        T area = 0;
+        for (size_t k = 0; k < nf; k++)
+        {
+            auto& a = msh.points[ cl.p[k] ];
+            auto& b = msh.points[ cl.p[(k+1)%nf] ];
+            area += a.x()*b.y() - a.y()*b.x();
+        }
+        if (area < T(0))
+            std::reverse(cl.p.begin()+1, cl.p.end());
+
+        msh.cells.push_back(cl);
+    }
+
+    std::vector<std::array<size_t,3>> boundary;
+    boundary.reserve( line_ids.size() );
+    for (size_t i = 0; i < line_ids.size(); i++)
+    {
+        auto a = node(line_nodes[2*i]);
+        auto b = node(line_nodes[2*i+1]);
+        if (point_of[a] == UNUSED or point_of[b] == UNUSED)
+            continue;
+        a = point_of[a];
+        b = point_of[b];
+        boundary.push_back( {{ std::min(a,b), std::max(a,b), line_ids[i] }} );
+    }
+    std::sort(boundary.begin(), boundary.end());
+
+    priv::build_faces(msh, boundary, num_threads);
+}
+
+/* Native binary format: the sections of core/checkpoint.hpp written by
+ * write_mesh(). The file is mapped in memory and copied to the mesh. */
+template<typename Mesh>
+void
+save_binary_mesh(const std::string& filename, const Mesh& msh)
+{
+    YAOURT_TIMED_SCOPE("io.mesh.save");
+    checkpoint::writer w(filename);
+    checkpoint::write_mesh(w, msh);
+    w.close();
+}
+
+template<typename Mesh>
+void
+load_binary_mesh(const std::string& filename, Mesh& msh)
+{
+    checkpoint::reader r(filename);
+    checkpoint::read_mesh(r, msh);
+}
+
+/* Load a mesh: Gmsh if the name ends in ".msh", native binary otherwise */
+template<typename Mesh>
+void
+load_mesh(const std::string& filename, Mesh& msh, size_t num_threads = 1)
+{
+    YAOURT_TIMED_SCOPE("io.mesh.load");
+
+    const std::string ext = ".msh";
+    if (filename.size() >= ext.size() and
+        filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0)
+        load_gmsh(filename, msh, num_threads);
+    else
+        load_binary_mesh(filename, msh);
+}
+
+} // namespace yaourt
@@ -20,6 +20,7 @@
 #pragma once
 
 #include "mesh.hpp"
+#include "parallel.hpp"
 
 namespace yaourt {
 
@@ -36,95 +37,138 @@ class mesher<simplicial_mesh<T>>
 	using point_type = typename mesh_type::point_type;
 
 	bool 					verbose;
+	size_t					num_threads;
+
+	/* Storage of the next refinement level, reused across the levels */
 	std::vector<cell_type> 	new_cells;
+	std::vector<face_type>	new_faces;
+	decltype(mesh_type::face_owners)	new_face_owners;
+	decltype(mesh_type::cell_faces)		new_cell_faces;
 
 	void
 	refine_mesh(mesh_type& msh)
 	{
-		new_cells.clear();
-
-		 /* break all the faces */
-        for (auto& e : msh.faces)
-        {
-        	assert(e.p0 < msh.points.size());
-        	assert(e.p1 < msh.points.size());
-            assert(!e.is_broken);
-            auto bar = (msh.points[e.p0] + msh.points[e.p1])/T(2);
-            e.pb = msh.points.size();
-            msh.points.push_back(bar);
-            e.is_broken = true;
-        }
-
-        /* refine the triangles */
-        size_t triangles_to_process = msh.cells.size();
-        msh.faces.reserve( msh.faces.size() + triangles_to_process*12 );
-        auto faces_end = msh.faces.end();
-        for (size_t i = 0; i < triangles_to_process; i++)
-        {
-            triangle t = msh.cells[i];
-            auto pts = t.point_ids();
-
-            auto p0 = pts[0];
-            auto p1 = pts[1];
-            auto p2 = pts[2];
-
-            /* find the faces of the triangle */
-            auto t_e0 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p0, p1));
-            assert(t_e0.is_broken);
-
-            auto t_e1 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p1, p2));
-            assert(t_e1.is_broken);
-
-            auto t_e2 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p0, p2));
-            assert(t_e2.is_broken);
-
-            auto p0b = t_e0.pb;
-            auto p1b = t_e1.pb;
-            auto p2b = t_e2.pb;
-
-            /* compute the faces of the new four triangles */
-            /* first triangle */
-            msh.faces.push_back( face_type(p0, p0b, t_e0.boundary_id, t_e0.is_boundary) );
-            msh.faces.push_back( face_type(p0b, p2b, false) );
-            msh.faces.push_back( face_type(p0, p2b, t_e2.boundary_id, t_e2.is_boundary) );
-            triangle t0(p0, p0b, p2b);
-            new_cells.push_back(t0);
-
-            /* second triangle */
-            msh.faces.push_back( face_type(p0b, p1, t_e0.boundary_id, t_e0.is_boundary) );
-            msh.faces.push_back( face_type(p0b, p1b, false) );
-            msh.faces.push_back( face_type(p1, p1b, t_e1.boundary_id, t_e1.is_boundary) );
-            triangle t1(p0b, p1, p1b);
-            new_cells.push_back(t1);
-
-            /* third triangle */
-            msh.faces.push_back( face_type(p1b, p2, t_e1.boundary_id, t_e1.is_boundary) );
-            msh.faces.push_back( face_type(p2b, p1b, false) );
-            msh.faces.push_back( face_type(p2, p2b, t_e2.boundary_id, t_e2.is_boundary) );
-            triangle t2(p1b, p2, p2b);
-            new_cells.push_back(t2);
-
-            /* fourth triangle */
-            triangle t3(p0b, p1b, p2b);
-            new_cells.push_back(t3);
-        }
-
-        /* we don't need the broken faces anymore, discard them */
-        auto face_is_broken = [](const face_type& f) -> bool { return f.is_broken; };
-        std::remove_if(msh.faces.begin(), msh.faces.end(), face_is_broken);
-
-        /* sort the faces to allow fast lookups */
-        priv::sort_uniq(msh.faces);
-        std::swap(msh.cells, new_cells);
+		/* Each face f is split in the faces 2f and 2f+1, the first one
+		 * containing the point with the lowest number. Each triangle c
+		 * is split in the triangles 4c, ..., 4c+3 and its three internal
+		 * faces are 2F+3c, ..., 2F+3c+2. The midpoint of the face f is
+		 * the point Np+f. All the numbers are known in advance, so the
+		 * faces and the cells are processed independently. */
+		const size_t num_points = msh.points.size();
+		const size_t num_faces = msh.faces.size();
+		const size_t num_cells = msh.cells.size();
+
+		msh.points.resize( num_points + num_faces );
+		new_faces.resize( 2*num_faces + 3*num_cells );
+		new_cells.resize( 4*num_cells );
+		new_face_owners.resize( new_faces.size() );
+		new_cell_faces.resize( new_cells.size() );
+
+		/* break all the faces */
+		parallel_for_chunks(num_faces, num_threads,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t fc_id = begin; fc_id < end; fc_id++)
+				{
+					const auto& e = msh.faces[fc_id];
+					assert(e.p0 < num_points);
+					assert(e.p1 < num_points);
+					auto pb = num_points + fc_id;
+					msh.points[pb] = (msh.points[e.p0] + msh.points[e.p1])/T(2);
+					new_faces[2*fc_id]   = face_type(e.p0, pb, e.boundary_id, e.is_boundary);
+					new_faces[2*fc_id+1] = face_type(pb, e.p1, e.boundary_id, e.is_boundary);
+					new_face_owners[2*fc_id]   = {{ NO_OWNER, NO_OWNER }};
+					new_face_owners[2*fc_id+1] = {{ NO_OWNER, NO_OWNER }};
+				}
+			});
+
+		/* refine the triangles */
+		parallel_for_chunks(num_cells, num_threads,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t cl_id = begin; cl_id < end; cl_id++)
+					refine_cell(msh, cl_id);
+			});
+
+		std::swap(msh.faces, new_faces);
+		std::swap(msh.cells, new_cells);
+		std::swap(msh.face_owners, new_face_owners);
+		std::swap(msh.cell_faces, new_cell_faces);
+	}
+
+	void
+	refine_cell(mesh_type& msh, size_t cl_id)
+	{
+		const size_t num_points = msh.points.size() - msh.faces.size();
+		const size_t num_faces = msh.faces.size();
+
+		auto pts = msh.cells[cl_id].point_ids();
+		auto p0 = pts[0];
+		auto p1 = pts[1];
+		auto p2 = pts[2];
+
+		/* the faces of the triangle */
+		const auto& fcids = msh.cell_faces[cl_id];
+		auto e0 = fcids[0];
+		auto e1 = fcids[1];
+		auto e2 = fcids[2];
+
+		auto p0b = num_points + e0;
+		auto p1b = num_points + e1;
+		auto p2b = num_points + e2;
+
+		/* child of face 'fc_id' containing the point 'pt', and the slot
+		 * of this cell in the owners of 'fc_id' */
+		auto half = [&](size_t fc_id, size_t pt) {
+			return 2*fc_id + (msh.faces[fc_id].p0 == pt ? 0 : 1);
+		};
+		auto own = [&](size_t fc_id, size_t pt, size_t child) {
+			auto slot = (msh.face_owners[fc_id][0] == cl_id) ? 0 : 1;
+			new_face_owners[ half(fc_id, pt) ][slot] = child;
+		};
+
+		/* the internal faces */
+		auto i0 = 2*num_faces + 3*cl_id;
+		auto i1 = i0 + 1;
+		auto i2 = i0 + 2;
+		new_faces[i0] = face_type(p0b, p2b, false);
+		new_faces[i1] = face_type(p0b, p1b, false);
+		new_faces[i2] = face_type(p2b, p1b, false);
+
+		auto c0 = 4*cl_id;
+		auto c1 = c0 + 1;
+		auto c2 = c0 + 2;
+		auto c3 = c0 + 3;
+		new_face_owners[i0] = {{ c0, c3 }};
+		new_face_owners[i1] = {{ c1, c3 }};
+		new_face_owners[i2] = {{ c2, c3 }};
+
+		/* the new four triangles, with their faces in the order given
+		 * by face_ids() */
+		new_cells[c0] = triangle(p0, p0b, p2b);
+		new_cell_faces[c0] = {{ half(e0, p0), i0, half(e2, p0) }};
+		own(e0, p0, c0);
+		own(e2, p0, c0);
+
+		new_cells[c1] = triangle(p0b, p1, p1b);
+		new_cell_faces[c1] = {{ half(e0, p1), half(e1, p1), i1 }};
+		own(e0, p1, c1);
+		own(e1, p1, c1);
+
+		new_cells[c2] = triangle(p1b, p2, p2b);
+		new_cell_faces[c2] = {{ half(e1, p2), half(e2, p2), i2 }};
+		own(e1, p2, c2);
+		own(e2, p2, c2);
+
+		new_cells[c3] = triangle(p0b, p1b, p2b);
+		new_cell_faces[c3] = {{ i1, i2, i0 }};
 	}
 
 public:
 	mesher()
-		: verbose(false)
+		: verbose(false), num_threads(1)
 	{}
 
-	mesher(bool vrb)
-		: verbose(vrb)
+	mesher(bool vrb, size_t nthreads = 1)
+		: verbose(vrb), num_threads( std::max<size_t>(nthreads, 1) )
 	{}
 
 	void
@@ -163,6 +207,16 @@ public:
 	void
 	refine_mesh(mesh_type& msh, size_t refinement_iterations)
 	{
+		YAOURT_TIMED_SCOPE("mesh.refine");
+
+		if ( !msh.hanging_faces.empty() )
+			throw std::logic_error("Uniform refinement of a nonconforming mesh");
+
+		/* The refinement works on the connectivity, which is then kept
+		 * up to date level by level */
+		if ( !msh.has_connectivity() )
+			msh.compute_connectivity();
+
 		for (size_t i = 0; i < refinement_iterations; i++)
 		{
 			refine_mesh(msh);
@@ -175,7 +229,7 @@ public:
 			}
 		}
 
-		std::sort(msh.cells.begin(), msh.cells.end());
+		msh.compute_lookup();
 	}
 
 
@@ -193,110 +247,152 @@ class mesher<quad_mesh<T>>
 	using point_type = typename mesh_type::point_type;
 
 	bool 					verbose;
+	size_t					num_threads;
+
+	/* Storage of the next refinement level, reused across the levels */
 	std::vector<cell_type> 	new_cells;
+	std::vector<face_type>	new_faces;
+	decltype(mesh_type::face_owners)	new_face_owners;
+	decltype(mesh_type::cell_faces)		new_cell_faces;
 
 	void
 	refine_mesh(mesh_type& msh)
 	{
-		new_cells.clear();
-
-		 /* break all the faces */
-        for (auto& e : msh.faces)
-        {
-        	assert(e.p0 < msh.points.size());
-        	assert(e.p1 < msh.points.size());
-            assert(!e.is_broken);
-            auto bar = (msh.points[e.p0] + msh.points[e.p1])/T(2);
-            e.pb = msh.points.size();
-            msh.points.push_back(bar);
-            e.is_broken = true;
-        }
-
-        /* refine the quads */
-        size_t quadrangles_to_process = msh.cells.size();
-        msh.faces.reserve( msh.faces.size() + quadrangles_to_process*16 );
-        auto faces_end = msh.faces.end();
-        for (size_t i = 0; i < quadrangles_to_process; i++)
-        {
-            quadrangle q = msh.cells[i];
-            auto pts = q.point_ids();
-
-            auto p0 = pts[0];
-            auto p1 = pts[1];
-            auto p2 = pts[2];
-            auto p3 = pts[3];
-
-            /* find the faces of the quadrangle */
-            auto q_e0 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p0, p1));
-            assert(q_e0.is_broken);
-
-            auto q_e1 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p1, p2));
-            assert(q_e1.is_broken);
-
-            auto q_e2 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p2, p3));
-            assert(q_e2.is_broken);
-
-            auto q_e3 = *std::lower_bound(msh.faces.begin(), faces_end, face_type(p0, p3));
-            assert(q_e3.is_broken);
-
-            auto p0b = q_e0.pb;
-            auto p1b = q_e1.pb;
-            auto p2b = q_e2.pb;
-            auto p3b = q_e3.pb;
-            auto bar = msh.points.size();
-            auto bar_pt = barycenter(msh, q);
-            msh.points.push_back(bar_pt);
-
-            /* compute the faces of the new four quadrangles */
-            /* first quadrangle */
-            msh.faces.push_back( face_type(p0,  p0b, q_e0.boundary_id, q_e0.is_boundary) );
-            msh.faces.push_back( face_type(p0b, bar, false) );
-            msh.faces.push_back( face_type(p3b, bar, false) );
-            msh.faces.push_back( face_type(p0,  p3b, q_e3.boundary_id, q_e3.is_boundary) );
-            quadrangle q0(p0, p0b, bar, p3b);
-            new_cells.push_back(q0);
-
-            /* second triangle */
-            msh.faces.push_back( face_type(p0b, p1,  q_e0.boundary_id, q_e0.is_boundary) );
-            msh.faces.push_back( face_type(p1,  p1b, q_e1.boundary_id, q_e1.is_boundary) );
-            msh.faces.push_back( face_type(p1b, bar, false) );
-            msh.faces.push_back( face_type(p0b, bar, false) );
-            quadrangle q1(p0b, p1, p1b, bar);
-            new_cells.push_back(q1);
-
-            /* third triangle */
-            msh.faces.push_back( face_type(p1b, bar, false) );
-            msh.faces.push_back( face_type(p1b, p2,  q_e1.boundary_id, q_e1.is_boundary) );
-            msh.faces.push_back( face_type(p2,  p2b, q_e2.boundary_id, q_e2.is_boundary) );
-            msh.faces.push_back( face_type(p2b, bar, false) );
-            quadrangle q2(bar, p1b, p2, p2b);
-            new_cells.push_back(q2);
-
-            /* fourth triangle */
-            msh.faces.push_back( face_type(p3b, bar, false) );
-            msh.faces.push_back( face_type(p2b, bar, false) );
-            msh.faces.push_back( face_type(p2b, p3,  q_e2.boundary_id, q_e2.is_boundary) );
-            msh.faces.push_back( face_type(p3,  p3b, q_e3.boundary_id, q_e3.is_boundary) );
-            quadrangle q3(p3b, bar, p2b, p3);
-            new_cells.push_back(q3);
-        }
-
-        /* we don't need the broken faces anymore, discard them */
-        auto face_is_broken = [](const face_type& f) -> bool { return f.is_broken; };
-        std::remove_if(msh.faces.begin(), msh.faces.end(), face_is_broken);
-
-        /* sort the faces to allow fast lookups */
-        priv::sort_uniq(msh.faces);
-        std::swap(msh.cells, new_cells);
+		/* Each face f is split in the faces 2f and 2f+1, the first one
+		 * containing the point with the lowest number. Each quadrangle c
+		 * is split in the quadrangles 4c, ..., 4c+3 and its four internal
+		 * faces are 2F+4c, ..., 2F+4c+3. The midpoint of the face f is
+		 * the point Np+f, the barycenter of the cell c is Np+F+c. All the
+		 * numbers are known in advance, so the faces and the cells are
+		 * processed independently. */
+		const size_t num_points = msh.points.size();
+		const size_t num_faces = msh.faces.size();
+		const size_t num_cells = msh.cells.size();
+
+		msh.points.resize( num_points + num_faces + num_cells );
+		new_faces.resize( 2*num_faces + 4*num_cells );
+		new_cells.resize( 4*num_cells );
+		new_face_owners.resize( new_faces.size() );
+		new_cell_faces.resize( new_cells.size() );
+
+		/* break all the faces */
+		parallel_for_chunks(num_faces, num_threads,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t fc_id = begin; fc_id < end; fc_id++)
+				{
+					const auto& e = msh.faces[fc_id];
+					assert(e.p0 < num_points);
+					assert(e.p1 < num_points);
+					auto pb = num_points + fc_id;
+					msh.points[pb] = (msh.points[e.p0] + msh.points[e.p1])/T(2);
+					new_faces[2*fc_id]   = face_type(e.p0, pb, e.boundary_id, e.is_boundary);
+					new_faces[2*fc_id+1] = face_type(pb, e.p1, e.boundary_id, e.is_boundary);
+					new_face_owners[2*fc_id]   = {{ NO_OWNER, NO_OWNER }};
+					new_face_owners[2*fc_id+1] = {{ NO_OWNER, NO_OWNER }};
+				}
+			});
+
+		/* refine the quads */
+		parallel_for_chunks(num_cells, num_threads,
+			[&](size_t, size_t begin, size_t end) {
+				for (size_t cl_id = begin; cl_id < end; cl_id++)
+					refine_cell(msh, cl_id);
+			});
+
+		std::swap(msh.faces, new_faces);
+		std::swap(msh.cells, new_cells);
+		std::swap(msh.face_owners, new_face_owners);
+		std::swap(msh.cell_faces, new_cell_faces);
+	}
+
+	void
+	refine_cell(mesh_type& msh, size_t cl_id)
+	{
+		const size_t num_cells = msh.cells.size();
+		const size_t num_faces = msh.faces.size();
+		const size_t num_points = msh.points.size() - num_faces - num_cells;
+
+		const auto& q = msh.cells[cl_id];
+		auto pts = q.point_ids();
+		auto p0 = pts[0];
+		auto p1 = pts[1];
+		auto p2 = pts[2];
+		auto p3 = pts[3];
+
+		/* the faces of the quadrangle */
+		const auto& fcids = msh.cell_faces[cl_id];
+		auto e0 = fcids[0];
+		auto e1 = fcids[1];
+		auto e2 = fcids[2];
+		auto e3 = fcids[3];
+
+		auto p0b = num_points + e0;
+		auto p1b = num_points + e1;
+		auto p2b = num_points + e2;
+		auto p3b = num_points + e3;
+		auto bar = num_points + num_faces + cl_id;
+
+		msh.points[bar] = barycenter(msh, q);
+
+		/* child of face 'fc_id' containing the point 'pt', and the slot
+		 * of this cell in the owners of 'fc_id' */
+		auto half = [&](size_t fc_id, size_t pt) {
+			return 2*fc_id + (msh.faces[fc_id].p0 == pt ? 0 : 1);
+		};
+		auto own = [&](size_t fc_id, size_t pt, size_t child) {
+			auto slot = (msh.face_owners[fc_id][0] == cl_id) ? 0 : 1;
+			new_face_owners[ half(fc_id, pt) ][slot] = child;
+		};
+
+		/* the internal faces */
+		auto i0 = 2*num_faces + 4*cl_id;
+		auto i1 = i0 + 1;
+		auto i2 = i0 + 2;
+		auto i3 = i0 + 3;
+		new_faces[i0] = face_type(p0b, bar, false);
+		new_faces[i1] = face_type(p1b, bar, false);
+		new_faces[i2] = face_type(p2b, bar, false);
+		new_faces[i3] = face_type(p3b, bar, false);
+
+		auto c0 = 4*cl_id;
+		auto c1 = c0 + 1;
+		auto c2 = c0 + 2;
+		auto c3 = c0 + 3;
+		new_face_owners[i0] = {{ c0, c1 }};
+		new_face_owners[i1] = {{ c1, c2 }};
+		new_face_owners[i2] = {{ c2, c3 }};
+		new_face_owners[i3] = {{ c0, c3 }};
+
+		/* the new four quadrangles, with their faces in the order given
+		 * by face_ids() */
+		new_cells[c0] = quadrangle(p0, p0b, bar, p3b);
+		new_cell_faces[c0] = {{ half(e0, p0), i0, i3, half(e3, p0) }};
+		own(e0, p0, c0);
+		own(e3, p0, c0);
+
+		new_cells[c1] = quadrangle(p0b, p1, p1b, bar);
+		new_cell_faces[c1] = {{ half(e0, p1), half(e1, p1), i1, i0 }};
+		own(e0, p1, c1);
+		own(e1, p1, c1);
+
+		new_cells[c2] = quadrangle(bar, p1b, p2, p2b);
+		new_cell_faces[c2] = {{ i1, half(e1, p2), half(e2, p2), i2 }};
+		own(e1, p2, c2);
+		own(e2, p2, c2);
+
+		new_cells[c3] = quadrangle(p3b, bar, p2b, p3);
+		new_cell_faces[c3] = {{ i3, i2, half(e2, p3), half(e3, p3) }};
+		own(e2, p3, c3);
+		own(e3, p3, c3);
 	}
 
 public:
 	mesher()
-		: verbose(false)
+		: verbose(false), num_threads(1)
 	{}
 
-	mesher(bool vrb)
-		: verbose(vrb)
+	mesher(bool vrb, size_t nthreads = 1)
+		: verbose(vrb), num_threads( std::max<size_t>(nthreads, 1) )
 	{}
 
 	void
@@ -345,6 +441,16 @@ public:
 	void
 	refine_mesh(mesh_type& msh, size_t refinement_iterations)
 	{
+		YAOURT_TIMED_SCOPE("mesh.refine");
+
+		if ( !msh.hanging_faces.empty() )
+			throw std::logic_error("Uniform refinement of a nonconforming mesh");
+
+		/* The refinement works on the connectivity, which is then kept
+		 * up to date level by level */
+		if ( !msh.has_connectivity() )
+			msh.compute_connectivity();
+
 		for (size_t i = 0; i < refinement_iterations; i++)
 		{
 			refine_mesh(msh);
@@ -357,7 +463,7 @@ public:
 			}
 		}
 
-		std::sort(msh.cells.begin(), msh.cells.end());
+		msh.compute_lookup();
 	}
 
 
@@ -365,9 +471,9 @@ public:
 
 template<typename Mesh>
 auto
-get_mesher(const Mesh&, bool verbose = false)
+get_mesher(const Mesh&, bool verbose = false, size_t num_threads = 1)
 {
-	return mesher<Mesh>(verbose);
+	return mesher<Mesh>(verbose, num_threads);
 }
 
 } // namespace yaourt
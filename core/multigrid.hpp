@@ -0,0 +1,518 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <blaze/Math.h>
+
+#include "mesh.hpp"
+#include "meshers.hpp"
+#include "reordering.hpp"
+#include "tabulation.hpp"
+#include "blaze_sparse_init.hpp"
+#include "batched_la.hpp"
+#include "preconditioners.hpp"
+#include "solvers.hpp"
+#include "parallel.hpp"
+
+/* Multigrid for the symmetric positive definite DG systems (SIP diffusion).
+ * The levels are the DG spaces of decreasing degree on the same mesh
+ * (p-coarsening) followed by the spaces on the coarser meshes of a
+ * mesh_hierarchy (h-coarsening). The spaces are nested, so the
+ * prolongations are exact: injection for p, L2 projection on the children
+ * for h. The coarse operators are the Galerkin ones, R*A*P with R = P',
+ * the smoother is damped block-Jacobi on the cell blocks and the coarsest
+ * level is solved with a dense Cholesky factorization. A coarsest level
+ * larger than params.max_dense_coarse (no h-coarsening, or a fine coarsest
+ * mesh) is instead solved with block-Jacobi CG to params.coarse_rr_tol.
+ *
+ * With the Galerkin operators the penalty of the coarse faces doubles at
+ * each h level, and the convergence of the V-cycle degrades with the
+ * number of levels. By default the levels that at least halve the number
+ * of unknowns are visited twice (W-cycle), which keeps the iterations
+ * independent of the mesh size at a cost still linear in it.
+ *
+ * multigrid_preconditioner implements the linear operator interface of
+ * core/preconditioners.hpp: apply() is a symmetric cycle, to be used in
+ * conjugated_gradient(). solve() runs the cycles alone. */
+
+namespace yaourt {
+
+/* Meshes obtained from the coarsest one by uniform refinement, with the
+ * parent of each cell in the previous level. Level 0 is the coarsest. */
+template<typename Mesh>
+class mesh_hierarchy
+{
+    std::vector<Mesh>                   meshes;
+    std::vector<std::vector<size_t>>    parent_cells;
+
+public:
+    mesh_hierarchy()
+    {}
+
+    /* The mesh of the mesher refined 'levels' times */
+    mesh_hierarchy(size_t levels, size_t num_threads = 1)
+    {
+        Mesh msh;
+        auto mesher = get_mesher(msh, false, num_threads);
+        mesher.create_mesh(msh, 0);
+
+        meshes.push_back(msh);
+        parent_cells.push_back( std::vector<size_t>() );
+        for (size_t l = 0; l < levels; l++)
+        {
+            /* The meshers number the children of the cell c as 4c, ..., 4c+3 */
+            mesher.refine_mesh(msh, 1);
+
+            std::vector<size_t> parents( msh.cells.size() );
+            for (size_t i = 0; i < parents.size(); i++)
+                parents[i] = i/4;
+
+            meshes.push_back(msh);
+            parent_cells.push_back( std::move(parents) );
+        }
+    }
+
+    size_t num_levels() const { return meshes.size(); }
+
+    const Mesh& mesh(size_t level) const { return meshes.at(level); }
+    const Mesh& finest() const { return meshes.back(); }
+
+    /* Parent in the level 'level'-1 of each cell of the level 'level' */
+    const std::vector<size_t>& parents(size_t level) const
+    {
+        return parent_cells.at(level);
+    }
+
+    /* Renumber the finest mesh, see reorder_mesh() */
+    void reorder_finest(mesh_ordering ordering)
+    {
+        auto& msh = meshes.back();
+        auto perm = cell_permutation(msh, ordering);
+        reorder_mesh(msh, perm);
+
+        if (meshes.size() < 2)
+            return;
+
+        auto& parents = parent_cells.back();
+        std::vector<size_t> new_parents( parents.size() );
+        for (size_t i = 0; i < perm.size(); i++)
+            new_parents[i] = parents[ perm[i] ];
+        parents = std::move(new_parents);
+    }
+};
+
+/* Prolongation from the DG space of degree 'coarse_degree' to the one of
+ * degree 'fine_degree' on the same mesh. The bases are hierarchical, the
+ * coarse functions are the first of the fine ones. */
+template<typename T, typename Mesh>
+blaze::CompressedMatrix<T>
+p_prolongation(const Mesh& msh, size_t fine_degree, size_t coarse_degree)
+{
+    if (coarse_degree > fine_degree)
+        throw std::invalid_argument("p_prolongation: coarse degree too high");
+
+    auto fbs = bases::scalar_basis_size(fine_degree, 2);
+    auto cbs = bases::scalar_basis_size(coarse_degree, 2);
+    auto num_cells = msh.cells.size();
+
+    blaze::CompressedMatrix<T> P(num_cells*fbs, num_cells*cbs);
+    P.reserve(num_cells*cbs);
+    for (size_t cl_id = 0; cl_id < num_cells; cl_id++)
+    {
+        for (size_t i = 0; i < fbs; i++)
+        {
+            if (i < cbs)
+                P.append(cl_id*fbs + i, cl_id*cbs + i, T(1));
+            P.finalize(cl_id*fbs + i);
+        }
+    }
+
+    return P;
+}
+
+/* Prolongation from the DG space of degree 'degree' on 'coarse' to the
+ * one on 'fine', 'parents' gives the coarse cell containing each fine
+ * cell. The block of a fine cell is inv(M)*B, M its mass matrix and B the
+ * products of its basis with the basis of the parent, so a coarse
+ * polynomial is represented exactly. Same tabulated bases as the DG
+ * assembly. */
+template<typename T, typename Mesh>
+blaze::CompressedMatrix<T>
+h_prolongation(const Mesh& coarse, const Mesh& fine,
+               const std::vector<size_t>& parents, size_t degree,
+               size_t num_threads = 1)
+{
+    using CT = typename Mesh::coordinate_type;
+
+    if (parents.size() != fine.cells.size())
+        throw std::invalid_argument("h_prolongation: wrong number of parents");
+
+    auto bs = bases::scalar_basis_size(degree, 2);
+    std::vector<std::vector<blaze::triplet<T>>> triplets( std::max<size_t>(num_threads, 1) );
+
+    parallel_for_chunks(fine.cells.size(), num_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+            blaze::DynamicVector<CT> pphi(bs);
+            for (size_t cl_id = begin; cl_id < end; cl_id++)
+            {
+                auto pcl_id = parents[cl_id];
+                auto fbasis = bases::make_tabulated_basis(fine, fine.cells[cl_id],
+                                                          degree, 2*degree);
+                auto pbasis = bases::make_tabulated_basis(coarse, coarse.cells.at(pcl_id),
+                                                          degree, 2*degree);
+
+                blaze::DynamicMatrix<CT> M(bs, bs, 0.0), B(bs, bs, 0.0);
+                auto qps = fbasis.cell_quadrature();
+                for (size_t iqp = 0; iqp < qps.size(); iqp++)
+                {
+                    auto qw = qps.weight(iqp);
+                    auto& phi = qps.phi(iqp);
+                    pbasis.eval(qps.point(iqp), pphi);
+
+                    M += qw * phi * trans(phi);
+                    B += qw * phi * trans(pphi);
+                }
+
+                blaze::DynamicMatrix<CT> blk = cholesky_factor<CT>(M).solve(B);
+                for (size_t i = 0; i < bs; i++)
+                    for (size_t j = 0; j < bs; j++)
+                        triplets[tid].push_back({cl_id*bs + i, pcl_id*bs + j, T(blk(i,j))});
+            }
+        });
+
+    std::vector<blaze::triplet<T>> all;
+    for (auto& t : triplets)
+        all.insert(all.end(), t.begin(), t.end());
+
+    blaze::CompressedMatrix<T> P(fine.cells.size()*bs, coarse.cells.size()*bs);
+    blaze::init_from_triplets(P, all.begin(), all.end(), num_threads);
+    return P;
+}
+
+template<typename T>
+struct multigrid_params
+{
+    size_t          pre_smoothing;
+    size_t          post_smoothing;
+    size_t          min_degree;     /* p-coarsening stops at this degree */
+    bool            p_coarsening;
+    bool            h_coarsening;
+    bool            w_cycle;        /* false for the plain V-cycle */
+
+    /* Coarsest level: dense Cholesky up to this size, then CG */
+    size_t          max_dense_coarse;
+    T               coarse_rr_tol;
+
+    /* Standalone solver only */
+    T               rr_tol;
+    size_t          max_cycles;
+    bool            verbose;
+
+    multigrid_params() : pre_smoothing(2),
+                         post_smoothing(2),
+                         min_degree(1),
+                         p_coarsening(true),
+                         h_coarsening(true),
+                         w_cycle(true),
+                         max_dense_coarse(2000),
+                         coarse_rr_tol(1e-10),
+                         rr_tol(1e-8),
+                         max_cycles(100),
+                         verbose(false) {}
+};
+
+template<typename T>
+class multigrid_preconditioner
+{
+    using vector_type = blaze::DynamicVector<T>;
+
+    /* Level 0 is the finest, P prolongates from the next level */
+    struct level
+    {
+        blaze::CompressedMatrix<T>          A, P, R;
+        block_jacobi_preconditioner<T>      smoother;
+        T                                   omega;
+
+        /* Cycle scratch space, w and e for the second visit */
+        mutable vector_type                 b, x, r, z, w, e;
+    };
+
+    multigrid_params<T>         params;
+    std::vector<level>          levels;
+    cholesky_factor<T>          coarse_solver;
+    mutable vector_type         coarse_b, coarse_x;
+
+    /* Coarsest level too large for the dense factorization */
+    bool                                        dense_coarse;
+    blaze::CompressedMatrix<T>                  coarse_A;
+    block_jacobi_preconditioner<T>              coarse_precond;
+    mutable conjugated_gradient_solver<T>       coarse_cg;
+    size_t                      m_iterations;
+    T                           m_rr;
+
+    /* Damping of the block-Jacobi smoother: 4/(3*lambda), lambda the
+     * largest eigenvalue of inv(D)*A estimated with the power method */
+    static T smoothing_damping(const level& lv)
+    {
+        auto N = lv.A.rows();
+        vector_type v(N), w(N), z(N);
+        for (size_t i = 0; i < N; i++)
+            v[i] = 1.0 + T(i % 7)/7.0;
+
+        T lambda = 1.0;
+        for (size_t it = 0; it < 15; it++)
+        {
+            v /= norm(v);
+            w = lv.A * v;
+            lv.smoother.apply(w, z);
+            lambda = dot(v, z);
+            v = z;
+        }
+
+        return 4.0/(3.0*std::max(lambda, T(1)));
+    }
+
+    /* x += omega*inv(D)*(b - A*x) */
+    void smooth(const level& lv, const vector_type& b, vector_type& x) const
+    {
+        lv.r = b - lv.A * x;
+        lv.smoother.apply(lv.r, lv.z);
+        x += lv.omega * lv.z;
+    }
+
+    void cycle(size_t l, const vector_type& b, vector_type& x) const
+    {
+        const auto& lv = levels[l];
+
+        /* First smoothing step from x = 0 */
+        lv.smoother.apply(b, lv.z);
+        x = lv.omega * lv.z;
+        for (size_t i = 1; i < params.pre_smoothing; i++)
+            smooth(lv, b, x);
+
+        lv.r = b - lv.A * x;
+        if (l+1 < levels.size())
+        {
+            const auto& next = levels[l+1];
+            next.b = lv.R * lv.r;
+            cycle(l+1, next.b, next.x);
+            if (params.w_cycle and 2*next.A.rows() <= lv.A.rows())
+            {
+                next.w = next.b - next.A * next.x;
+                cycle(l+1, next.w, next.e);
+                next.x += next.e;
+            }
+            x += lv.P * next.x;
+        }
+        else
+        {
+            coarse_b = lv.R * lv.r;
+            if (dense_coarse)
+                coarse_x = coarse_solver.solve(coarse_b);
+            else
+                coarse_cg.solve(coarse_A, coarse_b, coarse_x, coarse_precond);
+            x += lv.P * coarse_x;
+        }
+
+        for (size_t i = 0; i < params.post_smoothing; i++)
+            smooth(lv, b, x);
+    }
+
+public:
+    using value_type = T;
+
+    multigrid_preconditioner()
+        : dense_coarse(true), m_iterations(0), m_rr(0.0)
+    {}
+
+    /* 'prolongations[l]' prolongates from the level l+1 to the level l,
+     * the level 0 being the one of 'A'. 'block_sizes[l]' is the size of
+     * the cell blocks of the level l, for the smoother, an additional
+     * size is the one of the coarsest level (1 if not given). */
+    multigrid_preconditioner(const blaze::CompressedMatrix<T>& A,
+                             const std::vector<blaze::CompressedMatrix<T>>& prolongations,
+                             const std::vector<size_t>& block_sizes,
+                             const multigrid_params<T>& p_params = multigrid_params<T>())
+        : params(p_params), dense_coarse(true), m_iterations(0), m_rr(0.0)
+    {
+        if (prolongations.empty())
+            throw std::invalid_argument("Multigrid: at least two levels are needed");
+
+        if (block_sizes.size() < prolongations.size())
+            throw std::invalid_argument("Multigrid: missing block sizes");
+
+        if (params.pre_smoothing == 0)
+            throw std::invalid_argument("Multigrid: at least one pre-smoothing step");
+
+        blaze::CompressedMatrix<T> Al = A;
+        levels.resize( prolongations.size() );
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            auto& lv = levels[l];
+            if (prolongations[l].rows() != Al.rows())
+                throw std::invalid_argument("Multigrid: wrong prolongation size");
+
+            lv.A = std::move(Al);
+            lv.P = prolongations[l];
+            lv.R = trans(lv.P);
+            lv.smoother = block_jacobi_preconditioner<T>(lv.A, block_sizes[l]);
+            lv.omega = smoothing_damping(lv);
+
+            blaze::CompressedMatrix<T> AP = lv.A * lv.P;
+            Al = lv.R * AP;
+        }
+
+        coarse_x.resize( Al.rows() );
+        if (Al.rows() <= params.max_dense_coarse)
+        {
+            blaze::DynamicMatrix<T> Ac = Al;
+            coarse_solver.factorize(Ac);
+            return;
+        }
+
+        /* Solved accurately, the cycle stays a fixed linear operator
+         * up to coarse_rr_tol */
+        dense_coarse = false;
+        auto cbs = (block_sizes.size() > levels.size()) ? block_sizes[levels.size()] : 1;
+        coarse_A = std::move(Al);
+        coarse_precond = block_jacobi_preconditioner<T>(coarse_A, cbs);
+
+        conjugated_gradient_params<T> cgp;
+        cgp.rr_tol = params.coarse_rr_tol;
+        cgp.max_iter = coarse_A.rows();
+        coarse_cg = conjugated_gradient_solver<T>(cgp);
+    }
+
+    size_t num_levels() const { return levels.size() + 1; }
+    size_t rows() const     { return levels.empty() ? 0 : levels[0].A.rows(); }
+    size_t columns() const  { return rows(); }
+
+    /* z = cycle applied to r */
+    void apply(const vector_type& r, vector_type& z) const
+    {
+        YAOURT_TIMED_SCOPE("solver.mg.cycle");
+
+        z.resize( rows() );
+        cycle(0, r, z);
+    }
+
+    /* The cycle is symmetric: same smoother before and after, R = P' */
+    void apply_transpose(const vector_type& r, vector_type& z) const
+    {
+        apply(r, z);
+    }
+
+    /* Solve A*x = b with cycles on the residual, starting from x if it
+     * has the right size. Returns true if the relative residual went
+     * below params.rr_tol in at most params.max_cycles cycles. */
+    bool solve(const vector_type& b, vector_type& x)
+    {
+        YAOURT_TIMED_SCOPE("solver.mg");
+
+        const auto& A = levels.at(0).A;
+        if (x.size() != b.size())
+        {
+            x.resize(b.size());
+            x = 0.0;
+        }
+
+        vector_type r = b - A * x, e(b.size());
+        T nr0 = norm(b);
+        if (nr0 == 0.0)
+            nr0 = 1.0;
+
+        detail::progress_reporter progress(params.verbose, 0.1);
+
+        size_t iter = 0;
+        T rr = norm(r)/nr0;
+        while (rr > params.rr_tol and iter < params.max_cycles)
+        {
+            progress.report(iter, rr);
+            apply(r, e);
+            x += e;
+            r = b - A * x;
+            rr = norm(r)/nr0;
+            iter++;
+        }
+
+        progress.done(iter, rr);
+        YAOURT_COUNT("solver.mg.cycles", iter);
+
+        m_iterations = iter;
+        m_rr = rr;
+        return rr <= params.rr_tol;
+    }
+
+    /* Cycles and relative residual of the last solve() */
+    size_t iterations() const { return m_iterations; }
+    T relative_residual() const { return m_rr; }
+};
+
+/* Multigrid for a DG system of degree 'degree' on 'msh': p-coarsening down
+ * to params.min_degree, then h-coarsening on the levels of 'hier' if it is
+ * given, its finest mesh being 'msh'. */
+template<typename T, typename Mesh>
+multigrid_preconditioner<T>
+make_dg_multigrid(const Mesh& msh, const mesh_hierarchy<Mesh> *hier,
+                  const blaze::CompressedMatrix<T>& A, size_t degree,
+                  const multigrid_params<T>& params = multigrid_params<T>(),
+                  size_t num_threads = 1)
+{
+    YAOURT_TIMED_SCOPE("solver.mg.setup");
+
+    std::vector<blaze::CompressedMatrix<T>> prolongations;
+    std::vector<size_t> block_sizes;
+
+    size_t cur_degree = degree;
+    if (params.p_coarsening)
+    {
+        while (cur_degree > params.min_degree)
+        {
+            prolongations.push_back( p_prolongation<T>(msh, cur_degree, cur_degree-1) );
+            block_sizes.push_back( bases::scalar_basis_size(cur_degree, 2) );
+            cur_degree--;
+        }
+    }
+
+    if (params.h_coarsening and hier)
+    {
+        if (hier->finest().cells.size() != msh.cells.size())
+            throw std::invalid_argument("Multigrid: the mesh is not the finest of the hierarchy");
+
+        for (size_t l = hier->num_levels()-1; l > 0; l--)
+        {
+            const auto& fine = (l == hier->num_levels()-1) ? msh : hier->mesh(l);
+            prolongations.push_back( h_prolongation<T>(hier->mesh(l-1), fine,
+                                         hier->parents(l), cur_degree, num_threads) );
+            block_sizes.push_back( bases::scalar_basis_size(cur_degree, 2) );
+        }
+    }
+
+    /* Coarsest level */
+    block_sizes.push_back( bases::scalar_basis_size(cur_degree, 2) );
+
+    return multigrid_preconditioner<T>(A, prolongations, block_sizes, params);
+}
+
+} // namespace yaourt
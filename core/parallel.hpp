@@ -0,0 +1,286 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace yaourt {
+
+/* Number of threads to use when the user asks for 0 threads */
+inline size_t
+default_num_threads()
+{
+    auto nt = std::thread::hardware_concurrency();
+    return (nt == 0) ? 1 : nt;
+}
+
+/* Chunk 'tid' of the range [0, size) split in 'num_threads' contiguous
+ * chunks, the first ones being one element longer */
+inline std::pair<size_t, size_t>
+chunk_range(size_t size, size_t num_threads, size_t tid)
+{
+    auto chunk = size / num_threads;
+    auto rem = size % num_threads;
+    auto begin = tid*chunk + std::min(tid, rem);
+    return std::make_pair(begin, begin + chunk + (tid < rem ? 1 : 0));
+}
+
+/* Split the range [0, size) in 'num_threads' contiguous chunks and call
+ * f(thread_id, begin, end) on each chunk, each one in its own thread.
+ * With a single thread 'f' is called directly. If one of the calls
+ * throws, the first exception is rethrown after all the threads joined. */
+template<typename Function>
+void
+parallel_for_chunks(size_t size, size_t num_threads, const Function& f)
+{
+    num_threads = std::max<size_t>(1, std::min(num_threads, size));
+
+    if (num_threads == 1)
+    {
+        f(0, 0, size);
+        return;
+    }
+
+    std::vector<std::thread>        threads;
+    std::vector<std::exception_ptr> errors(num_threads);
+
+    for (size_t tid = 0; tid < num_threads; tid++)
+    {
+        auto range = chunk_range(size, num_threads, tid);
+
+        threads.push_back( std::thread([&, tid, range]() {
+            try {
+                f(tid, range.first, range.second);
+            }
+            catch (...) {
+                errors[tid] = std::current_exception();
+            }
+        }) );
+    }
+
+    for (auto& th : threads)
+        th.join();
+
+    for (auto& e : errors)
+        if (e)
+            std::rethrow_exception(e);
+}
+
+/* Reusable barrier for a fixed number of threads */
+class thread_barrier
+{
+    std::mutex              mtx;
+    std::condition_variable cv;
+    size_t                  num_threads, waiting, generation;
+
+public:
+    explicit thread_barrier(size_t p_num_threads)
+        : num_threads(p_num_threads), waiting(0), generation(0)
+    {}
+
+    /* Returns when all the threads called wait() */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        auto gen = generation;
+        if (++waiting == num_threads)
+        {
+            waiting = 0;
+            generation++;
+            cv.notify_all();
+            return;
+        }
+
+        cv.wait(lk, [&]() { return gen != generation; });
+    }
+};
+
+/* Threads started once and reused: for the operators applied at each
+ * iteration or time step, where starting the threads of
+ * parallel_for_chunks() at every call costs more than the work of small
+ * meshes. run(f) calls f(thread_id) on each of the size() threads, the
+ * calling thread being the thread 0, and returns when all the calls
+ * returned. Exceptions are rethrown as in parallel_for_chunks(). The
+ * calls to run() must come from one thread at a time and not be nested. */
+class thread_pool
+{
+    std::vector<std::thread>            workers;
+    std::vector<std::exception_ptr>     errors;
+    std::function<void(size_t)>         task;
+    std::mutex                          mtx;
+    std::condition_variable             start_cv, done_cv;
+    size_t                              generation, pending;
+    bool                                stopping;
+
+    void worker(size_t tid)
+    {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lk(mtx);
+        while (true)
+        {
+            start_cv.wait(lk, [&]() { return stopping or generation != seen; });
+            if (stopping)
+                return;
+
+            seen = generation;
+            lk.unlock();
+            try {
+                task(tid);
+            }
+            catch (...) {
+                errors[tid] = std::current_exception();
+            }
+            lk.lock();
+
+            if (--pending == 0)
+                done_cv.notify_one();
+        }
+    }
+
+public:
+    explicit thread_pool(size_t num_threads = 1)
+        : errors(std::max<size_t>(num_threads, 1)), generation(0),
+          pending(0), stopping(false)
+    {
+        for (size_t tid = 1; tid < errors.size(); tid++)
+            workers.push_back( std::thread([this, tid]() { worker(tid); }) );
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            stopping = true;
+        }
+        start_cv.notify_all();
+
+        for (auto& th : workers)
+            th.join();
+    }
+
+    size_t size() const { return errors.size(); }
+
+    template<typename Function>
+    void run(const Function& f)
+    {
+        if (workers.empty())
+        {
+            f(0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            task = [&f](size_t tid) { f(tid); };
+            pending = workers.size();
+            generation++;
+        }
+        start_cv.notify_all();
+
+        try {
+            f(0);
+        }
+        catch (...) {
+            errors[0] = std::current_exception();
+        }
+
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            done_cv.wait(lk, [&]() { return pending == 0; });
+            task = nullptr;
+        }
+
+        for (auto& e : errors)
+        {
+            if (e)
+            {
+                auto first = e;
+                std::fill(errors.begin(), errors.end(), nullptr);
+                std::rethrow_exception(first);
+            }
+        }
+    }
+
+    /* As parallel_for_chunks(size, size(), f) on the threads of the pool */
+    template<typename Function>
+    void for_chunks(size_t size, const Function& f)
+    {
+        run([&](size_t tid) {
+            auto range = chunk_range(size, this->size(), tid);
+            f(tid, range.first, range.second);
+        });
+    }
+};
+
+/* Sort [first, last) with 'num_threads' threads: each thread sorts one
+ * chunk, then the sorted chunks are merged pairwise, the merges of each
+ * round in parallel. */
+template<typename RandomIterator, typename Compare>
+void
+parallel_sort(RandomIterator first, RandomIterator last, size_t num_threads,
+              Compare comp)
+{
+    size_t size = std::distance(first, last);
+    num_threads = std::max<size_t>(1, std::min(num_threads, size));
+
+    if (num_threads == 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<RandomIterator> bounds(num_threads+1);
+    bounds[num_threads] = last;
+
+    parallel_for_chunks(size, num_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+            bounds[tid] = first + begin;
+            std::sort(first + begin, first + end, comp);
+        });
+
+    for (size_t width = 1; width < num_threads; width *= 2)
+    {
+        size_t num_merges = (num_threads + 2*width - 1) / (2*width);
+
+        parallel_for_chunks(num_merges, num_merges,
+            [&](size_t, size_t begin, size_t end) {
+                for (size_t m = begin; m < end; m++)
+                {
+                    size_t lo  = 2*width*m;
+                    size_t mid = std::min(lo + width, num_threads);
+                    size_t hi  = std::min(lo + 2*width, num_threads);
+                    std::inplace_merge(bounds[lo], bounds[mid], bounds[hi], comp);
+                }
+            });
+    }
+}
+
+} // namespace yaourt
@@ -0,0 +1,327 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+#include "mesh.hpp"
+
+/* Domain decomposition. The cells are split in parts on the graph of the
+ * cells sharing a face (the dual graph given by face_owners), then each
+ * part is extracted in a local mesh together with one layer of ghost
+ * cells: the cells of the other parts that share a face with it. This is
+ * what the DG operators need, the rows of the owned cells only use the
+ * DoFs of the face neighbours.
+ *
+ * All of this is serial and deterministic: every process partitions the
+ * same global mesh and gets the same result, so no communication is
+ * needed to agree on the decomposition. The exchange of the ghost DoFs is
+ * in core/distributed.hpp. */
+
+namespace yaourt {
+
+/* Split the cells in 'num_parts' parts of (almost) the same size, by
+ * recursive bisection of the dual graph. Each bisection numbers the cells
+ * of the part breadth-first from a pseudo-peripheral cell and cuts the
+ * numbering, which gives compact parts with short interfaces on the
+ * meshes of the meshers. Returns the part of each cell. Requires the
+ * connectivity. */
+template<typename Mesh>
+std::vector<size_t>
+partition_mesh(const Mesh& msh, size_t num_parts)
+{
+    if ( !msh.has_connectivity() )
+        throw std::logic_error("No connectivity information.");
+
+    if ( !msh.hanging_faces.empty() )
+        throw std::invalid_argument("partition_mesh: nonconforming meshes not supported");
+
+    const size_t num_cells = msh.cells.size();
+    if (num_parts == 0 or num_parts > num_cells)
+        throw std::invalid_argument("partition_mesh: invalid number of parts");
+
+    /* During the bisection the cells of each group are labeled with the
+     * first part of the group */
+    std::vector<size_t> part(num_cells, 0);
+    std::vector<bool> visited(num_cells, false);
+
+    /* Breadth-first visit of the cells labeled 'label' not yet visited,
+     * the visited cells are appended to 'order' */
+    auto bfs = [&](size_t root, size_t label, std::vector<size_t>& order) {
+        std::queue<size_t> q;
+        q.push(root);
+        visited[root] = true;
+        while ( !q.empty() )
+        {
+            auto cur = q.front();
+            q.pop();
+            order.push_back(cur);
+
+            for (auto& fcid : face_ids(msh, cur))
+            {
+                auto [ncl_id, has_neighbour] = neighbour_via(msh, cur, fcid);
+                if (!has_neighbour or visited[ncl_id] or part[ncl_id] != label)
+                    continue;
+                visited[ncl_id] = true;
+                q.push(ncl_id);
+            }
+        }
+    };
+
+    struct group {
+        std::vector<size_t> cells;
+        size_t              first_part, num_parts;
+    };
+
+    std::vector<group> stack;
+    std::vector<size_t> all(num_cells);
+    for (size_t i = 0; i < num_cells; i++)
+        all[i] = i;
+    stack.push_back( {std::move(all), 0, num_parts} );
+
+    while ( !stack.empty() )
+    {
+        auto g = std::move(stack.back());
+        stack.pop_back();
+
+        if (g.num_parts == 1)
+            continue;
+
+        /* Numbering of the group: one sweep to find a far cell, then the
+         * actual numbering from there. Disconnected groups are numbered
+         * one component after the other. */
+        std::vector<size_t> order;
+        order.reserve( g.cells.size() );
+        for (auto& start : g.cells)
+        {
+            if (visited[start])
+                continue;
+
+            std::vector<size_t> component;
+            bfs(start, g.first_part, component);
+            for (auto& c : component)
+                visited[c] = false;
+
+            bfs(component.back(), g.first_part, order);
+        }
+
+        for (auto& c : order)
+            visited[c] = false;
+
+        /* The cut is proportional to the number of parts on each side */
+        auto left_parts = g.num_parts/2;
+        auto num_left = (g.cells.size() * left_parts) / g.num_parts;
+
+        group left, right;
+        left.cells.assign(order.begin(), order.begin() + num_left);
+        left.first_part = g.first_part;
+        left.num_parts = left_parts;
+
+        right.cells.assign(order.begin() + num_left, order.end());
+        right.first_part = g.first_part + left_parts;
+        right.num_parts = g.num_parts - left_parts;
+
+        for (auto& c : right.cells)
+            part[c] = right.first_part;
+
+        stack.push_back( std::move(left) );
+        stack.push_back( std::move(right) );
+    }
+
+    return part;
+}
+
+/* A part of a decomposed mesh. In the local mesh the owned cells come
+ * first, in the order of the global mesh, then the ghost cells. For each
+ * neighbouring part, 'send' lists the owned cells the neighbour has as
+ * ghosts and 'recv' its cells that are ghosts here, both sorted by global
+ * number: the send list of a part is the receive list of the other. */
+struct mesh_partition
+{
+    struct halo_link
+    {
+        size_t              part;
+        std::vector<size_t> send, recv;     /* Local cell numbers */
+    };
+
+    size_t                  part, num_parts;
+    size_t                  num_owned, num_global_cells;
+
+    /* Global number of each local cell */
+    std::vector<size_t>     global_cell;
+
+    /* Owned cells without ghost neighbours, and the other owned cells.
+     * The rows of the interior cells can be computed while the ghost
+     * values are being exchanged. */
+    std::vector<size_t>     interior_cells, interface_cells;
+
+    std::vector<halo_link>  links;
+
+    mesh_partition()
+        : part(0), num_parts(1), num_owned(0), num_global_cells(0)
+    {}
+
+    bool is_distributed() const { return num_parts > 1; }
+    size_t num_ghosts() const { return global_cell.size() - num_owned; }
+};
+
+/* Build the local mesh 'local' of the part 'part_id' of 'msh', with one
+ * layer of ghost cells, and return the description of the part. 'parts'
+ * is the part of each cell, as computed by partition_mesh(). The points
+ * and the faces are renumbered, the faces keep their boundary
+ * information. The faces of the ghost cells towards cells that are not
+ * in the local mesh are left with a single owner and are not boundary
+ * faces: the rows of the ghost cells are not meaningful. The hanging
+ * faces of nonconforming meshes are not supported. */
+template<typename Mesh>
+mesh_partition
+extract_partition(const Mesh& msh, const std::vector<size_t>& parts,
+                  size_t part_id, Mesh& local)
+{
+    using face_type = typename Mesh::face_type;
+
+    if ( !msh.has_connectivity() )
+        throw std::logic_error("No connectivity information.");
+
+    if ( !msh.hanging_faces.empty() )
+        throw std::invalid_argument("extract_partition: nonconforming meshes not supported");
+
+    if ( parts.size() != msh.cells.size() )
+        throw std::invalid_argument("extract_partition: wrong number of parts");
+
+    mesh_partition ret;
+    ret.part = part_id;
+    ret.num_parts = 1 + *std::max_element(parts.begin(), parts.end());
+    ret.num_global_cells = msh.cells.size();
+
+    const size_t NOT_LOCAL = NO_OWNER;
+    std::vector<size_t> local_cell(msh.cells.size(), NOT_LOCAL);
+
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        if (parts[cl_id] != part_id)
+            continue;
+
+        local_cell[cl_id] = ret.global_cell.size();
+        ret.global_cell.push_back(cl_id);
+    }
+    ret.num_owned = ret.global_cell.size();
+
+    /* Ghosts, sorted by global number */
+    std::vector<size_t> ghosts;
+    for (size_t i = 0; i < ret.num_owned; i++)
+    {
+        auto cl_id = ret.global_cell[i];
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            if (has_neighbour and parts[ncl_id] != part_id)
+                ghosts.push_back(ncl_id);
+        }
+    }
+    priv::sort_uniq(ghosts);
+
+    for (auto& g : ghosts)
+    {
+        local_cell[g] = ret.global_cell.size();
+        ret.global_cell.push_back(g);
+    }
+
+    /* Links: the receive list is made of the ghosts, the send list of the
+     * owned cells adjacent to them */
+    std::vector<size_t> link_of(ret.num_parts, NOT_LOCAL);
+    auto get_link = [&](size_t p) -> mesh_partition::halo_link& {
+        if (link_of[p] == NOT_LOCAL)
+        {
+            link_of[p] = ret.links.size();
+            ret.links.push_back( {p, {}, {}} );
+        }
+        return ret.links[ link_of[p] ];
+    };
+
+    for (auto& g : ghosts)
+        get_link(parts[g]).recv.push_back( local_cell[g] );
+
+    for (size_t i = 0; i < ret.num_owned; i++)
+    {
+        auto cl_id = ret.global_cell[i];
+        bool is_interface = false;
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            if (!has_neighbour or parts[ncl_id] == part_id)
+                continue;
+
+            auto& send = get_link(parts[ncl_id]).send;
+            if (send.empty() or send.back() != i)
+                send.push_back(i);
+            is_interface = true;
+        }
+
+        if (is_interface)
+            ret.interface_cells.push_back(i);
+        else
+            ret.interior_cells.push_back(i);
+    }
+
+    std::sort(ret.links.begin(), ret.links.end(),
+        [](const mesh_partition::halo_link& a, const mesh_partition::halo_link& b) {
+            return a.part < b.part;
+        });
+
+    /* Local mesh */
+    std::vector<size_t> local_point(msh.points.size(), NOT_LOCAL);
+    local.points.clear();
+    local.cells.clear();
+    local.faces.clear();
+    local.hanging_faces.clear();
+
+    for (auto& cl_id : ret.global_cell)
+    {
+        auto cl = msh.cells[cl_id];
+        for (auto& pt : cl.p)
+        {
+            if (local_point[pt] == NOT_LOCAL)
+            {
+                local_point[pt] = local.points.size();
+                local.points.push_back( msh.points[pt] );
+            }
+            pt = local_point[pt];
+        }
+        local.cells.push_back(cl);
+
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            const auto& fc = msh.faces[fcid];
+            local.faces.push_back( face_type(local_point[fc.p0], local_point[fc.p1],
+                                             fc.boundary_id, fc.is_boundary) );
+        }
+    }
+
+    priv::sort_uniq(local.faces);
+    local.compute_connectivity();
+
+    return ret;
+}
+
+} //namespace yaourt
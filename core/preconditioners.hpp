@@ -0,0 +1,301 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <blaze/Math.h>
+
+#include "bsr_matrix.hpp"
+
+/* Preconditioners for the solvers in core/solvers.hpp. They implement
+ * the linear operator interface: apply(r, z) computes z = inv(M)*r and
+ * apply_transpose(r, z) computes z = inv(M)'*r. */
+
+namespace yaourt {
+
+/* Block-Jacobi preconditioner: M is the block diagonal part of A, with
+ * square blocks of size 'block_size' (in DG, the cell blocks). The blocks
+ * are inverted once at construction and the inverses are stored
+ * contiguously in column-major order. */
+template<typename T>
+class block_jacobi_preconditioner
+{
+    size_t          m_num_blocks, m_block_size;
+    std::vector<T>  m_inv_blocks;
+
+    template<typename Getter>
+    void build(size_t num_blocks, size_t block_size, const Getter& get)
+    {
+        m_num_blocks = num_blocks;
+        m_block_size = block_size;
+        m_inv_blocks.resize(num_blocks * block_size * block_size);
+
+        blaze::DynamicMatrix<T> blk(block_size, block_size);
+        for (size_t k = 0; k < num_blocks; k++)
+        {
+            get(k, blk);
+            blaze::DynamicMatrix<T> iblk = blaze::inv(blk);
+
+            T *dst = m_inv_blocks.data() + k * block_size * block_size;
+            for (size_t j = 0; j < block_size; j++)
+                for (size_t i = 0; i < block_size; i++)
+                    dst[j*block_size + i] = iblk(i,j);
+        }
+    }
+
+public:
+    using value_type = T;
+
+    block_jacobi_preconditioner()
+        : m_num_blocks(0), m_block_size(0)
+    {}
+
+    block_jacobi_preconditioner(const blaze::CompressedMatrix<T>& A,
+                                size_t block_size)
+    {
+        if (A.rows() != A.columns() or block_size == 0 or
+            A.rows() % block_size != 0)
+            throw std::invalid_argument("Block-Jacobi: invalid block size");
+
+        build(A.rows()/block_size, block_size,
+            [&](size_t k, blaze::DynamicMatrix<T>& blk) {
+                blk = 0.0;
+                for (size_t i = 0; i < block_size; i++)
+                {
+                    auto row = k*block_size + i;
+                    for (auto itor = A.begin(row); itor != A.end(row); ++itor)
+                    {
+                        auto col = itor->index();
+                        if (col >= k*block_size and col < (k+1)*block_size)
+                            blk(i, col - k*block_size) = itor->value();
+                    }
+                }
+            });
+    }
+
+    block_jacobi_preconditioner(const bsr_matrix<T>& A)
+    {
+        if (A.block_rows() != A.block_cols())
+            throw std::invalid_argument("Block-Jacobi: square matrix required");
+
+        auto bs = A.block_size();
+        build(A.block_rows(), bs,
+            [&](size_t k, blaze::DynamicMatrix<T>& blk) {
+                const T *src = A.block( A.find_block(k, k) );
+                for (size_t j = 0; j < bs; j++)
+                    for (size_t i = 0; i < bs; i++)
+                        blk(i,j) = src[j*bs + i];
+            });
+    }
+
+    size_t rows() const     { return m_num_blocks * m_block_size; }
+    size_t columns() const  { return m_num_blocks * m_block_size; }
+
+    void apply(const blaze::DynamicVector<T>& r, blaze::DynamicVector<T>& z) const
+    {
+        const size_t bs = m_block_size;
+        z.resize( rows() );
+
+        for (size_t k = 0; k < m_num_blocks; k++)
+        {
+            const T *iblk = m_inv_blocks.data() + k*bs*bs;
+            const T *rb = r.data() + k*bs;
+            T *zb = z.data() + k*bs;
+
+            for (size_t i = 0; i < bs; i++)
+                zb[i] = 0.0;
+
+            for (size_t j = 0; j < bs; j++)
+            {
+                const T rj = rb[j];
+                const T *col = iblk + j*bs;
+                for (size_t i = 0; i < bs; i++)
+                    zb[i] += col[i] * rj;
+            }
+        }
+    }
+
+    void apply_transpose(const blaze::DynamicVector<T>& r, blaze::DynamicVector<T>& z) const
+    {
+        const size_t bs = m_block_size;
+        z.resize( rows() );
+
+        for (size_t k = 0; k < m_num_blocks; k++)
+        {
+            const T *iblk = m_inv_blocks.data() + k*bs*bs;
+            const T *rb = r.data() + k*bs;
+            T *zb = z.data() + k*bs;
+
+            for (size_t j = 0; j < bs; j++)
+            {
+                const T *col = iblk + j*bs;
+                T acc = 0.0;
+                for (size_t i = 0; i < bs; i++)
+                    acc += col[i] * rb[i];
+                zb[j] = acc;
+            }
+        }
+    }
+};
+
+/* Incomplete LU factorization with no fill-in: L and U have the sparsity
+ * pattern of A, L has unit diagonal and is stored in the strictly lower
+ * part. The matrix is copied in CSR format and factored at construction,
+ * every stored entry of A is kept (explicit zeros included), so for DG the
+ * pattern is the full block pattern. */
+template<typename T>
+class ilu0_preconditioner
+{
+    size_t              N;
+    std::vector<size_t> row_ptr, col_idx, diag_ptr;
+    std::vector<T>      values;
+
+    void factorize()
+    {
+        /* Position of the entries of the current row, NO_ENTRY if absent */
+        const size_t NO_ENTRY = ~0;
+        std::vector<size_t> pos(N, NO_ENTRY);
+
+        for (size_t i = 0; i < N; i++)
+        {
+            for (size_t k = row_ptr[i]; k < row_ptr[i+1]; k++)
+                pos[ col_idx[k] ] = k;
+
+            for (size_t k = row_ptr[i]; k < diag_ptr[i]; k++)
+            {
+                size_t j = col_idx[k];
+                T lij = values[k] / values[ diag_ptr[j] ];
+                values[k] = lij;
+
+                for (size_t kk = diag_ptr[j]+1; kk < row_ptr[j+1]; kk++)
+                {
+                    auto p = pos[ col_idx[kk] ];
+                    if (p != NO_ENTRY)
+                        values[p] -= lij * values[kk];
+                }
+            }
+
+            if ( std::abs(values[ diag_ptr[i] ]) == 0.0 )
+                throw std::runtime_error("ILU(0): zero pivot");
+
+            for (size_t k = row_ptr[i]; k < row_ptr[i+1]; k++)
+                pos[ col_idx[k] ] = NO_ENTRY;
+        }
+    }
+
+public:
+    using value_type = T;
+
+    ilu0_preconditioner()
+        : N(0)
+    {}
+
+    ilu0_preconditioner(const blaze::CompressedMatrix<T>& A)
+        : N(A.rows())
+    {
+        if (A.rows() != A.columns())
+            throw std::invalid_argument("ILU(0): square matrix required");
+
+        row_ptr.reserve(N+1);
+        diag_ptr.resize(N);
+        col_idx.reserve( A.nonZeros() );
+        values.reserve( A.nonZeros() );
+
+        row_ptr.push_back(0);
+        for (size_t i = 0; i < N; i++)
+        {
+            bool has_diag = false;
+            for (auto itor = A.begin(i); itor != A.end(i); ++itor)
+            {
+                if (itor->index() == i)
+                {
+                    diag_ptr[i] = col_idx.size();
+                    has_diag = true;
+                }
+
+                col_idx.push_back( itor->index() );
+                values.push_back( itor->value() );
+            }
+
+            if (!has_diag)
+                throw std::invalid_argument("ILU(0): missing diagonal entry");
+
+            row_ptr.push_back( col_idx.size() );
+        }
+
+        factorize();
+    }
+
+    ilu0_preconditioner(const bsr_matrix<T>& A)
+        : ilu0_preconditioner( A.to_compressed() )
+    {}
+
+    size_t rows() const     { return N; }
+    size_t columns() const  { return N; }
+    size_t nonZeros() const { return values.size(); }
+
+    /* Solve L*U*z = r */
+    void apply(const blaze::DynamicVector<T>& r, blaze::DynamicVector<T>& z) const
+    {
+        z.resize(N);
+
+        for (size_t i = 0; i < N; i++)
+        {
+            T acc = r[i];
+            for (size_t k = row_ptr[i]; k < diag_ptr[i]; k++)
+                acc -= values[k] * z[ col_idx[k] ];
+            z[i] = acc;
+        }
+
+        for (size_t ii = N; ii > 0; ii--)
+        {
+            size_t i = ii-1;
+            T acc = z[i];
+            for (size_t k = diag_ptr[i]+1; k < row_ptr[i+1]; k++)
+                acc -= values[k] * z[ col_idx[k] ];
+            z[i] = acc / values[ diag_ptr[i] ];
+        }
+    }
+
+    /* Solve U'*L'*z = r, the factors are traversed by columns */
+    void apply_transpose(const blaze::DynamicVector<T>& r, blaze::DynamicVector<T>& z) const
+    {
+        z = r;
+
+        for (size_t i = 0; i < N; i++)
+        {
+            z[i] /= values[ diag_ptr[i] ];
+            for (size_t k = diag_ptr[i]+1; k < row_ptr[i+1]; k++)
+                z[ col_idx[k] ] -= values[k] * z[i];
+        }
+
+        for (size_t ii = N; ii > 0; ii--)
+        {
+            size_t i = ii-1;
+            for (size_t k = row_ptr[i]; k < diag_ptr[i]; k++)
+                z[ col_idx[k] ] -= values[k] * z[i];
+        }
+    }
+};
+
+} // namespace yaourt
@@ -42,8 +42,10 @@
 
 #pragma once
 
-#include <vector>
+#include <array>
 #include <cmath>
+#include <stdexcept>
+#include <vector>
 
 #include "core/point.hpp"
 #include "core/mesh.hpp"
@@ -293,23 +295,6 @@ static struct gauss_rule gauss_rules[] = {
     { 0, NULL }
 };
 
-template<typename T>
-std::vector<std::pair<point<T, 1>, T>>
-gauss_legendre_tab(size_t degree)
-{
-    auto rule_num = degree/2;
-    auto num_entries = gauss_rules[rule_num].num_entries;
-    std::vector<std::pair<point<T, 1>, T>> ret;
-    ret.reserve(num_entries);
-    for (size_t i = 0; i < num_entries; i++)
-    {
-        auto &qp = gauss_rules[rule_num].points[i];
-        ret.push_back( {qp.point, qp.weight} );
-    }
-
-    return ret;
-}
-
 
 struct dunavant_point {
     size_t      perms;
@@ -567,64 +552,187 @@ static struct dunavant_rule dunavant_rules[] = {
     { 0, 0, NULL }
 };
 
+/* Reference rules, built once from the tables above and then only read,
+ * so that they can be shared by the threads of an assembly. The segment
+ * rules are on [-1,1], the triangle rules are in barycentric coordinates
+ * with the weights summing to one and the quadrangle rules are on
+ * [-1,1]^2. */
+template<typename T, size_t N>
+struct reference_rule
+{
+    std::vector<std::array<T,N>>    coords;
+    std::vector<T>                  weights;
+
+    size_t size() const { return weights.size(); }
+
+    void push_back(const std::array<T,N>& c, T w)
+    {
+        coords.push_back(c);
+        weights.push_back(w);
+    }
+};
+
 template<typename T>
-std::vector<quadrature_point<T,2>>
+const reference_rule<T,1>&
+segment_rule(size_t degree)
+{
+    /* The initialization of a local static is thread-safe */
+    static const auto rules = [] {
+        std::vector<reference_rule<T,1>> ret;
+        for (size_t i = 0; gauss_rules[i].num_entries != 0; i++)
+        {
+            reference_rule<T,1> rule;
+            for (size_t j = 0; j < gauss_rules[i].num_entries; j++)
+            {
+                auto& gp = gauss_rules[i].points[j];
+                rule.push_back({T(gp.point)}, T(gp.weight));
+            }
+            ret.push_back( std::move(rule) );
+        }
+        return ret;
+    }();
+
+    auto rule_num = degree/2;
+    if (rule_num >= rules.size())
+        throw std::invalid_argument("Gauss quadrature: degree too high");
+
+    return rules[rule_num];
+}
+
+template<typename T>
+const reference_rule<T,3>&
+triangle_rule(size_t degree)
+{
+    static const auto rules = [] {
+        std::vector<reference_rule<T,3>> ret;
+        for (size_t i = 0; dunavant_rules[i].num_entries != 0; i++)
+        {
+            reference_rule<T,3> rule;
+            rule.coords.reserve(dunavant_rules[i].num_points);
+            rule.weights.reserve(dunavant_rules[i].num_points);
+
+            for (size_t j = 0; j < dunavant_rules[i].num_entries; j++)
+            {
+                auto& dp = dunavant_rules[i].points[j];
+
+                /* The rules are stored in double, convert once to T */
+                T l0 = dp.coords[0];
+                T l1 = dp.coords[1];
+                T l2 = dp.coords[2];
+                T w = dp.weight;
+
+                switch (dp.perms)
+                {
+                    case 1:
+                        rule.push_back({l0, l1, l2}, w);
+                        break;
+
+                    case 3:
+                        rule.push_back({l0, l1, l2}, w);
+                        rule.push_back({l1, l2, l0}, w);
+                        rule.push_back({l1, l0, l2}, w);
+                        break;
+
+                    case 6:
+                        rule.push_back({l0, l1, l2}, w);
+                        rule.push_back({l0, l2, l1}, w);
+                        rule.push_back({l1, l0, l2}, w);
+                        rule.push_back({l1, l2, l0}, w);
+                        rule.push_back({l2, l0, l1}, w);
+                        rule.push_back({l2, l1, l0}, w);
+                        break;
+                }
+            }
+            ret.push_back( std::move(rule) );
+        }
+        return ret;
+    }();
+
+    size_t rule_num = (degree == 0) ? 0 : degree - 1;
+    if (rule_num >= rules.size())
+        throw std::invalid_argument("Dunavant quadrature: degree too high");
+
+    return rules[rule_num];
+}
+
+/* Tensorized Gauss points, xi runs faster than eta */
+template<typename T>
+const reference_rule<T,2>&
+quadrangle_rule(size_t degree)
+{
+    static const auto rules = [] {
+        std::vector<reference_rule<T,2>> ret;
+        for (size_t i = 0; gauss_rules[i].num_entries != 0; i++)
+        {
+            auto& sr = segment_rule<T>(2*i);
+            reference_rule<T,2> rule;
+            for (size_t jy = 0; jy < sr.size(); jy++)
+                for (size_t jx = 0; jx < sr.size(); jx++)
+                    rule.push_back({sr.coords[jx][0], sr.coords[jy][0]},
+                                   sr.weights[jx] * sr.weights[jy]);
+            ret.push_back( std::move(rule) );
+        }
+        return ret;
+    }();
+
+    auto rule_num = degree/2;
+    if (rule_num >= rules.size())
+        throw std::invalid_argument("Gauss quadrature: degree too high");
+
+    return rules[rule_num];
+}
+
+template<typename T>
+std::vector<std::pair<point<T, 1>, T>>
+gauss_legendre_tab(size_t degree)
+{
+    auto& rule = segment_rule<T>(degree);
+    std::vector<std::pair<point<T, 1>, T>> ret;
+    ret.reserve(rule.size());
+    for (size_t i = 0; i < rule.size(); i++)
+        ret.push_back( {point<T,1>({rule.coords[i][0]}), rule.weights[i]} );
+
+    return ret;
+}
+
+/* Map the reference Dunavant rule on the triangle (p0, p1, p2). The
+ * points are stored in 'ret', which is reused: once it is large enough
+ * no allocation happens. */
+template<typename T>
+void
 triangle_quadrature_dunavant(const point<T,2>& p0,
                              const point<T,2>& p1,
                              const point<T,2>& p2,
-                             size_t degree)
+                             size_t degree,
+                             std::vector<quadrature_point<T,2>>& ret)
 {
-    auto max_degree = sizeof(dunavant_rules)/sizeof(dunavant_rule);
-    if (degree > max_degree)
-        throw std::invalid_argument("Dunavant quadrature: degree too high");
-
-    size_t rule_num = (degree == 0) ? 0 : degree - 1;
-    assert(rule_num < max_degree-1);
+    auto& rule = triangle_rule<T>(degree);
 
     auto v0 = p1 - p0;
     auto v1 = p2 - p0;
-    auto area = std::abs( (v0.x() * v1.y() - v0.y() * v1.x())/2.0 );
+    T area = std::abs( (v0.x() * v1.y() - v0.y() * v1.x())/2 );
 
-    auto num_entries = detail::dunavant_rules[rule_num].num_entries;
-    auto num_points = detail::dunavant_rules[rule_num].num_points;
-
-    std::vector<quadrature_point<T,2>> ret;
-    ret.reserve(num_points);
-
-    for (size_t i = 0; i < num_entries; i++)
+    ret.clear();
+    ret.reserve(rule.size());
+    for (size_t i = 0; i < rule.size(); i++)
     {
-        auto& dp = detail::dunavant_rules[rule_num].points[i];
-        
-        auto l0 = dp.coords[0];
-        auto l1 = dp.coords[1];
-        auto l2 = dp.coords[2];
-        auto w = dp.weight;
-        
-        switch (dp.perms)
-        {
-            case 1:
-                ret.push_back({p0*l0 + p1*l1 + p2*l2, w*area});
-                break;
-                
-            case 3:
-                ret.push_back({p0*l0 + p1*l1 + p2*l2, w*area});
-                ret.push_back({p0*l1 + p1*l2 + p2*l0, w*area});
-                ret.push_back({p0*l1 + p1*l0 + p2*l2, w*area});
-                break;
-            
-            case 6:
-                ret.push_back({p0*l0 + p1*l1 + p2*l2, w*area});
-                ret.push_back({p0*l0 + p1*l2 + p2*l1, w*area});
-                ret.push_back({p0*l1 + p1*l0 + p2*l2, w*area});
-                ret.push_back({p0*l1 + p1*l2 + p2*l0, w*area});
-                ret.push_back({p0*l2 + p1*l0 + p2*l1, w*area});
-                ret.push_back({p0*l2 + p1*l1 + p2*l0, w*area});
-                break;
-        }
+        auto& l = rule.coords[i];
+        ret.push_back({p0*l[0] + p1*l[1] + p2*l[2], rule.weights[i]*area});
     }
+}
 
+template<typename T>
+std::vector<quadrature_point<T,2>>
+triangle_quadrature_dunavant(const point<T,2>& p0,
+                             const point<T,2>& p1,
+                             const point<T,2>& p2,
+                             size_t degree)
+{
+    std::vector<quadrature_point<T,2>> ret;
+    triangle_quadrature_dunavant(p0, p1, p2, degree, ret);
     return ret;
 }
+
 /*
 void print_rule_details(void)
 {
@@ -659,7 +767,7 @@ triangle_quadrature_low_order(const point<T,2>& p0,
     std::vector<quadrature_point<T,2>>   ret;
     auto v0 = p1 - p0;
     auto v1 = p2 - p0;
-    auto area = std::abs( (v0.x() * v1.y() - v0.y() * v1.x())/2.0 );
+    T area = std::abs( (v0.x() * v1.y() - v0.y() * v1.x())/2 );
     point<T,2>      qp;
     T               qw;
     T               a1 = (6. - std::sqrt(15.)) / 21;
@@ -720,55 +828,92 @@ gauss_legendre(size_t degree)
     return detail::gauss_legendre_tab<T>(degree);
 }
 
+/* All the integrate() functions come in two versions: one returns a new
+ * vector of quadrature points, the other stores them in 'ret', reusing
+ * its storage. The reference rules are precomputed, only the mapping to
+ * the element is done at each call: in the loops on the elements, the
+ * second version does not allocate. */
 template<typename Mesh>
-std::vector<quadrature_point<typename Mesh::coordinate_type,2>>
+void
 integrate(const Mesh& msh,
           const typename Mesh::face_type& fc,
-          size_t degree)
+          size_t degree,
+          std::vector<quadrature_point<typename Mesh::coordinate_type,2>>& ret)
 {
     using T = typename Mesh::coordinate_type;
-    std::vector<quadrature_point<T,2>> ret;
-    auto raw_qps = gauss_legendre<T>(degree);
+    auto& rule = detail::segment_rule<T>(degree);
     auto meas = measure(msh, fc);
     auto pts  = points(msh, fc);
 
-    for (auto itor = raw_qps.begin(); itor != raw_qps.end(); itor++)
+    ret.clear();
+    ret.reserve(rule.size());
+    for (size_t i = 0; i < rule.size(); i++)
     {
-        auto raw_qp = *itor;
-        auto t  = raw_qp.first.x();
-        auto qp  = 0.5 * (1 - t) * pts[0] + 0.5 * (1 + t) * pts[1];
-        auto qw  = raw_qp.second * meas * 0.5;
+        auto t  = rule.coords[i][0];
+        auto qp = 0.5 * (1 - t) * pts[0] + 0.5 * (1 + t) * pts[1];
+        T qw    = rule.weights[i] * meas * 0.5;
 
         ret.push_back({qp,qw});
     }
+}
 
+template<typename Mesh>
+std::vector<quadrature_point<typename Mesh::coordinate_type,2>>
+integrate(const Mesh& msh,
+          const typename Mesh::face_type& fc,
+          size_t degree)
+{
+    std::vector<quadrature_point<typename Mesh::coordinate_type,2>> ret;
+    integrate(msh, fc, degree, ret);
     return ret;
 }
 
 template<typename T>
-std::vector<quadrature_point<T,2>>
+void
 integrate(const simplicial_mesh<T>& msh,
           const typename simplicial_mesh<T>::cell_type& cl,
-          size_t degree)
+          size_t degree,
+          std::vector<quadrature_point<T,2>>& ret)
 {
-#ifdef USE_DUNAVANT
     auto pts = points(msh, cl);
-    return detail::triangle_quadrature_dunavant(pts[0], pts[1], pts[2], degree);
+#ifdef USE_DUNAVANT
+    detail::triangle_quadrature_dunavant(pts[0], pts[1], pts[2], degree, ret);
 #else /* USE_DUNAVANT */
-    auto pts = points(msh, cl);
-    return detail::triangle_quadrature_low_order(pts[0], pts[1], pts[2], degree);
+    ret = detail::triangle_quadrature_low_order(pts[0], pts[1], pts[2], degree);
 #endif /* USE_DUNAVANT */
 }
 
+template<typename T>
+std::vector<quadrature_point<T,2>>
+integrate(const simplicial_mesh<T>& msh,
+          const typename simplicial_mesh<T>::cell_type& cl,
+          size_t degree)
+{
+    std::vector<quadrature_point<T,2>> ret;
+    integrate(msh, cl, degree, ret);
+    return ret;
+}
+
+template<typename T>
+void
+integrate(const refelem::reference_triangle<T>& t,
+          size_t degree,
+          std::vector<quadrature_point<T,2>>& ret)
+{
+    detail::triangle_quadrature_dunavant(t.points[0],
+                                         t.points[1],
+                                         t.points[2],
+                                         degree, ret);
+}
+
 template<typename T>
 std::vector<quadrature_point<T,2>>
 integrate(const refelem::reference_triangle<T>& t,
           size_t degree)
 {
-    return detail::triangle_quadrature_dunavant(t.points[0],
-                                                t.points[1],
-                                                t.points[2],
-                                                degree);
+    std::vector<quadrature_point<T,2>> ret;
+    integrate(t, degree, ret);
+    return ret;
 }
 
 /* Quadrature for cartesian quadrangles, it is just tensorized Gauss points. */
@@ -776,41 +921,27 @@ template<typename T>
 std::vector<std::pair<point<T, 2>, T>>
 quadrangle_quadrature(const size_t degree)
 {
-    auto qps = gauss_legendre<T>(degree);
+    auto& rule = detail::quadrangle_rule<T>(degree);
 
     std::vector<std::pair<point<T, 2>, T>> ret;
-    ret.reserve(qps.size() * qps.size());
-
-    for (auto jtor = qps.begin(); jtor != qps.end(); jtor++)
+    ret.reserve(rule.size());
+    for (size_t i = 0; i < rule.size(); i++)
     {
-        auto qp_y = *jtor;
-        auto eta  = qp_y.first.x();
-
-        for (auto itor = qps.begin(); itor != qps.end(); itor++)
-        {
-            auto qp_x = *itor;
-            auto xi   = qp_x.first.x();
-
-            auto qw2d = qp_x.second * qp_y.second;
-            auto qp2d = point<T, 2>({xi, eta});
-
-            ret.push_back({qp2d, qw2d});
-        }
+        auto qp2d = point<T, 2>({rule.coords[i][0], rule.coords[i][1]});
+        ret.push_back({qp2d, rule.weights[i]});
     }
 
     return ret;
 }
 
 template<typename T>
-std::vector<quadrature_point<T, 2>>
+void
 integrate(const quad_mesh<T>& msh,
           const typename quad_mesh<T>::cell_type& cl,
-          size_t degree)
+          size_t degree,
+          std::vector<quadrature_point<T, 2>>& ret)
 {
-    auto raw_qps = quadrangle_quadrature<T>(degree);
-
-    std::vector<quadrature_point<T, 2>> ret;
-    ret.reserve(raw_qps.size());
+    auto& rule = detail::quadrangle_rule<T>(degree);
 
     auto pts = points(msh, cl);
 
@@ -844,19 +975,30 @@ integrate(const quad_mesh<T>& msh,
         return std::abs(j11 * j22 - j12 * j21);
     };
 
-    for (auto& raw_qp : raw_qps)
+    ret.clear();
+    ret.reserve(rule.size());
+    for (size_t i = 0; i < rule.size(); i++)
     {
-        auto xi  = raw_qp.first.x();
-        auto eta = raw_qp.first.y();
+        auto xi  = rule.coords[i][0];
+        auto eta = rule.coords[i][1];
 
         auto px = P(xi, eta);
         auto py = Q(xi, eta);
 
-        auto qw = raw_qp.second * J(xi, eta);
+        auto qw = rule.weights[i] * J(xi, eta);
         auto qp = point<T, 2>({px, py});
         ret.push_back({qp, qw});
     }
+}
 
+template<typename T>
+std::vector<quadrature_point<T, 2>>
+integrate(const quad_mesh<T>& msh,
+          const typename quad_mesh<T>::cell_type& cl,
+          size_t degree)
+{
+    std::vector<quadrature_point<T, 2>> ret;
+    integrate(msh, cl, degree, ret);
     return ret;
 }
 
@@ -0,0 +1,335 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+#include "mesh.hpp"
+
+/* Mesh reordering for memory locality. The meshers produce the cells in
+ * lexicographic order of their point numbers, so cells that are close in
+ * the domain can be very far in memory. Renumbering the cells along a
+ * space-filling curve, or with Reverse Cuthill-McKee on the face graph,
+ * keeps the neighbours of a cell close in memory and reduces the
+ * bandwidth of the DG matrices.
+ *
+ * A reordered mesh can still be refined: the meshers number the children
+ * of the cell c as 4c, ..., 4c+3, so the refined mesh inherits the
+ * ordering of the coarse one. */
+
+namespace yaourt {
+
+enum class mesh_ordering {
+    NONE,
+    HILBERT,
+    REVERSE_CUTHILL_MCKEE
+};
+
+namespace priv {
+
+/* Position of (x, y) along the Hilbert curve filling the 2^bits x 2^bits
+ * grid */
+inline uint64_t
+hilbert_index(uint32_t x, uint32_t y, unsigned int bits)
+{
+    uint64_t d = 0;
+    for (uint32_t s = uint32_t(1) << (bits-1); s > 0; s >>= 1)
+    {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += uint64_t(s) * s * ((3 * rx) ^ ry);
+
+        /* Rotate the quadrant */
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s-1 - (x & (s-1));
+                y = s-1 - (y & (s-1));
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return d;
+}
+
+} //namespace priv
+
+/* Cell permutation along the Hilbert curve through the barycenters: the
+ * i-th cell of the new numbering is the cell perm[i] of the old one. */
+template<typename Mesh>
+std::vector<size_t>
+hilbert_ordering(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+    const unsigned int bits = 16;
+
+    std::vector<typename Mesh::point_type> bars;
+    bars.reserve( msh.cells.size() );
+    for (auto& cl : msh.cells)
+        bars.push_back( barycenter(msh, cl) );
+
+    std::vector<size_t> perm( msh.cells.size() );
+    if ( bars.empty() )
+        return perm;
+
+    auto min = bars[0];
+    auto max = bars[0];
+    for (auto& bar : bars)
+    {
+        min.x() = std::min(min.x(), bar.x()); max.x() = std::max(max.x(), bar.x());
+        min.y() = std::min(min.y(), bar.y()); max.y() = std::max(max.y(), bar.y());
+    }
+
+    /* Same scale on both axes, to follow the geometry of the domain */
+    T len = std::max(max.x() - min.x(), max.y() - min.y());
+    if (len <= 0.0)
+        len = 1.0;
+    T scale = T((uint32_t(1) << bits) - 1) / len;
+
+    std::vector<uint64_t> keys( bars.size() );
+    for (size_t i = 0; i < bars.size(); i++)
+    {
+        auto x = uint32_t( (bars[i].x() - min.x()) * scale );
+        auto y = uint32_t( (bars[i].y() - min.y()) * scale );
+        keys[i] = priv::hilbert_index(x, y, bits);
+        perm[i] = i;
+    }
+
+    std::stable_sort(perm.begin(), perm.end(),
+        [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    return perm;
+}
+
+/* Reverse Cuthill-McKee permutation of the cells, on the graph of the
+ * cells sharing a face. Each connected component is started from a
+ * pseudo-peripheral cell. Requires the connectivity. */
+template<typename Mesh>
+std::vector<size_t>
+rcm_ordering(const Mesh& msh)
+{
+    if ( !msh.has_connectivity() )
+        throw std::logic_error("No connectivity information.");
+
+    const size_t num_cells = msh.cells.size();
+
+    auto neighbours = [&](size_t cl_id) {
+        std::vector<size_t> ret;
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            if (has_neighbour)
+                ret.push_back(ncl_id);
+        }
+        return ret;
+    };
+
+    std::vector<size_t> degree(num_cells);
+    for (size_t i = 0; i < num_cells; i++)
+        degree[i] = neighbours(i).size();
+
+    /* Breadth-first visit from 'root' of the cells not yet numbered, the
+     * neighbours are visited by increasing degree. The visited cells are
+     * appended to 'order'. */
+    std::vector<bool> visited(num_cells, false);
+    auto bfs = [&](size_t root, std::vector<size_t>& order) {
+        std::queue<size_t> q;
+        q.push(root);
+        visited[root] = true;
+        while ( !q.empty() )
+        {
+            auto cur = q.front();
+            q.pop();
+            order.push_back(cur);
+
+            auto neighs = neighbours(cur);
+            std::sort(neighs.begin(), neighs.end(),
+                [&](size_t a, size_t b) { return degree[a] < degree[b]; });
+            for (auto& n : neighs)
+            {
+                if (visited[n])
+                    continue;
+                visited[n] = true;
+                q.push(n);
+            }
+        }
+    };
+
+    std::vector<size_t> perm;
+    perm.reserve(num_cells);
+
+    std::vector<size_t> by_degree(num_cells);
+    for (size_t i = 0; i < num_cells; i++)
+        by_degree[i] = i;
+    std::stable_sort(by_degree.begin(), by_degree.end(),
+        [&](size_t a, size_t b) { return degree[a] < degree[b]; });
+
+    for (auto& start : by_degree)
+    {
+        if (visited[start])
+            continue;
+
+        /* One sweep to move the root to the far end of the component:
+         * the last cell visited from a cell of minimum degree. */
+        std::vector<size_t> component;
+        bfs(start, component);
+        for (auto& c : component)
+            visited[c] = false;
+
+        bfs(component.back(), perm);
+    }
+
+    std::reverse(perm.begin(), perm.end());
+    return perm;
+}
+
+/* Renumber the cells of the mesh: the i-th cell of the new numbering is
+ * the cell perm[i] of the old one. The faces are renumbered in the order
+ * they are first touched by the new cell numbering, so that the faces of
+ * a cell are close in memory too. face_owners, cell_faces, the hanging
+ * faces and the lookup indices are updated, all the cell and face numbers previously obtained
+ * from the mesh are invalidated. */
+template<typename Mesh>
+void
+reorder_mesh(Mesh& msh, const std::vector<size_t>& perm)
+{
+    YAOURT_TIMED_SCOPE("mesh.reorder");
+
+    const size_t num_cells = msh.cells.size();
+    const size_t num_faces = msh.faces.size();
+
+    if (perm.size() != num_cells)
+        throw std::invalid_argument("reorder_mesh: wrong permutation size");
+
+    if ( !msh.has_connectivity() )
+        msh.compute_connectivity();
+
+    std::vector<size_t> cell_new(num_cells, NO_OWNER);
+    for (size_t i = 0; i < num_cells; i++)
+    {
+        if (perm[i] >= num_cells or cell_new[ perm[i] ] != NO_OWNER)
+            throw std::invalid_argument("reorder_mesh: not a permutation");
+        cell_new[ perm[i] ] = i;
+    }
+
+    std::vector<size_t> face_new(num_faces, NO_OWNER);
+    std::vector<typename Mesh::face_type> new_faces;
+    new_faces.reserve(num_faces);
+    for (size_t i = 0; i < num_cells; i++)
+    {
+        for (auto& fcid : msh.cell_faces[ perm[i] ])
+        {
+            if (face_new[fcid] != NO_OWNER)
+                continue;
+            face_new[fcid] = new_faces.size();
+            new_faces.push_back( msh.faces[fcid] );
+        }
+    }
+
+    if (new_faces.size() != num_faces)
+        throw std::logic_error("reorder_mesh: faces not belonging to any cell");
+
+    std::vector<typename Mesh::cell_type> new_cells;
+    new_cells.reserve(num_cells);
+    decltype(msh.cell_faces) new_cell_faces(num_cells);
+    for (size_t i = 0; i < num_cells; i++)
+    {
+        new_cells.push_back( msh.cells[ perm[i] ] );
+
+        const auto& old_fcids = msh.cell_faces[ perm[i] ];
+        for (size_t j = 0; j < old_fcids.size(); j++)
+            new_cell_faces[i][j] = face_new[ old_fcids[j] ];
+    }
+
+    /* As in compute_connectivity(), the first owner of a face is the cell
+     * with the lowest number */
+    decltype(msh.face_owners) new_face_owners(num_faces);
+    for (size_t i = 0; i < num_faces; i++)
+    {
+        auto fo = msh.face_owners[i];
+        for (auto& o : fo)
+            if (o != NO_OWNER)
+                o = cell_new[o];
+
+        if (fo[1] < fo[0])
+            std::swap(fo[0], fo[1]);
+
+        new_face_owners[ face_new[i] ] = fo;
+    }
+
+    for (auto& hf : msh.hanging_faces)
+        for (auto& fc_id : hf)
+            fc_id = face_new[fc_id];
+
+    msh.cells       = std::move(new_cells);
+    msh.faces       = std::move(new_faces);
+    msh.cell_faces  = std::move(new_cell_faces);
+    msh.face_owners = std::move(new_face_owners);
+    msh.compute_lookup();
+}
+
+/* Cell permutation of the given ordering, as taken by reorder_mesh().
+ * The identity for mesh_ordering::NONE. */
+template<typename Mesh>
+std::vector<size_t>
+cell_permutation(Mesh& msh, mesh_ordering ordering)
+{
+    YAOURT_TIMED_SCOPE("mesh.ordering");
+
+    switch (ordering)
+    {
+        case mesh_ordering::NONE:
+        {
+            std::vector<size_t> perm( msh.cells.size() );
+            for (size_t i = 0; i < perm.size(); i++)
+                perm[i] = i;
+            return perm;
+        }
+
+        case mesh_ordering::HILBERT:
+            return hilbert_ordering(msh);
+
+        case mesh_ordering::REVERSE_CUTHILL_MCKEE:
+            if ( !msh.has_connectivity() )
+                msh.compute_connectivity();
+            return rcm_ordering(msh);
+    }
+
+    throw std::invalid_argument("reorder_mesh: unknown ordering");
+}
+
+/* Renumber the cells and the faces of the mesh with the given ordering */
+template<typename Mesh>
+void
+reorder_mesh(Mesh& msh, mesh_ordering ordering)
+{
+    if (ordering == mesh_ordering::NONE)
+        return;
+
+    reorder_mesh(msh, cell_permutation(msh, ordering));
+}
+
+} //namespace yaourt
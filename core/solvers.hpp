@@ -17,9 +17,146 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #include <blaze/Math.h>
+#include <chrono>
+#include <cmath>
 #include <fstream>
+#include <iostream>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+
+#include "instrumentation.hpp"
+
+/* The solvers below are generic on the linear operator A. It can be
+ *  - a matrix, i.e. any type providing rows(), columns(), A*x and
+ *    trans(A)*x for a blaze::DynamicVector x (blaze::CompressedMatrix)
+ *  - a linear operator, i.e. a type providing rows(), columns() and
+ *      void apply(const blaze::DynamicVector<T>& x,
+ *                 blaze::DynamicVector<T>& y) const;         // y = A*x
+ *    where apply() resizes y if needed, and optionally
+ *      void apply_transpose(const blaze::DynamicVector<T>& x,
+ *                           blaze::DynamicVector<T>& y) const; // y = A'*x
+ *    The transpose is needed only for QMR and for the normal equations.
+ *    yaourt::bsr_matrix is used through apply(), so the products of the
+ *    iterations write in the work vectors of the solver.
+ * If the operator also provides
+ *      T reduce(T val) const;
+ * the vectors are considered distributed: dot products and norms are
+ * computed on the local part and then summed by reduce(), see
+ * core/distributed.hpp. CG and BiCGSTAB support distributed operators.
+ */
+namespace yaourt {
+namespace detail {
+
+template<typename Op, typename T, typename = void>
+struct has_apply : std::false_type {};
+
+template<typename Op, typename T>
+struct has_apply<Op, T, std::void_t<decltype(
+    std::declval<const Op&>().apply(std::declval<const blaze::DynamicVector<T>&>(),
+                                    std::declval<blaze::DynamicVector<T>&>())
+)>> : std::true_type {};
+
+template<typename Op, typename T, typename = void>
+struct has_apply_transpose : std::false_type {};
+
+template<typename Op, typename T>
+struct has_apply_transpose<Op, T, std::void_t<decltype(
+    std::declval<const Op&>().apply_transpose(std::declval<const blaze::DynamicVector<T>&>(),
+                                              std::declval<blaze::DynamicVector<T>&>())
+)>> : std::true_type {};
+
+template<typename Op, typename T, typename = void>
+struct has_reduce : std::false_type {};
+
+template<typename Op, typename T>
+struct has_reduce<Op, T, std::void_t<decltype(
+    std::declval<const Op&>().reduce(std::declval<T>())
+)>> : std::true_type {};
+
+/* True if trans(A)*x can be computed */
+template<typename Op, typename T>
+constexpr bool can_transpose = !has_apply<Op, T>::value ||
+                               has_apply_transpose<Op, T>::value;
+
+/* y = A*x */
+template<typename Op, typename T>
+void
+apply_operator(const Op& A, const blaze::DynamicVector<T>& x,
+               blaze::DynamicVector<T>& y)
+{
+    if constexpr (has_apply<Op, T>::value)
+        A.apply(x, y);
+    else
+        y = A*x;
+}
+
+/* y = trans(A)*x */
+template<typename Op, typename T>
+void
+apply_operator_transpose(const Op& A, const blaze::DynamicVector<T>& x,
+                         blaze::DynamicVector<T>& y)
+{
+    if constexpr (has_apply_transpose<Op, T>::value)
+        A.apply_transpose(x, y);
+    else if constexpr (!has_apply<Op, T>::value)
+        y = trans(A)*x;
+    else
+        throw std::logic_error("The operator does not provide apply_transpose()");
+}
+
+/* Sum of the local contributions 'val' of all the parts of a distributed
+ * operator, 'val' itself otherwise */
+template<typename Op, typename T>
+T
+global_sum(const Op& A, T val)
+{
+    if constexpr (has_reduce<Op, T>::value)
+        return A.reduce(val);
+    else
+        return val;
+}
+
+template<typename Op, typename T>
+T
+global_dot(const Op& A, const blaze::DynamicVector<T>& x,
+           const blaze::DynamicVector<T>& y)
+{
+    return global_sum(A, T(dot(x,y)));
+}
+
+template<typename Op, typename T>
+T
+global_norm(const Op& A, const blaze::DynamicVector<T>& x)
+{
+    if constexpr (has_reduce<Op, T>::value)
+        return std::sqrt( A.reduce( T(dot(x,x)) ) );
+    else
+        return norm(x);
+}
+
+/* y = trans(A)*A*x if normal equations are used, y = A*x otherwise.
+ * 'tmp' is scratch space. */
+template<typename Op, typename T>
+void
+apply_system(const Op& A, bool use_normal_eqns, const blaze::DynamicVector<T>& x,
+             blaze::DynamicVector<T>& y, blaze::DynamicVector<T>& tmp)
+{
+    if (use_normal_eqns)
+    {
+        apply_operator(A, x, tmp);
+        apply_operator_transpose(A, tmp, y);
+    }
+    else
+        apply_operator(A, x, y);
+}
+
+} // namespace detail
+} // namespace yaourt
 
 template<typename T>
 struct conjugated_gradient_params
@@ -31,121 +168,173 @@ struct conjugated_gradient_params
     bool            save_iteration_history;
     bool            use_initial_guess;
     bool            use_normal_eqns;
+    double          verbose_interval;   /* seconds between progress prints */
     std::string     history_filename;
 
+    /* Mixed precision solvers only: relative tolerance of each inner
+     * solve and maximum number of refinement steps */
+    T               inner_rr_tol;
+    size_t          max_refinements;
+
     conjugated_gradient_params() : rr_tol(1e-8),
                                    rr_max(20),
                                    max_iter(100),
                                    verbose(false),
                                    save_iteration_history(false),
                                    use_initial_guess(false),
-                                   use_normal_eqns(false) {}
+                                   use_normal_eqns(false),
+                                   verbose_interval(0.1),
+                                   inner_rr_tol(1e-4),
+                                   max_refinements(20) {}
 };
 
-// TODO: return false and some kind of error in case of non convergence.
-template<typename T>
-bool
-conjugated_gradient(const conjugated_gradient_params<T>& cgp,
-                    const blaze::CompressedMatrix<T>& A,
-                    const blaze::DynamicVector<T>& b,
-                    blaze::DynamicVector<T>& x)
+namespace yaourt {
+namespace detail {
+
+/* Print the progress of an iterative solver on a single line. Printing
+ * and flushing at each iteration is expensive when iterations are fast,
+ * so the line is updated at most once every 'interval' seconds. */
+class progress_reporter
 {
-    if ( A.rows() != A.columns() )
-    {
-        if (cgp.verbose)
-            std::cout << "[CG solver] A square matrix is required" << std::endl;
+    using clock = std::chrono::steady_clock;
 
-        return false;
-    }
+    bool                enabled, first;
+    double              interval;
+    clock::time_point   last;
 
-    size_t N = A.columns();
+public:
+    progress_reporter(bool p_enabled, double p_interval)
+        : enabled(p_enabled), first(true), interval(p_interval)
+    {}
 
-    if (b.size() != N)
+    template<typename T>
+    void report(size_t iter, T rr)
     {
-        if (cgp.verbose)
-            std::cout << "[CG solver] Wrong size of RHS vector" << std::endl;
+        if (!enabled)
+            return;
 
-        return false;
+        auto now = clock::now();
+        if (!first && std::chrono::duration<double>(now - last).count() < interval)
+            return;
+
+        first = false;
+        last = now;
+
+        std::cout << "                                                 \r";
+        std::cout << " -> Iteration " << iter << ", rr = ";
+        std::cout << rr << "\b\r";
+        std::cout.flush();
     }
 
-    if (x.size() != N)
+    template<typename T>
+    void done(size_t iter, T rr)
     {
-        if (cgp.verbose)
-            std::cout << "[CG solver] Wrong size of solution vector" << std::endl;
-
-        return false;
+        if (enabled)
+            std::cout << " -> Iteration " << iter << ", rr = " << rr << std::endl;
     }
+};
 
-    if (!cgp.use_initial_guess)
-        x = blaze::DynamicVector<T>(N, 0.0);
+/* x = x + alpha*d, r = r - alpha*y and return dot(r,r), in a single pass */
+template<typename T>
+T
+fused_cg_update(blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& r,
+                const blaze::DynamicVector<T>& d,
+                const blaze::DynamicVector<T>& y, T alpha)
+{
+    const size_t N = x.size();
+    T       *xp = x.data(), *rp = r.data();
+    const T *dp = d.data(), *yp = y.data();
 
-    size_t                      iter = 0;
-    T                           nr, nr0;
-    T                           alpha, beta, rho;
+    T rr = 0.0;
+    for (size_t i = 0; i < N; i++)
+    {
+        xp[i] += alpha * dp[i];
+        T ri = rp[i] - alpha * yp[i];
+        rp[i] = ri;
+        rr += ri * ri;
+    }
 
-    blaze::DynamicVector<T> d(N), r(N), r0(N), y(N);
+    return rr;
+}
 
-    if (cgp.use_normal_eqns)
-        r0 = d = r = trans(A)*(b - A*x);
-    else
-        r0 = d = r = b - A*x;
+/* d = z + beta*d */
+template<typename T>
+void
+fused_xpby(const blaze::DynamicVector<T>& z, T beta, blaze::DynamicVector<T>& d)
+{
+    const size_t N = d.size();
+    T       *dp = d.data();
+    const T *zp = z.data();
 
-    nr = nr0 = norm(r);
+    for (size_t i = 0; i < N; i++)
+        dp[i] = zp[i] + beta * dp[i];
+}
 
-    std::ofstream iter_hist_ofs;
-    if (cgp.save_iteration_history)
-        iter_hist_ofs.open(cgp.history_filename);
+} // namespace detail
+} // namespace yaourt
 
-    while ( nr/nr0 > cgp.rr_tol && iter < cgp.max_iter && nr/nr0 < cgp.rr_max )
+/* Conjugated gradient solver, optionally preconditioned. The work vectors
+ * are kept in the object, so repeated solves of the same size do not
+ * allocate. Apart from the operator application, each iteration updates
+ * the vectors and computes the residual norm in a single pass over the
+ * memory, and the dot product of the previous iteration is reused.
+ * solve() returns false if the relative residual did not reach
+ * cgp.rr_tol, because of max_iter, rr_max or a breakdown. */
+template<typename T>
+class conjugated_gradient_solver
+{
+    conjugated_gradient_params<T>   cgp;
+    blaze::DynamicVector<T>         d, r, y, z, tmp;
+    size_t                          m_iterations;
+    T                               m_rr;
+
+    template<typename Matrix, typename Precond>
+    bool do_solve(const Matrix& A, const blaze::DynamicVector<T>& b,
+                  blaze::DynamicVector<T>& x, const Precond *iM);
+
+public:
+    conjugated_gradient_solver()
+        : m_iterations(0), m_rr(0.0)
+    {}
+
+    conjugated_gradient_solver(const conjugated_gradient_params<T>& p_cgp)
+        : cgp(p_cgp), m_iterations(0), m_rr(0.0)
+    {}
+
+    conjugated_gradient_params<T>& params() { return cgp; }
+    const conjugated_gradient_params<T>& params() const { return cgp; }
+
+    /* Iterations and relative residual of the last solve */
+    size_t iterations() const { return m_iterations; }
+    T relative_residual() const { return m_rr; }
+
+    template<typename Matrix>
+    bool solve(const Matrix& A, const blaze::DynamicVector<T>& b,
+               blaze::DynamicVector<T>& x)
     {
-        if (cgp.verbose )
-        {
-            std::cout << "                                                 \r";
-            std::cout << " -> Iteration " << iter << ", rr = ";
-            std::cout << nr/nr0 << "\b\r";
-            std::cout.flush();
-        }
-
-        if (cgp.save_iteration_history)
-            iter_hist_ofs << nr/nr0 << std::endl;
-
-        if (cgp.use_normal_eqns)
-            y = trans(A)*A*d;
-        else
-            y = A*d;
-
-        rho = dot(r,r);
-        alpha = rho/dot(d,y);
-        x = x + alpha * d;
-        r = r - alpha * y;
-        beta = dot(r,r)/rho;
-        d = r + beta * d;
-
-        nr = norm(r);
-        iter++;
+        return do_solve(A, b, x, static_cast<const blaze::CompressedMatrix<T> *>(nullptr));
     }
 
-    if (cgp.save_iteration_history)
+    /* Preconditioned version, 'iM' is the inverse of the preconditioner:
+     * either a matrix or a linear operator (see core/preconditioners.hpp) */
+    template<typename Matrix, typename Precond>
+    bool solve(const Matrix& A, const blaze::DynamicVector<T>& b,
+               blaze::DynamicVector<T>& x, const Precond& iM)
     {
-        iter_hist_ofs << nr/nr0 << std::endl;
-        iter_hist_ofs.close();
+        return do_solve(A, b, x, &iM);
     }
+};
 
-    if (cgp.verbose)
-        std::cout << " -> Iteration " << iter << ", rr = " << nr/nr0 << std::endl;
-
-    return true;
-}
-
-// TODO: return false and some kind of error in case of non convergence.
 template<typename T>
+template<typename Matrix, typename Precond>
 bool
-conjugated_gradient(const conjugated_gradient_params<T>& cgp,
-                    const blaze::CompressedMatrix<T>& A,
-                    const blaze::DynamicVector<T>& b,
-                    blaze::DynamicVector<T>& x,
-                    const blaze::CompressedMatrix<T>& iM)
+conjugated_gradient_solver<T>::do_solve(const Matrix& A,
+                                        const blaze::DynamicVector<T>& b,
+                                        blaze::DynamicVector<T>& x,
+                                        const Precond *iM)
 {
+    YAOURT_TIMED_SCOPE("solver.cg");
+
     if ( A.rows() != A.columns() )
     {
         if (cgp.verbose)
@@ -172,61 +361,79 @@ conjugated_gradient(const conjugated_gradient_params<T>& cgp,
         return false;
     }
 
+    if (cgp.use_normal_eqns && !yaourt::detail::can_transpose<Matrix, T>)
+    {
+        if (cgp.verbose)
+            std::cout << "[CG solver] Normal equations need trans(A)" << std::endl;
+
+        return false;
+    }
+
     if (!cgp.use_initial_guess)
-        x = blaze::DynamicVector<T>(N, 0.0);
+        x = 0.0;
+
+    d.resize(N); r.resize(N); y.resize(N); tmp.resize(N);
+    if (iM)
+        z.resize(N);
 
     size_t                      iter = 0;
     T                           nr, nr0;
-    T                           alpha, beta, rho;
-
-    blaze::DynamicVector<T> d(N), r(N), r0(N), y(N);
-    blaze::CompressedMatrix<T> real_iM;
+    T                           alpha, beta, rho, rr;
 
+    yaourt::detail::apply_operator(A, x, y);
+    y = b - y;
     if (cgp.use_normal_eqns)
+        yaourt::detail::apply_operator_transpose(A, y, r);
+    else
+        r = y;
+
+    rr = yaourt::detail::global_dot(A, r, r);
+    if (iM)
     {
-        r0 = r = trans(A)*(b - A*x);
-        real_iM = iM;
+        yaourt::detail::apply_operator(*iM, r, z);
+        rho = yaourt::detail::global_dot(A, r, z);
+        d = z;
     }
     else
     {
-        r0 = r = b - A*x;
-        real_iM = iM;
+        rho = rr;
+        d = r;
     }
 
-    d = real_iM * r0;
-
-    nr = nr0 = norm(r);
+    nr = nr0 = std::sqrt(rr);
 
     std::ofstream iter_hist_ofs;
     if (cgp.save_iteration_history)
         iter_hist_ofs.open(cgp.history_filename);
 
+    yaourt::detail::progress_reporter progress(cgp.verbose, cgp.verbose_interval);
+
     while ( nr/nr0 > cgp.rr_tol && iter < cgp.max_iter && nr/nr0 < cgp.rr_max )
     {
-        if (cgp.verbose )
-        {
-            std::cout << "                                                 \r";
-            std::cout << " -> Iteration " << iter << ", rr = ";
-            std::cout << nr/nr0 << "\b\r";
-            std::cout.flush();
-        }
+        progress.report(iter, nr/nr0);
 
         if (cgp.save_iteration_history)
-            iter_hist_ofs << nr/nr0 << std::endl;
+            iter_hist_ofs << nr/nr0 << "\n";
 
-        if (cgp.use_normal_eqns)
-            y = trans(A)*A*d;
+        yaourt::detail::apply_system(A, cgp.use_normal_eqns, d, y, tmp);
+
+        alpha = rho/yaourt::detail::global_dot(A, d, y);
+        rr = yaourt::detail::global_sum(A,
+                yaourt::detail::fused_cg_update(x, r, d, y, alpha));
+
+        T rho_old = rho;
+        if (iM)
+        {
+            yaourt::detail::apply_operator(*iM, r, z);
+            rho = yaourt::detail::global_dot(A, r, z);
+        }
         else
-            y = A*d;
+            rho = rr;
 
-        rho = dot(r,real_iM*r);
-        alpha = rho/dot(d,y);
-        x = x + alpha * d;
-        r = r - alpha * y;
-        beta = dot(r,real_iM*r)/rho;
-        d = real_iM*r + beta * d;
+        beta = rho/rho_old;
+        yaourt::detail::fused_xpby(iM ? z : r, beta, d);
 
-        nr = norm(r);
+        nr = std::sqrt(rr);
         iter++;
     }
 
@@ -236,20 +443,48 @@ conjugated_gradient(const conjugated_gradient_params<T>& cgp,
         iter_hist_ofs.close();
     }
 
-    if (cgp.verbose)
-        std::cout << " -> Iteration " << iter << ", rr = " << nr/nr0 << std::endl;
+    progress.done(iter, nr/nr0);
+    YAOURT_COUNT("solver.cg.iterations", iter);
 
-    return true;
+    m_iterations = iter;
+    m_rr = nr/nr0;
+
+    return nr == 0.0 or nr/nr0 <= cgp.rr_tol;
 }
 
-// TODO: return false and some kind of error in case of non convergence.
-template<typename T>
+template<typename T, typename Matrix>
+bool
+conjugated_gradient(const conjugated_gradient_params<T>& cgp,
+                    const Matrix& A,
+                    const blaze::DynamicVector<T>& b,
+                    blaze::DynamicVector<T>& x)
+{
+    conjugated_gradient_solver<T> cg(cgp);
+    return cg.solve(A, b, x);
+}
+
+template<typename T, typename Matrix, typename Precond>
+bool
+conjugated_gradient(const conjugated_gradient_params<T>& cgp,
+                    const Matrix& A,
+                    const blaze::DynamicVector<T>& b,
+                    blaze::DynamicVector<T>& x,
+                    const Precond& iM)
+{
+    conjugated_gradient_solver<T> cg(cgp);
+    return cg.solve(A, b, x, iM);
+}
+
+/* Returns false if the relative residual did not reach cgp.rr_tol */
+template<typename T, typename Matrix>
 bool
 bicgstab(const conjugated_gradient_params<T>& cgp,
-         const blaze::CompressedMatrix<T>& A,
+         const Matrix& A,
          const blaze::DynamicVector<T>& b,
          blaze::DynamicVector<T>& x)
 {
+    YAOURT_TIMED_SCOPE("solver.bicgstab");
+
     if ( A.rows() != A.columns() )
     {
         if (cgp.verbose)
@@ -276,6 +511,14 @@ bicgstab(const conjugated_gradient_params<T>& cgp,
         return false;
     }
 
+    if (cgp.use_normal_eqns && !yaourt::detail::can_transpose<Matrix, T>)
+    {
+        if (cgp.verbose)
+            std::cout << "[CG solver] Normal equations need trans(A)" << std::endl;
+
+        return false;
+    }
+
     if (!cgp.use_initial_guess)
         x = blaze::DynamicVector<T>(N, 0.0);
 
@@ -284,67 +527,58 @@ bicgstab(const conjugated_gradient_params<T>& cgp,
     T       alpha = 1.0, omega = 1.0, rho = 1.0;
 
     blaze::DynamicVector<T> r(N), r0(N), p(N, 0.0), v(N, 0.0);
-    blaze::DynamicVector<T> s(N), t(N);
+    blaze::DynamicVector<T> s(N), t(N), tmp(N);
 
+    yaourt::detail::apply_operator(A, x, tmp);
+    tmp = b - tmp;
     if (cgp.use_normal_eqns)
-        r0 = r = trans(A)*(b - A*x);
+        yaourt::detail::apply_operator_transpose(A, tmp, r);
     else
-        r0 = r = b - A*x;
+        r = tmp;
+    r0 = r;
 
-    nr = nr0 = norm(r);
+    nr = nr0 = yaourt::detail::global_norm(A, r);
 
     std::ofstream iter_hist_ofs;
     if (cgp.save_iteration_history)
         iter_hist_ofs.open(cgp.history_filename);
 
+    yaourt::detail::progress_reporter progress(cgp.verbose, cgp.verbose_interval);
+
     while ( nr/nr0 > cgp.rr_tol && iter < cgp.max_iter && nr/nr0 < cgp.rr_max )
     {
-        if ( cgp.verbose )
-        {
-            std::cout << "                                                 \r";
-            std::cout << " -> Iteration " << iter << ", rr = ";
-            std::cout << nr/nr0 << "\b\r";
-            std::cout.flush();
-        }
+        progress.report(iter, nr/nr0);
 
         if (cgp.save_iteration_history)
             iter_hist_ofs << nr/nr0 << std::endl;
 
         T rho_old = rho;
 
-        rho = dot(r,r0);
+        rho = yaourt::detail::global_dot(A, r, r0);
         if ( std::abs(rho) < 1e-9 )
         {
-            if (cgp.use_normal_eqns)
-                r = b - trans(A)*A*x;
-            else
-                r = b - A*x;
+            yaourt::detail::apply_system(A, cgp.use_normal_eqns, x, r, tmp);
+            r = b - r;
             r0 = r;
-            rho = dot(r,r0);
+            rho = yaourt::detail::global_dot(A, r, r0);
         }
 
         T beta = (rho/rho_old)*(alpha/omega);
         p = r + beta * (p - omega*v);
 
-        if (cgp.use_normal_eqns)
-            v = trans(A)*A*p;
-        else
-            v = A*p;
+        yaourt::detail::apply_system(A, cgp.use_normal_eqns, p, v, tmp);
 
-        alpha = rho / dot(v, r0);
+        alpha = rho / yaourt::detail::global_dot(A, v, r0);
         s = r - alpha*v;
 
-        if (cgp.use_normal_eqns)
-            t = trans(A)*A*s;
-        else
-            t = A*s;
+        yaourt::detail::apply_system(A, cgp.use_normal_eqns, s, t, tmp);
 
-        omega = dot(t,s)/dot(t,t);
+        omega = yaourt::detail::global_dot(A, t, s)/yaourt::detail::global_dot(A, t, t);
 
         x = x + alpha * p + omega * s;
         r = s - omega*t;
 
-        nr = norm(r);
+        nr = yaourt::detail::global_norm(A, r);
         iter++;
     }
 
@@ -354,20 +588,22 @@ bicgstab(const conjugated_gradient_params<T>& cgp,
         iter_hist_ofs.close();
     }
 
-    if (cgp.verbose)
-        std::cout << " -> Iteration " << iter << ", rr = " << nr/nr0 << std::endl;
+    progress.done(iter, nr/nr0);
+    YAOURT_COUNT("solver.bicgstab.iterations", iter);
 
-    return true;
+    return nr == 0.0 or nr/nr0 <= cgp.rr_tol;
 }
 
-template<typename T>
+template<typename T, typename Matrix, typename Precond>
 bool
 bicgstab(const conjugated_gradient_params<T>& cgp,
-         const blaze::CompressedMatrix<T>& A,
+         const Matrix& A,
          const blaze::DynamicVector<T>& b,
          blaze::DynamicVector<T>& x,
-         const blaze::CompressedMatrix<T>& iM)
+         const Precond& iM)
 {
+    YAOURT_TIMED_SCOPE("solver.bicgstab");
+
     if ( A.rows() != A.columns() )
     {
         if (cgp.verbose)
@@ -403,54 +639,51 @@ bicgstab(const conjugated_gradient_params<T>& cgp,
 
     blaze::DynamicVector<T> r(N), r0(N), p(N, 0.0), v(N, 0.0);
     blaze::DynamicVector<T> s(N), t(N);
-    blaze::DynamicVector<T> y(N), z(N);
+    blaze::DynamicVector<T> y(N), z(N), iMt(N);
 
-    r0 = r = b - A*x;
-    nr = nr0 = norm(r);
+    yaourt::detail::apply_operator(A, x, r);
+    r0 = r = b - r;
+    nr = nr0 = yaourt::detail::global_norm(A, r);
 
     std::ofstream iter_hist_ofs;
     if (cgp.save_iteration_history)
         iter_hist_ofs.open(cgp.history_filename);
 
+    yaourt::detail::progress_reporter progress(cgp.verbose, cgp.verbose_interval);
+
     while ( nr/nr0 > cgp.rr_tol && iter < cgp.max_iter && nr/nr0 < cgp.rr_max )
     {
-        if ( cgp.verbose )
-        {
-            std::cout << "                                                 \r";
-            std::cout << " -> Iteration " << iter << ", rr = ";
-            std::cout << nr/nr0 << "\b\r";
-            std::cout.flush();
-        }
+        progress.report(iter, nr/nr0);
 
         if (cgp.save_iteration_history)
             iter_hist_ofs << nr/nr0 << std::endl;
 
         T rho_old = rho;
 
-        rho = dot(r,r0);
+        rho = yaourt::detail::global_dot(A, r, r0);
         if ( std::abs(rho) < 1e-9 )
         {
-            r = b - A*x;
-            r0 = r;
-            rho = dot(r,r0);
+            yaourt::detail::apply_operator(A, x, r);
+            r0 = r = b - r;
+            rho = yaourt::detail::global_dot(A, r, r0);
         }
 
         T beta = (rho/rho_old)*(alpha/omega);
         p = r + beta * (p - omega*v);
-        y = iM*p;
-        v = A*y;
-        alpha = rho / dot(v, r0);
+        yaourt::detail::apply_operator(iM, p, y);
+        yaourt::detail::apply_operator(A, y, v);
+        alpha = rho / yaourt::detail::global_dot(A, v, r0);
         s = r - alpha*v;
-        z = iM*s;
-        t = A*z;
+        yaourt::detail::apply_operator(iM, s, z);
+        yaourt::detail::apply_operator(A, z, t);
 
-        auto iMt = iM*t;
-        omega = dot(iMt,z)/dot(iMt,iMt);
+        yaourt::detail::apply_operator(iM, t, iMt);
+        omega = yaourt::detail::global_dot(A, iMt, z)/yaourt::detail::global_dot(A, iMt, iMt);
 
         x = x + alpha * y + omega * z;
         r = s - omega*t;
 
-        nr = norm(r);
+        nr = yaourt::detail::global_norm(A, r);
         iter++;
     }
 
@@ -460,17 +693,188 @@ bicgstab(const conjugated_gradient_params<T>& cgp,
         iter_hist_ofs.close();
     }
 
-    if (cgp.verbose)
-        std::cout << " -> Iteration " << iter << ", rr = " << nr/nr0 << std::endl;
+    progress.done(iter, nr/nr0);
+    YAOURT_COUNT("solver.bicgstab.iterations", iter);
 
-    return true;
+    return nr == 0.0 or nr/nr0 <= cgp.rr_tol;
 }
-template<typename T>
+namespace yaourt {
+namespace detail {
+
+/* Parameters of the inner solves of the mixed precision solvers */
+template<typename L, typename T>
+conjugated_gradient_params<L>
+inner_params(const conjugated_gradient_params<T>& cgp)
+{
+    conjugated_gradient_params<L> ret;
+    ret.rr_tol              = cgp.inner_rr_tol;
+    ret.rr_max              = cgp.rr_max;
+    ret.max_iter            = cgp.max_iter;
+    ret.verbose             = false;
+    ret.use_initial_guess   = false;
+    ret.use_normal_eqns     = cgp.use_normal_eqns;
+    return ret;
+}
+
+} // namespace detail
+} // namespace yaourt
+
+/* Mixed precision iterative refinement. The solution and the residual
+ * r = b - A*x are computed in T, the correction equation A*c = r is solved
+ * in the lower precision L by inner_solve(r_lo, c_lo), which gets the
+ * residual normalized to avoid underflows and returns false if it did
+ * not converge. Each step reduces the residual
+ * by about the inner tolerance, so a few steps of a float solver reach the
+ * accuracy of T, while the Krylov iterations move half the bytes of the
+ * double ones. cgp.rr_tol is the tolerance on the relative residual of
+ * the final solution, cgp.max_refinements the limit on the steps. Returns
+ * false if the tolerance is not reached or as soon as an inner solve
+ * fails, i.e. a low precision solver or preconditioner broke down. */
+template<typename L, typename T, typename Matrix, typename InnerSolve>
 bool
-qmr(const blaze::CompressedMatrix<T>& A,
+iterative_refinement(const conjugated_gradient_params<T>& cgp,
+                     const Matrix& A,
+                     const blaze::DynamicVector<T>& b,
+                     blaze::DynamicVector<T>& x,
+                     const InnerSolve& inner_solve)
+{
+    size_t N = A.columns();
+
+    if ( A.rows() != N or b.size() != N or x.size() != N )
+    {
+        if (cgp.verbose)
+            std::cout << "[Refinement] Wrong system size" << std::endl;
+
+        return false;
+    }
+
+    if (!cgp.use_initial_guess)
+        x = 0.0;
+
+    blaze::DynamicVector<T> r(N), Ax(N);
+    blaze::DynamicVector<L> r_lo(N), c_lo(N);
+
+    T nb = yaourt::detail::global_norm(A, b);
+    if (nb == 0.0)
+    {
+        x = 0.0;
+        return true;
+    }
+
+    for (size_t step = 0; step <= cgp.max_refinements; step++)
+    {
+        yaourt::detail::apply_operator(A, x, Ax);
+        r = b - Ax;
+
+        T nr = yaourt::detail::global_norm(A, r);
+
+        if (cgp.verbose)
+            std::cout << " -> Refinement " << step << ", rr = " << nr/nb << std::endl;
+
+        if (nr/nb <= cgp.rr_tol)
+            return true;
+
+        if (step == cgp.max_refinements)
+            break;
+
+        for (size_t i = 0; i < N; i++)
+            r_lo[i] = L(r[i]/nr);
+
+        c_lo = L(0);
+        if ( !inner_solve(r_lo, c_lo) )
+        {
+            if (cgp.verbose)
+                std::cout << "[Refinement] Inner solve did not converge" << std::endl;
+
+            return false;
+        }
+
+        for (size_t i = 0; i < N; i++)
+            x[i] += nr*T(c_lo[i]);
+    }
+
+    return false;
+}
+
+/* Conjugated gradient with mixed precision iterative refinement: 'A_lo'
+ * is 'A' stored in L (e.g. blaze::CompressedMatrix<float>), and the
+ * optional preconditioner works in L too. */
+template<typename L, typename T, typename Matrix, typename LoMatrix>
+bool
+conjugated_gradient_mixed(const conjugated_gradient_params<T>& cgp,
+                          const Matrix& A, const LoMatrix& A_lo,
+                          const blaze::DynamicVector<T>& b,
+                          blaze::DynamicVector<T>& x)
+{
+    conjugated_gradient_solver<L> cg( yaourt::detail::inner_params<L>(cgp) );
+    return iterative_refinement<L>(cgp, A, b, x,
+        [&](const blaze::DynamicVector<L>& r, blaze::DynamicVector<L>& c) {
+            return cg.solve(A_lo, r, c);
+        });
+}
+
+template<typename L, typename T, typename Matrix, typename LoMatrix, typename Precond>
+bool
+conjugated_gradient_mixed(const conjugated_gradient_params<T>& cgp,
+                          const Matrix& A, const LoMatrix& A_lo,
+                          const blaze::DynamicVector<T>& b,
+                          blaze::DynamicVector<T>& x,
+                          const Precond& iM_lo)
+{
+    conjugated_gradient_solver<L> cg( yaourt::detail::inner_params<L>(cgp) );
+    return iterative_refinement<L>(cgp, A, b, x,
+        [&](const blaze::DynamicVector<L>& r, blaze::DynamicVector<L>& c) {
+            return cg.solve(A_lo, r, c, iM_lo);
+        });
+}
+
+/* Same as above with BiCGStab */
+template<typename L, typename T, typename Matrix, typename LoMatrix>
+bool
+bicgstab_mixed(const conjugated_gradient_params<T>& cgp,
+               const Matrix& A, const LoMatrix& A_lo,
+               const blaze::DynamicVector<T>& b,
+               blaze::DynamicVector<T>& x)
+{
+    auto icgp = yaourt::detail::inner_params<L>(cgp);
+    return iterative_refinement<L>(cgp, A, b, x,
+        [&](const blaze::DynamicVector<L>& r, blaze::DynamicVector<L>& c) {
+            return bicgstab(icgp, A_lo, r, c);
+        });
+}
+
+template<typename L, typename T, typename Matrix, typename LoMatrix, typename Precond>
+bool
+bicgstab_mixed(const conjugated_gradient_params<T>& cgp,
+               const Matrix& A, const LoMatrix& A_lo,
+               const blaze::DynamicVector<T>& b,
+               blaze::DynamicVector<T>& x,
+               const Precond& iM_lo)
+{
+    auto icgp = yaourt::detail::inner_params<L>(cgp);
+    return iterative_refinement<L>(cgp, A, b, x,
+        [&](const blaze::DynamicVector<L>& r, blaze::DynamicVector<L>& c) {
+            return bicgstab(icgp, A_lo, r, c, iM_lo);
+        });
+}
+
+namespace yaourt {
+namespace detail {
+
+/* QMR, left preconditioned by 'iM' if not null (M1 = M, M2 = I in the
+ * notation of the "Templates" book) */
+template<typename T, typename Matrix, typename Precond>
+bool
+qmr(const Matrix& A,
     const blaze::DynamicVector<T>& b,
-    blaze::DynamicVector<T>& x)
+    blaze::DynamicVector<T>& x,
+    const Precond *iM,
+    const std::string& history_filename)
 {
+    static_assert(can_transpose<Matrix, T>, "QMR needs trans(A)");
+
+    YAOURT_TIMED_SCOPE("solver.qmr");
+
     size_t  N = A.columns();
     size_t  iter = 0;
     T       nr, nr0;
@@ -479,11 +883,15 @@ qmr(const blaze::CompressedMatrix<T>& A,
     blaze::DynamicVector<T> r(N), r0(N);
     blaze::DynamicVector<T> d, s, p, p_tilde, q, v, v_tilde, w, w_tilde, y, y_tilde, z, z_tilde;
     
-    r0 = r = b - A*x;
+    apply_operator(A, x, r);
+    r0 = r = b - r;
     nr = nr0 = norm(r);
     
     v_tilde = r;
-    y = /*eiM **/ v_tilde; // pre
+    if (iM)
+        apply_operator(*iM, v_tilde, y);
+    else
+        y = v_tilde;
     rho = norm(y);
     w_tilde = r;
     z = /*eiM **/ w_tilde; // pre
@@ -491,7 +899,7 @@ qmr(const blaze::CompressedMatrix<T>& A,
     gamma = 1;
     eta = -1;
     
-    std::ofstream ofs("qmr_nopre_convergence.txt");
+    std::ofstream ofs(history_filename);
     
     while ( nr/nr0 > 1e-8 && iter < N*10 && nr/nr0 < 10000 )
     {
@@ -502,7 +910,7 @@ qmr(const blaze::CompressedMatrix<T>& A,
         
         ofs << nr/nr0 << std::endl;
         
-        if (abs(rho) < 1e-15 or abs(xi) < 1e-15)
+        if (std::abs(rho) < 1e-15 or std::abs(xi) < 1e-15)
         {
             std::cout << "QMR failed (rho, xi)" << std::endl;
             return false;
@@ -513,13 +921,16 @@ qmr(const blaze::CompressedMatrix<T>& A,
         w = w_tilde / xi;
         z = z / xi;
         delta = dot(z,y);
-        if (abs(delta) < 1e-15)
+        if (std::abs(delta) < 1e-15)
         {
             std::cout << "QMR failed (delta)" << std::endl;
             return false;
         }
-        y_tilde = /*eiM **/ y; // pre
-        z_tilde = /*eiM **/ z; // pre
+        y_tilde = y;
+        if (iM)
+            apply_operator_transpose(*iM, z, z_tilde);
+        else
+            z_tilde = z;
         
         if (iter == 0)
         {
@@ -532,24 +943,28 @@ qmr(const blaze::CompressedMatrix<T>& A,
             q = z_tilde - (rho*(delta/epsilon))*q;
         }
         
-        p_tilde = A*p;
+        apply_operator(A, p, p_tilde);
         epsilon = dot(q, p_tilde);
-        if (abs(epsilon) < 1e-15)
+        if (std::abs(epsilon) < 1e-15)
         {
             std::cout << "QMR failed (epsilon)" << std::endl;
             return false;
         }
         beta = epsilon/delta;
-        if (abs(beta) < 1e-15)
+        if (std::abs(beta) < 1e-15)
         {
             std::cout << "QMR failed (beta)" << std::endl;
             return false;
         }
         v_tilde = p_tilde - beta*v;
-        y = /*eiM **/ v_tilde; // pre
+        if (iM)
+            apply_operator(*iM, v_tilde, y);
+        else
+            y = v_tilde;
         rho1 = rho;
         rho = norm(y);
-        w_tilde = trans(A)*q - beta*w;
+        apply_operator_transpose(A, q, w_tilde);
+        w_tilde = w_tilde - beta*w;
         z = /*eiM **/ w_tilde; // pre
         xi = norm(z);
         
@@ -560,7 +975,7 @@ qmr(const blaze::CompressedMatrix<T>& A,
         gamma1 = gamma;
         
         gamma = 1.0/sqrt(1.0+theta*theta);
-        if (abs(gamma) < 1e-15)
+        if (std::abs(gamma) < 1e-15)
         {
             std::cout << "QMR failed (gamma)" << std::endl;
             return false;
@@ -589,6 +1004,35 @@ qmr(const blaze::CompressedMatrix<T>& A,
     ofs.close();
     
     std::cout << " -> Iteration " << iter << ", rr = " << nr/nr0 << std::endl;
+    YAOURT_COUNT("solver.qmr.iterations", iter);
     
     return true;
 }
+
+} // namespace detail
+} // namespace yaourt
+
+template<typename T, typename Matrix>
+bool
+qmr(const Matrix& A,
+    const blaze::DynamicVector<T>& b,
+    blaze::DynamicVector<T>& x)
+{
+    return yaourt::detail::qmr(A, b, x,
+                               static_cast<const blaze::CompressedMatrix<T> *>(nullptr),
+                               "qmr_nopre_convergence.txt");
+}
+
+/* Preconditioned QMR, the preconditioner must provide its transpose */
+template<typename T, typename Matrix, typename Precond>
+bool
+qmr(const Matrix& A,
+    const blaze::DynamicVector<T>& b,
+    blaze::DynamicVector<T>& x,
+    const Precond& iM)
+{
+    static_assert(yaourt::detail::can_transpose<Precond, T>,
+                  "QMR needs the transpose of the preconditioner");
+
+    return yaourt::detail::qmr(A, b, x, &iM, "qmr_pre_convergence.txt");
+}
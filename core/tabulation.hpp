@@ -0,0 +1,503 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "core/refelem.hpp"
+#include "core/quadratures.hpp"
+#include "core/bases.hpp"
+
+/* Tabulation of the basis functions at the quadrature points.
+ *
+ * On simplicial meshes the basis of an element is the basis of the
+ * reference triangle pushed forward by the affine map of the element.
+ * Values and gradients of the reference basis are computed only once per
+ * (element type, degree, quadrature order) and cached: evaluating the
+ * basis on a physical element reduces to picking the precomputed values
+ * and multiplying the reference gradients by the inverse Jacobian.
+ *
+ * On the other meshes the same interface is provided, but the values are
+ * computed on the fly with the usual physical basis.
+ *
+ * All the classes take the degree K of the kernels using them (see
+ * bases::local_types): with K fixed at compile time the values are
+ * tabulated directly in static vectors and matrices, which the kernels use
+ * in place. The default is the degree known only at runtime.
+ */
+
+namespace yaourt {
+namespace bases {
+
+/* Quadrature points together with basis values and gradients on them */
+template<typename T, size_t K = dynamic_degree>
+struct basis_tabulation
+{
+    using vector_type   = typename local_types<T,K>::vector_type;
+    using gradient_type = typename local_types<T,K>::gradient_type;
+
+    std::vector<quadratures::quadrature_point<T,2>>     qps;
+    std::vector<vector_type>                            phi;
+    std::vector<gradient_type>                          dphi;
+
+    template<typename Basis>
+    void push_back(const Basis& basis, const quadratures::quadrature_point<T,2>& qp)
+    {
+        qps.push_back(qp);
+        phi.push_back( basis.eval(qp.point()) );
+        dphi.push_back( basis.eval_grads(qp.point()) );
+    }
+
+    size_t size() const { return qps.size(); }
+};
+
+template<typename RefElem, size_t K = dynamic_degree>
+class reference_tabulation;
+
+/* Basis of the reference triangle tabulated on the cell quadrature and
+ * on the quadratures of the three edges. The edges are numbered as in
+ * faces(): (v0,v1), (v1,v2), (v0,v2). Edge points are tabulated in both
+ * orientations, so that two cells sharing an edge see the same physical
+ * points in the same order. */
+template<typename T, size_t K>
+class reference_tabulation<refelem::reference_triangle<T>, K>
+{
+    using refelem_type  = refelem::reference_triangle<T>;
+    using tab_type      = basis_tabulation<T,K>;
+
+    size_t                                  basis_degree, quad_order;
+    tab_type                                cell_tab;
+    std::array<std::array<tab_type,2>,3>    face_tabs;
+
+public:
+    static constexpr size_t face_vertices[3][2] = { {0,1}, {1,2}, {0,2} };
+
+    reference_tabulation(size_t degree, size_t order)
+        : basis_degree(degree), quad_order(order)
+    {
+        refelem_type rt;
+        auto basis = detail::refelement_scalar_basis<refelem_type,K>(rt, degree);
+
+        auto qps = quadratures::integrate(rt, order);
+        for (auto& qp : qps)
+            cell_tab.push_back(basis, qp);
+
+        auto raw_qps = quadratures::gauss_legendre<T>(order);
+        for (size_t f = 0; f < 3; f++)
+        {
+            auto pa = rt.points[ face_vertices[f][0] ];
+            auto pb = rt.points[ face_vertices[f][1] ];
+
+            for (auto& raw_qp : raw_qps)
+            {
+                T t  = raw_qp.first.x();
+                /* Weights are relative to the physical face length */
+                T qw = raw_qp.second * T(0.5);
+
+                auto qp  = T(0.5) * (1 - t) * pa + T(0.5) * (1 + t) * pb;
+                face_tabs[f][0].push_back(basis, {qp, qw});
+
+                auto qpr = T(0.5) * (1 - t) * pb + T(0.5) * (1 + t) * pa;
+                face_tabs[f][1].push_back(basis, {qpr, qw});
+            }
+        }
+    }
+
+    const tab_type&
+    cell() const
+    {
+        return cell_tab;
+    }
+
+    const tab_type&
+    face(size_t local_face, bool reversed) const
+    {
+        assert(local_face < 3);
+        return face_tabs[local_face][reversed ? 1 : 0];
+    }
+
+    size_t degree() const { return basis_degree; }
+    size_t order() const { return quad_order; }
+};
+
+template<typename T, size_t K>
+constexpr size_t reference_tabulation<refelem::reference_triangle<T>, K>::face_vertices[3][2];
+
+/* Get the tabulation of the basis of degree 'degree' on the quadrature of
+ * order 'order' of the reference element. Tabulations are computed on the
+ * first request and then kept in a cache, one per element type and K. */
+template<size_t K = dynamic_degree, typename RefElem>
+const reference_tabulation<RefElem,K>&
+get_reference_tabulation(const RefElem&, size_t degree, size_t order)
+{
+    using tab_type = reference_tabulation<RefElem,K>;
+    using key_type = std::pair<size_t, size_t>;
+
+    static std::map<key_type, std::unique_ptr<tab_type>> cache;
+    static std::mutex cache_mutex;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    auto& tab = cache[ std::make_pair(degree, order) ];
+    if (!tab)
+        tab = std::make_unique<tab_type>(degree, order);
+
+    return *tab;
+}
+
+namespace detail {
+
+/* Map in place the reference gradients stored in the rows of 'dphi' to
+ * the physical ones, i.e. dphi = dphi * iJ. */
+template<typename MT, typename T>
+void
+map_gradients(MT& dphi, const blaze::StaticMatrix<T,2,2>& iJ)
+{
+    for (size_t i = 0; i < dphi.rows(); i++)
+    {
+        auto gx = dphi(i,0);
+        auto gy = dphi(i,1);
+        dphi(i,0) = gx*iJ(0,0) + gy*iJ(1,0);
+        dphi(i,1) = gx*iJ(0,1) + gy*iJ(1,1);
+    }
+}
+
+template<typename T>
+refelem::transform<T>
+identity_transform()
+{
+    refelem::transform<T> ret;
+    ret.Tm = blaze::IdentityMatrix<T>(2);
+    ret.Tv = 0.0;
+    ret.Tdet = 1.0;
+    return ret;
+}
+
+} // namespace detail
+
+/* A tabulation seen on a physical element: points are mapped with 'r2p',
+ * weights are scaled by 'wscale' and gradients are multiplied by the
+ * inverse of the Jacobian. */
+template<typename T, size_t K = dynamic_degree>
+class tabulated_quadrature
+{
+    using point_type    = point<T,2>;
+    using tab_type      = basis_tabulation<T,K>;
+    using vector_type   = typename tab_type::vector_type;
+    using gradient_type = typename tab_type::gradient_type;
+
+    const tab_type*             tab;
+    refelem::transform<T>       r2p;
+    blaze::StaticMatrix<T,2,2>  iJ;
+    T                           wscale;
+
+public:
+    tabulated_quadrature(const tab_type& p_tab,
+                         const refelem::transform<T>& p_r2p,
+                         const blaze::StaticMatrix<T,2,2>& p_iJ,
+                         T p_wscale)
+        : tab(&p_tab), r2p(p_r2p), iJ(p_iJ), wscale(p_wscale)
+    {}
+
+    size_t size() const { return tab->size(); }
+
+    T
+    weight(size_t i) const
+    {
+        return wscale * tab->qps[i].weight();
+    }
+
+    point_type
+    point(size_t i) const
+    {
+        return refelem::ref2phys(r2p, tab->qps[i].point());
+    }
+
+    /* A static vector with K fixed: the products with the other local
+     * quantities of the kernel have sizes known at compile time */
+    const vector_type&
+    phi(size_t i) const
+    {
+        return tab->phi[i];
+    }
+
+    gradient_type
+    grads(size_t i) const
+    {
+        return tab->dphi[i] * iJ;
+    }
+
+    /* Same as above without allocating, 'ret' must be size() x 2 */
+    template<typename MT>
+    void
+    grads(size_t i, MT&& ret) const
+    {
+        assert(ret.rows() == tab->dphi[i].rows() and ret.columns() == 2);
+        ret = tab->dphi[i];
+        detail::map_gradients(ret, iJ);
+    }
+};
+
+/* Generic case: no reference element, tabulate the physical basis on
+ * the physical quadratures of the cell and of its faces. */
+template<typename Mesh, size_t K = dynamic_degree>
+class tabulated_basis
+{
+    using T             = typename Mesh::coordinate_type;
+    using cell_type     = typename Mesh::cell_type;
+    using face_type     = typename Mesh::face_type;
+    using point_type    = typename Mesh::point_type;
+    using basis_type    = detail::scalar_basis<Mesh, cell_type, K>;
+    using tab_type      = basis_tabulation<T,K>;
+
+    static const size_t num_faces = cell_type::num_faces;
+
+    basis_type                                  basis;
+    cell_type                                   cl;
+    tab_type                                    cell_tab;
+    std::array<tab_type, num_faces>             face_tabs;
+    std::array<face_type, num_faces>            local_faces;
+
+public:
+    tabulated_basis(const Mesh& msh, const cell_type& p_cl, size_t degree, size_t order)
+        : basis(msh, p_cl, degree), cl(p_cl)
+    {
+        /* The same buffer is used for the cell and the faces */
+        std::vector<quadratures::quadrature_point<T,2>> qps;
+        quadratures::integrate(msh, cl, order, qps);
+        for (auto& qp : qps)
+            cell_tab.push_back(basis, qp);
+
+        auto ptids = cl.point_ids();
+        for (size_t i = 0; i < num_faces; i++)
+        {
+            /* Same numbering as faces() */
+            auto a = (i == num_faces-1) ? 0 : i;
+            auto b = (i == num_faces-1) ? i : i+1;
+            local_faces[i] = face_type(ptids[a], ptids[b]);
+
+            quadratures::integrate(msh, local_faces[i], order, qps);
+            for (auto& fqp : qps)
+                face_tabs[i].push_back(basis, fqp);
+        }
+    }
+
+    tabulated_quadrature<T,K>
+    cell_quadrature() const
+    {
+        auto id = detail::identity_transform<T>();
+        return tabulated_quadrature<T,K>(cell_tab, id, id.Tm, 1.0);
+    }
+
+    tabulated_quadrature<T,K>
+    face_quadrature(const face_type& fc) const
+    {
+        for (size_t i = 0; i < num_faces; i++)
+        {
+            if (local_faces[i].p0 != fc.p0 or local_faces[i].p1 != fc.p1)
+                continue;
+
+            auto id = detail::identity_transform<T>();
+            return tabulated_quadrature<T,K>(face_tabs[i], id, id.Tm, 1.0);
+        }
+
+        throw std::invalid_argument("Face does not belong to the cell");
+    }
+
+    typename tab_type::vector_type
+    eval(const point_type& pt) const
+    {
+        return basis.eval(pt);
+    }
+
+    typename tab_type::gradient_type
+    eval_grads(const point_type& pt) const
+    {
+        return basis.eval_grads(pt);
+    }
+
+    template<typename VT>
+    void
+    eval(const point_type& pt, VT&& ret) const
+    {
+        basis.eval(pt, std::forward<VT>(ret));
+    }
+
+    template<typename MT>
+    void
+    eval_grads(const point_type& pt, MT&& ret) const
+    {
+        basis.eval_grads(pt, std::forward<MT>(ret));
+    }
+
+    size_t size() const { return basis.size(); }
+    size_t degree() const { return basis.degree(); }
+};
+
+/* Simplicial case: use the cached tabulation of the reference triangle */
+template<typename T, size_t K>
+class tabulated_basis<simplicial_mesh<T>, K>
+{
+    using mesh_type     = simplicial_mesh<T>;
+    using cell_type     = typename mesh_type::cell_type;
+    using face_type     = typename mesh_type::face_type;
+    using point_type    = typename mesh_type::point_type;
+    using refelem_type  = refelem::reference_triangle<T>;
+    using tab_type      = reference_tabulation<refelem_type,K>;
+    using vector_type   = typename local_types<T,K>::vector_type;
+    using gradient_type = typename local_types<T,K>::gradient_type;
+
+    detail::refelement_scalar_basis<refelem_type,K> rbasis;
+    const tab_type*                                 tab;
+    cell_type                                       cl;
+    size_t                                          rot;
+    refelem::transform<T>                           r2p, p2r;
+    std::array<T, 3>                                face_meas;
+
+    /* Cell vertex corresponding to the i-th vertex of the reference */
+    size_t vertex(size_t i) const { return (rot + i) % 3; }
+
+public:
+    tabulated_basis(const mesh_type& msh, const cell_type& p_cl, size_t degree, size_t order)
+        : rbasis(refelem_type(), degree), cl(p_cl), rot(0)
+    {
+        refelem_type rt;
+        tab = &get_reference_tabulation<K>(rt, degree, order);
+
+        auto pts = points(msh, cl);
+
+        /* The right angle of the reference is mapped to the largest angle
+         * of the cell (the vertex opposite to the longest edge). This keeps
+         * the map as close as possible to a similarity, so the pushed
+         * forward basis is as well conditioned as the physical one. */
+        T max_len = 0.0;
+        for (size_t i = 0; i < 3; i++)
+        {
+            auto len = distance(pts[(i+1)%3], pts[(i+2)%3]);
+            if (len > max_len)
+            {
+                max_len = len;
+                rot = i;
+            }
+        }
+
+        auto v1 = pts[vertex(1)] - pts[vertex(0)];
+        auto v2 = pts[vertex(2)] - pts[vertex(0)];
+
+        r2p.Tm(0,0) = v1.x();  r2p.Tm(0,1) = v2.x();
+        r2p.Tm(1,0) = v1.y();  r2p.Tm(1,1) = v2.y();
+        r2p.Tv[0] = pts[vertex(0)].x();
+        r2p.Tv[1] = pts[vertex(0)].y();
+        r2p.Tdet = det(r2p.Tm);
+
+        p2r = refelem::inverse(r2p);
+
+        for (size_t f = 0; f < 3; f++)
+        {
+            auto pa = pts[ vertex(tab_type::face_vertices[f][0]) ];
+            auto pb = pts[ vertex(tab_type::face_vertices[f][1]) ];
+            face_meas[f] = distance(pa, pb);
+        }
+    }
+
+    tabulated_quadrature<T,K>
+    cell_quadrature() const
+    {
+        return tabulated_quadrature<T,K>(tab->cell(), r2p, p2r.Tm, std::abs(r2p.Tdet));
+    }
+
+    /* Points are in the order of integrate(msh, fc, order) */
+    tabulated_quadrature<T,K>
+    face_quadrature(const face_type& fc) const
+    {
+        for (size_t f = 0; f < 3; f++)
+        {
+            auto a = cl.p[ vertex(tab_type::face_vertices[f][0]) ];
+            auto b = cl.p[ vertex(tab_type::face_vertices[f][1]) ];
+
+            if ( std::min(a,b) != fc.p0 or std::max(a,b) != fc.p1 )
+                continue;
+
+            const auto& ftab = tab->face(f, a != fc.p0);
+            return tabulated_quadrature<T,K>(ftab, r2p, p2r.Tm, face_meas[f]);
+        }
+
+        throw std::invalid_argument("Face does not belong to the cell");
+    }
+
+    vector_type
+    eval(const point_type& pt) const
+    {
+        return rbasis.eval( refelem::ref2phys(p2r, pt) );
+    }
+
+    gradient_type
+    eval_grads(const point_type& pt) const
+    {
+        return rbasis.eval_grads( refelem::ref2phys(p2r, pt) ) * p2r.Tm;
+    }
+
+    template<typename VT>
+    void
+    eval(const point_type& pt, VT&& ret) const
+    {
+        rbasis.eval( refelem::ref2phys(p2r, pt), std::forward<VT>(ret) );
+    }
+
+    template<typename MT>
+    void
+    eval_grads(const point_type& pt, MT&& ret) const
+    {
+        rbasis.eval_grads( refelem::ref2phys(p2r, pt), ret );
+        detail::map_gradients(ret, p2r.Tm);
+    }
+
+    size_t size() const { return rbasis.size(); }
+    size_t degree() const { return rbasis.degree(); }
+};
+
+/* Make a basis of degree 'degree' on the cell 'cl', tabulated on the
+ * quadratures of order 'order' of the cell and of its faces */
+template<typename Mesh>
+auto
+make_tabulated_basis(const Mesh& msh, const typename Mesh::cell_type& cl,
+                     size_t degree, size_t order)
+{
+    return tabulated_basis<Mesh>(msh, cl, degree, order);
+}
+
+/* Same as above for the kernels of degree K, that must be 'degree' unless
+ * it is dynamic_degree */
+template<size_t K, typename Mesh>
+auto
+make_tabulated_basis(const Mesh& msh, const typename Mesh::cell_type& cl,
+                     size_t degree, size_t order)
+{
+    return tabulated_basis<Mesh,K>(msh, cl, degree, order);
+}
+
+} // namespace bases
+} // namespace yaourt
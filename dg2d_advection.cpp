@@ -28,13 +28,22 @@
 
 #include "core/mesh.hpp"
 #include "core/meshers.hpp"
+#include "core/reordering.hpp"
+#include "core/adaptivity.hpp"
 #include "core/quadratures.hpp"
 #include "core/bases.hpp"
+#include "core/tabulation.hpp"
 #include "core/solvers.hpp"
 #include "core/blaze_sparse_init.hpp"
 #include "core/dataio.hpp"
+#include "core/parallel.hpp"
+#include "core/batched_la.hpp"
 
 #include "methods/dg.hpp"
+#include "methods/dg_assembly.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
 namespace params {
 /* Reaction term coefficient */
@@ -88,6 +97,10 @@ struct solver_status
     T   mesh_h;
     T   L2_errsq_qp;
     T   L2_errsq_mm;
+
+    /* Squared L2 error on each cell, the indicator of the adaptive
+     * refinement */
+    std::vector<T>  indicators;
 };
 
 template<typename T>
@@ -106,111 +119,117 @@ struct dg_config
     T               eta;
     int             degree;
     int             ref_levels;
-    bool            use_preconditioner;
+    dg_preconditioner preconditioner;
     bool            shatter;
+    size_t          num_threads;
+    yaourt::mesh_ordering ordering;
+    bool            use_block_matrix;
     bool            use_upwinding;
-
+    bool            mixed_precision;
+    size_t          adapt_steps;
+    T               adapt_fraction;
 
     dg_config()
-        : eta(1.0), degree(1), ref_levels(4), use_preconditioner(false),
-          shatter(false), use_upwinding(false)
+        : eta(1.0), degree(1), ref_levels(4), preconditioner(dg_preconditioner::NONE),
+          shatter(false), num_threads(1), ordering(yaourt::mesh_ordering::NONE),
+          use_block_matrix(false), use_upwinding(false), mixed_precision(false),
+          adapt_steps(0), adapt_fraction(0.5)
     {}
 };
 
-template<typename Mesh>
-solver_status<typename Mesh::coordinate_type>
-run_advection_reaction_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>& cfg)
+/* Face terms on the nonconforming faces. Each fine face is shared by a
+ * fine and a coarse cell: the terms are the same as on the conforming
+ * faces, integrated on the fine face with the basis of the coarse cell
+ * evaluated at the physical quadrature points. As for the conforming
+ * faces, the terms are assembled once from each side. */
+template<typename Mesh, typename Assembler, typename BetaFunction>
+void
+assemble_hanging_faces(const Mesh& msh, Assembler& assm, size_t degree,
+                       typename Mesh::coordinate_type eta, bool upwinding,
+                       const BetaFunction& beta_fun)
 {
-    using mesh_type = Mesh;
-    using T = typename mesh_type::coordinate_type;
-
-    solver_status<T>    status;
-    status.mesh_h = diameter(msh);
-
-    msh.compute_connectivity();
+    YAOURT_TIMED_SCOPE("assembly.hanging_faces");
 
-    size_t degree = cfg.degree;
+    using T = typename Mesh::coordinate_type;
 
-    T eta = cfg.eta;
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
 
-    assembler<mesh_type> assm(msh, degree, cfg.use_preconditioner);
-    for (auto& tcl : msh.cells)
+    for (auto& hf : msh.hanging_faces)
     {
-        auto tbasis = yaourt::bases::make_basis(msh, tcl, degree);
+        const auto& fc = msh.faces[ hf[1] ];
+        auto coarse_id = msh.face_owners[ hf[0] ][0];
+        auto fine_id = msh.face_owners[ hf[1] ][0];
+        const auto& ccl = msh.cells[coarse_id];
+        const auto& fcl = msh.cells[fine_id];
 
-        blaze::DynamicMatrix<T> K(tbasis.size(), tbasis.size(), 0.0);
-        blaze::DynamicVector<T> loc_rhs(tbasis.size(), 0.0);
+        auto cbasis = yaourt::bases::make_tabulated_basis(msh, ccl, degree, 2*degree);
+        auto fbasis = yaourt::bases::make_tabulated_basis(msh, fcl, degree, 2*degree);
 
-        auto qps = yaourt::quadratures::integrate(msh, tcl, 2*degree);
-        for (auto& qp : qps)
-        {
-            auto ep   = qp.point();
-            auto phi  = tbasis.eval(ep);
-            auto dphi = tbasis.eval_grads(ep);
+        auto qps = yaourt::quadratures::integrate(msh, fc, 2*degree);
 
-            /* Reaction */
-            K += params::mu(ep) * qp.weight() * phi * trans(phi);
-            /* Advection */
-            K += qp.weight() * phi * trans( dphi*params::beta(ep) );
+        /* 'n' is the outward normal of the cell 't' */
+        auto assemble_side = [&](size_t t_id, const auto& tbasis,
+                                 size_t n_id, const auto& nbasis,
+                                 const blaze::StaticVector<T,2>& n) {
+            blaze::DynamicMatrix<T> Att(bs, bs, 0.0);
+            blaze::DynamicMatrix<T> Atn(bs, bs, 0.0);
 
-            loc_rhs += qp.weight() * data::rhs(ep) * phi;
-        }
+            for (auto& qp : qps)
+            {
+                auto fqw    = qp.weight();
+                auto tphi   = tbasis.eval(qp.point());
+                auto nphi   = nbasis.eval(qp.point());
 
-        auto fcs = faces(msh, tcl);
-        for (auto& fc : fcs)
-        {
-            blaze::DynamicMatrix<T> Att(tbasis.size(), tbasis.size(), 0.0);
-            blaze::DynamicMatrix<T> Atn(tbasis.size(), tbasis.size(), 0.0);
+                T beta_nf = dot(beta_fun(qp.point()), n);
+                T fi_coeff = beta_nf;
+                if (upwinding)
+                    fi_coeff -= eta * std::abs(beta_nf);
 
-            auto [ncl, has_neighbour] = neighbour_via(msh, tcl, fc);
-            auto nbasis = yaourt::bases::make_basis(msh, ncl, degree);
-            assert(tbasis.size() == nbasis.size());
+                Att += - fqw * 0.5 * fi_coeff * tphi * trans(tphi);
+                Atn += + fqw * fi_coeff * 0.5 * tphi * trans(nphi);
+            }
 
-            auto n     = normal(msh, tcl, fc);
-            auto f_qps = yaourt::quadratures::integrate(msh, fc, 2*degree);
-            
-            for (auto& fqp : f_qps)
-            {
-                auto ep     = fqp.point();
-                auto tphi   = tbasis.eval(ep);
-                auto tdphi  = tbasis.eval_grads(ep);
+            assm.assemble(msh, t_id, t_id, Att);
+            assm.assemble(msh, t_id, n_id, Atn);
+        };
 
-                T beta_nf = dot(params::beta(ep), n);
-                T fi_coeff;
+        blaze::StaticVector<T,2> n = normal(msh, fcl, fc);
+        assemble_side(fine_id, fbasis, coarse_id, cbasis, n);
+        assemble_side(coarse_id, cbasis, fine_id, fbasis, -n);
+    }
+}
 
-                if (cfg.use_upwinding)
-                    fi_coeff = beta_nf - eta * std::abs(beta_nf);
-                else
-                    fi_coeff = beta_nf;
+template<typename Mesh>
+solver_status<typename Mesh::coordinate_type>
+run_advection_reaction_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>& cfg)
+{
+    using mesh_type = Mesh;
+    using T = typename mesh_type::coordinate_type;
 
-                if (has_neighbour)
-                {   /* NOT on a boundary */
-                    Att += - fqp.weight() * 0.5 * fi_coeff * tphi * trans(tphi);
-                }
-                else
-                {   /* On a boundary*/
-                    auto beta_minus = 0.5*(std::abs(beta_nf) - beta_nf);
+    solver_status<T>    status;
+    status.mesh_h = diameter(msh);
 
-                    if (beta_nf < 0.0)
-                        Att += fqp.weight() * beta_minus * tphi * trans(tphi);
+    if ( !msh.has_connectivity() )
+        msh.compute_connectivity();
 
-                    continue;
-                }
+    size_t degree = cfg.degree;
 
-                auto nphi   = nbasis.eval(ep);
-                auto ndphi  = nbasis.eval_grads(ep);
+    T eta = cfg.eta;
 
-                /* Advection-Reaction */
-                Atn += + fqp.weight() * fi_coeff * 0.5 * tphi * trans(nphi);
-            }
+    auto amode = cfg.use_block_matrix ? dg_assembly_mode::BLOCKS :
+                                        dg_assembly_mode::PATTERN;
+    bool jacobi = (cfg.preconditioner == dg_preconditioner::JACOBI);
+    assembler<mesh_type> assm(msh, degree, jacobi,
+                              cfg.num_threads, amode);
 
-            assm.assemble(msh, tcl, tcl, Att);
-            if (has_neighbour)
-                assm.assemble(msh, tcl, ncl, Atn);
-        }
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
 
-        assm.assemble(msh, tcl, K, loc_rhs);
-    }
+    assemble_advection_reaction(msh, assm, degree, eta, cfg.use_upwinding,
+                                params::mu<T>, params::beta<T>, data::rhs<T>,
+                                cfg.num_threads);
+
+    assemble_hanging_faces(msh, assm, degree, eta, cfg.use_upwinding,
+                           params::beta<T>);
 
     assm.finalize();
 
@@ -222,19 +241,82 @@ run_advection_reaction_solver(Mesh& msh, const dg_config<typename Mesh::coordina
     cgp.rr_max = 10000;
     cgp.rr_tol = 1e-8;
     cgp.max_iter = 2*assm.system_size();
-    cgp.use_normal_eqns = true; /* USE CG ON NORMAL EQUATIONS - ASYMMETRIC SYSTEM */
 
-    conjugated_gradient(cgp, assm.lhs, assm.rhs, sol);
+    /* With a preconditioner, solve the asymmetric system with BiCGStab */
+    auto solve = [&](const auto& A) {
+        switch (cfg.preconditioner)
+        {
+            case dg_preconditioner::JACOBI:
+                bicgstab(cgp, A, assm.rhs, sol, assm.pc);
+                break;
+
+            case dg_preconditioner::BLOCK_JACOBI:
+                bicgstab(cgp, A, assm.rhs, sol, assm.block_jacobi());
+                break;
+
+            case dg_preconditioner::ILU0:
+                bicgstab(cgp, A, assm.rhs, sol, assm.ilu0());
+                break;
+
+            default:
+                cgp.use_normal_eqns = true; /* USE CG ON NORMAL EQUATIONS - ASYMMETRIC SYSTEM */
+                conjugated_gradient(cgp, A, assm.rhs, sol);
+        }
+    };
+
+    /* Mixed precision: the Krylov solver runs on a single precision copy
+     * of the matrix, with the preconditioner built on it, and the solution
+     * is refined with the residual computed in double */
+    auto solve_mixed = [&]() {
+        using L = float;
+        blaze::CompressedMatrix<L> A_lo(assm.lhs);
+        switch (cfg.preconditioner)
+        {
+            case dg_preconditioner::JACOBI:
+                bicgstab_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                                  blaze::CompressedMatrix<L>(assm.pc));
+                break;
+
+            case dg_preconditioner::BLOCK_JACOBI:
+                bicgstab_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                    yaourt::block_jacobi_preconditioner<L>(A_lo, bs));
+                break;
+
+            case dg_preconditioner::ILU0:
+                bicgstab_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                    yaourt::ilu0_preconditioner<L>(A_lo));
+                break;
+
+            default:
+                cgp.use_normal_eqns = true;
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol);
+        }
+    };
+
+    YAOURT_TIMED_SCOPE_VAR(solve_timer, "dg.solve", false);
+    if (cfg.mixed_precision)
+        solve_mixed();
+    else if (cfg.use_block_matrix)
+        solve(assm.lhs_blocks);
+    else
+        solve(assm.lhs);
+    solve_timer.stop();
 
     std::ofstream gnuplot_output("advection_reaction_solution.txt");
 
+    /* The L2 projections of the reference solution use the mass matrices
+     * factorized once per class of cells of the same shape */
+    auto mass = yaourt::tabulated_mass_factorizations(msh, degree, 2*degree,
+                                                      cfg.num_threads);
+
     status.L2_errsq_qp = 0.0;
     status.L2_errsq_mm = 0.0;
-    for (auto& cl : msh.cells)
+    blaze::DynamicVector<T> tphi(bs);
+    for (size_t ofs = 0; ofs < msh.cells.size(); ofs++)
     {
-        auto basis = yaourt::bases::make_basis(msh, cl, degree);
+        const auto& cl = msh.cells[ofs];
+        auto basis = yaourt::bases::make_tabulated_basis(msh, cl, degree, 2*degree);
         auto basis_size = basis.size();
-        auto ofs = offset(msh, cl);
 
         blaze::DynamicVector<T> loc_sol(basis_size);
         for (size_t i = 0; i < basis_size; i++)
@@ -243,39 +325,46 @@ run_advection_reaction_solver(Mesh& msh, const dg_config<typename Mesh::coordina
         auto tps = yaourt::make_test_points(msh, cl, 6);
         for (auto& tp : tps)
         {
-            auto phi = basis.eval(tp);
-            T sval = dot(loc_sol, phi);
+            basis.eval(tp, tphi);
+            T sval = dot(loc_sol, tphi);
 
             gnuplot_output << tp.x() << " " << tp.y() << " " << sval << std::endl;
         }
 
-        blaze::DynamicMatrix<T> M(basis_size, basis_size, 0.0);
         blaze::DynamicVector<T> a(basis_size, 0.0);
+        T cell_errsq = 0.0;
 
-        auto qps = yaourt::quadratures::integrate(msh, cl, 2*degree);
-        for (auto& qp : qps)
+        auto qps = basis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
         {
-            auto ep   = qp.point();
-            auto phi  = basis.eval(ep);
+            auto ep     = qps.point(iqp);
+            auto qw     = qps.weight(iqp);
+            auto& phi   = qps.phi(iqp);
 
             auto sv = data::advection_ref_sol(ep);
 
-            M += qp.weight() * phi * trans(phi);
-            a += qp.weight() * sv * phi;
+            a += qw * sv * phi;
 
             T cv = dot(loc_sol, phi);
-            status.L2_errsq_qp += qp.weight() * (sv - cv) * (sv - cv);
+            cell_errsq += qw * (sv - cv) * (sv - cv);
         }
 
-        blaze::DynamicVector<T> proj = blaze::solve_LU(M, a);
-        status.L2_errsq_mm += dot(proj-loc_sol, M*(proj-loc_sol));
+        status.L2_errsq_qp += cell_errsq;
+        status.indicators.push_back(cell_errsq);
+
+        /* (proj - sol)' * M * (proj - sol), on the quadrature points */
+        blaze::DynamicVector<T> diff = mass.solve(ofs, a) - loc_sol;
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
+        {
+            T dv = dot(diff, qps.phi(iqp));
+            status.L2_errsq_mm += qps.weight(iqp) * dv * dv;
+        }
 
     }
 
 
 #ifdef WITH_SILO
     blaze::DynamicVector<T> var(msh.cells.size());
-    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
     for (size_t i = 0; i < msh.cells.size(); i++)
     {
         var[i] = sol[bs*i];
@@ -321,12 +410,29 @@ void run_dg(const dg_config<typename Mesh::coordinate_type>& cfg)
     if (cfg.shatter)
         shatter_mesh(msh, 0.2);
 
+    reorder_mesh(msh, cfg.ordering);
+
     solver_status<T> status;
 
     std::cout << "Running dG advection-reaction solver" << std::endl;
     std::cout << "  degree: " << cfg.degree << ", eta: " << cfg.eta << std::endl;
-    status = run_advection_reaction_solver(msh, cfg);
-    std::cout << status << std::endl;
+
+    for (size_t step = 0; step <= cfg.adapt_steps; step++)
+    {
+        status = run_advection_reaction_solver(msh, cfg);
+        std::cout << status << std::endl;
+
+        if (step == cfg.adapt_steps)
+            break;
+
+        auto marked = yaourt::doerfler_marking(status.indicators, cfg.adapt_fraction);
+        yaourt::refine_cells(msh, marked);
+        reorder_mesh(msh, cfg.ordering);
+
+        std::cout << "Adaptive step " << step+1 << ": " << msh.cells.size();
+        std::cout << " elements, " << msh.hanging_faces.size()/2;
+        std::cout << " hanging faces" << std::endl;
+    }
 }
 
 int main(int argc, char **argv)
@@ -341,18 +447,36 @@ int main(int argc, char **argv)
 
     int     ch;
 
-    while ( (ch = getopt(argc, argv, "e:k:r:m:pSuh")) != -1 )
+    while ( (ch = getopt(argc, argv, "a:be:j:k:Mr:m:o:pP:Suh")) != -1 )
     {
         switch(ch)
         {
+            case 'a':
+                cfg.adapt_steps = std::max(0, atoi(optarg));
+                break;
+
+            case 'b':
+                cfg.use_block_matrix = true;
+                break;
+
             case 'e':
                 cfg.eta = atof(optarg);
                 break;
 
+            case 'j':
+                cfg.num_threads = std::max(0, atoi(optarg));
+                if (cfg.num_threads == 0)
+                    cfg.num_threads = yaourt::default_num_threads();
+                break;
+
             case 'k':
                 cfg.degree = atoi(optarg);
                 break;
 
+            case 'M':
+                cfg.mixed_precision = true;
+                break;
+
             case 'r':
                 cfg.ref_levels = atoi(optarg);
                 if (cfg.ref_levels < 0)
@@ -366,8 +490,38 @@ int main(int argc, char **argv)
                     mt = yaourt::meshtype::QUADRANGULAR;
                 break;
 
+            case 'o':
+                if ( strcmp(optarg, "none") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::NONE;
+                else if ( strcmp(optarg, "hilbert") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::HILBERT;
+                else if ( strcmp(optarg, "rcm") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::REVERSE_CUTHILL_MCKEE;
+                else
+                {
+                    std::cout << "Unknown ordering " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+
             case 'p':
-                cfg.use_preconditioner = true;
+                cfg.preconditioner = dg_preconditioner::JACOBI;
+                break;
+
+            case 'P':
+                if ( strcmp(optarg, "none") == 0 )
+                    cfg.preconditioner = dg_preconditioner::NONE;
+                else if ( strcmp(optarg, "jacobi") == 0 )
+                    cfg.preconditioner = dg_preconditioner::JACOBI;
+                else if ( strcmp(optarg, "bjacobi") == 0 )
+                    cfg.preconditioner = dg_preconditioner::BLOCK_JACOBI;
+                else if ( strcmp(optarg, "ilu0") == 0 )
+                    cfg.preconditioner = dg_preconditioner::ILU0;
+                else
+                {
+                    std::cout << "Unknown preconditioner " << optarg << std::endl;
+                    exit(1);
+                }
                 break;
 
             case 'S':
@@ -389,6 +543,11 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    if (cfg.mixed_precision and cfg.use_block_matrix)
+    {
+        std::cout << "Mixed precision needs the CSR matrix, don't use -b" << std::endl;
+        exit(1);
+    }
 
     switch (mt)
     {
@@ -20,6 +20,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <memory>
 
 #include <cstring>
 #include <cmath>
@@ -28,13 +29,24 @@
 
 #include "core/mesh.hpp"
 #include "core/meshers.hpp"
+#include "core/reordering.hpp"
+#include "core/adaptivity.hpp"
 #include "core/quadratures.hpp"
 #include "core/bases.hpp"
+#include "core/tabulation.hpp"
 #include "core/solvers.hpp"
 #include "core/blaze_sparse_init.hpp"
 #include "core/dataio.hpp"
+#include "core/parallel.hpp"
+#include "core/batched_la.hpp"
+#include "core/multigrid.hpp"
 
 #include "methods/dg.hpp"
+#include "methods/dg_assembly.hpp"
+#include "methods/dg_matrix_free.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
 namespace params {
 /* Diffusion term coefficient */
@@ -78,18 +90,43 @@ diffusion_ref_sol(const point<T,2>& pt)
 } // namespace data
 
 
+/* Error indicator driving the adaptive refinement: the L2 error on each
+ * cell (the exact solution is known) or the jumps of the solution on the
+ * faces of each cell (see yaourt::jump_indicators) */
+enum class error_indicator
+{
+    L2_ERROR,
+    JUMPS
+};
+
 template<typename T>
 struct dg_config
 {
     T               eta;
     int             degree;
     int             ref_levels;
-    bool            use_preconditioner;
+    dg_preconditioner preconditioner;
     bool            shatter;
+    size_t          num_threads;
+    yaourt::mesh_ordering ordering;
+    bool            use_block_matrix;
+    bool            matrix_free;
+    bool            mixed_precision;
+    size_t          adapt_steps;
+    T               adapt_fraction;
+    error_indicator indicator;
+
+    /* Multigrid only: coarsen also the mesh, not only the degree, and
+     * run the cycles alone instead of using them in CG */
+    bool            mg_h_coarsening;
+    bool            mg_standalone;
 
     dg_config()
-        : eta(1.0), degree(1), ref_levels(4), use_preconditioner(false),
-          shatter(false)
+        : eta(1.0), degree(1), ref_levels(4), preconditioner(dg_preconditioner::NONE),
+          shatter(false), num_threads(1), ordering(yaourt::mesh_ordering::NONE),
+          use_block_matrix(false), matrix_free(false), mixed_precision(false),
+          adapt_steps(0), adapt_fraction(0.5), indicator(error_indicator::L2_ERROR),
+          mg_h_coarsening(true), mg_standalone(false)
     {}
 };
 
@@ -99,6 +136,9 @@ struct solver_status
     T   mesh_h;
     T   L2_errsq_qp;
     T   L2_errsq_mm;
+
+    /* Squared error indicator of each cell */
+    std::vector<T>  indicators;
 };
 
 template<typename T>
@@ -111,9 +151,77 @@ std::ostream& operator<<(std::ostream& os, const solver_status<T>& s)
     return os;
 }
 
+/* Interior penalty terms on the nonconforming faces. Each fine face is
+ * shared by a fine and a coarse cell: the terms are the same as on the
+ * conforming faces, integrated on the fine face with the basis of the
+ * coarse cell evaluated at the physical quadrature points. As for the
+ * conforming faces, the terms are assembled once from each side. */
+template<typename Mesh, typename Assembler>
+void
+assemble_hanging_faces(const Mesh& msh, Assembler& assm, size_t degree,
+                       typename Mesh::coordinate_type eta)
+{
+    YAOURT_TIMED_SCOPE("assembly.hanging_faces");
+
+    using T = typename Mesh::coordinate_type;
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+
+    for (auto& hf : msh.hanging_faces)
+    {
+        const auto& fc = msh.faces[ hf[1] ];
+        auto coarse_id = msh.face_owners[ hf[0] ][0];
+        auto fine_id = msh.face_owners[ hf[1] ][0];
+        const auto& ccl = msh.cells[coarse_id];
+        const auto& fcl = msh.cells[fine_id];
+
+        auto cbasis = yaourt::bases::make_tabulated_basis(msh, ccl, degree, 2*degree);
+        auto fbasis = yaourt::bases::make_tabulated_basis(msh, fcl, degree, 2*degree);
+
+        auto eta_l  = eta / diameter(msh, fc);
+        auto qps    = yaourt::quadratures::integrate(msh, fc, 2*degree);
+
+        /* 'n' is the outward normal of the cell 't' */
+        auto assemble_side = [&](size_t t_id, const auto& tbasis,
+                                 size_t n_id, const auto& nbasis,
+                                 const blaze::StaticVector<T,2>& n) {
+            blaze::DynamicMatrix<T> Att(bs, bs, 0.0);
+            blaze::DynamicMatrix<T> Atn(bs, bs, 0.0);
+
+            for (auto& qp : qps)
+            {
+                auto fqw    = qp.weight();
+                auto tphi   = tbasis.eval(qp.point());
+                auto nphi   = nbasis.eval(qp.point());
+                blaze::DynamicVector<T> tdn = tbasis.eval_grads(qp.point())*n;
+                blaze::DynamicVector<T> ndn = nbasis.eval_grads(qp.point())*n;
+
+                Att += + fqw * eta_l * tphi * trans(tphi);     // [u][v]
+                Att += - fqw * 0.5 * tphi * trans(tdn);        // {grad(u).n}[v]
+                Att += - fqw * 0.5 * tdn * trans(tphi);        // [u]{grad(v).n}
+
+                Atn += - fqw * eta_l * tphi * trans(nphi);     // [u][v]
+                Atn += - fqw * 0.5 * tphi * trans(ndn);        // {grad(u).n}[v]
+                Atn += + fqw * 0.5 * tdn * trans(nphi);        // [u]{grad(v).n}
+            }
+
+            assm.assemble(msh, t_id, t_id, Att);
+            assm.assemble(msh, t_id, n_id, Atn);
+        };
+
+        blaze::StaticVector<T,2> n = normal(msh, fcl, fc);
+        assemble_side(fine_id, fbasis, coarse_id, cbasis, n);
+        assemble_side(coarse_id, cbasis, fine_id, fbasis, -n);
+    }
+}
+
+/* 'hier' is the mesh hierarchy used by the multigrid for h-coarsening,
+ * 'msh' is its finest mesh. Without it the multigrid coarsens only the
+ * degree. */
 template<typename Mesh>
 solver_status<typename Mesh::coordinate_type>
-run_diffusion_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>& cfg)
+run_diffusion_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>& cfg,
+                     const yaourt::mesh_hierarchy<Mesh> *hier = nullptr)
 {
     using mesh_type = Mesh;
     using T = typename mesh_type::coordinate_type;
@@ -121,84 +229,30 @@ run_diffusion_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>&
     solver_status<T>    status;
     status.mesh_h = diameter(msh);
 
-    msh.compute_connectivity();
+    if ( !msh.has_connectivity() )
+        msh.compute_connectivity();
 
     size_t degree = cfg.degree;
     T eta = 3*degree*degree*cfg.eta;
 
 
     /* PROBLEM ASSEMBLY */
-    assembler<mesh_type> assm(msh, degree, cfg.use_preconditioner);
-
-    for (auto& tcl : msh.cells)
-    {
-        auto tbasis = yaourt::bases::make_basis(msh, tcl, degree);
-
-        blaze::DynamicMatrix<T> K(tbasis.size(), tbasis.size(), 0.0);
-        blaze::DynamicVector<T> loc_rhs(tbasis.size(), 0.0);
-
-        auto qps = yaourt::quadratures::integrate(msh, tcl, 2*degree);
-        for (auto& qp : qps)
-        {
-            auto ep   = qp.point();
-            auto phi  = tbasis.eval(ep);
-            auto dphi = tbasis.eval_grads(ep);
+    auto amode = dg_assembly_mode::PATTERN;
+    if (cfg.use_block_matrix)
+        amode = dg_assembly_mode::BLOCKS;
+    if (cfg.matrix_free)
+        amode = dg_assembly_mode::MATRIX_FREE;
 
-            K += qp.weight() * dphi * trans(dphi);
-            loc_rhs += qp.weight() * data::rhs(ep) * phi;
-        }
-
-        auto fcs = faces(msh, tcl);
-        for (auto& fc : fcs)
-        {
-            blaze::DynamicMatrix<T> Att(tbasis.size(), tbasis.size(), 0.0);
-            blaze::DynamicMatrix<T> Atn(tbasis.size(), tbasis.size(), 0.0);
-
-            auto [ncl, has_neighbour] = neighbour_via(msh, tcl, fc);
-            auto nbasis = yaourt::bases::make_basis(msh, ncl, degree);
-            assert(tbasis.size() == nbasis.size());
-
-            auto n     = normal(msh, tcl, fc);
-            auto eta_l = eta / diameter(msh, fc);
-            auto f_qps = yaourt::quadratures::integrate(msh, fc, 2*degree);
-
-            for (auto& fqp : f_qps)
-            {
-                auto ep     = fqp.point();
-                auto tphi   = tbasis.eval(ep);
-                auto tdphi  = tbasis.eval_grads(ep);
-
-                if (has_neighbour)
-                {   /* NOT on a boundary */
-                    Att += + fqp.weight() * eta_l * tphi * trans(tphi);     // [u][v]
-                    Att += - fqp.weight() * 0.5 * tphi * trans(tdphi*n);    // {grad(u).n}[v]
-                    Att += - fqp.weight() * 0.5 * (tdphi*n) * trans(tphi);  // [u]{grad(v).n}
-                    
-                    auto nphi   = nbasis.eval(ep);
-                    auto ndphi  = nbasis.eval_grads(ep);
-
-                    Atn += - fqp.weight() * eta_l * tphi * trans(nphi);         // [u][v]
-                    Atn += - fqp.weight() * 0.5 * tphi * trans(ndphi*n);        // {grad(u).n}[v]
-                    Atn += + fqp.weight() * 0.5 * (tdphi*n) * trans(nphi);      // [u]{grad(v).n}
-                }
-                else
-                {   /* On a boundary*/
-                    Att += + fqp.weight() * eta_l * tphi * trans(tphi);     // [u][v]
-                    Att += - fqp.weight() * tphi * trans(tdphi*n);          // {grad(u).n}[v]
-                    Att += - fqp.weight() * (tdphi*n) * trans(tphi);        // [u]{grad(v).n}
+    bool jacobi = (cfg.preconditioner == dg_preconditioner::JACOBI);
+    assembler<mesh_type> assm(msh, degree, jacobi,
+                              cfg.num_threads, amode);
 
-                    loc_rhs -= fqp.weight() * data::dirichlet(ep) * (tdphi*n);
-                    loc_rhs += fqp.weight() * eta_l * data::dirichlet(ep) * tphi;
-                }
-            }
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
 
-            assm.assemble(msh, tcl, tcl, Att);
-            if (has_neighbour)
-                assm.assemble(msh, tcl, ncl, Atn);
-        }
+    assemble_sip_diffusion(msh, assm, degree, eta, data::rhs<T>, data::dirichlet<T>,
+                           cfg.num_threads);
 
-        assm.assemble(msh, tcl, K, loc_rhs);
-    }
+    assemble_hanging_faces(msh, assm, degree, eta);
 
     assm.finalize();
 
@@ -213,23 +267,124 @@ run_diffusion_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>&
 
     std::cout << "System size: " << assm.system_size() << ", iter limit: " << cgp.max_iter << std::endl;
 
-    if (cfg.use_preconditioner)
-        conjugated_gradient(cgp, assm.lhs, assm.rhs, sol, assm.pc);
-    else    
-        conjugated_gradient(cgp, assm.lhs, assm.rhs, sol);
+    /* Multigrid on the assembled matrix, in the precision of 'A' */
+    auto make_multigrid = [&](const auto& A) {
+        using VT = typename std::decay_t<decltype(A)>::ElementType;
+        yaourt::multigrid_params<VT> mgp;
+        mgp.h_coarsening = cfg.mg_h_coarsening;
+        mgp.rr_tol = cgp.rr_tol;
+        mgp.max_cycles = cgp.max_iter;
+        mgp.verbose = cgp.verbose;
+
+        auto mg = yaourt::make_dg_multigrid(msh, hier, A, degree, mgp, cfg.num_threads);
+        std::cout << "Multigrid levels: " << mg.num_levels() << std::endl;
+        return mg;
+    };
+
+    auto assembled_matrix = [&]() {
+        if (cfg.matrix_free)
+            throw std::logic_error("Multigrid needs the assembled matrix");
+
+        if (cfg.use_block_matrix)
+            return assm.lhs_blocks.to_compressed();
+
+        return blaze::CompressedMatrix<T>(assm.lhs);
+    };
+
+    auto solve = [&](const auto& A) {
+        switch (cfg.preconditioner)
+        {
+            case dg_preconditioner::JACOBI:
+                conjugated_gradient(cgp, A, assm.rhs, sol, assm.pc);
+                break;
+
+            case dg_preconditioner::BLOCK_JACOBI:
+                conjugated_gradient(cgp, A, assm.rhs, sol, assm.block_jacobi());
+                break;
+
+            case dg_preconditioner::ILU0:
+                conjugated_gradient(cgp, A, assm.rhs, sol, assm.ilu0());
+                break;
+
+            case dg_preconditioner::MULTIGRID:
+                conjugated_gradient(cgp, A, assm.rhs, sol,
+                                    make_multigrid(assembled_matrix()));
+                break;
+
+            default:
+                conjugated_gradient(cgp, A, assm.rhs, sol);
+        }
+    };
+
+    /* Mixed precision: CG runs on a single precision copy of the matrix,
+     * with the preconditioner built on it, and the solution is refined
+     * with the residual computed in double */
+    auto solve_mixed = [&]() {
+        using L = float;
+        blaze::CompressedMatrix<L> A_lo(assm.lhs);
+        switch (cfg.preconditioner)
+        {
+            case dg_preconditioner::JACOBI:
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                                             blaze::CompressedMatrix<L>(assm.pc));
+                break;
+
+            case dg_preconditioner::BLOCK_JACOBI:
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                    yaourt::block_jacobi_preconditioner<L>(A_lo, bs));
+                break;
+
+            case dg_preconditioner::ILU0:
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                    yaourt::ilu0_preconditioner<L>(A_lo));
+                break;
+
+            case dg_preconditioner::MULTIGRID:
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol,
+                    make_multigrid(A_lo));
+                break;
+
+            default:
+                conjugated_gradient_mixed<L>(cgp, assm.lhs, A_lo, assm.rhs, sol);
+        }
+    };
+
+    YAOURT_TIMED_SCOPE_VAR(solve_timer, "dg.solve", false);
+    if (cfg.mg_standalone)
+    {
+        auto mg = make_multigrid(assembled_matrix());
+        sol = 0.0;
+        mg.solve(assm.rhs, sol);
+    }
+    else if (cfg.mixed_precision)
+        solve_mixed();
+    else if (cfg.matrix_free)
+        solve( yaourt::dg::make_sip_diffusion_operator(msh, degree, eta,
+                                                       cfg.num_threads) );
+    else if (cfg.use_block_matrix)
+        solve(assm.lhs_blocks);
+    else
+        solve(assm.lhs);
+    solve_timer.stop();
 
     /* POSTPROCESS PART */
+    YAOURT_TIMED_SCOPE_VAR(post_timer, "dg.postprocess", false);
 
     std::ofstream gnuplot_output("diffusion_solution.txt");
 
+    /* The L2 projections of the reference solution use the mass matrices
+     * factorized once per class of cells of the same shape */
+    auto mass = yaourt::tabulated_mass_factorizations(msh, degree, 2*degree,
+                                                      cfg.num_threads);
+
     status.L2_errsq_qp = 0.0;
     status.L2_errsq_mm = 0.0;
-    for (auto& cl : msh.cells)
+    blaze::DynamicVector<T> tphi(bs);
+    for (size_t ofs = 0; ofs < msh.cells.size(); ofs++)
     {
-
-        auto basis = yaourt::bases::make_basis(msh, cl, degree);
+        const auto& cl = msh.cells[ofs];
+        auto basis = yaourt::bases::make_tabulated_basis(msh, cl, degree, 2*degree);
         auto basis_size = basis.size();
-        auto ofs = offset(msh, cl);
 
         blaze::DynamicVector<T> loc_sol(basis_size);
         for (size_t i = 0; i < basis_size; i++)
@@ -238,39 +393,51 @@ run_diffusion_solver(Mesh& msh, const dg_config<typename Mesh::coordinate_type>&
         auto tps = yaourt::make_test_points(msh, cl, 7);
         for (auto& tp : tps)
         {
-            auto phi = basis.eval(tp);
-            T sval = dot(loc_sol, phi);
+            basis.eval(tp, tphi);
+            T sval = dot(loc_sol, tphi);
 
             gnuplot_output << tp.x() << " " << tp.y() << " " << sval << std::endl;
         }
 
-        blaze::DynamicMatrix<T> M(basis_size, basis_size, 0.0);
         blaze::DynamicVector<T> a(basis_size, 0.0);
+        T cell_errsq = 0.0;
 
-        auto qps = yaourt::quadratures::integrate(msh, cl, 2*degree);
-        for (auto& qp : qps)
+        auto qps = basis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
         {
-            auto ep   = qp.point();
-            auto phi  = basis.eval(ep);
+            auto ep     = qps.point(iqp);
+            auto qw     = qps.weight(iqp);
+            auto& phi   = qps.phi(iqp);
 
             auto sv = data::diffusion_ref_sol(ep);
 
-            M += qp.weight() * phi * trans(phi);
-            a += qp.weight() * sv * phi;
+            a += qw * sv * phi;
 
             T cv = dot(loc_sol, phi);
-            status.L2_errsq_qp += qp.weight() * (sv - cv) * (sv - cv);
+            cell_errsq += qw * (sv - cv) * (sv - cv);
         }
 
-        blaze::DynamicVector<T> proj = blaze::solve_LU(M, a);
-        status.L2_errsq_mm += dot(proj-loc_sol, M*(proj-loc_sol));
+        status.L2_errsq_qp += cell_errsq;
+        status.indicators.push_back(cell_errsq);
+
+        /* (proj - sol)' * M * (proj - sol), on the quadrature points */
+        blaze::DynamicVector<T> diff = mass.solve(ofs, a) - loc_sol;
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
+        {
+            T dv = dot(diff, qps.phi(iqp));
+            status.L2_errsq_mm += qps.weight(iqp) * dv * dv;
+        }
 
     }
 
+    if (cfg.indicator == error_indicator::JUMPS)
+        status.indicators = yaourt::jump_indicators(msh, degree, sol,
+                                                    data::dirichlet<T>);
+    post_timer.stop();
+
 #ifdef WITH_SILO
 
     blaze::DynamicVector<T> var(msh.cells.size());
-    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
     for (size_t i = 0; i < msh.cells.size(); i++)
     {
         var[i] = sol[bs*i];
@@ -305,18 +472,50 @@ void run_dg(const dg_config<typename Mesh::coordinate_type>& cfg)
 
     mesh_type msh;
 
-    auto mesher = yaourt::get_mesher(msh);
-    mesher.create_mesh(msh, cfg.ref_levels);
+    /* The multigrid coarsens the mesh along the uniform refinements, the
+     * meshes are not nested once shattered */
+    std::unique_ptr<yaourt::mesh_hierarchy<mesh_type>> hier;
+    if (cfg.preconditioner == dg_preconditioner::MULTIGRID and
+        cfg.mg_h_coarsening and !cfg.shatter)
+    {
+        hier = std::make_unique<yaourt::mesh_hierarchy<mesh_type>>(cfg.ref_levels,
+                                                                   cfg.num_threads);
+        hier->reorder_finest(cfg.ordering);
+        msh = hier->finest();
+    }
+    else
+    {
+        auto mesher = yaourt::get_mesher(msh);
+        mesher.create_mesh(msh, cfg.ref_levels);
 
-    if (cfg.shatter)
-        shatter_mesh(msh, 0.2);
+        if (cfg.shatter)
+            shatter_mesh(msh, 0.2);
+
+        reorder_mesh(msh, cfg.ordering);
+    }
 
     solver_status<T> status;
 
     std::cout << "Running dG diffusion solver" << std::endl;
     std::cout << "  degree: " << cfg.degree << ", eta: " << cfg.eta << std::endl;
-    status = run_diffusion_solver(msh, cfg);
-    std::cout << status << std::endl;
+
+    for (size_t step = 0; step <= cfg.adapt_steps; step++)
+    {
+        /* The adapted meshes are not in the hierarchy */
+        status = run_diffusion_solver(msh, cfg, step == 0 ? hier.get() : nullptr);
+        std::cout << status << std::endl;
+
+        if (step == cfg.adapt_steps)
+            break;
+
+        auto marked = yaourt::doerfler_marking(status.indicators, cfg.adapt_fraction);
+        yaourt::refine_cells(msh, marked);
+        reorder_mesh(msh, cfg.ordering);
+
+        std::cout << "Adaptive step " << step+1 << ": " << msh.cells.size();
+        std::cout << " elements, " << msh.hanging_faces.size()/2;
+        std::cout << " hanging faces" << std::endl;
+    }
 }
 
 int main(int argc, char **argv)
@@ -331,18 +530,52 @@ int main(int argc, char **argv)
 
     int     ch;
 
-    while ( (ch = getopt(argc, argv, "e:k:r:m:pSh")) != -1 )
+    while ( (ch = getopt(argc, argv, "a:be:FI:j:k:Mr:m:o:pP:SVh")) != -1 )
     {
         switch(ch)
         {
+            case 'b':
+                cfg.use_block_matrix = true;
+                break;
+
             case 'e':
                 cfg.eta = atof(optarg);
                 break;
 
+            case 'a':
+                cfg.adapt_steps = std::max(0, atoi(optarg));
+                break;
+
+            case 'F':
+                cfg.matrix_free = true;
+                break;
+
+            case 'I':
+                if ( strcmp(optarg, "error") == 0 )
+                    cfg.indicator = error_indicator::L2_ERROR;
+                else if ( strcmp(optarg, "jump") == 0 )
+                    cfg.indicator = error_indicator::JUMPS;
+                else
+                {
+                    std::cout << "Unknown error indicator " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+
+            case 'j':
+                cfg.num_threads = std::max(0, atoi(optarg));
+                if (cfg.num_threads == 0)
+                    cfg.num_threads = yaourt::default_num_threads();
+                break;
+
             case 'k':
                 cfg.degree = atoi(optarg);
                 break;
 
+            case 'M':
+                cfg.mixed_precision = true;
+                break;
+
             case 'r':
                 cfg.ref_levels = atoi(optarg);
                 if (cfg.ref_levels < 0)
@@ -356,14 +589,55 @@ int main(int argc, char **argv)
                     mt = yaourt::meshtype::QUADRANGULAR;
                 break;
 
+            case 'o':
+                if ( strcmp(optarg, "none") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::NONE;
+                else if ( strcmp(optarg, "hilbert") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::HILBERT;
+                else if ( strcmp(optarg, "rcm") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::REVERSE_CUTHILL_MCKEE;
+                else
+                {
+                    std::cout << "Unknown ordering " << optarg << std::endl;
+                    exit(1);
+                }
+                break;
+
             case 'p':
-                cfg.use_preconditioner = true;
+                cfg.preconditioner = dg_preconditioner::JACOBI;
+                break;
+
+            case 'P':
+                if ( strcmp(optarg, "none") == 0 )
+                    cfg.preconditioner = dg_preconditioner::NONE;
+                else if ( strcmp(optarg, "jacobi") == 0 )
+                    cfg.preconditioner = dg_preconditioner::JACOBI;
+                else if ( strcmp(optarg, "bjacobi") == 0 )
+                    cfg.preconditioner = dg_preconditioner::BLOCK_JACOBI;
+                else if ( strcmp(optarg, "ilu0") == 0 )
+                    cfg.preconditioner = dg_preconditioner::ILU0;
+                else if ( strcmp(optarg, "mg") == 0 )
+                    cfg.preconditioner = dg_preconditioner::MULTIGRID;
+                else if ( strcmp(optarg, "pmg") == 0 )
+                {
+                    cfg.preconditioner = dg_preconditioner::MULTIGRID;
+                    cfg.mg_h_coarsening = false;
+                }
+                else
+                {
+                    std::cout << "Unknown preconditioner " << optarg << std::endl;
+                    exit(1);
+                }
                 break;
 
             case 'S':
                 cfg.shatter = true;
                 break;
 
+            case 'V':
+                cfg.mg_standalone = true;
+                break;
+
             case 'h':
             case '?':
             default:
@@ -375,6 +649,31 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
+    if (cfg.mg_standalone and cfg.preconditioner != dg_preconditioner::MULTIGRID)
+    {
+        std::cout << "-V runs the multigrid alone, use it with -P mg or -P pmg" << std::endl;
+        exit(1);
+    }
+
+    if (cfg.mixed_precision and (cfg.use_block_matrix or cfg.matrix_free))
+    {
+        std::cout << "Mixed precision needs the CSR matrix, don't use -b or -F" << std::endl;
+        exit(1);
+    }
+
+    /* The matrix-free operator carries only its diagonal */
+    if (cfg.matrix_free and cfg.preconditioner != dg_preconditioner::NONE and
+        cfg.preconditioner != dg_preconditioner::JACOBI)
+    {
+        std::cout << "-F supports only -P none or -P jacobi" << std::endl;
+        exit(1);
+    }
+
+    if (cfg.matrix_free and cfg.adapt_steps > 0)
+    {
+        std::cout << "-F does not support the hanging faces, don't use -a" << std::endl;
+        exit(1);
+    }
 
     switch (mt)
     {
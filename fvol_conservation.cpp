@@ -20,6 +20,9 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <memory>
+#include <string>
 
 #include <cstdio>
 #include <cstring>
@@ -34,20 +37,22 @@
 #include "core/solvers.hpp"
 #include "core/blaze_sparse_init.hpp"
 #include "core/dataio.hpp"
+#include "core/checkpoint.hpp"
+#include "core/partitioning.hpp"
+#include "core/distributed.hpp"
 
 #include "methods/dg.hpp"
+#include "methods/fvol_acoustics.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
 #define VX	0
 #define VY	1
 #define P	2
 
-template<typename T>
-struct field_energies
-{
-	T	Wvx;
-	T	Wvy;
-	T	Wp;
-};
+using yaourt::fvol::acoustics_fields;
+using yaourt::fvol::field_energies;
 
 class gnuplot
 {
@@ -108,205 +113,216 @@ public:
 
 
 
+#ifdef WITH_SILO
+/* Called by the Silo writer, in the background */
 template<typename Mesh>
-void
-apply_acoustics_operator(Mesh& msh,
-	const blaze::DynamicMatrix<typename Mesh::coordinate_type>& in,
-	blaze::DynamicMatrix<typename Mesh::coordinate_type>& out)
-{
-	using mesh_type = Mesh;
-    using T = typename mesh_type::coordinate_type;
-
-	assert( msh.cells.size() == in.rows() );
-	assert( msh.cells.size() == out.rows() );
-	assert( in.columns() == 3 );
-	assert( out.columns() == 3 );
-
-    msh.compute_connectivity();
-
-	for (auto& tcl : msh.cells)
-    {
-		auto ofs_mine = offset(msh, tcl);
-		auto ht = measure(msh, tcl);
-		auto alpha = 1.0;
-		
-		T flux_p  = 0.0;
-		T flux_vx = 0.0;
-		T flux_vy = 0.0;
-
-		auto fcs = faces(msh, tcl);
-        for (auto& fc : fcs)
-        {
-			auto hf = measure(msh, fc);
-            auto [ncl, has_neighbour] = neighbour_via(msh, tcl, fc);
-            auto n = normal(msh, tcl, fc);
-			auto nx = n[0];
-			auto ny = n[1];
-
-			if (not has_neighbour)
-			{
-				assert(fc.is_boundary == true);
-				auto svx = in(ofs_mine, VX);
-				auto svy = in(ofs_mine, VY);
-				auto sp  = in(ofs_mine, P);
-				
-				auto jvx = in(ofs_mine, VX);
-				auto jvy = in(ofs_mine, VY);
-				auto jp = in(ofs_mine, P);
-
-				//if (fc.boundary_id != 1)
-				//{
-				//	flux_vx += (hf/ht) * ( nx*sp + alpha*jvx );
-				//	flux_vy += (hf/ht) * ( ny*sp + alpha*jvy );
-				//}
-				
-				flux_p  += (hf/ht) * ( nx*svx + ny*svy + alpha*jp );
-			}
-			else
-			{
-				auto ofs_neigh = offset(msh, ncl);
-
-				auto svx = in(ofs_mine, VX) + in(ofs_neigh, VX);
-				auto svy = in(ofs_mine, VY) + in(ofs_neigh, VY);
-				auto sp  = in(ofs_mine, P)  + in(ofs_neigh, P);
-
-				auto jvx = in(ofs_mine, VX) - in(ofs_neigh, VX);
-				auto jvy = in(ofs_mine, VY) - in(ofs_neigh, VY);
-				auto jp = in(ofs_mine, P) - in(ofs_neigh, P);
-
-				flux_vx += (0.5*hf/ht) * ( nx*sp + alpha*jvx );
-				flux_vy += (0.5*hf/ht) * ( ny*sp + alpha*jvy );
-				flux_p  += (0.5*hf/ht) * ( nx*svx + ny*svy + alpha*jp );
-			}
-		}
-		
-		out(ofs_mine, VX) = -flux_vx;
-		out(ofs_mine, VY) = -flux_vy;
-		out(ofs_mine, P) = -flux_p;
-	}
-}
-
-
-
-template<typename Mesh>
-field_energies<typename Mesh::coordinate_type>
-compute_energies(Mesh& msh,
-	const blaze::DynamicMatrix<typename Mesh::coordinate_type>& field)
+static void
+export_solution(yaourt::dataio::silo_database& silo, const std::string& mesh_name,
+	const acoustics_fields<typename Mesh::coordinate_type>& data)
 {
-	using mesh_type = Mesh;
-    using T = typename mesh_type::coordinate_type;
-
-	field_energies<T> fe;
-	fe.Wvx = 0.0;
-	fe.Wvy = 0.0;
-	fe.Wp = 0.0;
-
-	size_t cell_i = 0;
-	for (auto& tcl : msh.cells)
-	{
-		auto ht = measure(msh, tcl);
-
-		T vx = field(cell_i, VX);
-		T vy = field(cell_i, VY);
-		T p = field(cell_i, P);
+	using T = typename Mesh::coordinate_type;
 
-		fe.Wvx += 0.5*vx*vx*ht;
-		fe.Wvy += 0.5*vy*vy*ht;
-		fe.Wp += 0.5*p*p*ht;
+	blaze::DynamicVector<T> vx = column(data, VX);
+	silo.add_zonal_variable(mesh_name, "vx", vx);
 
-		cell_i++;
-	}
+	blaze::DynamicVector<T> vy = column(data, VY);
+	silo.add_zonal_variable(mesh_name, "vy", vy);
 
-	return fe;
+	blaze::DynamicVector<T> p = column(data, P);
+	silo.add_zonal_variable(mesh_name, "p", p);
 }
+#endif
 
-#ifdef WITH_SILO
+/* The mesh, its partition and the state after the timestep 'step'. The
+ * state is saved one row per cell, as the checkpoints always did. */
 template<typename Mesh>
 static void
-export_solution(Mesh& msh, size_t ts,
-	blaze::DynamicMatrix<typename Mesh::coordinate_type>& data)
+write_acoustics_checkpoint(const std::string& filename, const Mesh& msh,
+	const yaourt::mesh_partition& part,
+	const acoustics_fields<typename Mesh::coordinate_type>& state, size_t step)
 {
 	using T = typename Mesh::coordinate_type;
-	std::stringstream ss;
-	ss << "fvol_acoustics_" << ts << ".silo";
-	yaourt::dataio::silo_database silo;
-    silo.create( ss.str() );
-    silo.add_mesh(msh, "mesh");
 
-	blaze::DynamicVector<T> vx = column(data, VX);
-	silo.add_zonal_variable("mesh", "vx", vx);
+	yaourt::checkpoint::writer w(filename);
+	yaourt::checkpoint::write_mesh(w, msh);
+	yaourt::checkpoint::write_partition(w, part);
+	w.write("acoustics.state", blaze::DynamicMatrix<T>(state));
+	w.write_value("acoustics.step", uint64_t(step));
+	w.close();
+}
 
-	blaze::DynamicVector<T> vy = column(data, VY);
-	silo.add_zonal_variable("mesh", "vy", vy);
+struct checkpoint_options
+{
+	const char	*checkpoint_fn;		/* Where to save the checkpoints */
+	size_t		checkpoint_rate;	/* Timesteps between checkpoints */
+	const char	*restart_fn;		/* Checkpoint to restart from */
 
-	blaze::DynamicVector<T> p = column(data, P);
-	silo.add_zonal_variable("mesh", "p", p);
+	checkpoint_options()
+		: checkpoint_fn(nullptr), checkpoint_rate(1000), restart_fn(nullptr)
+	{}
+};
 
-    silo.close();
+/* With MPI each process has its own checkpoint */
+static std::string
+process_filename(const char *filename, const yaourt::mesh_partition& part)
+{
+	std::string ret = filename;
+	if (part.is_distributed())
+		ret += "_" + std::to_string(part.part);
+	return ret;
 }
-#endif
 
+/* With MPI, 'msh' is the local mesh described by 'part'. If 'restart' is
+ * not null the solver continues from the state it contains. */
 template<typename Mesh>
 static void
-run_acoustics_solver(Mesh& msh)
+run_acoustics_solver(Mesh& msh, const yaourt::mesh_partition& part,
+	const checkpoint_options& copts, const yaourt::checkpoint::reader *restart,
+	size_t num_threads)
 {
 	auto num_cells = msh.cells.size();
 
 	using T = typename Mesh::coordinate_type;
-	blaze::DynamicMatrix<T> curr(num_cells, 3);
-	blaze::DynamicMatrix<T> next(num_cells, 3);
-	blaze::DynamicMatrix<T> k1(num_cells, 3);
-	blaze::DynamicMatrix<T> k2(num_cells, 3);
-	blaze::DynamicMatrix<T> k3(num_cells, 3);
-	blaze::DynamicMatrix<T> k4(num_cells, 3);
-	blaze::DynamicMatrix<T> tmp(num_cells, 3);
+	acoustics_fields<T> curr(num_cells, 3, 0.0);
+	acoustics_fields<T> next(num_cells, 3);
+	acoustics_fields<T> k1(num_cells, 3);
+	acoustics_fields<T> k2(num_cells, 3);
+	acoustics_fields<T> k3(num_cells, 3);
+	acoustics_fields<T> k4(num_cells, 3);
+	acoustics_fields<T> tmp(num_cells, 3);
 
 	T dt = 0.0001;
 
-	for (auto& tcl : msh.cells)
-    {
-		auto bar = barycenter(msh, tcl);
-		auto ax = bar.x() - 0.5;
-		auto ay = bar.y() - 0.5;
-		//T e = -100*(ax*ax + ay*ay);
-		//T val = std::exp(e);
-		T val = std::sin(M_PI*bar.x())*std::sin(M_PI*bar.y());
-		auto ofs = offset(msh, tcl);
-		curr(ofs, P) = val;
+	size_t first_step = 0;
+	if (restart)
+	{
+		blaze::DynamicMatrix<T> state;
+		restart->read("acoustics.state", state);
+		if (state.rows() != num_cells or state.columns() != 3)
+			throw std::runtime_error("Checkpoint: inconsistent state");
+		curr = state;
+		first_step = restart->read_value<uint64_t>("acoustics.step") + 1;
+	}
+	else
+	{
+		for (auto& tcl : msh.cells)
+		{
+			auto bar = barycenter(msh, tcl);
+			auto ax = bar.x() - 0.5;
+			auto ay = bar.y() - 0.5;
+			//T e = -100*(ax*ax + ay*ay);
+			//T val = std::exp(e);
+			T val = std::sin(M_PI*bar.x())*std::sin(M_PI*bar.y());
+			auto ofs = offset(msh, tcl);
+			curr(ofs, P) = val;
+		}
 	}
 
+	size_t num_owned = num_cells;
+	bool root = true;
+#ifdef WITH_MPI
+	std::unique_ptr<yaourt::mpi::halo_exchange<T>> halo;
+	if (part.is_distributed())
+	{
+		halo = std::make_unique<yaourt::mpi::halo_exchange<T>>(part);
+		num_owned = part.num_owned;
+		root = (part.part == 0);
+	}
+#endif
+
+	/* The face geometry is computed once for all the timesteps */
+	yaourt::fvol::acoustics_operator<Mesh> op(msh, num_owned, 1.0, num_threads);
+
+	/* With MPI the ghost rows of 'in' are exchanged while the faces between
+	 * the owned cells are computed */
+	auto apply_op = [&](acoustics_fields<T>& in, acoustics_fields<T>& out,
+	                    field_energies<T> *fe) {
+#ifdef WITH_MPI
+		if (halo)
+		{
+			halo->begin(in);
+			op.apply(in, out, fe, [&]() { halo->end(); });
+			return;
+		}
+#endif
+		op.apply(in, out, fe);
+	};
+
+#ifdef WITH_SILO
+	/* The mesh is written once, the solution in the background */
+	using silo_writer = yaourt::dataio::async_silo_writer<acoustics_fields<T>>;
+	std::string suffix;
+	if (part.is_distributed())
+		suffix = "_" + std::to_string(part.part);
+
+	silo_writer silo_out(msh, "fvol_acoustics", "mesh",
+		[](yaourt::dataio::silo_database& silo, const std::string& mesh_name,
+		   const acoustics_fields<T>& data, int, double) {
+			export_solution<Mesh>(silo, mesh_name, data);
+		}, suffix);
+#endif
+
 	std::vector<field_energies<T>> nrg;
 
-	gnuplot gp;
+	/* The energies are summed over all the processes and plotted by the
+	 * first one */
+	std::unique_ptr<gnuplot> gp;
+	if (root)
+		gp = std::make_unique<gnuplot>();
 
-	for (size_t i = 0; i < 20000; i++)
+	for (size_t i = first_step; i < 20000; i++)
 	{
-		std::cout << "Timestep " << i << "\r" << std::flush;
-		apply_acoustics_operator(msh, curr, k1);
+		YAOURT_TIMED_SCOPE("fvol.timestep");
+
+		if (root)
+			std::cout << "Timestep " << i << "\r" << std::flush;
+
+		apply_op(curr, k1, nullptr);
 
 		tmp = curr + 0.5*dt*k1;
-		apply_acoustics_operator(msh, tmp, k2);
+		apply_op(tmp, k2, nullptr);
 
 		tmp = curr + 0.5*dt*k2;
-		apply_acoustics_operator(msh, tmp, k3);
+		apply_op(tmp, k3, nullptr);
 
 		tmp = curr + dt*k3;
-		apply_acoustics_operator(msh, tmp, k4);
+		apply_op(tmp, k4, nullptr);
 
 		next = curr + dt*(k1 + 2.0*k2 + 2.0*k3 + k4)/6.0;
 
+		/* The energies of the state written at (i+1)*dt */
 		if (i%100 == 0)
 		{
 #ifdef WITH_SILO
-			export_solution(msh, i+1, next);
+			silo_out.submit(i+1, (i+1)*dt, next);
+#endif
+			auto fe = op.energies(next);
+#ifdef WITH_MPI
+			if (part.is_distributed())
+			{
+				fe.Wvx = yaourt::mpi::allreduce_sum(fe.Wvx);
+				fe.Wvy = yaourt::mpi::allreduce_sum(fe.Wvy);
+				fe.Wp = yaourt::mpi::allreduce_sum(fe.Wp);
+			}
 #endif
-			nrg.push_back( compute_energies(msh, next) );
-			gp.plot(nrg);
+			nrg.push_back(fe);
+			if (gp)
+				gp->plot(nrg);
 		}
 
 		curr = next;
+
+		if (copts.checkpoint_fn and (i+1) % copts.checkpoint_rate == 0)
+			write_acoustics_checkpoint(process_filename(copts.checkpoint_fn, part),
+				msh, part, curr, i);
 	}
-	std::cout << std::endl;
+
+#ifdef WITH_SILO
+	silo_out.flush();
+#endif
+
+	if (root)
+		std::cout << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -314,12 +330,89 @@ int main(int argc, char **argv)
 	using T = double;
 	using mesh_type = yaourt::quad_mesh<T>;
 
+#ifdef WITH_MPI
+	MPI_Init(&argc, &argv);
+	if ( yaourt::mpi::is_parallel() )
+		yaourt::instrumentation::registry::instance().set_process( yaourt::mpi::comm_rank() );
+#endif
+
+	checkpoint_options copts;
+	size_t num_threads = 1;
+	int ch;
+	while ((ch = getopt(argc, argv, "c:C:j:x:")) != -1)
+	{
+		switch (ch)
+		{
+			/* Save the state every checkpoint-rate timesteps */
+			case 'c':
+				copts.checkpoint_fn = optarg;
+				break;
+
+			case 'C':
+				copts.checkpoint_rate = std::max(1, atoi(optarg));
+				break;
+
+			case 'j':
+				num_threads = std::max(0, atoi(optarg));
+				if (num_threads == 0)
+					num_threads = yaourt::default_num_threads();
+				break;
+
+			/* Continue the run saved in a checkpoint */
+			case 'x':
+				copts.restart_fn = optarg;
+				break;
+
+			default:
+				std::cout << "Usage: " << argv[0] << " [-c checkpoint] ";
+				std::cout << "[-C checkpoint rate] [-j threads] [-x restart]" << std::endl;
+				return 1;
+		}
+	}
+
 	mesh_type msh;
+	yaourt::mesh_partition part;
+	std::unique_ptr<yaourt::checkpoint::reader> restart;
 
-    auto mesher = yaourt::get_mesher(msh);
-    mesher.create_mesh(msh, 6);
+	if (copts.restart_fn)
+	{
+		/* The mesh and the partition are the ones of the checkpoint */
+		std::string restart_fn = copts.restart_fn;
+#ifdef WITH_MPI
+		if ( yaourt::mpi::is_parallel() )
+			restart_fn += "_" + std::to_string( yaourt::mpi::comm_rank() );
+#endif
+		restart = std::make_unique<yaourt::checkpoint::reader>(restart_fn);
+		yaourt::checkpoint::read_mesh(*restart, msh);
+		part = yaourt::checkpoint::read_partition(*restart);
+
+		size_t num_procs = 1;
+#ifdef WITH_MPI
+		if ( yaourt::mpi::is_parallel() )
+			num_procs = yaourt::mpi::comm_size();
+#endif
+		if (part.num_parts != num_procs)
+		{
+			std::cout << "Checkpoint saved with another number of processes" << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		auto mesher = yaourt::get_mesher(msh);
+		mesher.create_mesh(msh, 6);
+
+#ifdef WITH_MPI
+		if ( yaourt::mpi::is_parallel() )
+			part = yaourt::mpi::distribute_mesh(msh);
+#endif
+	}
+
+	run_acoustics_solver(msh, part, copts, restart.get(), num_threads);
 
-	run_acoustics_solver(msh);
+#ifdef WITH_MPI
+	MPI_Finalize();
+#endif
 
 	return 0;
 }
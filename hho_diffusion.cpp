@@ -1,41 +1,122 @@
+#include <iostream>
+#include <cmath>
+#include <cstring>
+
+#include <unistd.h>
+
 #include "methods/hho.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
+/* L2 error of the cell unknowns on the solution of the model problem,
+ * sin(pi*x)*sin(pi*y) */
 template<typename Mesh>
-static void
-run_hho_solver(Mesh& msh)
+static typename Mesh::coordinate_type
+run_hho_solver(Mesh& msh, size_t degree, size_t num_threads)
 {
-    using matr = blaze::DynamicMatrix<typename Mesh::coordinate_type>;
     using vect = blaze::DynamicVector<typename Mesh::coordinate_type>;
     using point_type = typename Mesh::point_type;
+    using T = typename Mesh::coordinate_type;
 
-    hho_degree_info hdi( equal_order{1} );
+    hho_degree_info hdi( equal_order{degree} );
 
-    auto rhs_fun = [](const point_type& pt) -> auto {
-        return 0.0;
+    auto rhs_fun = [](const point_type& pt) -> T {
+        return 2.0 * M_PI * M_PI * std::sin(M_PI*pt.x()) * std::sin(M_PI*pt.y());
     };
 
-    for (auto& cl : msh.cells)
+    auto sol_fun = [](const point_type& pt) -> T {
+        return std::sin(M_PI*pt.x()) * std::sin(M_PI*pt.y());
+    };
+
+    conjugated_gradient_params<T> cgp;
+    cgp.verbose = true;
+    cgp.rr_max = 10000;
+    cgp.rr_tol = 1e-10;
+    cgp.max_iter = 10000;
+
+    auto sol = solve_hho_diffusion(msh, hdi, rhs_fun, sol_fun, cgp, num_threads);
+
+    auto cd = hdi.cell_degree();
+    auto cbs = yaourt::bases::scalar_basis_size(cd, 2);
+    vect phi(cbs);
+
+    T err = 0.0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
     {
-        auto [GR, A] = make_hho_gradient_reconstruction(msh, cl, hdi);
-        auto S = make_hho_stabilization(msh, cl, GR, hdi);
-        matr L = A + S;
-        auto b = hho_rhs(msh, cl, hdi, rhs_fun);
+        const auto& cl = msh.cells[cl_id];
+        auto cb = yaourt::bases::make_basis(msh, cl, cd);
+        auto solT = subvector(sol[cl_id], 0, cbs);
 
-        auto [LC, bC] = static_condensation(hdi, L, b);
+        auto qps = yaourt::quadratures::integrate(msh, cl, 2*cd+2);
+        for (auto& qp : qps)
+        {
+            cb.eval(qp.point(), phi);
+            auto diff = sol_fun(qp.point()) - dot(solT, phi);
+            err += qp.weight() * diff * diff;
+        }
     }
+
+    return std::sqrt(err);
+}
+
+template<typename Mesh>
+static void
+run(size_t degree, size_t levels, size_t num_threads)
+{
+    Mesh msh;
+
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, levels);
+
+    auto err = run_hho_solver(msh, degree, num_threads);
+    std::cout << "h = " << diameter(msh) << ", L2 error: " << err << std::endl;
 }
 
 int main(int argc, char **argv)
 {
-	using T = double;
-	using mesh_type = yaourt::simplicial_mesh<T>;
+    using T = double;
 
-	mesh_type msh;
+    size_t  degree = 1;
+    size_t  levels = 6;
+    size_t  num_threads = 1;
+    bool    quads = false;
+    int     ch;
 
-    auto mesher = yaourt::get_mesher(msh);
-    mesher.create_mesh(msh, 6);
+    while ( (ch = getopt(argc, argv, "k:r:m:j:")) != -1 )
+    {
+        switch(ch)
+        {
+            case 'k':
+                degree = std::max(0, atoi(optarg));
+                break;
+
+            case 'r':
+                levels = std::max(0, atoi(optarg));
+                break;
+
+            case 'm':
+                quads = (strcmp(optarg, "quad") == 0);
+                break;
+
+            case 'j':
+                num_threads = std::max(0, atoi(optarg));
+                if (num_threads == 0)
+                    num_threads = yaourt::default_num_threads();
+                break;
+
+            case '?':
+            default:
+                std::cout << "Usage: " << argv[0] << " [-k degree] [-r levels] ";
+                std::cout << "[-m tri|quad] [-j threads]" << std::endl;
+                return 1;
+        }
+    }
 
-	run_hho_solver(msh);
+    if (quads)
+        run< yaourt::quad_mesh<T> >(degree, levels, num_threads);
+    else
+        run< yaourt::simplicial_mesh<T> >(degree, levels, num_threads);
 
-	return 0;
+    return 0;
 }
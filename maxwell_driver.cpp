@@ -23,74 +23,71 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fstream>
 #include <cstring>
+#include <memory>
+#include <string>
 #include <getopt.h>
+#include <type_traits>
 
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 
 #include "methods/dg_maxwell_2D.hpp"
+#ifdef YAOURT_COUNT_ALLOCATIONS
+#include "core/allocation_counter.hpp"
+#endif
 
 namespace ymax = yaourt::maxwell_2D;
 
 #ifdef WITH_SILO
+/* Write the fields of a cycle. This runs on the thread of the Silo writer,
+ * while the solver goes on: it uses only the DoFs it receives and the mesh,
+ * which does not change during the timestepping. */
 template<typename Mesh>
-bool
-export_data_to_silo(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
+void
+export_data_to_silo(const Mesh& msh, size_t degree,
+                    yaourt::dataio::silo_database& silo,
+                    const std::string& mesh_name,
+                    const blaze::DynamicVector<typename Mesh::coordinate_type>& dofs,
+                    typename Mesh::coordinate_type time,
                     const ymax::ICF_type<Mesh>& Hx_ref,
                     const ymax::ICF_type<Mesh>& Hy_ref,
                     const ymax::ICF_type<Mesh>& Ez_ref)
 {
-    if (!ctx.cfg.silo_basename)
-        return false;
-
     namespace yb = yaourt::bases;
-    auto basis_size = yb::scalar_basis_size(ctx.cfg.degree, 2);
+    auto basis_size = yb::scalar_basis_size(degree, 2);
 
     using T = typename Mesh::coordinate_type;
     using namespace blaze;
-    DynamicVector<T> Hx(ctx.msh.cells.size(), 0.0);
-    DynamicVector<T> Hy(ctx.msh.cells.size(), 0.0);
-    DynamicVector<T> Ez(ctx.msh.cells.size(), 0.0);
+    DynamicVector<T> Hx(msh.cells.size(), 0.0);
+    DynamicVector<T> Hy(msh.cells.size(), 0.0);
+    DynamicVector<T> Ez(msh.cells.size(), 0.0);
 
-    DynamicVector<T> Hx_refsol(ctx.msh.cells.size(), 0.0);
-    DynamicVector<T> Hy_refsol(ctx.msh.cells.size(), 0.0);
-    DynamicVector<T> Ez_refsol(ctx.msh.cells.size(), 0.0);
+    DynamicVector<T> Hx_refsol(msh.cells.size(), 0.0);
+    DynamicVector<T> Hy_refsol(msh.cells.size(), 0.0);
+    DynamicVector<T> Ez_refsol(msh.cells.size(), 0.0);
 
     size_t cell_i = 0;
-    for (auto& tcl : ctx.msh.cells)
+    for (auto& tcl : msh.cells)
     {          
-        Hx[cell_i] = ctx.gDofs[cell_i*3*basis_size];
-        Hy[cell_i] = ctx.gDofs[cell_i*3*basis_size + basis_size];
-        Ez[cell_i] = ctx.gDofs[cell_i*3*basis_size + 2*basis_size];
+        Hx[cell_i] = dofs[cell_i*3*basis_size];
+        Hy[cell_i] = dofs[cell_i*3*basis_size + basis_size];
+        Ez[cell_i] = dofs[cell_i*3*basis_size + 2*basis_size];
 
-        auto bar = barycenter(ctx.msh, tcl);
-        Hx_refsol[cell_i] = Hx_ref(bar, cycle*ctx.cfg.delta_t);
-        Hy_refsol[cell_i] = Hy_ref(bar, cycle*ctx.cfg.delta_t);
-        Ez_refsol[cell_i] = Ez_ref(bar, cycle*ctx.cfg.delta_t);
+        auto bar = barycenter(msh, tcl);
+        Hx_refsol[cell_i] = Hx_ref(bar, time);
+        Hy_refsol[cell_i] = Hy_ref(bar, time);
+        Ez_refsol[cell_i] = Ez_ref(bar, time);
 
 
         /* LAST */
         cell_i++;
     }
 
-
-    //std::cout << "Time: " << t*delta_t << ", step " << t+1 << " of " << timesteps << std::endl;
-
-    std::stringstream ss;
-    ss << ctx.cfg.silo_basename << "_" << cycle << ".silo";
-
-    yaourt::dataio::silo_database silo;
-
-    silo.create( ss.str() );
-
-    silo.add_time(cycle, cycle*ctx.cfg.delta_t);
-
-    const char *mesh_name = "mesh_maxwell2D";
-
-    silo.add_mesh(ctx.msh, mesh_name);
-
     silo.add_zonal_variable(mesh_name, "Hx", Hx);
     silo.add_zonal_variable(mesh_name, "Hy", Hy);
     silo.add_zonal_variable(mesh_name, "Ez", Ez);
@@ -106,8 +103,6 @@ export_data_to_silo(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
     silo.add_expression("Ez_diff", "Ez-Ez_refsol", DB_VARTYPE_SCALAR);
 
     silo.add_expression("H_diff", "{Hx_diff, Hy_diff}", DB_VARTYPE_VECTOR);
-
-    return true;
 }
 #endif
 
@@ -139,6 +134,8 @@ report_errors(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
               const ymax::ICF_type<Mesh>& Hy_ref,
               const ymax::ICF_type<Mesh>& Ez_ref)
 {
+    YAOURT_TIMED_SCOPE("maxwell.errors");
+
     namespace yb = yaourt::bases;
     namespace yq = yaourt::quadratures;
     auto basis_size = yb::scalar_basis_size(ctx.cfg.degree, 2);
@@ -150,9 +147,10 @@ report_errors(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
     T Hy_err = 0.0;
     T Ez_err = 0.0;
 
-    size_t cell_i = 0;
-    for (auto& tcl : ctx.msh.cells)
+    /* The ghost elements are counted by their owners */
+    for (size_t cell_i = 0; cell_i < ctx.num_owned_cells(); cell_i++)
     {
+        const auto& tcl = ctx.msh.cells[cell_i];
         auto dofs_ofs = 3*basis_size*cell_i;
 
         auto local_dofs = subvector(ctx.gDofs, dofs_ofs, 3*basis_size);
@@ -160,28 +158,36 @@ report_errors(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
         auto local_Hy_dofs = subvector(local_dofs, basis_size, basis_size);
         auto local_Ez_dofs = subvector(local_dofs, 2*basis_size, basis_size);
 
-        auto tbasis = yb::make_basis(ctx.msh, tcl, ctx.cfg.degree);
-        auto qps = yq::integrate(ctx.msh, tcl, 2*ctx.cfg.degree);
-        for (auto& qp : qps)
+        auto tbasis = yb::make_tabulated_basis(ctx.msh, tcl, ctx.cfg.degree, 2*ctx.cfg.degree);
+        auto qps = tbasis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
         {
-            auto phi = tbasis.eval(qp.point());
+            auto ep     = qps.point(iqp);
+            auto qw     = qps.weight(iqp);
+            auto& phi   = qps.phi(iqp);
             
             auto Hx_num = dot(local_Hx_dofs, phi);
-            auto Hx_ana = Hx_ref(qp.point(), cycle*ctx.cfg.delta_t);
-            Hx_err  += qp.weight() * (Hx_num-Hx_ana)*(Hx_num-Hx_ana);
+            auto Hx_ana = Hx_ref(ep, cycle*ctx.cfg.delta_t);
+            Hx_err  += qw * (Hx_num-Hx_ana)*(Hx_num-Hx_ana);
 
             auto Hy_num = dot(local_Hy_dofs, phi);
-            auto Hy_ana = Hy_ref(qp.point(), cycle*ctx.cfg.delta_t);
-            Hy_err += qp.weight() * (Hy_num-Hy_ana)*(Hy_num-Hy_ana);
+            auto Hy_ana = Hy_ref(ep, cycle*ctx.cfg.delta_t);
+            Hy_err += qw * (Hy_num-Hy_ana)*(Hy_num-Hy_ana);
 
             auto Ez_num = dot(local_Ez_dofs, phi);
-            auto Ez_ana = Ez_ref(qp.point(), cycle*ctx.cfg.delta_t);
-            Ez_err += qp.weight() * (Ez_num-Ez_ana)*(Ez_num-Ez_ana);
+            auto Ez_ana = Ez_ref(ep, cycle*ctx.cfg.delta_t);
+            Ez_err += qw * (Ez_num-Ez_ana)*(Ez_num-Ez_ana);
         }
+    }
 
-        /* LAST */
-        cell_i++;
+#ifdef WITH_MPI
+    if (ctx.part.is_distributed())
+    {
+        Hx_err = yaourt::mpi::allreduce_sum(Hx_err);
+        Hy_err = yaourt::mpi::allreduce_sum(Hy_err);
+        Ez_err = yaourt::mpi::allreduce_sum(Ez_err);
     }
+#endif
 
     error_info<T> ei;
     ei.cycle    = cycle;
@@ -193,6 +199,17 @@ report_errors(ymax::maxwell_context<Mesh>& ctx, size_t cycle,
     return ei;
 }
 
+/* With MPI each process has its own checkpoint */
+template<typename Mesh>
+std::string
+process_filename(const ymax::maxwell_context<Mesh>& ctx, const char *filename)
+{
+    std::string ret = filename;
+    if (ctx.part.is_distributed())
+        ret += "_" + std::to_string(ctx.part.part);
+    return ret;
+}
+
 template<typename Mesh>
 void
 run_maxwell_solver(const ymax::maxwell_config<typename Mesh::coordinate_type>& cfg)
@@ -222,38 +239,90 @@ run_maxwell_solver(const ymax::maxwell_config<typename Mesh::coordinate_type>& c
     ymax::maxwell_context<Mesh> ctx(cfg);
 
     auto basis_size = yb::scalar_basis_size(ctx.cfg.degree, 2);
+
+    /* With MPI the errors are computed by all the processes, and written
+     * by the first one */
+    bool root = (ctx.part.part == 0);
+    auto num_cells = ctx.part.is_distributed() ? ctx.part.num_global_cells
+                                               : ctx.msh.cells.size();
+
     std::ofstream err_ofs;
-    if (ctx.cfg.error_fn)
+    if (ctx.cfg.error_fn and root and ctx.restarted())
+    {
+        /* Continue the log of the run that wrote the checkpoint */
+        err_ofs.open(ctx.cfg.error_fn, std::ios::app);
+        err_ofs << "# restarted at cycle " << ctx.first_cycle << std::endl;
+    }
+    else if (ctx.cfg.error_fn and root)
     {
         err_ofs.open(ctx.cfg.error_fn);
         err_ofs << "# -> Maxwell 2D solver <- " << std::endl;
         err_ofs << "# mesh levels:      " << ctx.cfg.mesh_levels << std::endl;
-        err_ofs << "# DOFs:             " << 3*ctx.msh.cells.size()*basis_size << std::endl;
+        err_ofs << "# DOFs:             " << 3*num_cells*basis_size << std::endl;
+        if (ctx.part.is_distributed())
+            err_ofs << "# MPI processes:    " << ctx.part.num_parts << std::endl;
         err_ofs << "# degree:           " << ctx.cfg.degree << std::endl;
+        err_ofs << "# precision:        " << (std::is_same<T,float>::value ? "single" : "double") << std::endl;
         err_ofs << "# delta_t:          " << ctx.cfg.delta_t << std::endl;
         err_ofs << "# total steps:      " << ctx.cfg.timesteps << std::endl;
         err_ofs << "# upwind:           " << (ctx.cfg.upwind ? "yes" : "no") << std::endl;
+        err_ofs << "# LTS levels:       " << ctx.cfg.lts_levels << std::endl;
 
         if (ctx.cfg.time_integrator == ymax::time_integrator_type::EXPLICIT_EULER)
             err_ofs << "# time integrator:  " << "Explicit Euler (you're doing the wrong thing)" << std::endl;
 
         if (ctx.cfg.time_integrator == ymax::time_integrator_type::RUNGE_KUTTA_4)
             err_ofs << "# time integrator:  " << "4th order Runge-Kutta" << std::endl;
+
+        if (ctx.cfg.time_integrator == ymax::time_integrator_type::SSP_RUNGE_KUTTA_3)
+            err_ofs << "# time integrator:  " << "3rd order SSP Runge-Kutta" << std::endl;
+
+        if (ctx.cfg.time_integrator == ymax::time_integrator_type::LOW_STORAGE_RK_4)
+            err_ofs << "# time integrator:  " << "4th order low-storage Runge-Kutta, 5 stages" << std::endl;
     }
 
-    assemble(ctx);
-    apply_initial_condition(ctx, Hx_ref, Hy_ref, Ez_ref);
+    /* A restarted context has already the operator and the DoFs */
+    if ( !ctx.restarted() )
+    {
+        assemble(ctx);
+        apply_initial_condition(ctx, Hx_ref, Hy_ref, Ez_ref);
+    }
+
+#ifdef WITH_SILO
+    /* The mesh is written once, the fields of the cycles are written in
+     * the background. With MPI each process writes its local mesh. */
+    using silo_writer = yaourt::dataio::async_silo_writer<blaze::DynamicVector<T>>;
+    std::unique_ptr<silo_writer> silo_out;
+    if (ctx.cfg.silo_basename)
+    {
+        auto write = [&](yaourt::dataio::silo_database& silo, const std::string& mesh_name,
+                         const blaze::DynamicVector<T>& dofs, int, double time) {
+            export_data_to_silo(ctx.msh, ctx.cfg.degree, silo, mesh_name, dofs,
+                                T(time), Hx_ref, Hy_ref, Ez_ref);
+        };
+
+        std::string suffix;
+        if (ctx.part.is_distributed())
+            suffix = "_" + std::to_string(ctx.part.part);
+
+        silo_out = std::make_unique<silo_writer>(ctx.msh, ctx.cfg.silo_basename,
+                                                 "mesh_maxwell2D", write, suffix);
+    }
+#endif
 
     auto last_output_time = std::chrono::system_clock::now();
-    for (size_t cycle = 0; cycle < ctx.cfg.timesteps; cycle++)
+    for (size_t cycle = ctx.first_cycle; cycle < ctx.cfg.timesteps; cycle++)
     {
         do_timestep(ctx);
 
+        if (ctx.cfg.checkpoint_fn and (cycle+1) % ctx.cfg.checkpoint_rate == 0)
+            ctx.write_checkpoint(process_filename(ctx, ctx.cfg.checkpoint_fn), cycle);
+
         bool do_output = (cycle % ctx.cfg.output_rate == 0);
 
 #ifdef WITH_SILO
-        if (ctx.cfg.silo_basename and do_output)
-            export_data_to_silo(ctx, cycle, Hx_ref, Hy_ref, Ez_ref);
+        if (silo_out and do_output)
+            silo_out->submit(cycle, cycle*ctx.cfg.delta_t, ctx.gDofs);
 #endif
         if (ctx.cfg.verbosity > 0 and do_output)
         {
@@ -268,9 +337,15 @@ run_maxwell_solver(const ymax::maxwell_config<typename Mesh::coordinate_type>& c
         if (ctx.cfg.error_fn)
         {
             auto ei = report_errors(ctx, cycle, Hx_ref, Hy_ref, Ez_ref);
-            err_ofs << ei << std::endl;
+            if (root)
+                err_ofs << ei << std::endl;
         }
     }
+
+#ifdef WITH_SILO
+    if (silo_out)
+        silo_out->flush();
+#endif
 }
 
 enum class mesh_type  {
@@ -288,7 +363,7 @@ void usage(const char* progname)
     "  -m, --mesh-type          'tri' for triangles, 'quad' for cartesian \n"
     "  -r, --mesh-refinement    number of mesh refinement levels\n"
     "  -k, --degree             polynomial degree (greater than 0)\n"
-    "  -i, --time-integrator    'euler' or 'rk4', rk4 default\n"
+    "  -i, --time-integrator    'euler', 'rk4', 'ssprk3' or 'lsrk4', rk4 default\n"
     "  -d, --delta-t            timestep size\n"
     "  -t, --timesteps          number of timesteps\n"
     "  -T, --max-time           max simulation time\n"
@@ -298,16 +373,43 @@ void usage(const char* progname)
     "  -u, --use-upwind         use upwind fluxes\n"
     "  -v, --verbose            enable verbose output\n"
     "  -S, --shatter-mesh       add random displacement to mesh points\n"
+    "  -j, --threads            number of threads, 0 for all the cores\n"
+    "  -l, --lts-levels         max number of local timestepping levels (rk4 only)\n"
+    "  -o, --ordering           cell ordering: 'none', 'hilbert' or 'rcm'\n"
+    "  -f, --single-precision   store and compute everything in float\n"
+    "  -c, --checkpoint         file where to save the state for a restart\n"
+    "  -C, --checkpoint-rate    timestep interval between checkpoints\n"
+    "  -x, --restart            checkpoint to restart from\n"
+    "  -g, --mesh-file          load the mesh from a Gmsh .msh or a native file\n"
+    "  -G, --save-mesh          save the mesh in the native binary format\n"
     "  -h, --help               print this help\n"
     << std::endl;
 }
 
+template<typename T>
+void
+run_maxwell(mesh_type mt, const ymax::maxwell_config<T>& cfg)
+{
+    if (mt == mesh_type::TRIANGULAR)
+        run_maxwell_solver<yaourt::simplicial_mesh<T>>(cfg);
+    else if (mt == mesh_type::QUADRANGULAR)
+        run_maxwell_solver<yaourt::quad_mesh<T>>(cfg);
+}
+
 int main(int argc, char **argv)
 {
+    /* The options are parsed in double, the solver runs in float with -f */
     using T = double;
 
+#ifdef WITH_MPI
+    MPI_Init(&argc, &argv);
+    if ( yaourt::mpi::is_parallel() )
+        yaourt::instrumentation::registry::instance().set_process( yaourt::mpi::comm_rank() );
+#endif
+
     mesh_type mt = mesh_type::TRIANGULAR;
     ymax::maxwell_config<T> cfg;
+    bool single_precision = false;
     int ch;
 
     static struct option longopts[] = {
@@ -324,6 +426,15 @@ int main(int argc, char **argv)
         { "use-upwind",             no_argument,        NULL, 'u' },
         { "verbose",                no_argument,        NULL, 'v' },
         { "shatter-mesh",           no_argument,        NULL, 'S' },
+        { "threads",                required_argument,  NULL, 'j' },
+        { "lts-levels",             required_argument,  NULL, 'l' },
+        { "ordering",               required_argument,  NULL, 'o' },
+        { "single-precision",       no_argument,        NULL, 'f' },
+        { "checkpoint",             required_argument,  NULL, 'c' },
+        { "checkpoint-rate",        required_argument,  NULL, 'C' },
+        { "restart",                required_argument,  NULL, 'x' },
+        { "mesh-file",              required_argument,  NULL, 'g' },
+        { "save-mesh",              required_argument,  NULL, 'G' },
         { "help",                   no_argument,        NULL, 'h' },
         { NULL,                     0,                  NULL,  0  }
     };
@@ -336,7 +447,7 @@ int main(int argc, char **argv)
 #endif
     //_MM_SET_EXCEPTION_MASK(_MM_GET_EXCEPTION_MASK() & ~_MM_MASK_INVALID);
 
-    while ((ch = getopt_long(argc, argv, "m:r:k:i:d:t:T:E:s:R:uvSh", longopts, NULL)) != -1)
+    while ((ch = getopt_long(argc, argv, "m:r:k:i:d:t:T:E:s:R:uvSj:l:o:fc:C:x:g:G:h", longopts, NULL)) != -1)
     {
         switch (ch)
         {
@@ -363,6 +474,12 @@ int main(int argc, char **argv)
             case 'i':
                 if ( strcmp(optarg, "euler") == 0 )
                     cfg.time_integrator = ymax::time_integrator_type::EXPLICIT_EULER;
+                else if ( strcmp(optarg, "rk4") == 0 )
+                    cfg.time_integrator = ymax::time_integrator_type::RUNGE_KUTTA_4;
+                else if ( strcmp(optarg, "ssprk3") == 0 )
+                    cfg.time_integrator = ymax::time_integrator_type::SSP_RUNGE_KUTTA_3;
+                else if ( strcmp(optarg, "lsrk4") == 0 )
+                    cfg.time_integrator = ymax::time_integrator_type::LOW_STORAGE_RK_4;
                 break;
             
             /* Select timestepping delta-t */
@@ -413,6 +530,67 @@ int main(int argc, char **argv)
 
             case 'S':
                 cfg.shatter_mesh = true;
+                break;
+
+            /* Number of threads used in the timestepping */
+            case 'j':
+                cfg.num_threads = std::max(0, atoi(optarg));
+                if (cfg.num_threads == 0)
+                    cfg.num_threads = yaourt::default_num_threads();
+                break;
+
+            /* Enable local timestepping, delta-t is the step of the
+             * largest elements */
+            case 'l':
+                cfg.lts_levels = std::max(1, atoi(optarg));
+                break;
+
+            /* Renumber the cells for memory locality */
+            case 'o':
+                if ( strcmp(optarg, "none") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::NONE;
+                else if ( strcmp(optarg, "hilbert") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::HILBERT;
+                else if ( strcmp(optarg, "rcm") == 0 )
+                    cfg.ordering = yaourt::mesh_ordering::REVERSE_CUTHILL_MCKEE;
+                else
+                {
+                    std::cout << "Unknown ordering " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+
+            /* Run in single precision */
+            case 'f':
+                single_precision = true;
+                break;
+
+            /* Save the state every checkpoint-rate timesteps */
+            case 'c':
+                cfg.checkpoint_fn = optarg;
+                break;
+
+            case 'C':
+                cfg.checkpoint_rate = std::max(1, atoi(optarg));
+                break;
+
+            /* Continue the run saved in a checkpoint, the options must
+             * be the same as in that run */
+            case 'x':
+                cfg.restart_fn = optarg;
+                break;
+
+            /* Use an imported mesh instead of refining the unit square,
+             * -m must match the type of its cells */
+            case 'g':
+                cfg.mesh_fn = optarg;
+                break;
+
+            /* Save the mesh as used by the solver, to load it again
+             * with -g without importing it */
+            case 'G':
+                cfg.save_mesh_fn = optarg;
+                break;
 
             case 0:
                 break;
@@ -428,10 +606,27 @@ int main(int argc, char **argv)
     argc -= optind;
     argv += optind;
 
-    if (mt == mesh_type::TRIANGULAR)
-        run_maxwell_solver<yaourt::simplicial_mesh<T>>(cfg);
-    else if (mt == mesh_type::QUADRANGULAR)
-        run_maxwell_solver<yaourt::quad_mesh<T>>(cfg);
+    if (cfg.lts_levels > 1 and
+        cfg.time_integrator != ymax::time_integrator_type::RUNGE_KUTTA_4)
+    {
+        std::cout << "Local timestepping is available only with rk4" << std::endl;
+        return 1;
+    }
+
+#ifdef WITH_MPI
+    /* Only the first process prints */
+    if (yaourt::mpi::comm_rank() != 0)
+        cfg.verbosity = 0;
+#endif
+
+    if (single_precision)
+        run_maxwell(mt, ymax::maxwell_config<float>(cfg));
+    else
+        run_maxwell(mt, cfg);
+
+#ifdef WITH_MPI
+    MPI_Finalize();
+#endif
 
     return 0;
 }
@@ -21,6 +21,9 @@
 
 #include <blaze/Math.h>
 #include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
 #include "../core/mesh.hpp"
 #include "../core/blaze_sparse_init.hpp"
 
@@ -95,29 +98,37 @@ enum class bc_mode
     NITSCHE
 };
 
+/* CFEM assembler. Elements can be assembled concurrently by up to
+ * 'num_threads' threads, each passing its id to assemble(). Contrary to
+ * DG, nodes are shared between elements, so each thread accumulates both
+ * triplets and right hand side in its own buffers; they are summed in
+ * finalize(). */
 template<typename Mesh>
 class assembler
 {
     using T = typename Mesh::coordinate_type;
     using triplet_type = blaze::triplet<T>;
 
-    std::vector<triplet_type>       triplets;
+    std::vector<std::vector<triplet_type>>      triplets;
+    std::vector<blaze::DynamicVector<T>>        thread_rhs;
     std::vector<bool>               dirichlet_nodes;
 
     std::vector<size_t>             compress_map;
     std::vector<size_t>             expand_map;
     
-    size_t                          sys_size;
+    size_t                          sys_size, num_threads;
 
 public:
     blaze::CompressedMatrix<T>      lhs;
     blaze::DynamicVector<T>         rhs;
 
     assembler()
+        : sys_size(0), num_threads(1)
     {}
 
     assembler(const Mesh& msh/*, const BoundaryConditions& bc,
-              const bc_mode& bcmode*/)
+              const bc_mode& bcmode*/, size_t nthreads = 1)
+        : num_threads( std::max<size_t>(nthreads, 1) )
     {
         dirichlet_nodes.resize( msh.points.size() );
         for (auto& f : msh.faces)
@@ -148,13 +159,24 @@ public:
         }
         
         lhs.resize( sys_size, sys_size );
-        rhs.resize( sys_size );
+        rhs = blaze::DynamicVector<T>(sys_size, 0.0);
+
+        triplets.resize( num_threads );
+        thread_rhs.resize( num_threads - 1, blaze::DynamicVector<T>(sys_size, 0.0) );
     }
 
     bool assemble(const Mesh& msh, const typename Mesh::cell_type& cl,
                   const blaze::StaticMatrix<T,3,3>& local_rhs,
-                  const blaze::StaticVector<T,3>& local_lhs)
+                  const blaze::StaticVector<T,3>& local_lhs,
+                  size_t thread_id = 0)
     {
+        if ( thread_id >= num_threads )
+            throw std::invalid_argument("Invalid thread id");
+
+        /* Thread 0 accumulates directly in the global rhs */
+        auto& trip = triplets[thread_id];
+        auto& trhs = (thread_id == 0) ? rhs : thread_rhs[thread_id-1];
+
         auto l2g = cl.point_ids();
         assert(l2g.size() == 3);
         
@@ -170,10 +192,10 @@ public:
                 auto ci = compress_map.at(l2g[i]);
                 auto cj = compress_map.at(l2g[j]);
                 
-                triplets.push_back( {ci, cj, local_rhs(i,j)} );
+                trip.push_back( {ci, cj, local_rhs(i,j)} );
             }
 
-            rhs[ compress_map.at(l2g[i]) ] += local_lhs[i];
+            trhs[ compress_map.at(l2g[i]) ] += local_lhs[i];
         }
         
         return true;
@@ -181,8 +203,22 @@ public:
     
     void finalize()
     {
-        blaze::init_from_triplets(lhs, triplets.begin(), triplets.end());
-        triplets.clear();
+        auto& all = triplets[0];
+        for (size_t i = 1; i < triplets.size(); i++)
+        {
+            all.insert(all.end(), triplets[i].begin(), triplets[i].end());
+            triplets[i].clear();
+            triplets[i].shrink_to_fit();
+        }
+
+        blaze::init_from_triplets(lhs, all.begin(), all.end(), num_threads);
+        all.clear();
+
+        for (auto& trhs : thread_rhs)
+        {
+            rhs += trhs;
+            blaze::reset(trhs);
+        }
     }
 
     size_t system_size() const { return sys_size; }
@@ -198,9 +234,9 @@ public:
 };
 
 template<typename Mesh>
-auto get_assembler(const Mesh& msh, size_t degree)
+auto get_assembler(const Mesh& msh, size_t degree, size_t num_threads = 1)
 {
-    return assembler<Mesh>(msh);
+    return assembler<Mesh>(msh, num_threads);
 }
 
 } //namespace cfem
@@ -19,61 +19,254 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <iterator>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 #include "blaze/Math.h"
+#include "core/bsr_matrix.hpp"
+#include "core/preconditioners.hpp"
+#include "core/instrumentation.hpp"
 
 
+/* How the DG assembler builds the system matrix. With TRIPLETS all the
+ * contributions are collected and sorted in finalize(). With PATTERN the
+ * block sparsity is computed up front from the mesh connectivity (one
+ * diagonal block per cell plus one block per neighbour, the neighbours
+ * across the hanging faces included) and the local matrices are added
+ * directly in place, without intermediate storage.
+ * BLOCKS uses the same pattern, but the matrix is stored in block format
+ * in 'lhs_blocks' instead of 'lhs'. MATRIX_FREE does not store the system
+ * matrix at all: only the right hand side and, if requested, the diagonal
+ * preconditioner are assembled, the operator is applied on the fly (see
+ * methods/dg_matrix_free.hpp). */
+enum class dg_assembly_mode
+{
+    TRIPLETS,
+    PATTERN,
+    BLOCKS,
+    MATRIX_FREE
+};
+
+/* Preconditioners available for the DG systems. JACOBI is built by the
+ * assembler along with the matrix (the 'bpc' flag), BLOCK_JACOBI, ILU0 and
+ * MULTIGRID are computed from the assembled matrix after finalize(). */
+enum class dg_preconditioner
+{
+    NONE,
+    JACOBI,
+    BLOCK_JACOBI,
+    ILU0,
+    MULTIGRID
+};
+
+/* DG assembler. The cells can be assembled concurrently by up to
+ * 'num_threads' threads: each thread pushes its triplets in its own buffer
+ * and passes its id to assemble(). The rows of the system touched by
+ * assemble() always belong to the first cell given, so 'rhs' and the
+ * preconditioner diagonal are shared safely as long as each cell is
+ * assembled by a single thread. */
 template<typename Mesh>
 class assembler
 {
     using T = typename Mesh::coordinate_type;
     using triplet_type = blaze::triplet<T>;
 
-    std::vector<triplet_type>       triplets;
-    std::vector<triplet_type>       pc_triplets;
+    template<typename MT>
+    using is_matrix_t = std::enable_if_t<blaze::IsMatrix<MT>::value>;
 
-    size_t                          sys_size, basis_size;
+    std::vector<std::vector<triplet_type>>  triplets;
+    std::vector<triplet_type>               pc_triplets;
+
+    /* Cell adjacency in CSR format, used by PATTERN and BLOCKS: the blocks
+     * in the rows of cell i are block_idx[block_ptr[i]..block_ptr[i+1]] */
+    std::vector<size_t>             block_ptr, block_idx;
+
+    size_t                          sys_size, basis_size, num_threads;
     bool                            build_pc;
+    dg_assembly_mode                mode;
+
+    void build_pattern(const Mesh& msh)
+    {
+        lhs.reset();
+        block_ptr.clear();
+        block_idx.clear();
+        block_ptr.reserve( msh.cells.size()+1 );
+        block_ptr.push_back(0);
+
+        /* The cells coupled by the nonconforming faces */
+        std::vector<std::vector<size_t>> hanging_neighs;
+        if ( !msh.hanging_faces.empty() )
+        {
+            hanging_neighs.resize( msh.cells.size() );
+            for (auto& hf : msh.hanging_faces)
+            {
+                auto coarse_cl = msh.face_owners[ hf[0] ][0];
+                auto fine_cl = msh.face_owners[ hf[1] ][0];
+                hanging_neighs[coarse_cl].push_back(fine_cl);
+                hanging_neighs[fine_cl].push_back(coarse_cl);
+            }
+        }
+
+        for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+        {
+            auto bbegin = block_idx.size();
+            block_idx.push_back(cl_id);
+
+            for (auto& fcid : face_ids(msh, cl_id))
+            {
+                auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+                if (has_neighbour)
+                    block_idx.push_back(ncl_id);
+            }
+
+            if ( !hanging_neighs.empty() )
+                block_idx.insert(block_idx.end(), hanging_neighs[cl_id].begin(),
+                                 hanging_neighs[cl_id].end());
+
+            auto bb = std::next(block_idx.begin(), bbegin);
+            std::sort(bb, block_idx.end());
+            block_idx.erase( std::unique(bb, block_idx.end()), block_idx.end() );
+            block_ptr.push_back( block_idx.size() );
+        }
+
+        if (mode == dg_assembly_mode::BLOCKS)
+        {
+            auto num_cells = msh.cells.size();
+            lhs_blocks = yaourt::bsr_matrix<T>(num_cells, num_cells,
+                                               basis_size, block_ptr, block_idx);
+            return;
+        }
+
+        /* Store explicitly all the entries of the blocks, zero for now */
+        lhs.reserve( block_idx.size() * basis_size * basis_size );
+        for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+        {
+            for (size_t i = 0; i < basis_size; i++)
+            {
+                auto ci = cl_id * basis_size + i;
+                for (size_t b = block_ptr[cl_id]; b < block_ptr[cl_id+1]; b++)
+                    for (size_t j = 0; j < basis_size; j++)
+                        lhs.append(ci, block_idx[b] * basis_size + j, 0.0);
+
+                lhs.finalize(ci);
+            }
+        }
+    }
+
+    /* Add a local matrix to the block (cl_a_id, cl_b_id) of the pattern */
+    template<typename MT>
+    void scatter(size_t cl_a_id, size_t cl_b_id, const MT& local_rhs)
+    {
+        if (mode == dg_assembly_mode::BLOCKS)
+        {
+            lhs_blocks.add_to_block(cl_a_id, cl_b_id, local_rhs);
+            return;
+        }
+
+        auto bbegin = std::next(block_idx.begin(), block_ptr[cl_a_id]);
+        auto bend = std::next(block_idx.begin(), block_ptr[cl_a_id+1]);
+        auto itor = std::lower_bound(bbegin, bend, cl_b_id);
+        if (itor == bend or *itor != cl_b_id)
+            throw std::invalid_argument("Block not in the sparsity pattern");
+
+        auto col_ofs = std::distance(bbegin, itor) * basis_size;
+
+        for (size_t i = 0; i < basis_size; i++)
+        {
+            auto row = lhs.begin(cl_a_id * basis_size + i) + col_ofs;
+            for (size_t j = 0; j < basis_size; j++)
+            {
+                assert( (row+j)->index() == cl_b_id * basis_size + j );
+                (row+j)->value() += local_rhs(i,j);
+            }
+        }
+    }
 
 public:
     blaze::CompressedMatrix<T>      lhs;
+    yaourt::bsr_matrix<T>           lhs_blocks;
     blaze::DynamicVector<T>         rhs;
     blaze::CompressedMatrix<T>      pc;
     blaze::DynamicVector<T>         pc_temp;
 
     assembler()
-        : sys_size(0), basis_size(0)
+        : sys_size(0), basis_size(0), num_threads(1),
+          mode(dg_assembly_mode::TRIPLETS)
     {}
 
-    assembler(const Mesh& msh, size_t degree, bool bpc = false)
+    assembler(const Mesh& msh, size_t degree, bool bpc = false,
+              size_t nthreads = 1,
+              dg_assembly_mode amode = dg_assembly_mode::TRIPLETS)
     {
-        initialize(msh, degree, bpc);
+        initialize(msh, degree, bpc, nthreads, amode);
     }
 
-    void initialize(const Mesh& msh, size_t degree, bool bpc = false)
+    /* The PATTERN and BLOCKS modes need the mesh connectivity */
+    void initialize(const Mesh& msh, size_t degree, bool bpc = false,
+                    size_t nthreads = 1,
+                    dg_assembly_mode amode = dg_assembly_mode::TRIPLETS)
     {
         basis_size = yaourt::bases::scalar_basis_size(degree,2);
         sys_size = basis_size * msh.cells.size();
+        num_threads = std::max<size_t>(nthreads, 1);
+        triplets.clear();
+        triplets.resize(num_threads);
 
         lhs.resize( sys_size, sys_size );
         rhs.resize( sys_size );
         pc.resize( sys_size, sys_size );
         pc_temp = blaze::DynamicVector<T>(sys_size, 0.0);
         build_pc = bpc;
+        mode = amode;
+
+        if (mode == dg_assembly_mode::PATTERN or mode == dg_assembly_mode::BLOCKS)
+            build_pattern(msh);
     }
 
+    /* The local matrices and vectors can be any blaze dense type, in
+     * particular the StaticMatrix/StaticVector of the kernels with the
+     * degree fixed at compile time (see bases::dispatch_degree()) */
+    template<typename MT, typename = is_matrix_t<MT>>
     bool assemble(const Mesh& msh,
                   const typename Mesh::cell_type& cl_a,
                   const typename Mesh::cell_type& cl_b,
-                  const blaze::DynamicMatrix<T>& local_rhs)
+                  const MT& local_rhs,
+                  size_t thread_id = 0)
+    {
+        return assemble(msh, offset(msh, cl_a), offset(msh, cl_b), local_rhs,
+                        thread_id);
+    }
+
+    template<typename MT, typename VT, typename = is_matrix_t<MT>>
+    bool assemble(const Mesh& msh, const typename Mesh::cell_type& cl,
+                  const MT& local_rhs, const VT& local_lhs,
+                  size_t thread_id = 0)
+    {
+        return assemble(msh, offset(msh, cl), local_rhs, local_lhs, thread_id);
+    }
+
+    /* Same as above, but the cells are given by their global numbers */
+    template<typename MT, typename = is_matrix_t<MT>>
+    bool assemble(const Mesh& msh, size_t cl_a_id, size_t cl_b_id,
+                  const MT& local_rhs, size_t thread_id = 0)
     {
         if ( sys_size == 0 or basis_size == 0 )
             throw std::invalid_argument("Assembler in invalid state");
 
-        auto cl_a_ofs = offset(msh, cl_a) * basis_size;
-        auto cl_b_ofs = offset(msh, cl_b) * basis_size;
+        if ( thread_id >= num_threads )
+            throw std::invalid_argument("Invalid thread id");
+
+        auto& trip = triplets[thread_id];
+
+        auto cl_a_ofs = cl_a_id * basis_size;
+        auto cl_b_ofs = cl_b_id * basis_size;
+
+        if (mode == dg_assembly_mode::PATTERN or mode == dg_assembly_mode::BLOCKS)
+            scatter(cl_a_id, cl_b_id, local_rhs);
 
         for (size_t i = 0; i < basis_size; i++)
         {
@@ -83,7 +276,8 @@ public:
             {
                 auto cj = cl_b_ofs + j;
 
-                triplets.push_back( {ci, cj, local_rhs(i,j)} );
+                if (mode == dg_assembly_mode::TRIPLETS)
+                    trip.push_back( {ci, cj, local_rhs(i,j)} );
 
                 if (build_pc && ci == cj)
                     pc_temp[ci] += local_rhs(i,j);
@@ -93,14 +287,23 @@ public:
         return true;
     }
 
-    bool assemble(const Mesh& msh, const typename Mesh::cell_type& cl,
-                  const blaze::DynamicMatrix<T>& local_rhs,
-                  const blaze::DynamicVector<T>& local_lhs)
+    template<typename MT, typename VT, typename = is_matrix_t<MT>>
+    bool assemble(const Mesh& msh, size_t cl_id,
+                  const MT& local_rhs, const VT& local_lhs,
+                  size_t thread_id = 0)
     {
         if ( sys_size == 0 or basis_size == 0 )
             throw std::invalid_argument("Assembler in invalid state");
 
-        auto cl_ofs = offset(msh, cl) * basis_size;
+        if ( thread_id >= num_threads )
+            throw std::invalid_argument("Invalid thread id");
+
+        auto& trip = triplets[thread_id];
+
+        auto cl_ofs = cl_id * basis_size;
+
+        if (mode == dg_assembly_mode::PATTERN or mode == dg_assembly_mode::BLOCKS)
+            scatter(cl_id, cl_id, local_rhs);
 
         for (size_t i = 0; i < basis_size; i++)
         {
@@ -110,7 +313,8 @@ public:
             {
                 auto cj = cl_ofs + j;
 
-                triplets.push_back( {ci, cj, local_rhs(i,j)} );
+                if (mode == dg_assembly_mode::TRIPLETS)
+                    trip.push_back( {ci, cj, local_rhs(i,j)} );
 
                 if (build_pc && ci == cj)
                     pc_temp[ci] += local_rhs(i,j);
@@ -122,13 +326,48 @@ public:
         return true;
     }
 
+    /* Right hand side only, for the cells whose matrices are not needed,
+     * see needs_matrix() */
+    template<typename VT>
+    void assemble_rhs(size_t cl_id, const VT& local_lhs)
+    {
+        if ( sys_size == 0 or basis_size == 0 )
+            throw std::invalid_argument("Assembler in invalid state");
+
+        auto cl_ofs = cl_id * basis_size;
+        for (size_t i = 0; i < basis_size; i++)
+            rhs[cl_ofs + i] = local_lhs[i];
+    }
+
+    /* False in MATRIX_FREE mode without the Jacobi preconditioner: the
+     * local matrices are discarded, the kernels can skip computing them */
+    bool needs_matrix() const
+    {
+        return mode != dg_assembly_mode::MATRIX_FREE or build_pc;
+    }
+
     void finalize()
     {
         if ( sys_size == 0 or basis_size == 0 )
             throw std::invalid_argument("Assembler in invalid state");
 
-        blaze::init_from_triplets(lhs, triplets.begin(), triplets.end());
-        triplets.clear();
+        YAOURT_TIMED_SCOPE("assembly.finalize");
+
+        /* In the other modes the matrix is already in place or not needed */
+        if (mode == dg_assembly_mode::TRIPLETS)
+        {
+            /* Gather the per-thread buffers in the first one */
+            auto& all = triplets[0];
+            for (size_t i = 1; i < triplets.size(); i++)
+            {
+                all.insert(all.end(), triplets[i].begin(), triplets[i].end());
+                triplets[i].clear();
+                triplets[i].shrink_to_fit();
+            }
+
+            blaze::init_from_triplets(lhs, all.begin(), all.end(), num_threads);
+            all.clear();
+        }
 
         if (build_pc)
         {
@@ -144,4 +383,28 @@ public:
     }
 
     size_t system_size() const { return sys_size; }
+
+    /* Block-Jacobi preconditioner on the cell blocks of the matrix */
+    yaourt::block_jacobi_preconditioner<T> block_jacobi() const
+    {
+        if (mode == dg_assembly_mode::MATRIX_FREE)
+            throw std::logic_error("Block-Jacobi needs the assembled matrix");
+
+        if (mode == dg_assembly_mode::BLOCKS)
+            return yaourt::block_jacobi_preconditioner<T>(lhs_blocks);
+
+        return yaourt::block_jacobi_preconditioner<T>(lhs, basis_size);
+    }
+
+    /* ILU(0) preconditioner of the matrix */
+    yaourt::ilu0_preconditioner<T> ilu0() const
+    {
+        if (mode == dg_assembly_mode::MATRIX_FREE)
+            throw std::logic_error("ILU(0) needs the assembled matrix");
+
+        if (mode == dg_assembly_mode::BLOCKS)
+            return yaourt::ilu0_preconditioner<T>(lhs_blocks);
+
+        return yaourt::ilu0_preconditioner<T>(lhs);
+    }
 };
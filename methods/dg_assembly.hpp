@@ -0,0 +1,290 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+
+#include "core/mesh.hpp"
+#include "core/bases.hpp"
+#include "core/tabulation.hpp"
+#include "core/parallel.hpp"
+#include "methods/dg.hpp"
+
+/* Assembly of the DG systems solved by dg2d_diffusion and dg2d_advection,
+ * also used by the benchmarks. The data of the problems are functions of
+ * the point, the matrix is finalized by the caller. */
+
+/* Symmetric interior penalty discretization of -div(grad(u)) = f with
+ * u = g on the boundary. 'eta' is the penalty parameter, divided by the
+ * diameter of each face. The nonconforming faces are skipped, see
+ * assemble_hanging_faces() in dg2d_diffusion.cpp. If the assembler does
+ * not need the matrix (matrix-free solve) only the right hand side is
+ * computed: the interior faces are skipped altogether. */
+template<typename Mesh, typename RhsFunction, typename DirichletFunction>
+void
+assemble_sip_diffusion(const Mesh& msh, assembler<Mesh>& assm, size_t degree,
+                       typename Mesh::coordinate_type eta,
+                       const RhsFunction& rhs_fun,
+                       const DirichletFunction& dirichlet_fun,
+                       size_t num_threads = 1)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+
+    YAOURT_TIMED_SCOPE("assembly.sip");
+
+    /* The volume and face kernels are instantiated for each degree up to
+     * YAOURT_MAX_STATIC_DEGREE, with local matrices of fixed size, the
+     * higher degrees go through the version with dynamic sizes */
+    yaourt::bases::dispatch_degree(degree, [&](auto static_degree) {
+        constexpr size_t static_k = decltype(static_degree)::value;
+        using lt = yaourt::bases::local_types<T, static_k>;
+
+        const bool lhs = assm.needs_matrix();
+
+        /* Cells are split among the threads, each one with its own scratch
+         * space for the gradients to avoid allocations in the loops. The
+         * values of the bases are tabulated in the local types and used in
+         * place. */
+        auto assemble_chunk = [&](size_t tid, size_t begin, size_t end) {
+            auto dphi = lt::zero_gradient(bs), tdphi = dphi, ndphi = dphi;
+
+            for (size_t tcl_id = begin; tcl_id < end; tcl_id++)
+            {
+                const auto& tcl = msh.cells[tcl_id];
+                auto tbasis = yaourt::bases::make_tabulated_basis<static_k>(msh, tcl, degree, 2*degree);
+
+                auto K = lt::zero_matrix(bs);
+                auto loc_rhs = lt::zero_vector(bs);
+
+                auto qps = tbasis.cell_quadrature();
+                for (size_t iqp = 0; iqp < qps.size(); iqp++)
+                {
+                    auto ep     = qps.point(iqp);
+                    auto qw     = qps.weight(iqp);
+                    const auto& phi = qps.phi(iqp);
+                    loc_rhs += qw * rhs_fun(ep) * phi;
+
+                    if (not lhs)
+                        continue;
+
+                    qps.grads(iqp, dphi);
+                    K += qw * dphi * trans(dphi);
+                }
+
+                const auto& fcids = face_ids(msh, tcl_id);
+                for (auto& fcid : fcids)
+                {
+                    const auto& fc = msh.faces[fcid];
+                    auto Att = lt::zero_matrix(bs);
+                    auto Atn = lt::zero_matrix(bs);
+
+                    auto [ncl_id, has_neighbour] = neighbour_via(msh, tcl_id, fcid);
+                    if (!has_neighbour and !fc.is_boundary)
+                        continue; /* nonconforming, see assemble_hanging_faces() */
+
+                    if (has_neighbour and not lhs)
+                        continue; /* no right hand side term */
+
+                    const auto& ncl = has_neighbour ? msh.cells[ncl_id] : tcl;
+                    auto nbasis = yaourt::bases::make_tabulated_basis<static_k>(msh, ncl, degree, 2*degree);
+                    assert(tbasis.size() == nbasis.size());
+
+                    auto n      = normal(msh, tcl, fc);
+                    auto eta_l  = eta / diameter(msh, fc);
+                    auto t_fqps = tbasis.face_quadrature(fc);
+                    auto n_fqps = nbasis.face_quadrature(fc);
+
+                    for (size_t ifqp = 0; ifqp < t_fqps.size(); ifqp++)
+                    {
+                        auto ep     = t_fqps.point(ifqp);
+                        auto fqw    = t_fqps.weight(ifqp);
+                        const auto& tphi = t_fqps.phi(ifqp);
+                        t_fqps.grads(ifqp, tdphi);
+
+                        if (has_neighbour)
+                        {   /* NOT on a boundary */
+                            Att += + fqw * eta_l * tphi * trans(tphi);     // [u][v]
+                            Att += - fqw * 0.5 * tphi * trans(tdphi*n);    // {grad(u).n}[v]
+                            Att += - fqw * 0.5 * (tdphi*n) * trans(tphi);  // [u]{grad(v).n}
+                
+                            const auto& nphi = n_fqps.phi(ifqp);
+                            n_fqps.grads(ifqp, ndphi);
+
+                            Atn += - fqw * eta_l * tphi * trans(nphi);         // [u][v]
+                            Atn += - fqw * 0.5 * tphi * trans(ndphi*n);        // {grad(u).n}[v]
+                            Atn += + fqw * 0.5 * (tdphi*n) * trans(nphi);      // [u]{grad(v).n}
+                        }
+                        else
+                        {   /* On a boundary*/
+                            if (lhs)
+                            {
+                                Att += + fqw * eta_l * tphi * trans(tphi);     // [u][v]
+                                Att += - fqw * tphi * trans(tdphi*n);          // {grad(u).n}[v]
+                                Att += - fqw * (tdphi*n) * trans(tphi);        // [u]{grad(v).n}
+                            }
+
+                            loc_rhs -= fqw * dirichlet_fun(ep) * (tdphi*n);
+                            loc_rhs += fqw * eta_l * dirichlet_fun(ep) * tphi;
+                        }
+                    }
+
+                    if (not lhs)
+                        continue;
+
+                    assm.assemble(msh, tcl_id, tcl_id, Att, tid);
+                    if (has_neighbour)
+                        assm.assemble(msh, tcl_id, ncl_id, Atn, tid);
+                }
+
+                if (lhs)
+                    assm.assemble(msh, tcl_id, K, loc_rhs, tid);
+                else
+                    assm.assemble_rhs(tcl_id, loc_rhs);
+            }
+        };
+
+        yaourt::parallel_for_chunks(msh.cells.size(), num_threads,
+                                    assemble_chunk);
+    });
+}
+
+/* Advection-reaction problem mu*u + beta.grad(u) = f, with u = 0 on the
+ * inflow boundary. With 'upwinding' the face fluxes are stabilized by
+ * 'eta' times |beta.n|. The nonconforming faces are skipped, see
+ * assemble_hanging_faces() in dg2d_advection.cpp. */
+template<typename Mesh, typename MuFunction, typename BetaFunction,
+         typename RhsFunction>
+void
+assemble_advection_reaction(const Mesh& msh, assembler<Mesh>& assm, size_t degree,
+                            typename Mesh::coordinate_type eta, bool upwinding,
+                            const MuFunction& mu_fun, const BetaFunction& beta_fun,
+                            const RhsFunction& rhs_fun, size_t num_threads = 1)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+
+    YAOURT_TIMED_SCOPE("assembly.advection");
+
+    /* The kernel is instantiated for each degree up to
+     * YAOURT_MAX_STATIC_DEGREE, with local matrices of fixed size, the
+     * higher degrees go through the version with dynamic sizes */
+    yaourt::bases::dispatch_degree(degree, [&](auto static_degree) {
+        constexpr size_t static_k = decltype(static_degree)::value;
+        using lt = yaourt::bases::local_types<T, static_k>;
+
+        /* Cells are split among the threads, each one with its own scratch
+         * space for the gradients, the values are used in place as above */
+        auto assemble_chunk = [&](size_t tid, size_t begin, size_t end) {
+            auto dphi = lt::zero_gradient(bs);
+
+            for (size_t tcl_id = begin; tcl_id < end; tcl_id++)
+            {
+                const auto& tcl = msh.cells[tcl_id];
+                auto tbasis = yaourt::bases::make_tabulated_basis<static_k>(msh, tcl, degree, 2*degree);
+
+                auto K = lt::zero_matrix(bs);
+                auto loc_rhs = lt::zero_vector(bs);
+
+                auto qps = tbasis.cell_quadrature();
+                for (size_t iqp = 0; iqp < qps.size(); iqp++)
+                {
+                    auto ep     = qps.point(iqp);
+                    auto qw     = qps.weight(iqp);
+                    const auto& phi = qps.phi(iqp);
+                    qps.grads(iqp, dphi);
+
+                    /* Reaction */
+                    K += mu_fun(ep) * qw * phi * trans(phi);
+                    /* Advection */
+                    K += qw * phi * trans( dphi*beta_fun(ep) );
+
+                    loc_rhs += qw * rhs_fun(ep) * phi;
+                }
+
+                const auto& fcids = face_ids(msh, tcl_id);
+                for (auto& fcid : fcids)
+                {
+                    const auto& fc = msh.faces[fcid];
+                    auto Att = lt::zero_matrix(bs);
+                    auto Atn = lt::zero_matrix(bs);
+
+                    auto [ncl_id, has_neighbour] = neighbour_via(msh, tcl_id, fcid);
+                    if (!has_neighbour and !fc.is_boundary)
+                        continue; /* nonconforming, see assemble_hanging_faces() */
+
+                    const auto& ncl = has_neighbour ? msh.cells[ncl_id] : tcl;
+                    auto nbasis = yaourt::bases::make_tabulated_basis<static_k>(msh, ncl, degree, 2*degree);
+                    assert(tbasis.size() == nbasis.size());
+
+                    auto n      = normal(msh, tcl, fc);
+                    auto t_fqps = tbasis.face_quadrature(fc);
+                    auto n_fqps = nbasis.face_quadrature(fc);
+
+                    for (size_t ifqp = 0; ifqp < t_fqps.size(); ifqp++)
+                    {
+                        auto ep     = t_fqps.point(ifqp);
+                        auto fqw    = t_fqps.weight(ifqp);
+                        const auto& tphi = t_fqps.phi(ifqp);
+
+                        T beta_nf = dot(beta_fun(ep), n);
+                        T fi_coeff;
+
+                        if (upwinding)
+                            fi_coeff = beta_nf - eta * std::abs(beta_nf);
+                        else
+                            fi_coeff = beta_nf;
+
+                        if (has_neighbour)
+                        {   /* NOT on a boundary */
+                            Att += - fqw * 0.5 * fi_coeff * tphi * trans(tphi);
+                        }
+                        else
+                        {   /* On a boundary*/
+                            auto beta_minus = 0.5*(std::abs(beta_nf) - beta_nf);
+
+                            if (beta_nf < 0.0)
+                                Att += fqw * beta_minus * tphi * trans(tphi);
+
+                            continue;
+                        }
+
+                        const auto& nphi = n_fqps.phi(ifqp);
+
+                        /* Advection-Reaction */
+                        Atn += + fqw * fi_coeff * 0.5 * tphi * trans(nphi);
+                    }
+
+                    assm.assemble(msh, tcl_id, tcl_id, Att, tid);
+                    if (has_neighbour)
+                        assm.assemble(msh, tcl_id, ncl_id, Atn, tid);
+                }
+
+                assm.assemble(msh, tcl_id, K, loc_rhs, tid);
+            }
+        };
+
+        yaourt::parallel_for_chunks(msh.cells.size(), num_threads,
+                                    assemble_chunk);
+    });
+}
@@ -0,0 +1,231 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "blaze/Math.h"
+#include "core/mesh.hpp"
+#include "core/tabulation.hpp"
+#include "core/parallel.hpp"
+
+namespace yaourt {
+namespace dg {
+
+/* Matrix-free symmetric interior penalty operator for -div(grad(u)), with
+ * homogeneous Dirichlet conditions imposed weakly. It applies the same
+ * bilinear form assembled by dg2d_diffusion.cpp, but the element and face
+ * contributions are recomputed at each application from the tabulated
+ * bases, so only the geometric data of each cell and face is stored.
+ *
+ * The operator is symmetric, it implements the linear operator interface
+ * of core/solvers.hpp and can be passed to conjugated_gradient(). Each
+ * cell only writes its own rows of the result, so the cells are split
+ * among 'num_threads' threads without synchronization. The threads are
+ * started once by the constructor and reused by each application. */
+template<typename Mesh>
+class sip_diffusion_operator
+{
+    using T             = typename Mesh::coordinate_type;
+    using basis_type    = decltype( bases::make_tabulated_basis(
+                                        std::declval<const Mesh&>(),
+                                        std::declval<const typename Mesh::cell_type&>(),
+                                        0, 0) );
+    using quad_type     = bases::tabulated_quadrature<T>;
+
+    struct face_info
+    {
+        size_t                      neighbour;
+        bool                        has_neighbour;
+        blaze::StaticVector<T,2>    n;
+        T                           eta_l;
+        quad_type                   t_fqps, n_fqps;
+    };
+
+    size_t                          basis_size;
+    std::vector<basis_type>         tbases;
+    std::vector<quad_type>          cell_qps;
+    std::vector<size_t>             face_ptr;
+    std::vector<face_info>          face_data;
+
+    /* Shared by the copies of the operator, never applied concurrently */
+    std::shared_ptr<thread_pool>    pool;
+
+    void apply_cells(const blaze::DynamicVector<T>& x,
+                     blaze::DynamicVector<T>& y,
+                     size_t begin, size_t end) const;
+
+public:
+    using value_type = T;
+
+    /* 'eta' is the penalty parameter, scaled by the face diameter */
+    sip_diffusion_operator(const Mesh& msh, size_t degree, T eta,
+                           size_t nthreads = 1)
+        : basis_size( bases::scalar_basis_size(degree, 2) ),
+          pool( std::make_shared<thread_pool>(nthreads) )
+    {
+        if ( msh.face_owners.size() != msh.faces.size() )
+            throw std::logic_error("No connectivity information.");
+
+        if ( !msh.hanging_faces.empty() )
+            throw std::invalid_argument("SIP operator: nonconforming meshes not supported");
+
+        /* The quadratures keep pointers in the bases, so the bases must
+         * not move after this point */
+        tbases.reserve( msh.cells.size() );
+        for (auto& cl : msh.cells)
+            tbases.push_back( bases::make_tabulated_basis(msh, cl, degree, 2*degree) );
+
+        face_ptr.reserve( msh.cells.size()+1 );
+        face_ptr.push_back(0);
+        for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+        {
+            const auto& tcl = msh.cells[cl_id];
+            const auto& tbasis = tbases[cl_id];
+            cell_qps.push_back( tbasis.cell_quadrature() );
+
+            for (auto& fcid : face_ids(msh, cl_id))
+            {
+                const auto& fc = msh.faces[fcid];
+                auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+                const auto& nbasis = has_neighbour ? tbases[ncl_id] : tbasis;
+
+                face_data.push_back( face_info{ ncl_id, has_neighbour,
+                                                normal(msh, tcl, fc),
+                                                eta / diameter(msh, fc),
+                                                tbasis.face_quadrature(fc),
+                                                nbasis.face_quadrature(fc) } );
+            }
+
+            face_ptr.push_back( face_data.size() );
+        }
+    }
+
+    size_t rows() const     { return basis_size * tbases.size(); }
+    size_t columns() const  { return basis_size * tbases.size(); }
+
+    /* y = A*x */
+    void apply(const blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& y) const
+    {
+        if (x.size() != columns())
+            throw std::invalid_argument("SIP operator: size mismatch");
+
+        y.resize( rows() );
+
+        pool->for_chunks(tbases.size(),
+            [&](size_t, size_t begin, size_t end) {
+                apply_cells(x, y, begin, end);
+            });
+    }
+
+    /* The operator is symmetric */
+    void apply_transpose(const blaze::DynamicVector<T>& x, blaze::DynamicVector<T>& y) const
+    {
+        apply(x, y);
+    }
+};
+
+template<typename Mesh>
+void
+sip_diffusion_operator<Mesh>::apply_cells(const blaze::DynamicVector<T>& x,
+                                          blaze::DynamicVector<T>& y,
+                                          size_t begin, size_t end) const
+{
+    const auto bs = basis_size;
+
+    /* Scratch space, allocated once per call */
+    blaze::DynamicVector<T> ut(bs), un(bs), yt(bs), tdn(bs), ndn(bs);
+    blaze::DynamicVector<T> g(2);
+    blaze::DynamicMatrix<T> dphi(bs, 2), ndphi(bs, 2);
+
+    for (size_t cl_id = begin; cl_id < end; cl_id++)
+    {
+        for (size_t i = 0; i < bs; i++)
+        {
+            ut[i] = x[cl_id*bs + i];
+            yt[i] = 0.0;
+        }
+
+        /* Volume term: (grad(u), grad(v)) */
+        const auto& qps = cell_qps[cl_id];
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
+        {
+            qps.grads(iqp, dphi);
+            g = trans(dphi)*ut;
+            yt += qps.weight(iqp) * (dphi*g);
+        }
+
+        for (size_t f = face_ptr[cl_id]; f < face_ptr[cl_id+1]; f++)
+        {
+            const auto& fi = face_data[f];
+
+            if (fi.has_neighbour)
+                for (size_t i = 0; i < bs; i++)
+                    un[i] = x[fi.neighbour*bs + i];
+
+            for (size_t ifqp = 0; ifqp < fi.t_fqps.size(); ifqp++)
+            {
+                auto fqw    = fi.t_fqps.weight(ifqp);
+                auto& tphi  = fi.t_fqps.phi(ifqp);
+                fi.t_fqps.grads(ifqp, dphi);
+                tdn = dphi*fi.n;
+
+                T tu    = dot(tphi, ut);
+                T tgn   = dot(tdn, ut);
+
+                if (fi.has_neighbour)
+                {   /* NOT on a boundary: jump and average */
+                    auto& nphi  = fi.n_fqps.phi(ifqp);
+                    fi.n_fqps.grads(ifqp, ndphi);
+                    ndn = ndphi*fi.n;
+
+                    T jump  = tu - dot(nphi, un);
+                    T avg   = 0.5*(tgn + dot(ndn, un));
+
+                    yt += fqw * (fi.eta_l*jump - avg) * tphi;
+                    yt -= fqw * 0.5 * jump * tdn;
+                }
+                else
+                {   /* On a boundary */
+                    yt += fqw * (fi.eta_l*tu - tgn) * tphi;
+                    yt -= fqw * tu * tdn;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < bs; i++)
+            y[cl_id*bs + i] = yt[i];
+    }
+}
+
+template<typename Mesh>
+auto
+make_sip_diffusion_operator(const Mesh& msh, size_t degree,
+                            typename Mesh::coordinate_type eta,
+                            size_t num_threads = 1)
+{
+    return sip_diffusion_operator<Mesh>(msh, degree, eta, num_threads);
+}
+
+} // namespace dg
+} // namespace yaourt
@@ -19,14 +19,24 @@
 
 #pragma once
 
-#include <chrono>
+#include <memory>
+#include <string>
 
 #include "core/mesh.hpp"
 #include "core/meshers.hpp"
+#include "core/reordering.hpp"
+#include "core/partitioning.hpp"
+#include "core/distributed.hpp"
 #include "core/quadratures.hpp"
 #include "core/bases.hpp"
+#include "core/tabulation.hpp"
+#include "core/batched_la.hpp"
 #include "core/blaze_sparse_init.hpp"
+#include "core/checkpoint.hpp"
+#include "core/mesh_io.hpp"
 #include "core/dataio.hpp"
+#include "core/parallel.hpp"
+#include "core/instrumentation.hpp"
 
 #include "core/refelem.hpp"
 
@@ -39,6 +49,8 @@ namespace yaourt::maxwell_2D {
 enum class time_integrator_type {
     EXPLICIT_EULER, /* Don't use, only for experimental purposes */
     RUNGE_KUTTA_4,
+    SSP_RUNGE_KUTTA_3,  /* Strong stability preserving, Shu-Osher form */
+    LOW_STORAGE_RK_4,   /* Carpenter-Kennedy LSRK4(5), 2N storage */
 };
 
 template<typename T>
@@ -59,18 +71,51 @@ struct maxwell_config
 
     char *                  error_fn;       /* Error dump filename */
     char *                  silo_basename;  /* Base name for silo export */
+    char *                  checkpoint_fn;  /* Checkpoint filename */
+    size_t                  checkpoint_rate;/* Number of timesteps between checkpoints */
+    char *                  restart_fn;     /* Checkpoint to restart from */
+    char *                  mesh_fn;        /* Mesh to load instead of the mesher's */
+    char *                  save_mesh_fn;   /* Where to save the mesh, native format */
 
     bool                    shatter_mesh;
 
+    size_t                  num_threads;    /* Threads used in the timestepping */
+    size_t                  lts_levels;     /* Max local timestepping levels, 1 disables it */
+    mesh_ordering           ordering;       /* Cell numbering, see core/reordering.hpp */
+
     maxwell_config() :
         degree(1), mesh_levels(4), timesteps(100), output_rate(10),
         delta_t(0.1), eta(1.0), verbosity(0), upwind(false),
         time_integrator(time_integrator_type::RUNGE_KUTTA_4),
-        error_fn(nullptr), silo_basename(nullptr), shatter_mesh(false)
+        error_fn(nullptr), silo_basename(nullptr), checkpoint_fn(nullptr),
+        checkpoint_rate(100), restart_fn(nullptr), mesh_fn(nullptr),
+        save_mesh_fn(nullptr), shatter_mesh(false),
+        num_threads(1), lts_levels(1), ordering(mesh_ordering::NONE)
+    {}
+
+    /* Same configuration with another scalar type, e.g. to run in single
+     * precision from the options parsed in double */
+    template<typename U>
+    explicit maxwell_config(const maxwell_config<U>& other) :
+        degree(other.degree), mesh_levels(other.mesh_levels),
+        timesteps(other.timesteps), output_rate(other.output_rate),
+        delta_t(other.delta_t), eta(other.eta), verbosity(other.verbosity),
+        upwind(other.upwind), time_integrator(other.time_integrator),
+        error_fn(other.error_fn), silo_basename(other.silo_basename),
+        checkpoint_fn(other.checkpoint_fn), checkpoint_rate(other.checkpoint_rate),
+        restart_fn(other.restart_fn), mesh_fn(other.mesh_fn),
+        save_mesh_fn(other.save_mesh_fn), shatter_mesh(other.shatter_mesh), num_threads(other.num_threads),
+        lts_levels(other.lts_levels), ordering(other.ordering)
     {}
 };
 
 
+template<typename Mesh>
+struct maxwell_context;
+
+template<typename Mesh>
+void setup_local_timestepping(maxwell_context<Mesh>&);
+
 template<typename Mesh>
 struct maxwell_context
 {
@@ -89,8 +134,44 @@ struct maxwell_context
     /* Elemental mass and stiffness matrices (stiffness not needed, actually) */
     blaze::DynamicMatrix<T>     gM;//, gSx, gSy;
 
-    /* Global operator diagonal and offdiagonal terms */
-    blaze::DynamicMatrix<T>     gOp_ondiag, gOp_offdiag;
+    /* Factorized mass matrices, shared by the elements of the same shape.
+     * Computed by assemble(), used by the local solves of the assembly and
+     * of the initial condition. */
+    yaourt::mass_factorizations<mesh_type>  mass_inv;
+
+    /* Global operator, stored element by element: the on-diagonal block
+     * followed by the blocks of the actual neighbours, in the order of
+     * face_ids(). The blocks of element i are gOp_ptr[i] to gOp_ptr[i+1]
+     * and block k multiplies the DoFs of element gOp_neigh[k]. Of each
+     * block only the nonzero field sub-blocks are stored, grouped in the
+     * panels listed in gOp_panels. Each panel is stored column-major and
+     * the size of the blocks is padded to 32 bytes, so the storage of an
+     * element is contiguous and its blocks are aligned for SIMD. */
+    struct op_panel
+    {
+        size_t  field_in;       /* First field multiplied by the panel */
+        size_t  num_in;         /* Number of consecutive fields multiplied */
+        size_t  field_out;      /* First field of the result */
+        size_t  num_out;        /* Number of consecutive result fields */
+        size_t  offset;         /* Offset of the panel in the block */
+    };
+
+    blaze::DynamicVector<T>                     gOp_values;
+    std::vector<size_t>                         gOp_ptr, gOp_neigh;
+    std::vector<op_panel>                       gOp_panels;
+    size_t                                      gOp_block_size;
+
+    /* Inputs of the Runge-Kutta stages (for the low-storage scheme, the
+     * stage increment), kept here to avoid allocating them at each
+     * timestep. Only the vectors needed by the integrator are allocated. */
+    blaze::DynamicVector<T>     gDofs_stage[2];
+
+    /* Threads of the timestepping, started once with the context, and the
+     * operator applied to one element by each of them. The scratch of a
+     * thread starts at tid*op_scratch_stride, padded to a cache line. */
+    std::unique_ptr<yaourt::thread_pool>    pool;
+    mutable std::vector<T>                  op_scratch;
+    size_t                                  op_scratch_stride;
 
     /* Material parameters */
     T                           mu_0, eps_0;
@@ -99,10 +180,35 @@ struct maxwell_context
     /* Basis size*/
     size_t                      basis_size;
 
-    using no_pair_t = std::pair<size_t, bool>;
-    std::vector<no_pair_t>      offdiag_neigh_offsets;
+    /* Local timestepping: rate level of each element, elements of each
+     * level, elements of other levels adjacent to each level and elements
+     * adjacent to a coarser level. The first two time derivatives at the
+     * beginning of the step are needed by the interface coupling. */
+    std::vector<size_t>                 lts_level;
+    std::vector<std::vector<size_t>>    lts_cells, lts_ghosts;
+    std::vector<size_t>                 lts_predicted;
+    blaze::DynamicVector<T>             lts_dudt, lts_d2udt2, lts_acc;
+
+    /* Domain decomposition, when running on more than one MPI process:
+     * 'msh' is the local mesh, with the owned elements first and then the
+     * ghosts. The DoFs of the ghosts are refreshed by 'halo' before each
+     * operator evaluation. */
+    yaourt::mesh_partition              part;
+#ifdef WITH_MPI
+    std::unique_ptr<yaourt::mpi::halo_exchange<T>>  halo;
+#endif
+
+    /* First timestep to compute: 0, or the one after the timestep saved
+     * in the checkpoint the context was restarted from */
+    size_t                              first_cycle;
 
-    constexpr int faces_per_elem()
+    /* Number of elements advanced by this process */
+    size_t num_owned_cells() const
+    {
+        return part.is_distributed() ? part.num_owned : msh.cells.size();
+    }
+
+    constexpr int faces_per_elem() const
     {
         if (std::is_same<Mesh, yaourt::simplicial_mesh<T>>::value)
             return 3;
@@ -113,42 +219,318 @@ struct maxwell_context
         return 0;
     }
 
-    maxwell_context() = delete;
+    /* Scratch space of the thread 'tid' of the pool */
+    T* thread_scratch(size_t tid) const
+    {
+        return op_scratch.data() + tid*op_scratch_stride;
+    }
 
-    maxwell_context(const maxwell_config<T>& p_cfg) :
-        cfg(p_cfg), mu_0(4.*M_PI*1e-7), eps_0(8.8541878128e-12)
+    T* op_block(size_t k)
     {
-        namespace yb = yaourt::bases;
+        return gOp_values.data() + k*gOp_block_size;
+    }
 
-        /* Create mesh */
-        auto mesher = yaourt::get_mesher(msh, LOGLEVEL_INFO(cfg.verbosity));
-        mesher.create_mesh(msh, cfg.mesh_levels);
+    const T* op_block(size_t k) const
+    {
+        return gOp_values.data() + k*gOp_block_size;
+    }
+
+    /* Copy the field sub-block (i,j) of the block k in the storage. The
+     * sub-blocks not in gOp_panels are not stored, they must be zero. */
+    template<typename MT>
+    void store_op_subblock(size_t k, size_t i, size_t j, const MT& M)
+    {
+        for (auto& p : gOp_panels)
+        {
+            if (j < p.field_in or j >= p.field_in+p.num_in or
+                i < p.field_out or i >= p.field_out+p.num_out)
+                continue;
+
+            auto col_size = p.num_out*basis_size;
+            T *dst = op_block(k) + p.offset + (i - p.field_out)*basis_size
+                                            + (j - p.field_in)*basis_size*col_size;
+            for (size_t c = 0; c < basis_size; c++)
+                for (size_t r = 0; r < basis_size; r++)
+                    dst[c*col_size + r] = M(r,c);
+            return;
+        }
+
+        for (size_t c = 0; c < basis_size; c++)
+            for (size_t r = 0; r < basis_size; r++)
+                if (M(r,c) != 0.0)
+                    throw std::logic_error("Nonzero operator sub-block outside of the panels");
+    }
+
+private:
+    void create_mesh()
+    {
+        YAOURT_TIMED_SCOPE("maxwell.mesh");
+
+        /* The mesher and the loaders also compute the connectivity */
+        if (cfg.mesh_fn)
+            yaourt::load_mesh(cfg.mesh_fn, msh, cfg.num_threads);
+        else
+        {
+            auto mesher = yaourt::get_mesher(msh, LOGLEVEL_INFO(cfg.verbosity),
+                                              cfg.num_threads);
+            mesher.create_mesh(msh, cfg.mesh_levels);
+        }
 
         if (cfg.shatter_mesh)
             shatter_mesh(msh, 0.2);
 
-        msh.compute_connectivity();
+        reorder_mesh(msh, cfg.ordering);
+
+        if (cfg.save_mesh_fn)
+        {
+#ifdef WITH_MPI
+            /* All the processes have the same global mesh */
+            if (yaourt::mpi::comm_rank() == 0)
+#endif
+            yaourt::save_binary_mesh(cfg.save_mesh_fn, msh);
+        }
+
+#ifdef WITH_MPI
+        /* The global mesh is reordered before the partitioning, so the
+         * owned elements keep the ordering */
+        if ( yaourt::mpi::is_parallel() )
+        {
+            if (cfg.lts_levels > 1)
+                throw std::invalid_argument("Local timestepping is not available with MPI");
+
+            part = yaourt::mpi::distribute_mesh(msh);
+            halo = std::make_unique<yaourt::mpi::halo_exchange<T>>(part);
+        }
+#endif
+    }
+
+    /* Restore the mesh and its partition from the checkpoint: the storage
+     * is then allocated as usual and read_checkpoint() fills it. */
+    void load_mesh(const yaourt::checkpoint::reader& ckpt)
+    {
+        if (ckpt.read_value<uint64_t>("maxwell.value_size") != sizeof(T))
+            throw std::invalid_argument("Checkpoint: saved with another precision");
+
+        if (ckpt.read_value<uint64_t>("maxwell.degree") != cfg.degree)
+            throw std::invalid_argument("Checkpoint: saved with another degree");
+
+        if (ckpt.read_value<uint64_t>("maxwell.upwind") != cfg.upwind)
+            throw std::invalid_argument("Checkpoint: saved with other fluxes");
+
+        /* The coefficients are only meaningful in the same basis */
+        auto kind = uint64_t(yaourt::bases::default_basis_kind);
+        if (ckpt.has("maxwell.basis_kind") and
+            ckpt.read_value<uint64_t>("maxwell.basis_kind") != kind)
+            throw std::invalid_argument("Checkpoint: saved with another basis");
+
+        if (ckpt.read_value<T>("maxwell.delta_t") != cfg.delta_t)
+            throw std::invalid_argument("Checkpoint: saved with another delta_t");
+
+        yaourt::checkpoint::read_mesh(ckpt, msh);
+        part = yaourt::checkpoint::read_partition(ckpt);
+
+#ifdef WITH_MPI
+        auto num_procs = yaourt::mpi::is_parallel() ? yaourt::mpi::comm_size() : 1;
+        if (part.num_parts != size_t(num_procs))
+            throw std::invalid_argument("Checkpoint: saved with another number of processes");
+
+        if ( part.is_distributed() )
+        {
+            if (part.part != size_t(yaourt::mpi::comm_rank()))
+                throw std::invalid_argument("Checkpoint: saved by another process");
+
+            if (cfg.lts_levels > 1)
+                throw std::invalid_argument("Local timestepping is not available with MPI");
+
+            halo = std::make_unique<yaourt::mpi::halo_exchange<T>>(part);
+        }
+#else
+        if ( part.is_distributed() )
+            throw std::invalid_argument("Checkpoint: saved by a distributed run");
+#endif
+    }
+
+public:
+    maxwell_context() = delete;
+
+    /* If cfg.restart_fn is set, the mesh, the operator and the DoFs are
+     * restored from that checkpoint and assemble() must not be called. */
+    maxwell_context(const maxwell_config<T>& p_cfg) :
+        cfg(p_cfg), mu_0(4.*M_PI*1e-7), eps_0(8.8541878128e-12), first_cycle(0)
+    {
+        namespace yb = yaourt::bases;
+
+        std::unique_ptr<yaourt::checkpoint::reader> ckpt;
+        if (cfg.restart_fn)
+        {
+            /* With MPI each process has its own checkpoint */
+            std::string restart_fn = cfg.restart_fn;
+#ifdef WITH_MPI
+            if ( yaourt::mpi::is_parallel() )
+                restart_fn += "_" + std::to_string( yaourt::mpi::comm_rank() );
+#endif
+            ckpt = std::make_unique<yaourt::checkpoint::reader>(restart_fn);
+            load_mesh(*ckpt);
+        }
+        else
+            create_mesh();
 
         /* Initialize data storage */
         basis_size = yb::scalar_basis_size(cfg.degree, 2);
 
         auto num_fDofs = basis_size * msh.cells.size();
         auto num_gDofs = 3 * num_fDofs;
-        auto num_lDofs = 3 * basis_size;
 
         gDofs.resize(num_gDofs); reset(gDofs);
-        gDofs_t_plus_one.resize(num_gDofs); reset(gDofs_t_plus_one);
+        switch (cfg.time_integrator)
+        {
+            case time_integrator_type::EXPLICIT_EULER:
+                gDofs_t_plus_one.resize(num_gDofs); reset(gDofs_t_plus_one);
+                break;
+
+            case time_integrator_type::RUNGE_KUTTA_4:
+                gDofs_t_plus_one.resize(num_gDofs); reset(gDofs_t_plus_one);
+                gDofs_stage[0].resize(num_gDofs);
+                gDofs_stage[1].resize(num_gDofs);
+                break;
+
+            case time_integrator_type::SSP_RUNGE_KUTTA_3:
+                gDofs_t_plus_one.resize(num_gDofs); reset(gDofs_t_plus_one);
+                gDofs_stage[0].resize(num_gDofs);
+                break;
+
+            case time_integrator_type::LOW_STORAGE_RK_4:
+                gDofs_stage[0].resize(num_gDofs); reset(gDofs_stage[0]);
+                break;
+        }
+
+        if (cfg.lts_levels > 1)
+        {
+            if (cfg.time_integrator != time_integrator_type::RUNGE_KUTTA_4)
+                throw std::invalid_argument("Local timestepping is available only with RK4");
+
+            lts_dudt.resize(num_gDofs);
+            lts_d2udt2.resize(num_gDofs);
+            lts_acc.resize(num_gDofs);
+        }
+
+        pool = std::make_unique<yaourt::thread_pool>(cfg.num_threads);
+        op_scratch_stride = 3*basis_size + (64/sizeof(T) - 1);
+        op_scratch_stride -= op_scratch_stride % (64/sizeof(T));
+        op_scratch.resize(pool->size() * op_scratch_stride);
 
         gM.resize(num_fDofs, basis_size); reset(gM);
         //gSx.resize(num_fDofs, basis_size);
         //gSy.resize(num_fDofs, basis_size);
 
-        gOp_ondiag.resize(num_gDofs, num_lDofs); reset(gOp_ondiag);
-        gOp_offdiag.resize( faces_per_elem() * num_gDofs, num_lDofs ); reset(gOp_offdiag);
-        offdiag_neigh_offsets.resize( faces_per_elem() * num_gDofs );
+        /* With centered fluxes H is coupled only to E and vice versa, the
+         * H-H and E-E couplings come from the upwind fluxes */
+        if (cfg.upwind)
+            gOp_panels = { {0, 3, 0, 3, 0} };
+        else
+            gOp_panels = { {0, 2, 2, 1, 0}, {2, 1, 0, 2, 0} };
+
+        gOp_block_size = 0;
+        for (auto& p : gOp_panels)
+        {
+            p.offset = gOp_block_size;
+            gOp_block_size += p.num_in*p.num_out*basis_size*basis_size;
+        }
+
+        /* The operator is memory bound, so only the blocks are padded,
+         * padding the columns costs more bandwidth than it saves */
+        const size_t pad = std::max<size_t>(32/sizeof(T), 1);
+        gOp_block_size = pad * ((gOp_block_size + pad - 1)/pad);
+
+        gOp_ptr.reserve(msh.cells.size()+1);
+        gOp_ptr.push_back(0);
+        for (size_t cell_i = 0; cell_i < msh.cells.size(); cell_i++)
+        {
+            gOp_neigh.push_back(cell_i);
+            for (auto& fcid : face_ids(msh, cell_i))
+            {
+                auto [neigh, has_neighbour] = neighbour_via(msh, cell_i, fcid);
+                if (has_neighbour)
+                    gOp_neigh.push_back(neigh);
+            }
+            gOp_ptr.push_back( gOp_neigh.size() );
+        }
+
+        gOp_values.resize( gOp_neigh.size() * gOp_block_size ); reset(gOp_values);
 
         mu_r.resize(msh.cells.size());      mu_r = 1.0;
         eps_r.resize(msh.cells.size());     eps_r = 1.0;
+
+        if (ckpt)
+            read_checkpoint(*ckpt);
+    }
+
+    /* Save everything needed to continue after the timestep 'cycle', in
+     * the file 'filename' (one per process with MPI). */
+    void write_checkpoint(const std::string& filename, size_t cycle) const
+    {
+        YAOURT_TIMED_SCOPE("maxwell.checkpoint");
+
+        namespace yc = yaourt::checkpoint;
+        yc::writer w(filename);
+
+        w.write_value("maxwell.value_size", uint64_t(sizeof(T)));
+        w.write_value("maxwell.degree", uint64_t(cfg.degree));
+        w.write_value("maxwell.upwind", uint64_t(cfg.upwind));
+        w.write_value("maxwell.basis_kind", uint64_t(yaourt::bases::default_basis_kind));
+        w.write_value("maxwell.delta_t", cfg.delta_t);
+        w.write_value("maxwell.cycle", uint64_t(cycle));
+
+        yc::write_mesh(w, msh);
+        yc::write_partition(w, part);
+
+        w.write_value("maxwell.op_block_size", uint64_t(gOp_block_size));
+        w.write("maxwell.op_values", gOp_values);
+        w.write("maxwell.op_ptr", gOp_ptr);
+        w.write("maxwell.op_neigh", gOp_neigh);
+        w.write("maxwell.mass", gM);
+        w.write("maxwell.mu_r", mu_r);
+        w.write("maxwell.eps_r", eps_r);
+        w.write("maxwell.dofs", gDofs);
+
+        w.close();
+    }
+
+private:
+    void read_checkpoint(const yaourt::checkpoint::reader& ckpt)
+    {
+        /* The layout of the operator depends only on the mesh, the degree
+         * and the fluxes, which are the same: it is checked anyway. */
+        std::vector<size_t> ptr, neigh;
+        ckpt.read("maxwell.op_ptr", ptr);
+        ckpt.read("maxwell.op_neigh", neigh);
+        if (ckpt.read_value<uint64_t>("maxwell.op_block_size") != gOp_block_size or
+            ptr != gOp_ptr or neigh != gOp_neigh)
+            throw std::runtime_error("Checkpoint: inconsistent operator layout");
+
+        auto num_gDofs = gDofs.size();
+        ckpt.read("maxwell.op_values", gOp_values);
+        ckpt.read("maxwell.mass", gM);
+        ckpt.read("maxwell.mu_r", mu_r);
+        ckpt.read("maxwell.eps_r", eps_r);
+        ckpt.read("maxwell.dofs", gDofs);
+
+        if (gOp_values.size() != gOp_neigh.size()*gOp_block_size or
+            gDofs.size() != num_gDofs or mu_r.size() != msh.cells.size() or
+            eps_r.size() != msh.cells.size())
+            throw std::runtime_error("Checkpoint: inconsistent data");
+
+        first_cycle = ckpt.read_value<uint64_t>("maxwell.cycle") + 1;
+
+        /* What assemble() does after the operator */
+        if (cfg.lts_levels > 1)
+            setup_local_timestepping(*this);
+    }
+
+public:
+    bool restarted() const
+    {
+        return first_cycle > 0;
     }
 };
 
@@ -186,9 +568,10 @@ struct maxwell_context<simplicial_mesh<T>>
         namespace yb = yaourt::bases;
 
         /* Create mesh */
-        auto mesher = yaourt::get_mesher(msh, LOGLEVEL_INFO(cfg.verbosity));
+        auto mesher = yaourt::get_mesher(msh, LOGLEVEL_INFO(cfg.verbosity),
+                                          cfg.num_threads);
         mesher.create_mesh(msh, cfg.mesh_levels);
-        msh.compute_connectivity();
+        reorder_mesh(msh, cfg.ordering);
 
         /* Initialize data storage */
         basis_size = yb::scalar_basis_size(cfg.degree, 2);
@@ -217,6 +600,85 @@ struct maxwell_context<simplicial_mesh<T>>
 #endif /* USE_REFERENCE_SIMPLEX */
 
 
+/* Group the elements in rate levels for the local timestepping. The
+ * element 'cl' can take timesteps proportional to its diameter divided
+ * by the speed of light 1/sqrt(mu_r*eps_r), the elements where this
+ * quantity is largest are in level 0 and advance with ctx.cfg.delta_t.
+ * The elements of level l advance with delta_t/2^l, at most
+ * ctx.cfg.lts_levels levels are created. */
+template<typename Mesh>
+void
+setup_local_timestepping(maxwell_context<Mesh>& ctx)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto num_cells = ctx.msh.cells.size();
+    std::vector<T> cfl_len(num_cells);
+    for (size_t cell_i = 0; cell_i < num_cells; cell_i++)
+    {
+        auto h = diameter(ctx.msh, ctx.msh.cells[cell_i]);
+        cfl_len[cell_i] = h * std::sqrt(ctx.mu_r[cell_i] * ctx.eps_r[cell_i]);
+    }
+
+    auto max_len = *std::max_element(cfl_len.begin(), cfl_len.end());
+    auto max_level = std::max<size_t>(ctx.cfg.lts_levels, 1) - 1;
+
+    ctx.lts_level.resize(num_cells);
+    size_t num_levels = 1;
+    for (size_t cell_i = 0; cell_i < num_cells; cell_i++)
+    {
+        /* The tolerance keeps uniform meshes in a single level */
+        T ratio = std::log2(max_len/cfl_len[cell_i]) - 1e-8;
+        size_t level = (ratio > 0) ? size_t(std::ceil(ratio)) : 0;
+        ctx.lts_level[cell_i] = std::min(level, max_level);
+        num_levels = std::max(num_levels, ctx.lts_level[cell_i]+1);
+    }
+
+    ctx.lts_cells.assign(num_levels, {});
+    ctx.lts_ghosts.assign(num_levels, {});
+    for (size_t cell_i = 0; cell_i < num_cells; cell_i++)
+        ctx.lts_cells[ ctx.lts_level[cell_i] ].push_back(cell_i);
+
+    ctx.lts_predicted.clear();
+    for (size_t l = 0; l < num_levels; l++)
+    {
+        auto& ghosts = ctx.lts_ghosts[l];
+        for (auto& cell_i : ctx.lts_cells[l])
+        {
+            for (auto& fcid : face_ids(ctx.msh, cell_i))
+            {
+                auto [neigh, has_neighbour] = neighbour_via(ctx.msh, cell_i, fcid);
+                if (has_neighbour and ctx.lts_level[neigh] != l)
+                    ghosts.push_back(neigh);
+                if (has_neighbour and ctx.lts_level[neigh] > l)
+                    ctx.lts_predicted.push_back(neigh);
+            }
+        }
+
+        std::sort(ghosts.begin(), ghosts.end());
+        ghosts.erase( std::unique(ghosts.begin(), ghosts.end()), ghosts.end() );
+    }
+
+    auto& pred = ctx.lts_predicted;
+    std::sort(pred.begin(), pred.end());
+    pred.erase( std::unique(pred.begin(), pred.end()), pred.end() );
+
+    if ( LOGLEVEL_INFO(ctx.cfg.verbosity) )
+    {
+        /* Element operator evaluations per step, relative to global
+         * timestepping with the step of the finest level */
+        size_t lts_work = num_cells + pred.size();
+        size_t gts_work = 4*(num_cells << (num_levels-1));
+        std::cout << "Local timestepping levels:";
+        for (size_t l = 0; l < num_levels; l++)
+        {
+            std::cout << " " << ctx.lts_cells[l].size();
+            lts_work += 4*(ctx.lts_cells[l].size() << l);
+        }
+        std::cout << " elements. Work ratio: " << double(lts_work)/gts_work << std::endl;
+    }
+}
+
 template<typename Mesh>
 void
 assemble(maxwell_context<Mesh>& ctx)
@@ -235,45 +697,56 @@ assemble(maxwell_context<Mesh>& ctx)
         std::cout << "Assembling dG operator, " << ndofs << " DoFs." << std::endl;
     }
 
-    auto asm_start_time = std::chrono::system_clock::now();
+    YAOURT_TIMED_SCOPE_VAR(asm_timer, "maxwell.assemble", LOGLEVEL_INFO(ctx.cfg.verbosity));
+
+    /* Scratch space for the gradients */
+    DynamicMatrix<T> dphi(basis_size, 2);
+
+    /* Each block below is multiplied by the inverse of the mass matrix,
+     * the factorization is done once per element shape */
+    ctx.mass_inv = yaourt::tabulated_mass_factorizations(ctx.msh, ctx.cfg.degree,
+                                    2*ctx.cfg.degree, ctx.cfg.num_threads);
 
     size_t cell_i = 0;
-    size_t offdiag_contrib_i = 0;
     for (auto& tcl : ctx.msh.cells)
     {
-        auto tbasis = yb::make_basis(ctx.msh, tcl, ctx.cfg.degree);
+        auto tbasis = yb::make_tabulated_basis(ctx.msh, tcl, ctx.cfg.degree, 2*ctx.cfg.degree);
 
         DynamicMatrix<T> M2d(basis_size, basis_size, 0.0);
         DynamicMatrix<T> Sx(basis_size, basis_size, 0.0);
         DynamicMatrix<T> Sy(basis_size, basis_size, 0.0);
         
         /* Make mass and stiffness matrices on the element */
-        auto qps = yq::integrate(ctx.msh, tcl, 2*ctx.cfg.degree);
-        for (auto& qp : qps)
+        auto qps = tbasis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
         {
-            auto ep   = qp.point();
-            auto phi  = tbasis.eval(ep);
-            auto dphi = tbasis.eval_grads(ep);
+            auto qw     = qps.weight(iqp);
+            auto& phi   = qps.phi(iqp);
+            qps.grads(iqp, dphi);
 
             auto dphi_x = blaze::column<0>(dphi);
             auto dphi_y = blaze::column<1>(dphi);
 
             /* Mass */
-            M2d += qp.weight() * phi * trans( phi );
+            M2d += qw * phi * trans( phi );
             /* Stiffness, direction x */
-            Sx += qp.weight() * phi * trans( dphi_x );
+            Sx += qw * phi * trans( dphi_x );
             /* Stiffness, direction y */
-            Sy += qp.weight() * phi * trans( dphi_y );
+            Sy += qw * phi * trans( dphi_y );
         }
 
         /* Save local mass matrix, will be needed in iteration */
         auto gM_offset = cell_i*basis_size;
         submatrix(ctx.gM, gM_offset, 0, basis_size, basis_size) = M2d;
 
-        auto get_global_ondiag_block = [&](size_t i, size_t j) -> auto {
-            auto offset_i = 3*basis_size*cell_i + i*basis_size;
-            auto offset_j = j*basis_size;
-            return submatrix(ctx.gOp_ondiag, offset_i, offset_j, basis_size, basis_size);
+        /* On-diagonal block, the off-diagonal ones are stored as soon as
+         * they are computed, after the on-diagonal one */
+        DynamicMatrix<T> ondiag(3*basis_size, 3*basis_size, 0.0);
+        size_t ondiag_block_i = ctx.gOp_ptr[cell_i];
+        size_t offdiag_block_i = ondiag_block_i + 1;
+
+        auto get_ondiag_block = [&](size_t i, size_t j) -> auto {
+            return submatrix(ondiag, i*basis_size, j*basis_size, basis_size, basis_size);
         };
 
         auto mu         = ctx.mu_r[cell_i];
@@ -281,27 +754,32 @@ assemble(maxwell_context<Mesh>& ctx)
         auto inv_mu     = 1./mu;
         auto inv_eps    = 1./eps;
 
-        auto invM2d_Sx  = blaze::solve(M2d, Sx);
-        auto invM2d_Sy  = blaze::solve(M2d, Sy);
+        auto invM2d_Sx  = ctx.mass_inv.solve(cell_i, Sx);
+        auto invM2d_Sy  = ctx.mass_inv.solve(cell_i, Sy);
 
         auto Z_this     = std::sqrt(mu/eps);
         auto Y_this     = 1./Z_this;
         
-        get_global_ondiag_block(0, 2) = -inv_mu * invM2d_Sy;
+        get_ondiag_block(0, 2) = -inv_mu * invM2d_Sy;
 
-        get_global_ondiag_block(1, 2) = +inv_mu * invM2d_Sx;
+        get_ondiag_block(1, 2) = +inv_mu * invM2d_Sx;
 
-        get_global_ondiag_block(2, 0) = -inv_eps * invM2d_Sy;
-        get_global_ondiag_block(2, 1) = +inv_eps * invM2d_Sx;
+        get_ondiag_block(2, 0) = -inv_eps * invM2d_Sy;
+        get_ondiag_block(2, 1) = +inv_eps * invM2d_Sx;
 
         /* Do numerical fluxes */
-        auto fcs = faces(ctx.msh, tcl);
-        for (auto& fc : fcs)
+        const auto& fcids = face_ids(ctx.msh, cell_i);
+        for (auto& fcid : fcids)
         {
-            auto [ncl, has_neighbour] = neighbour_via(ctx.msh, tcl, fc);
-            auto nbasis = yb::make_basis(ctx.msh, ncl, ctx.cfg.degree);
+            const auto& fc = ctx.msh.faces[fcid];
+            auto [neigh_ofs, has_neighbour] = neighbour_via(ctx.msh, cell_i, fcid);
+            const auto& ncl = has_neighbour ? ctx.msh.cells[neigh_ofs] : tcl;
+            auto nbasis = yb::make_tabulated_basis(ctx.msh, ncl, ctx.cfg.degree, 2*ctx.cfg.degree);
             assert(tbasis.size() == nbasis.size());
 
+            auto t_fqps = tbasis.face_quadrature(fc);
+            auto n_fqps = nbasis.face_quadrature(fc);
+
             auto n       = normal(ctx.msh, tcl, fc);
             auto nx      = n[0];
             auto ny      = n[1];
@@ -317,8 +795,6 @@ assemble(maxwell_context<Mesh>& ctx)
 
             if (has_neighbour)
             {   /* NOT on a boundary */
-                size_t neigh_ofs = offset(ctx.msh, ncl);
-                ctx.offdiag_neigh_offsets[offdiag_contrib_i] = std::make_pair(neigh_ofs, true);
 
                 /* Default use centered fluxes */
                 T kappa_E = 0.5;
@@ -339,18 +815,17 @@ assemble(maxwell_context<Mesh>& ctx)
                     nu_H = ctx.cfg.eta/(Z_this + Z_neigh);
                 }
 
-                auto f_qps = yq::integrate(ctx.msh, fc, 2*ctx.cfg.degree);
-                for (auto& fqp : f_qps)
+                for (size_t ifqp = 0; ifqp < t_fqps.size(); ifqp++)
                 {
-                    auto ep = fqp.point();
+                    auto fqw = t_fqps.weight(ifqp);
 
                     /* Basis evaluated on myself */
-                    auto tphi  = tbasis.eval(ep);
-                    auto tmass = fqp.weight() * tphi * trans(tphi);
+                    auto& tphi = t_fqps.phi(ifqp);
+                    auto tmass = fqw * tphi * trans(tphi);
 
                     /* Basis evaluated on the neighbour */
-                    auto nphi  = nbasis.eval(ep);
-                    auto nmass = fqp.weight() * tphi * trans(nphi);
+                    auto& nphi = n_fqps.phi(ifqp);
+                    auto nmass = fqw * tphi * trans(nphi);
 
                     /* Centered, myself */
                     get_block(FC_diag, 0, 2) += (+ny * kappa_E * inv_mu) * tmass;           // Hx equation, [E]
@@ -379,11 +854,10 @@ assemble(maxwell_context<Mesh>& ctx)
                         get_block(FC_offdiag, 1, 1) -= -nx * nx * nu_H * inv_mu * nmass;    // Hy equation, [H]
                         get_block(FC_offdiag, 2, 2) -= -nu_E * inv_eps * nmass;             // Ez equation, [E]
                     }
-                } /* end for (auto& fqp : f_qps) */
+                } /* end for (size_t ifqp = 0; ifqp < t_fqps.size(); ifqp++) */
             } /*end if (has_neighbour) */
             else
             {   /* On a boundary*/
-                ctx.offdiag_neigh_offsets[offdiag_contrib_i] = std::make_pair(0, false);
                 /* Default use centered fluxes */
                 T kappa_E = 0.5;
                 T kappa_H = 0.5;
@@ -398,14 +872,13 @@ assemble(maxwell_context<Mesh>& ctx)
                     nu_H = ctx.cfg.eta/(2*Z_this);
                 }
 
-                auto f_qps = yq::integrate(ctx.msh, fc, 2*ctx.cfg.degree);
-                for (auto& fqp : f_qps)
+                for (size_t ifqp = 0; ifqp < t_fqps.size(); ifqp++)
                 {
-                    auto ep = fqp.point();
+                    auto fqw = t_fqps.weight(ifqp);
 
                     /* Basis evaluated on myself */
-                    auto tphi  = tbasis.eval(ep);
-                    auto tmass = fqp.weight() * tphi * trans(tphi);
+                    auto& tphi = t_fqps.phi(ifqp);
+                    auto tmass = fqw * tphi * trans(tphi);
 
                     /* Centered */
                     get_block(FC_diag, 0, 2) += +ny * 2 * kappa_E * inv_mu * tmass;     // Hx equation, [E]
@@ -423,41 +896,42 @@ assemble(maxwell_context<Mesh>& ctx)
                 for (size_t j = 0; j < 3; j++)
                 {
                     auto blk = get_block(FC_diag, i, j);
-                    get_global_ondiag_block(i, j) += solve(M2d, blk);
+                    get_ondiag_block(i, j) += ctx.mass_inv.solve(cell_i, blk);
                 }
             }
 
             if (has_neighbour)
             {   /* Save offdiag */
-                auto offdiag_base = 3*basis_size*offdiag_contrib_i;
+                assert(ctx.gOp_neigh[offdiag_block_i] == neigh_ofs);
 
                 for (size_t i = 0; i < 3; i++)
                 {
                     for (size_t j = 0; j < 3; j++)
                     {
-                        auto offset_i = offdiag_base + basis_size*i;
-                        auto offset_j = basis_size*j;
                         auto blk = get_block(FC_offdiag, i, j);
-                        submatrix(ctx.gOp_offdiag, offset_i, offset_j, basis_size, basis_size) = solve(M2d, blk);
+                        ctx.store_op_subblock(offdiag_block_i, i, j, ctx.mass_inv.solve(cell_i, blk));
                     }
                 }
+
+                offdiag_block_i++;
             }
+        } // for (auto& fcid : fcids)
 
-            /* LAST */
-            offdiag_contrib_i++;
-        } // for (auto& fc : fcs)
+        for (size_t i = 0; i < 3; i++)
+            for (size_t j = 0; j < 3; j++)
+                ctx.store_op_subblock(ondiag_block_i, i, j, get_ondiag_block(i, j));
 
         /* LAST */
         cell_i++;
     } // for (auto& tcl : ctx.msh.cells)
 
-    auto asm_end_time = std::chrono::system_clock::now();
-
     if ( LOGLEVEL_INFO(ctx.cfg.verbosity) )
-    {
-        std::chrono::duration<double> asmtime = asm_end_time - asm_start_time;
-        std::cout << "Assembly time: " << asmtime.count() << " seconds" << std::endl;
-    }
+        std::cout << "Assembly time: " << asm_timer.elapsed() << " seconds" << std::endl;
+
+    asm_timer.stop();
+
+    if (ctx.cfg.lts_levels > 1)
+        setup_local_timestepping(ctx);
 }
 
 #ifdef USE_REFERENCE_SIMPLEX
@@ -518,27 +992,26 @@ apply_initial_condition(maxwell_context<Mesh>& ctx, const ICF_type<Mesh>& Hx_ic,
     size_t cell_i = 0;
     for (auto& tcl : ctx.msh.cells)
     {
-        auto tbasis = yb::make_basis(ctx.msh, tcl, ctx.cfg.degree);
+        auto tbasis = yb::make_tabulated_basis(ctx.msh, tcl, ctx.cfg.degree, 2*ctx.cfg.degree);
         DynamicVector<T> loc_rhs_Hx(basis_size, 0.0);
         DynamicVector<T> loc_rhs_Hy(basis_size, 0.0);
         DynamicVector<T> loc_rhs_Ez(basis_size, 0.0);
 
-        auto qps = yq::integrate(ctx.msh, tcl, 2*ctx.cfg.degree);
-        for(auto& qp : qps)
+        auto qps = tbasis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
         {
-            auto phi = tbasis.eval(qp.point());
-            loc_rhs_Hx += Hx_ic(qp.point(), 0.0) * qp.weight() * phi;
-            loc_rhs_Hy += Hy_ic(qp.point(), 0.0) * qp.weight() * phi;
-            loc_rhs_Ez += Ez_ic(qp.point(), 0.0) * qp.weight() * phi;
+            auto ep     = qps.point(iqp);
+            auto qw     = qps.weight(iqp);
+            auto& phi   = qps.phi(iqp);
+            loc_rhs_Hx += Hx_ic(ep, 0.0) * qw * phi;
+            loc_rhs_Hy += Hy_ic(ep, 0.0) * qw * phi;
+            loc_rhs_Ez += Ez_ic(ep, 0.0) * qw * phi;
         }
 
-        auto gM_offset = cell_i * basis_size;
-        auto M2d = submatrix(ctx.gM, gM_offset, 0, basis_size, basis_size);
-
         auto gDofs_base = 3 * cell_i * basis_size;
-        subvector(ctx.gDofs, gDofs_base, basis_size) = solve(M2d, loc_rhs_Hx);
-        subvector(ctx.gDofs, gDofs_base + basis_size, basis_size) = solve(M2d, loc_rhs_Hy);
-        subvector(ctx.gDofs, gDofs_base + 2*basis_size, basis_size) = solve(M2d, loc_rhs_Ez);
+        subvector(ctx.gDofs, gDofs_base, basis_size) = ctx.mass_inv.solve(cell_i, loc_rhs_Hx);
+        subvector(ctx.gDofs, gDofs_base + basis_size, basis_size) = ctx.mass_inv.solve(cell_i, loc_rhs_Hy);
+        subvector(ctx.gDofs, gDofs_base + 2*basis_size, basis_size) = ctx.mass_inv.solve(cell_i, loc_rhs_Ez);
 
         /* LAST */
         cell_i++;
@@ -555,123 +1028,400 @@ apply_initial_condition(maxwell_context<simplicial_mesh<T>>& ctx,
 {}
 #endif /* USE_REFERENCE_SIMPLEX */
 
-template<typename Mesh>
+namespace detail {
+
+/* y += A*x, A has 'm' rows and 'n' columns and is stored column-major.
+ * The inner loop is an AXPY on contiguous memory. */
+template<typename T>
 void
-do_timestep(maxwell_context<Mesh>& ctx)
+block_gemv_add(size_t n, size_t m, const T *A, const T *x, T *y)
 {
-    using namespace blaze;
-    namespace yb = yaourt::bases;
+    for (size_t j = 0; j < n; j++)
+    {
+        const T xj = x[j];
+        const T *col = A + j*m;
+        for (size_t i = 0; i < m; i++)
+            y[i] += col[i] * xj;
+    }
+}
 
-    using T = typename Mesh::coordinate_type;
-    auto basis_size = yb::scalar_basis_size(ctx.cfg.degree, 2);
+/* Evaluate the rows of the dG operator applied to 'v' relative to the
+ * element 'cell_i', the result is stored in 'y'. */
+template<typename Mesh, typename T>
+void
+apply_operator_cell(const maxwell_context<Mesh>& ctx, const blaze::DynamicVector<T>& v,
+                    size_t cell_i, T *y)
+{
+    const size_t bs = ctx.basis_size;
 
-    auto get_dofs = [&](DynamicVector<T>& v, size_t elem) -> auto {
-        return subvector(v, 3*basis_size*elem, 3*basis_size);
-    };
+    for (size_t i = 0; i < 3*bs; i++)
+        y[i] = 0.0;
 
-    auto get_ondiag = [&](size_t index) -> auto {
-        auto size = 3*basis_size;
-        auto offset = size*index;
-        return submatrix(ctx.gOp_ondiag, offset, 0, size, size);
-    };
+    // 2*basis_size^2 FLOPS per stored sub-block
+    for (size_t k = ctx.gOp_ptr[cell_i]; k < ctx.gOp_ptr[cell_i+1]; k++)
+    {
+        const T *blk = ctx.op_block(k);
+        const T *x = v.data() + 3*bs*ctx.gOp_neigh[k];
+        for (auto& p : ctx.gOp_panels)
+            block_gemv_add(p.num_in*bs, p.num_out*bs, blk + p.offset,
+                           x + p.field_in*bs, y + p.field_out*bs);
+    }
+}
 
-    auto get_offdiag = [&](size_t index) -> auto {
-        auto size = 3*basis_size;
-        auto offset = size*index;
-        return submatrix(ctx.gOp_offdiag, offset, 0, size, size);
-    };
+/* Apply the operator to 'in' element by element. The result k relative to
+ * each element is passed right away to update(base, k), which can only
+ * write the DoFs of the element, starting at 'base'. In this way the
+ * stage updates are fused with the operator evaluation and the elements
+ * are split among the threads without further synchronization. The
+ * vectors written by 'update' must not alias 'in'. */
+template<typename Mesh, typename T, typename Update>
+void
+fused_operator_apply(const maxwell_context<Mesh>& ctx,
+                     const blaze::DynamicVector<T>& in, const Update& update)
+{
+    const size_t size = 3*ctx.basis_size;
 
-    // Total FLOPS: (2*(3*basis_size)^2)*(faces_per_elem+1)*ctx.msh.cells.size()
-    auto apply_operator = [&](DynamicVector<T>& v, DynamicVector<T>& v_next) -> void {
-        size_t cell_i = 0;
-        size_t offdiag_contrib_i = 0;
+    ctx.pool->for_chunks(ctx.msh.cells.size(),
+        [&](size_t tid, size_t begin, size_t end) {
+            T *k = ctx.thread_scratch(tid);
+            for (size_t cell_i = begin; cell_i < end; cell_i++)
+            {
+                apply_operator_cell(ctx, in, cell_i, k);
+                update(size*cell_i, k);
+            }
+        });
+}
 
-        for (auto& tcl : ctx.msh.cells)
-        {
-            // 2*(3*basis_size)^2 FLOPS
-            get_dofs(v_next, cell_i) = get_ondiag(cell_i) * get_dofs(v, cell_i);
+/* Same as above, but only for the elements in 'cells' */
+template<typename Mesh, typename T, typename Update>
+void
+fused_operator_apply(const maxwell_context<Mesh>& ctx, const std::vector<size_t>& cells,
+                     const blaze::DynamicVector<T>& in, const Update& update)
+{
+    const size_t size = 3*ctx.basis_size;
 
-//#define BE_NAIVE
-#ifdef BE_NAIVE
-            auto fcs = faces(ctx.msh, tcl);
-            for (auto& fc : fcs)
+    ctx.pool->for_chunks(cells.size(),
+        [&](size_t tid, size_t begin, size_t end) {
+            T *k = ctx.thread_scratch(tid);
+            for (size_t i = begin; i < end; i++)
             {
-                auto nv = neighbour_via(ctx.msh, tcl, fc);
-                auto ncl = nv.first;
-                if (has_neighbour)
-                {
-                    auto neigh_ofs = offset(ctx.msh, ncl);
-                    get_dofs(v_next, cell_i) += get_offdiag(offdiag_contrib_i) * get_dofs(v, neigh_ofs);
-                
-                }
-                /* LAST */
-                offdiag_contrib_i++;
+                apply_operator_cell(ctx, in, cells[i], k);
+                update(size*cells[i], k);
             }
-#else
-            // (2*(3*basis_size)^2)*faces_per_elem FLOPS
-            for (size_t fi = 0; fi < ctx.faces_per_elem(); fi++)
-            {
-                auto no = ctx.offdiag_neigh_offsets[offdiag_contrib_i];
-                if (no.second)
-                    get_dofs(v_next, cell_i) += get_offdiag(offdiag_contrib_i) * get_dofs(v, no.first);
+        });
+}
 
-                /* LAST */
-                offdiag_contrib_i++;
-            }
+/* Same as fused_operator_apply() on the owned elements. On a distributed
+ * mesh the DoFs of the ghost elements of 'in' are exchanged first, and
+ * the elements that do not need them are computed while the messages are
+ * in flight. */
+template<typename Mesh, typename T, typename Update>
+void
+owned_operator_apply(const maxwell_context<Mesh>& ctx,
+                     blaze::DynamicVector<T>& in, const Update& update)
+{
+#ifdef WITH_MPI
+    if (ctx.halo)
+    {
+        ctx.halo->begin(in, 3*ctx.basis_size);
+        fused_operator_apply(ctx, ctx.part.interior_cells, in, update);
+        ctx.halo->end();
+        fused_operator_apply(ctx, ctx.part.interface_cells, in, update);
+        return;
+    }
 #endif
-            /* LAST */
-            cell_i++;
-        }
+
+    fused_operator_apply(ctx, in, update);
+}
+
+/* y += a*x, split among the threads of the pool */
+template<typename T>
+void
+parallel_axpy(yaourt::thread_pool& pool, T a, const blaze::DynamicVector<T>& x,
+              blaze::DynamicVector<T>& y)
+{
+    assert(x.size() == y.size());
+    pool.for_chunks(x.size(),
+        [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                y[i] += a*x[i];
+        });
+}
+
+/* Coefficients of the 5-stage, 4th order, 2N-storage Runge-Kutta scheme
+ * of Carpenter and Kennedy (NASA TM-109112, 1994, solution 3) */
+template<typename T>
+struct lsrk45_coefficients
+{
+    static constexpr size_t stages = 5;
+
+    static constexpr T A[stages] = {
+        0.0,
+        -567301805773.0/1357537059087.0,
+        -2404267990393.0/2016746695238.0,
+        -3550918686646.0/2091501179385.0,
+        -1275806237668.0/842570457699.0
     };
 
-    auto ts_start_time = std::chrono::system_clock::now();
+    static constexpr T B[stages] = {
+        1432997174477.0/9575080441755.0,
+        5161836677717.0/13612068292357.0,
+        1720146321549.0/2090206949498.0,
+        3134564353537.0/4481467310338.0,
+        2277821191437.0/14882151754819.0
+    };
+};
 
-    /* Here ctx.gDofs_t_plus_one is used as scratch space */
-    if (ctx.cfg.time_integrator == time_integrator_type::EXPLICIT_EULER)
+/* Number of operator evaluations and of FLOPS per DoF spent in the stage
+ * updates by each integrator, for the performance estimate */
+inline std::pair<size_t, size_t>
+integrator_cost(time_integrator_type ti)
+{
+    switch (ti)
     {
-        apply_operator(ctx.gDofs, ctx.gDofs_t_plus_one);
-        ctx.gDofs_t_plus_one = ctx.gDofs + ctx.cfg.delta_t*ctx.gDofs_t_plus_one;
+        case time_integrator_type::EXPLICIT_EULER:      return {1, 2};
+        case time_integrator_type::RUNGE_KUTTA_4:       return {4, 14};
+        case time_integrator_type::SSP_RUNGE_KUTTA_3:   return {3, 12};
+        case time_integrator_type::LOW_STORAGE_RK_4:    return {5, 25};
     }
 
-    if (ctx.cfg.time_integrator == time_integrator_type::RUNGE_KUTTA_4)
+    return {0, 0};
+}
+
+} // namespace detail
+
+/* Local timestepping, called by do_timestep() when the elements are in
+ * more than one rate level. The levels are advanced from the coarsest to
+ * the finest, level l takes 2^l RK4 steps. When a level is advanced, the
+ * elements of other levels adjacent to it are needed at the stage times:
+ * the coarser ones are already at t+dt and are interpolated with the
+ * quadratic matching u(t), u'(t) and u(t+dt), the finer ones are
+ * extrapolated with the Taylor expansion u(t) + tau*u'(t) + tau^2/2*u''(t).
+ * The coupling is thus third order accurate in time at the interfaces
+ * between levels. */
+template<typename Mesh>
+void
+do_local_timestep(maxwell_context<Mesh>& ctx)
+{
+    using T = typename Mesh::coordinate_type;
+    const size_t size = 3*ctx.basis_size;
+    const T dt = ctx.cfg.delta_t;
+
+    const auto& u = ctx.gDofs;
+    auto& un = ctx.gDofs_t_plus_one;
+    auto& dudt = ctx.lts_dudt;
+    auto& d2udt2 = ctx.lts_d2udt2;
+    auto& acc = ctx.lts_acc;
+    auto& s0 = ctx.gDofs_stage[0];
+    auto& s1 = ctx.gDofs_stage[1];
+
+    detail::fused_operator_apply(ctx, u, [&](size_t base, const T *k) {
+        for (size_t i = 0; i < size; i++)
+            dudt[base+i] = k[i];
+    });
+
+    /* The operator is linear and time independent, so u'' = L(u') */
+    detail::fused_operator_apply(ctx, ctx.lts_predicted, dudt, [&](size_t base, const T *k) {
+        for (size_t i = 0; i < size; i++)
+            d2udt2[base+i] = k[i];
+    });
+
+    /* Each level updates its elements in place, 'un' holds u(t+dt) for
+     * the levels already advanced and u(t) for the others */
+    un = u;
+
+    for (size_t l = 0; l < ctx.lts_cells.size(); l++)
     {
-        auto size = ctx.gDofs.size();
-        blaze::DynamicVector<T> k1(size);
-        blaze::DynamicVector<T> k2(size);
-        blaze::DynamicVector<T> k3(size);
-        blaze::DynamicVector<T> k4(size);
+        const auto& cells = ctx.lts_cells[l];
+        const auto& ghosts = ctx.lts_ghosts[l];
+        const T h = dt/(1 << l);
+
+        /* Values of the elements of the other levels at time t+tau */
+        auto fill_ghosts = [&](blaze::DynamicVector<T>& v, T tau) {
+            T theta = tau/dt;
+            ctx.pool->for_chunks(ghosts.size(),
+                [&](size_t, size_t begin, size_t end) {
+                    for (size_t g = begin; g < end; g++)
+                    {
+                        auto cell_i = ghosts[g];
+                        auto base = size*cell_i;
+                        bool coarser = ctx.lts_level[cell_i] < l;
+                        for (size_t i = 0; i < size; i++)
+                        {
+                            auto j = base+i;
+                            T val = u[j] + tau*dudt[j];
+                            if (coarser)
+                                val += theta*theta*(un[j] - u[j] - dt*dudt[j]);
+                            else
+                                val += 0.5*tau*tau*d2udt2[j];
+                            v[j] = val;
+                        }
+                    }
+                });
+        };
 
-        apply_operator(ctx.gDofs, k1);
+        /* Same as the global RK4, restricted to the elements of the level */
+        auto stage = [&](const blaze::DynamicVector<T>& in, bool init, T acc_w,
+                         blaze::DynamicVector<T> *next, T next_w) {
+            detail::fused_operator_apply(ctx, cells, in, [&](size_t base, const T *k) {
+                for (size_t i = 0; i < size; i++)
+                    acc[base+i] = (init ? un[base+i] : acc[base+i]) + acc_w*k[i];
+
+                if (next)
+                    for (size_t i = 0; i < size; i++)
+                        (*next)[base+i] = un[base+i] + next_w*k[i];
+                else
+                    for (size_t i = 0; i < size; i++)
+                        un[base+i] = acc[base+i];
+            });
+        };
 
-        ctx.gDofs_t_plus_one = ctx.gDofs + (ctx.cfg.delta_t/2.)*k1; //2*(3*basis_size*msh.cells.size()) FLOPS
-        apply_operator(ctx.gDofs_t_plus_one, k2);
-        
-        ctx.gDofs_t_plus_one = ctx.gDofs + (ctx.cfg.delta_t/2.)*k2; //2*(3*basis_size*msh.cells.size()) FLOPS
-        apply_operator(ctx.gDofs_t_plus_one, k3);
-        
-        ctx.gDofs_t_plus_one = ctx.gDofs + (ctx.cfg.delta_t)*k3;    //2*(3*basis_size*msh.cells.size()) FLOPS
-        apply_operator(ctx.gDofs_t_plus_one, k4);
+        for (size_t step = 0; step < (size_t(1) << l); step++)
+        {
+            T tau = step*h;
+
+            for (auto& cell_i : cells)
+                for (size_t i = size*cell_i; i < size*(cell_i+1); i++)
+                    s0[i] = un[i];
+
+            fill_ghosts(s0, tau);
+            stage(s0, true, h/6., &s1, h/2.);
+            fill_ghosts(s1, tau + h/2.);
+            stage(s1, false, h/3., &s0, h/2.);
+            fill_ghosts(s0, tau + h/2.);
+            stage(s0, false, h/3., &s1, h);
+            fill_ghosts(s1, tau + h);
+            stage(s1, false, h/6., nullptr, 0.0);
+        }
+    }
+}
+
+/* Estimated FLOPS of a call to do_timestep(): the operator evaluations
+ * (2*basis_size^2 per sub-block) and the stage updates */
+template<typename Mesh>
+size_t
+timestep_flops(const maxwell_context<Mesh>& ctx)
+{
+    auto basis_size = ctx.basis_size;
+    auto [num_evals, update_flops] = detail::integrator_cost(ctx.cfg.time_integrator);
 
-        // 6 * (3*basis_size*msh.cells.size()) FLOPS
-        ctx.gDofs_t_plus_one = ctx.gDofs + ((1./6.) * ctx.cfg.delta_t) * (k1 + 2*(k2 + k3) + k4);
+    /* Element operator evaluations */
+    size_t cell_evals = num_evals*ctx.num_owned_cells();
+    if (ctx.lts_cells.size() > 1)
+    {
+        cell_evals = ctx.msh.cells.size() + ctx.lts_predicted.size();
+        for (size_t l = 0; l < ctx.lts_cells.size(); l++)
+            cell_evals += num_evals*(ctx.lts_cells[l].size() << l);
     }
 
-    auto ts_end_time = std::chrono::system_clock::now();
+    /* Evaluation of the whole operator */
+    size_t num_subblocks = 0;
+    for (auto& p : ctx.gOp_panels)
+        num_subblocks += p.num_in*p.num_out;
 
-    if ( LOGLEVEL_DETAIL(ctx.cfg.verbosity) )
+    size_t op_flops = 2*basis_size*basis_size*num_subblocks*ctx.gOp_neigh.size();
+
+    size_t totflops;
+    totflops  = op_flops*cell_evals/ctx.msh.cells.size(); //operator evaluation
+    totflops += update_flops*(3*basis_size)*cell_evals/num_evals; // stage updates
+    return totflops;
+}
+
+template<typename Mesh>
+void
+do_timestep(maxwell_context<Mesh>& ctx)
+{
+    using T = typename Mesh::coordinate_type;
+    auto basis_size = ctx.basis_size;
+    auto dt = ctx.cfg.delta_t;
+
+    auto& u = ctx.gDofs;
+    auto& un = ctx.gDofs_t_plus_one;
+
+    YAOURT_TIMED_SCOPE_VAR(ts_timer, "maxwell.timestep", LOGLEVEL_DETAIL(ctx.cfg.verbosity));
+
+    if (ctx.lts_cells.size() > 1)
+        do_local_timestep(ctx);
+    else switch (ctx.cfg.time_integrator)
     {
-        std::chrono::duration<double> tstime = ts_end_time - ts_start_time;
-        double time = tstime.count();
-        std::cout << "Timestep time: " << time << " seconds. ";
+        case time_integrator_type::EXPLICIT_EULER:
+            detail::owned_operator_apply(ctx, u, [&](size_t base, const T *k) {
+                for (size_t i = 0; i < 3*basis_size; i++)
+                    un[base+i] = u[base+i] + dt*k[i];
+            });
+            break;
+
+        case time_integrator_type::RUNGE_KUTTA_4: {
+            /* The solution at the next step is accumulated in 'un' while
+             * the stages are computed, the stage inputs alternate between
+             * s0 and s1. */
+            auto& s0 = ctx.gDofs_stage[0];
+            auto& s1 = ctx.gDofs_stage[1];
+
+            auto stage = [&](blaze::DynamicVector<T>& in, bool init, T acc_w,
+                             blaze::DynamicVector<T> *next, T next_w) {
+                detail::owned_operator_apply(ctx, in, [&](size_t base, const T *k) {
+                    for (size_t i = 0; i < 3*basis_size; i++)
+                        un[base+i] = (init ? u[base+i] : un[base+i]) + acc_w*k[i];
+
+                    if (next)
+                        for (size_t i = 0; i < 3*basis_size; i++)
+                            (*next)[base+i] = u[base+i] + next_w*k[i];
+                });
+            };
 
-        size_t totflops;
-        totflops  = 4*(2*(3*basis_size)*(3*basis_size)*(ctx.faces_per_elem()+1))*ctx.msh.cells.size(); //operator evaluation
-        totflops += 12*(3*basis_size*ctx.msh.cells.size()); // RK4 vector-scalar multiplications
+            stage(u, true, dt/6., &s0, dt/2.);
+            stage(s0, false, dt/3., &s1, dt/2.);
+            stage(s1, false, dt/3., &s0, dt);
+            stage(s0, false, dt/6., nullptr, 0.0);
+            } break;
+
+        case time_integrator_type::SSP_RUNGE_KUTTA_3: {
+            /* Each stage computes out = a*u + b*(in + dt*L(in)) */
+            auto stage = [&](blaze::DynamicVector<T>& in,
+                             blaze::DynamicVector<T>& out, T a, T b) {
+                detail::owned_operator_apply(ctx, in, [&](size_t base, const T *k) {
+                    for (size_t i = 0; i < 3*basis_size; i++)
+                        out[base+i] = a*u[base+i] + b*(in[base+i] + dt*k[i]);
+                });
+            };
+
+            auto& s0 = ctx.gDofs_stage[0];
+            stage(u, un, 0.0, 1.0);
+            stage(un, s0, 3./4., 1./4.);
+            stage(s0, un, 1./3., 2./3.);
+            } break;
 
-        std::cout << "Estimated performance: " << double(totflops)/time << std::endl;
+        case time_integrator_type::LOW_STORAGE_RK_4: {
+            /* 2N storage: the increment du = A*du + dt*L(u) is fused with
+             * the operator, the solution is updated in place once all the
+             * elements have been evaluated. */
+            using coeffs = detail::lsrk45_coefficients<T>;
+            auto& du = ctx.gDofs_stage[0];
+
+            for (size_t s = 0; s < coeffs::stages; s++)
+            {
+                auto a = coeffs::A[s];
+                detail::owned_operator_apply(ctx, u, [&](size_t base, const T *k) {
+                    for (size_t i = 0; i < 3*basis_size; i++)
+                        du[base+i] = (s == 0 ? 0.0 : a*du[base+i]) + dt*k[i];
+                });
+
+                detail::parallel_axpy(*ctx.pool, coeffs::B[s], du, ctx.gDofs);
+            }
+            } break;
+    }
+
+    if ( LOGLEVEL_DETAIL(ctx.cfg.verbosity) )
+    {
+        double time = ts_timer.elapsed();
+        std::cout << "Timestep time: " << time << " seconds. ";
+        std::cout << "Estimated performance: " << double(timestep_flops(ctx))/time << std::endl;
     }
 
-    swap(ctx.gDofs_t_plus_one, ctx.gDofs);
+    /* The low-storage scheme updates the solution in place */
+    if (ctx.cfg.time_integrator != time_integrator_type::LOW_STORAGE_RK_4)
+        swap(ctx.gDofs_t_plus_one, ctx.gDofs);
 }
 
 #ifdef USE_REFERENCE_SIMPLEX
@@ -0,0 +1,492 @@
+/*
+ * Yaourt-FEM-DG - Yet AnOther Useful Resource for Teaching FEM and DG.
+ *
+ * Matteo Cicuttin (C) 2019-2022
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <blaze/Math.h>
+
+#include "core/mesh.hpp"
+#include "core/parallel.hpp"
+#include "core/instrumentation.hpp"
+
+/* Tell the compiler that the iterations of the next loop are independent:
+ * the faces of a colour have no cell in common, so their scatters do not
+ * conflict and the loop can be vectorized */
+#if defined(__clang__)
+#define YAOURT_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define YAOURT_IVDEP _Pragma("GCC ivdep")
+#else
+#define YAOURT_IVDEP
+#endif
+
+namespace yaourt {
+namespace fvol {
+
+/* Columns of the acoustic fields */
+enum : size_t {
+    FIELD_VX = 0,
+    FIELD_VY = 1,
+    FIELD_P  = 2
+};
+
+/* The acoustic fields (vx, vy, p), one row per cell. The storage is by
+ * columns: the values of each field are contiguous. */
+template<typename T>
+using acoustics_fields = blaze::DynamicMatrix<T, blaze::columnMajor>;
+
+template<typename T>
+struct field_energies
+{
+    T   Wvx;
+    T   Wvy;
+    T   Wp;
+};
+
+/* Finite volume operator of the acoustic wave equation on the cell
+ * averages, with centered fluxes plus 'alpha' times the jumps and all the
+ * boundaries treated as p = 0. The geometry of the faces is computed once
+ * in the constructor, the operator is then evaluated face by face: each
+ * interior face computes its flux once and adds it to its two cells.
+ *
+ * The faces are coloured so that the faces of a colour have no cell in
+ * common: a colour is processed in parallel and vectorized without write
+ * conflicts. With a partitioned mesh only the first 'num_owned' cells are
+ * computed, the faces between them are processed before the ones that
+ * need the values of the ghost cells. Each apply() is a single run of a
+ * thread pool kept by the operator, with a barrier after each colour. */
+template<typename Mesh>
+class acoustics_operator
+{
+    using T = typename Mesh::coordinate_type;
+
+    /* Faces between two cells, 'l' and 'r'. The unit normal (nx, ny) goes
+     * from 'l' to 'r', cl and cr are half the face length divided by the
+     * areas of 'l' and 'r'. colours[c] is the first face of colour c. */
+    struct interior_faces
+    {
+        std::vector<size_t>     l, r;
+        std::vector<T>          nx, ny, cl, cr;
+        std::vector<size_t>     colours;
+    };
+
+    /* Boundary faces of each 'cell', c is the face length divided by the
+     * area of the cell */
+    struct boundary_faces
+    {
+        std::vector<size_t>     cell;
+        std::vector<T>          nx, ny, c;
+        std::vector<size_t>     colours;
+    };
+
+    interior_faces      owned_faces, ghost_faces;
+    boundary_faces      bnd_faces;
+    std::vector<T>      areas;
+    size_t              num_owned;
+    T                   alpha;
+
+    /* Shared by the copies of the operator, never applied concurrently */
+    std::shared_ptr<thread_pool>    pool;
+
+    /* Greedy colouring of the faces with the cells 'l' and 'r' ('r' may
+     * be NO_OWNER). Returns the colour of each face, the number of colours
+     * is at most twice the number of faces of a cell. */
+    static std::vector<size_t>
+    colour_faces(size_t num_cells, const std::vector<size_t>& l,
+                 const std::vector<size_t>& r, size_t& num_colours)
+    {
+        std::vector<uint32_t> used(num_cells, 0);
+        std::vector<size_t> colour( l.size() );
+
+        num_colours = 0;
+        for (size_t i = 0; i < l.size(); i++)
+        {
+            uint32_t taken = used[ l[i] ];
+            if (r[i] != NO_OWNER)
+                taken |= used[ r[i] ];
+
+            size_t c = 0;
+            while (c < 32 and (taken & (uint32_t(1) << c)))
+                c++;
+
+            if (c == 32)
+                throw std::logic_error("acoustics_operator: too many face colours");
+
+            colour[i] = c;
+            used[ l[i] ] |= uint32_t(1) << c;
+            if (r[i] != NO_OWNER)
+                used[ r[i] ] |= uint32_t(1) << c;
+            num_colours = std::max(num_colours, c+1);
+        }
+
+        return colour;
+    }
+
+    /* Stable sort of the faces by colour: the faces keep the mesh order,
+     * and so its locality, inside their colour */
+    static std::vector<size_t>
+    sort_by_colour(const std::vector<size_t>& colour, size_t num_colours,
+                   std::vector<size_t>& offsets)
+    {
+        offsets.assign(num_colours+1, 0);
+        for (auto c : colour)
+            offsets[c+1]++;
+        for (size_t c = 0; c < num_colours; c++)
+            offsets[c+1] += offsets[c];
+
+        std::vector<size_t> pos(offsets.begin(), offsets.end()-1);
+        std::vector<size_t> order( colour.size() );
+        for (size_t i = 0; i < colour.size(); i++)
+            order[ pos[colour[i]]++ ] = i;
+
+        return order;
+    }
+
+    static void
+    make_interior_faces(const Mesh& msh, const std::vector<T>& areas,
+                        const std::vector<size_t>& fcids, interior_faces& ifs)
+    {
+        std::vector<size_t> l, r;
+        for (auto fcid : fcids)
+        {
+            l.push_back( msh.face_owners[fcid][0] );
+            r.push_back( msh.face_owners[fcid][1] );
+        }
+
+        size_t num_colours;
+        auto colour = colour_faces(msh.cells.size(), l, r, num_colours);
+        auto order = sort_by_colour(colour, num_colours, ifs.colours);
+
+        for (auto i : order)
+        {
+            const auto& fc = msh.faces[ fcids[i] ];
+            auto hf = measure(msh, fc);
+            auto n = normal(msh, msh.cells[ l[i] ], fc);
+
+            ifs.l.push_back( l[i] );
+            ifs.r.push_back( r[i] );
+            ifs.nx.push_back( n[0] );
+            ifs.ny.push_back( n[1] );
+            ifs.cl.push_back( 0.5*hf/areas[ l[i] ] );
+            ifs.cr.push_back( 0.5*hf/areas[ r[i] ] );
+        }
+    }
+
+    static void
+    make_boundary_faces(const Mesh& msh, const std::vector<T>& areas,
+                        const std::vector<size_t>& fcids,
+                        const std::vector<size_t>& cells, boundary_faces& bfs)
+    {
+        std::vector<size_t> none(cells.size(), NO_OWNER);
+        size_t num_colours;
+        auto colour = colour_faces(msh.cells.size(), cells, none, num_colours);
+        auto order = sort_by_colour(colour, num_colours, bfs.colours);
+
+        for (auto i : order)
+        {
+            const auto& fc = msh.faces[ fcids[i] ];
+            auto n = normal(msh, msh.cells[ cells[i] ], fc);
+
+            bfs.cell.push_back( cells[i] );
+            bfs.nx.push_back( n[0] );
+            bfs.ny.push_back( n[1] );
+            bfs.c.push_back( measure(msh, fc)/areas[ cells[i] ] );
+        }
+    }
+
+    /* Energies of the owned cells of the chunk 'tid' of 'in' */
+    field_energies<T>
+    cell_energies(size_t tid, const acoustics_fields<T>& in) const
+    {
+        const size_t sin = in.spacing();
+        const T *ivx = in.data(), *ivy = ivx + sin, *ip = ivy + sin;
+        const T *area = areas.data();
+
+        auto range = chunk_range(areas.size(), pool->size(), tid);
+        T wvx = 0.0, wvy = 0.0, wp = 0.0;
+        for (size_t i = range.first; i < std::min(range.second, num_owned); i++)
+        {
+            wvx += 0.5*ivx[i]*ivx[i]*area[i];
+            wvy += 0.5*ivy[i]*ivy[i]*area[i];
+            wp  += 0.5*ip[i]*ip[i]*area[i];
+        }
+
+        return field_energies<T>{wvx, wvy, wp};
+    }
+
+    static field_energies<T>
+    sum_energies(const std::vector<field_energies<T>>& partial)
+    {
+        field_energies<T> fe{0.0, 0.0, 0.0};
+        for (auto& p : partial)
+        {
+            fe.Wvx += p.Wvx;
+            fe.Wvy += p.Wvy;
+            fe.Wp += p.Wp;
+        }
+
+        return fe;
+    }
+
+    /* Zero the chunk 'tid' of 'out' and, if asked, compute the energies of
+     * its owned cells of 'in' */
+    field_energies<T>
+    cell_pass(size_t tid, const acoustics_fields<T>& in, acoustics_fields<T>& out,
+              bool energies) const
+    {
+        const size_t sout = out.spacing();
+        T *ovx = out.data(), *ovy = ovx + sout, *op = ovy + sout;
+
+        auto range = chunk_range(areas.size(), pool->size(), tid);
+        for (size_t i = range.first; i < range.second; i++)
+        {
+            ovx[i] = 0.0;
+            ovy[i] = 0.0;
+            op[i] = 0.0;
+        }
+
+        if (not energies)
+            return field_energies<T>{0.0, 0.0, 0.0};
+
+        return cell_energies(tid, in);
+    }
+
+    /* Chunk 'tid' of each colour of 'ifs', all the threads wait for the
+     * others at the end of each colour */
+    void face_pass(size_t tid, thread_barrier& barrier, const interior_faces& ifs,
+                   const acoustics_fields<T>& in, acoustics_fields<T>& out) const
+    {
+        const size_t sin = in.spacing(), sout = out.spacing();
+        const T *ivx = in.data(), *ivy = ivx + sin, *ip = ivy + sin;
+        T *ovx = out.data(), *ovy = ovx + sout, *op = ovy + sout;
+        const size_t *fl = ifs.l.data(), *fr = ifs.r.data();
+        const T *fnx = ifs.nx.data(), *fny = ifs.ny.data();
+        const T *fcl = ifs.cl.data(), *fcr = ifs.cr.data();
+        const T a = alpha;
+
+        for (size_t c = 0; c+1 < ifs.colours.size(); c++)
+        {
+            auto first = ifs.colours[c];
+            auto range = chunk_range(ifs.colours[c+1] - first, pool->size(), tid);
+
+            YAOURT_IVDEP
+            for (size_t f = first+range.first; f < first+range.second; f++)
+            {
+                auto l = fl[f];
+                auto r = fr[f];
+
+                T svx = ivx[l] + ivx[r];
+                T svy = ivy[l] + ivy[r];
+                T sp  = ip[l] + ip[r];
+                T jvx = ivx[l] - ivx[r];
+                T jvy = ivy[l] - ivy[r];
+                T jp  = ip[l] - ip[r];
+
+                T flux_vx = fnx[f]*sp + a*jvx;
+                T flux_vy = fny[f]*sp + a*jvy;
+                T flux_p  = fnx[f]*svx + fny[f]*svy + a*jp;
+
+                ovx[l] -= fcl[f]*flux_vx;
+                ovy[l] -= fcl[f]*flux_vy;
+                op[l]  -= fcl[f]*flux_p;
+                ovx[r] += fcr[f]*flux_vx;
+                ovy[r] += fcr[f]*flux_vy;
+                op[r]  += fcr[f]*flux_p;
+            }
+
+            barrier.wait();
+        }
+    }
+
+    void boundary_pass(size_t tid, thread_barrier& barrier,
+                       const acoustics_fields<T>& in, acoustics_fields<T>& out) const
+    {
+        const size_t sin = in.spacing(), sout = out.spacing();
+        const T *ivx = in.data(), *ivy = ivx + sin, *ip = ivy + sin;
+        T *op = out.data() + 2*sout;
+        const size_t *fcell = bnd_faces.cell.data();
+        const T *fnx = bnd_faces.nx.data(), *fny = bnd_faces.ny.data();
+        const T *fc = bnd_faces.c.data();
+        const T a = alpha;
+
+        for (size_t c = 0; c+1 < bnd_faces.colours.size(); c++)
+        {
+            auto first = bnd_faces.colours[c];
+            auto range = chunk_range(bnd_faces.colours[c+1] - first, pool->size(), tid);
+
+            YAOURT_IVDEP
+            for (size_t f = first+range.first; f < first+range.second; f++)
+            {
+                auto i = fcell[f];
+                op[i] -= fc[f]*( fnx[f]*ivx[i] + fny[f]*ivy[i] + a*ip[i] );
+            }
+
+            barrier.wait();
+        }
+    }
+
+public:
+    acoustics_operator()
+        : num_owned(0), alpha(1.0), pool(std::make_shared<thread_pool>(1))
+    {}
+
+    /* The cells from 'p_num_owned' on are ghosts: their rows of the result
+     * are not meaningful. */
+    acoustics_operator(Mesh& msh, size_t p_num_owned, T p_alpha = 1.0,
+                       size_t p_num_threads = 1)
+        : num_owned(p_num_owned), alpha(p_alpha),
+          pool(std::make_shared<thread_pool>(p_num_threads))
+    {
+        if ( !msh.has_connectivity() )
+            msh.compute_connectivity();
+
+        if (num_owned > msh.cells.size())
+            throw std::invalid_argument("acoustics_operator: too many owned cells");
+
+        areas.resize( msh.cells.size() );
+        for (size_t i = 0; i < msh.cells.size(); i++)
+            areas[i] = measure(msh, msh.cells[i]);
+
+        std::vector<size_t> owned, ghost, bnd, bnd_cells;
+        for (size_t fcid = 0; fcid < msh.faces.size(); fcid++)
+        {
+            const auto& fo = msh.face_owners[fcid];
+            bool own0 = fo[0] < num_owned;
+            bool own1 = fo[1] != NO_OWNER and fo[1] < num_owned;
+
+            /* Single owner: a boundary face, or a face of a ghost cell
+             * towards the cells out of the local mesh */
+            if (fo[1] == NO_OWNER)
+            {
+                if (own0)
+                {
+                    bnd.push_back(fcid);
+                    bnd_cells.push_back(fo[0]);
+                }
+                continue;
+            }
+
+            if (own0 and own1)
+                owned.push_back(fcid);
+            else if (own0 or own1)
+                ghost.push_back(fcid);
+        }
+
+        make_interior_faces(msh, areas, owned, owned_faces);
+        make_interior_faces(msh, areas, ghost, ghost_faces);
+        make_boundary_faces(msh, areas, bnd, bnd_cells, bnd_faces);
+    }
+
+    acoustics_operator(Mesh& msh, T p_alpha = 1.0, size_t p_num_threads = 1)
+        : acoustics_operator(msh, msh.cells.size(), p_alpha, p_num_threads)
+    {}
+
+    size_t num_colours() const
+    {
+        auto nc = [](const std::vector<size_t>& colours) {
+            return colours.empty() ? 0 : colours.size()-1;
+        };
+
+        return std::max({nc(owned_faces.colours), nc(ghost_faces.colours),
+                         nc(bnd_faces.colours)});
+    }
+
+    /* out = operator applied to 'in'. If 'fe' is not null the energies of
+     * the owned cells of 'in' are stored there, in the same pass that
+     * clears 'out'. The ghost values of 'in' are read only after
+     * wait_ghosts() returns: with a partitioned mesh it completes the halo
+     * exchange, which so overlaps the faces between the owned cells. It is
+     * called by the calling thread, the thread 0 of the pool. */
+    template<typename WaitGhosts>
+    void apply(const acoustics_fields<T>& in, acoustics_fields<T>& out,
+               field_energies<T> *fe, const WaitGhosts& wait_ghosts) const
+    {
+        if (in.rows() != areas.size() or in.columns() != 3)
+            throw std::invalid_argument("acoustics_operator: wrong field size");
+
+        YAOURT_TIMED_SCOPE_VAR(op_timer, "fvol.operator", false);
+        op_timer.add_bytes(2*in.rows()*3*sizeof(T));
+
+        out.resize(in.rows(), 3, false);
+
+        thread_barrier barrier( pool->size() );
+        std::vector<field_energies<T>> partial( pool->size() );
+        std::exception_ptr ghost_error;
+
+        pool->run([&](size_t tid) {
+            partial[tid] = cell_pass(tid, in, out, fe != nullptr);
+            barrier.wait();
+
+            boundary_pass(tid, barrier, in, out);
+            face_pass(tid, barrier, owned_faces, in, out);
+
+            /* The other threads must reach the barrier also if it throws */
+            if (tid == 0)
+            {
+                try {
+                    wait_ghosts();
+                }
+                catch (...) {
+                    ghost_error = std::current_exception();
+                }
+            }
+            barrier.wait();
+
+            if (not ghost_error)
+                face_pass(tid, barrier, ghost_faces, in, out);
+        });
+
+        if (ghost_error)
+            std::rethrow_exception(ghost_error);
+
+        if (fe)
+            *fe = sum_energies(partial);
+    }
+
+    void apply(const acoustics_fields<T>& in, acoustics_fields<T>& out,
+               field_energies<T> *fe = nullptr) const
+    {
+        apply(in, out, fe, [](){});
+    }
+
+    /* Energies of the owned cells of 'in', for the states that are not
+     * the input of an apply() */
+    field_energies<T> energies(const acoustics_fields<T>& in) const
+    {
+        if (in.rows() != areas.size() or in.columns() != 3)
+            throw std::invalid_argument("acoustics_operator: wrong field size");
+
+        std::vector<field_energies<T>> partial( pool->size() );
+        pool->run([&](size_t tid) {
+            partial[tid] = cell_energies(tid, in);
+        });
+
+        return sum_energies(partial);
+    }
+};
+
+} // namespace fvol
+} // namespace yaourt
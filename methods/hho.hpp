@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 
 #include "core/mesh.hpp"
@@ -29,6 +31,9 @@
 #include "blaze/Math.h"
 
 #include "core/blaze_sparse_init.hpp"
+#include "core/solvers.hpp"
+#include "core/parallel.hpp"
+#include "core/batched_la.hpp"
 
 template<bool mixed>
 struct hho_flavour {
@@ -153,18 +158,23 @@ make_hho_gradient_reconstruction(const Mesh& msh,
     blaze::DynamicMatrix<T> K(rbs, rbs, 0.0);
     blaze::DynamicMatrix<T> oper_lhs(rbs-1, rbs-1, 0.0);
     blaze::DynamicMatrix<T> oper_rhs(rbs-1, cbs + nf*fbs, 0.0);
+
+    /* Scratch space for the basis evaluations */
+    blaze::DynamicVector<T> f_phi(fbs), c_phi(cbs);
+    blaze::DynamicMatrix<T> r_dphi(rbs, 2);
     
     auto qps = yaourt::quadratures::integrate(msh, cl, 2*(rd-1));
     for (auto& qp : qps)
     {
         auto ep   = qp.point();
-        auto r_dphi = rbasis.eval_grads(ep);
+        rbasis.eval_grads(ep, r_dphi);
         K += qp.weight() * r_dphi * trans(r_dphi);
     }
     
     submatrix(oper_lhs, 0, 0, rbs-1, rbs-1) = submatrix(K, 1, 1, rbs-1, rbs-1);
     submatrix(oper_rhs, 0, 0, rbs-1, cbs) = submatrix(K, 1, 0, rbs-1, cbs);
     
+    std::vector<yaourt::quadratures::quadrature_point<T,2>> fqps;
     for (size_t fc_i = 0; fc_i < nf; fc_i++)
     {
         size_t ofs = cbs + fc_i*fbs;
@@ -172,13 +182,13 @@ make_hho_gradient_reconstruction(const Mesh& msh,
         auto fbasis = yaourt::bases::make_basis(msh, fc, fd);
         auto n = normal(msh, cl, fc);
 
-        auto fqps = yaourt::quadratures::integrate(msh, fc, (rd-1)+std::max(cd,fd));
+        yaourt::quadratures::integrate(msh, fc, (rd-1)+std::max(cd,fd), fqps);
         for (auto& fqp : fqps)
         {
             auto ep         = fqp.point();
-            auto f_phi      = fbasis.eval(ep);
-            auto c_phi      = cbasis.eval(ep);
-            auto r_dphi     = rbasis.eval_grads(ep);
+            fbasis.eval(ep, f_phi);
+            cbasis.eval(ep, c_phi);
+            rbasis.eval_grads(ep, r_dphi);
             auto r_dphi_n2  = r_dphi * n;
             auto r_dphi_n   = subvector(r_dphi_n2, 1, rbs-1);
             
@@ -190,7 +200,7 @@ make_hho_gradient_reconstruction(const Mesh& msh,
         }
     }
     
-    blaze::DynamicMatrix<T> GR = blaze::solve_LU(oper_lhs, oper_rhs);
+    blaze::DynamicMatrix<T> GR = yaourt::cholesky_factor<T>(oper_lhs).solve(oper_rhs);
     blaze::DynamicMatrix<T> A = trans(oper_rhs) * GR;
 
     return std::make_pair(GR, A); 
@@ -220,7 +230,11 @@ make_hho_stabilization(const Mesh& msh,
     
     blaze::DynamicMatrix<T> oper(cbs + nf*fbs, cbs + nf*fbs, 0.0);
     auto ht = diameter(msh, cl);
+
+    /* Scratch space for the basis evaluations */
+    blaze::DynamicVector<T> f_phi(fbs), c_phi(cbs);
     
+    std::vector<yaourt::quadratures::quadrature_point<T,2>> fqps;
     for (size_t fc_i = 0; fc_i < nf; fc_i++)
     {
         size_t ofs = cbs + fc_i*fbs;
@@ -235,18 +249,18 @@ make_hho_stabilization(const Mesh& msh,
         
         auto fbasis = yaourt::bases::make_basis(msh, fc, fd);
 
-        auto fqps = yaourt::quadratures::integrate(msh, fc, cd+fd);
+        yaourt::quadratures::integrate(msh, fc, cd+fd, fqps);
         for (auto& fqp : fqps)
         {
             auto ep     = fqp.point();
-            auto f_phi  = fbasis.eval(ep);
-            auto c_phi  = cbasis.eval(ep);
+            fbasis.eval(ep, f_phi);
+            cbasis.eval(ep, c_phi);
             
             mass    += fqp.weight() * f_phi * trans(f_phi);
             trace   += fqp.weight() * f_phi * trans(c_phi);
         }
         
-        submatrix(oper_rhs, 0, 0, fbs, cbs) = blaze::solve_LU(mass, trace);
+        submatrix(oper_rhs, 0, 0, fbs, cbs) = yaourt::cholesky_factor<T>(mass).solve(trace);
         
         oper += trans(oper_rhs) * mass * oper_rhs / ht;
     }
@@ -283,11 +297,14 @@ make_hho_stabilization(const Mesh& msh,
     blaze::DynamicMatrix<T> oper(cbs + nf*fbs, cbs + nf*fbs, 0.0);
     auto ht = diameter(msh, cl);
     
+    /* Scratch space for the basis evaluations */
+    blaze::DynamicVector<T> f_phi(fbs), r_phi(rbs);
+
     blaze::DynamicMatrix<T> CT(cbs, rbs, 0.0);
     auto qps = yaourt::quadratures::integrate(msh, cl, cd+rd);
     for (auto& qp : qps)
     {
-        auto r_phi = rbasis.eval(qp.point());
+        rbasis.eval(qp.point(), r_phi);
         auto c_phi = subvector(r_phi, 0, cbs);
         CT += qp.weight() * c_phi * trans(r_phi);
     }
@@ -296,9 +313,10 @@ make_hho_stabilization(const Mesh& msh,
     blaze::DynamicMatrix<T> Cmass  = submatrix(CT, 0, 0, cbs, cbs);
     
     blaze::DynamicMatrix<T> evR = -evalRC * R;
-    blaze::DynamicMatrix<T> projRT = blaze::solve_LU(Cmass, evR);
+    blaze::DynamicMatrix<T> projRT = yaourt::cholesky_factor<T>(Cmass).solve(evR);
     submatrix(projRT, 0, 0, cbs, cbs) += blaze::IdentityMatrix<T>(cbs);
     
+    std::vector<yaourt::quadratures::quadrature_point<T,2>> fqps;
     for (size_t fc_i = 0; fc_i < nf; fc_i++)
     {
         size_t ofs = cbs + fc_i*fbs;
@@ -309,12 +327,12 @@ make_hho_stabilization(const Mesh& msh,
         
         auto fbasis = yaourt::bases::make_basis(msh, fc, fd);
 
-        auto fqps = yaourt::quadratures::integrate(msh, fc, rd+fd);
+        yaourt::quadratures::integrate(msh, fc, rd+fd, fqps);
         for (auto& fqp : fqps)
         {
             auto ep     = fqp.point();
-            auto f_phi  = fbasis.eval(ep);
-            auto r_phi  = rbasis.eval(ep);
+            fbasis.eval(ep, f_phi);
+            rbasis.eval(ep, r_phi);
             
             Fmass   += fqp.weight() * f_phi * trans(f_phi);
             Ftrace  += fqp.weight() * f_phi * trans(r_phi);
@@ -323,7 +341,7 @@ make_hho_stabilization(const Mesh& msh,
         blaze::DynamicMatrix<T> F = submatrix(Ftrace, 0, 1, fbs, rbs-1)*R;
         F += submatrix(Ftrace, 0, 0, fbs, cbs)*projRT;
         
-        oper_rhs = blaze::solve_LU(Fmass, F);
+        oper_rhs = yaourt::cholesky_factor<T>(Fmass).solve(F);
         
         auto I = blaze::IdentityMatrix<T>(fbs);
         submatrix(oper_rhs, 0, ofs, fbs, fbs) -= I;
@@ -334,11 +352,27 @@ make_hho_stabilization(const Mesh& msh,
     return oper;
 }
 
+/* What static_decondensation() needs of the condensation of a cell: the
+ * LU factors of ATT as computed by getrf(), ATF and bT. Keeping them
+ * avoids factorizing ATT again to recover the cell unknowns. */
+template<typename T>
+struct hho_condensation_data
+{
+    blaze::DynamicMatrix<T>     ATT_LU;
+    std::vector<int>            ipiv;
+    blaze::DynamicMatrix<T>     ATF;
+    blaze::DynamicVector<T>     bT;
+};
+
+/* Eliminate the cell unknowns of the local system [ATT ATF; AFT AFF], ATT
+ * is factorized once for all the right hand sides. Returns the system of
+ * the face unknowns, the factorization is stored in 'cdata'. */
 template<typename T>
 auto
 static_condensation(const hho_degree_info& hdi,
                     const blaze::DynamicMatrix<T>& A,
-                    const blaze::DynamicVector<T>& b)
+                    const blaze::DynamicVector<T>& b,
+                    hho_condensation_data<T>& cdata)
 {
     using matr = blaze::DynamicMatrix<T>;
     using vect = blaze::DynamicVector<T>;
@@ -350,16 +384,25 @@ static_condensation(const hho_degree_info& hdi,
     auto cbs = yaourt::bases::scalar_basis_size(cd, 2);
     auto rs = A.rows() - cbs;
 
-    matr ATT = submatrix(A,   0,   0, cbs, cbs);
-    matr ATF = submatrix(A,   0, cbs, cbs,  rs);
-    auto AFT = submatrix(A, cbs,   0,  rs, cbs);
-    auto AFF = submatrix(A, cbs, cbs,  rs,  rs);
+    cdata.ATT_LU = submatrix(A,   0,   0, cbs, cbs);
+    cdata.ATF    = submatrix(A,   0, cbs, cbs,  rs);
+    auto AFT     = submatrix(A, cbs,   0,  rs, cbs);
+    auto AFF     = submatrix(A, cbs, cbs,  rs,  rs);
+
+    cdata.bT = subvector(b,   0, cbs);
+    auto bF  = subvector(b, cbs,  rs);
+
+    cdata.ipiv.resize(cbs);
+    blaze::getrf(cdata.ATT_LU, cdata.ipiv.data());
 
-    vect bT = subvector(b,   0, cbs);
-    auto bF = subvector(b, cbs,  rs);
+    /* Same as solve_LU(): getrs() solves for the rows of a row-major
+     * right hand side */
+    matr ALt = trans(cdata.ATF);
+    blaze::getrs(cdata.ATT_LU, ALt, 'N', cdata.ipiv.data());
+    matr AL = trans(ALt);
 
-    matr AL = blaze::solve_LU(ATT, ATF);
-    vect bL = blaze::solve_LU(ATT, bT);
+    vect bL = cdata.bT;
+    blaze::getrs(cdata.ATT_LU, bL, 'N', cdata.ipiv.data());
 
     matr AC = AFF - AFT * AL;
     vect bC = bF - AFT * bL;
@@ -367,6 +410,16 @@ static_condensation(const hho_degree_info& hdi,
     return std::make_pair(AC, bC);
 }
 
+template<typename T>
+auto
+static_condensation(const hho_degree_info& hdi,
+                    const blaze::DynamicMatrix<T>& A,
+                    const blaze::DynamicVector<T>& b)
+{
+    hho_condensation_data<T> cdata;
+    return static_condensation(hdi, A, b, cdata);
+}
+
 template<typename T>
 blaze::DynamicVector<T>
 static_decondensation_impl(const hho_degree_info& hdi,
@@ -391,4 +444,248 @@ static_decondensation_impl(const hho_degree_info& hdi,
     subvector(ret, cbs, rs) = solF;
 
     return ret;
-}
\ No newline at end of file
+}
+
+/* Recover all the unknowns of a cell from its face unknowns, with the
+ * factorization kept by static_condensation() */
+template<typename T>
+blaze::DynamicVector<T>
+static_decondensation(const hho_condensation_data<T>& cdata,
+                      const blaze::DynamicVector<T>& solF)
+{
+    using vect = blaze::DynamicVector<T>;
+
+    auto cbs = cdata.bT.size();
+
+    vect solT = cdata.bT - cdata.ATF*solF;
+    blaze::getrs(cdata.ATT_LU, solT, 'N', cdata.ipiv.data());
+
+    vect ret( cbs + solF.size() );
+    subvector(ret, 0, cbs)           = solT;
+    subvector(ret, cbs, solF.size()) = solF;
+
+    return ret;
+}
+
+/* Assembler of the condensed HHO systems. The unknowns are the ones of the
+ * faces not on the boundary, the Dirichlet data is imposed strongly on the
+ * boundary faces and moved to the right hand side. As in the DG assembler
+ * the cells can be assembled concurrently by up to 'num_threads' threads,
+ * each one with its own buffers; here the right hand side is also split,
+ * because the rows of a face belong to two cells. */
+template<typename Mesh>
+class hho_assembler
+{
+    using T = typename Mesh::coordinate_type;
+    using triplet_type = blaze::triplet<T>;
+
+    std::vector<std::vector<triplet_type>>  triplets;
+    std::vector<blaze::DynamicVector<T>>    rhs_parts;
+
+    /* First unknown of each face, NO_OWNER on the boundary */
+    std::vector<size_t>     face_dof;
+
+    hho_degree_info         hdi;
+    size_t                  sys_size, fbs, num_threads;
+
+public:
+    blaze::CompressedMatrix<T>  lhs;
+    blaze::DynamicVector<T>     rhs;
+
+    /* Needs the mesh connectivity */
+    hho_assembler(const Mesh& msh, const hho_degree_info& p_hdi,
+                  size_t nthreads = 1)
+        : hdi(p_hdi), sys_size(0)
+    {
+        if ( !msh.has_connectivity() )
+            throw std::logic_error("No connectivity information.");
+
+        if ( !msh.hanging_faces.empty() )
+            throw std::invalid_argument("hho_assembler: nonconforming meshes not supported");
+
+        fbs = yaourt::bases::scalar_basis_size(hdi.face_degree(), 1);
+        num_threads = std::max<size_t>(nthreads, 1);
+
+        face_dof.resize( msh.faces.size() );
+        for (size_t i = 0; i < msh.faces.size(); i++)
+        {
+            if (msh.faces[i].is_boundary)
+            {
+                face_dof[i] = NO_OWNER;
+                continue;
+            }
+
+            face_dof[i] = sys_size;
+            sys_size += fbs;
+        }
+
+        triplets.resize(num_threads);
+        rhs_parts.assign(num_threads, blaze::DynamicVector<T>(sys_size, 0.0));
+        lhs.resize(sys_size, sys_size);
+        rhs.resize(sys_size);
+    }
+
+    /* Projection of the Dirichlet data on the boundary faces of a cell,
+     * zero on the other faces, in the layout of the face unknowns */
+    template<typename Function>
+    blaze::DynamicVector<T>
+    dirichlet_data(const Mesh& msh, size_t cl_id, const Function& g) const
+    {
+        const auto& fcids = face_ids(msh, cl_id);
+        blaze::DynamicVector<T> ret(fcids.size() * fbs, 0.0);
+
+        for (size_t fc_i = 0; fc_i < fcids.size(); fc_i++)
+        {
+            const auto& fc = msh.faces[ fcids[fc_i] ];
+            if (!fc.is_boundary)
+                continue;
+
+            auto fb = yaourt::bases::make_basis(msh, fc, hdi.face_degree());
+            subvector(ret, fc_i*fbs, fbs) = project(msh, fc, fb, g);
+        }
+
+        return ret;
+    }
+
+    /* Assemble the condensed system of the cell 'cl_id', 'dirichlet' as
+     * given by dirichlet_data() */
+    template<typename MT, typename VT>
+    void assemble(const Mesh& msh, size_t cl_id, const MT& AC, const VT& bC,
+                  const blaze::DynamicVector<T>& dirichlet,
+                  size_t thread_id = 0)
+    {
+        if ( thread_id >= num_threads )
+            throw std::invalid_argument("Invalid thread id");
+
+        auto& trip = triplets[thread_id];
+        auto& lrhs = rhs_parts[thread_id];
+
+        const auto& fcids = face_ids(msh, cl_id);
+        for (size_t fi = 0; fi < fcids.size(); fi++)
+        {
+            auto row_ofs = face_dof[ fcids[fi] ];
+            if (row_ofs == NO_OWNER)
+                continue;
+
+            for (size_t i = 0; i < fbs; i++)
+            {
+                auto li = fi*fbs + i;
+                for (size_t fj = 0; fj < fcids.size(); fj++)
+                {
+                    auto col_ofs = face_dof[ fcids[fj] ];
+                    for (size_t j = 0; j < fbs; j++)
+                    {
+                        auto lj = fj*fbs + j;
+                        if (col_ofs == NO_OWNER)
+                            lrhs[row_ofs+i] -= AC(li,lj) * dirichlet[lj];
+                        else
+                            trip.push_back( {row_ofs+i, col_ofs+j, AC(li,lj)} );
+                    }
+                }
+
+                lrhs[row_ofs+i] += bC[li];
+            }
+        }
+    }
+
+    void finalize()
+    {
+        auto& all = triplets[0];
+        for (size_t i = 1; i < triplets.size(); i++)
+        {
+            all.insert(all.end(), triplets[i].begin(), triplets[i].end());
+            triplets[i].clear();
+            triplets[i].shrink_to_fit();
+        }
+
+        blaze::init_from_triplets(lhs, all.begin(), all.end(), num_threads);
+        all.clear();
+
+        rhs = rhs_parts[0];
+        for (size_t i = 1; i < rhs_parts.size(); i++)
+            rhs += rhs_parts[i];
+    }
+
+    /* The face unknowns of the cell 'cl_id' from the global solution */
+    blaze::DynamicVector<T>
+    take_local_solution(const Mesh& msh, size_t cl_id,
+                        const blaze::DynamicVector<T>& sol,
+                        const blaze::DynamicVector<T>& dirichlet) const
+    {
+        const auto& fcids = face_ids(msh, cl_id);
+        blaze::DynamicVector<T> ret(fcids.size() * fbs);
+
+        for (size_t fi = 0; fi < fcids.size(); fi++)
+        {
+            auto ofs = face_dof[ fcids[fi] ];
+            if (ofs == NO_OWNER)
+                subvector(ret, fi*fbs, fbs) = subvector(dirichlet, fi*fbs, fbs);
+            else
+                subvector(ret, fi*fbs, fbs) = subvector(sol, ofs, fbs);
+        }
+
+        return ret;
+    }
+
+    size_t system_size() const { return sys_size; }
+};
+
+/* Solve -lapl(u) = f with u = g on the boundary. The local operators and
+ * the condensation are computed in parallel on 'num_threads' threads, the
+ * condensed system is solved with CG, then the cell unknowns are
+ * recovered with the factorizations kept by the condensation. Returns
+ * the unknowns of each cell, as in hho_reduce(). */
+template<typename Mesh, typename RhsFunction, typename DirichletFunction>
+std::vector<blaze::DynamicVector<typename Mesh::coordinate_type>>
+solve_hho_diffusion(const Mesh& msh, const hho_degree_info& hdi,
+                    const RhsFunction& f, const DirichletFunction& g,
+                    const conjugated_gradient_params<typename Mesh::coordinate_type>& cgp,
+                    size_t num_threads = 1)
+{
+    using T = typename Mesh::coordinate_type;
+    using matr = blaze::DynamicMatrix<T>;
+    using vect = blaze::DynamicVector<T>;
+
+    auto num_cells = msh.cells.size();
+    hho_assembler<Mesh> assm(msh, hdi, num_threads);
+
+    std::vector<hho_condensation_data<T>> cdata(num_cells);
+    std::vector<vect> dirichlet(num_cells);
+
+    YAOURT_TIMED_SCOPE_VAR(asm_timer, "hho.assembly", false);
+    yaourt::parallel_for_chunks(num_cells, num_threads,
+        [&](size_t tid, size_t begin, size_t end) {
+            for (size_t cl_id = begin; cl_id < end; cl_id++)
+            {
+                const auto& cl = msh.cells[cl_id];
+                auto [GR, A] = make_hho_gradient_reconstruction(msh, cl, hdi);
+                auto S = make_hho_stabilization(msh, cl, GR, hdi);
+                matr L = A + S;
+                auto b = hho_rhs(msh, cl, hdi, f);
+
+                auto [AC, bC] = static_condensation(hdi, L, b, cdata[cl_id]);
+                dirichlet[cl_id] = assm.dirichlet_data(msh, cl_id, g);
+                assm.assemble(msh, cl_id, AC, bC, dirichlet[cl_id], tid);
+            }
+        });
+
+    assm.finalize();
+    asm_timer.stop();
+
+    vect sol(assm.system_size(), 0.0);
+    if (assm.system_size() > 0)
+        conjugated_gradient(cgp, assm.lhs, assm.rhs, sol);
+
+    YAOURT_TIMED_SCOPE("hho.decondensation");
+    std::vector<vect> ret(num_cells);
+    yaourt::parallel_for_chunks(num_cells, num_threads,
+        [&](size_t, size_t begin, size_t end) {
+            for (size_t cl_id = begin; cl_id < end; cl_id++)
+            {
+                auto solF = assm.take_local_solution(msh, cl_id, sol, dirichlet[cl_id]);
+                ret[cl_id] = static_decondensation(cdata[cl_id], solF);
+            }
+        });
+
+    return ret;
+}
@@ -0,0 +1,110 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/reordering.hpp"
+#include "core/adaptivity.hpp"
+
+/* Check a nonconforming mesh: the cells cover the domain, each fine face
+ * lies on its coarse face and the faces with a single owner are either
+ * on the boundary or hanging. Returns the number of errors. */
+template<typename Mesh>
+size_t
+check_mesh(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+
+    size_t errors = 0;
+
+    T area = 0.0;
+    for (auto& cl : msh.cells)
+        area += measure(msh, cl);
+    if ( std::abs(area - 1.0) > 1e-12 )
+        errors++;
+
+    std::vector<size_t> hanging(msh.faces.size(), 0);
+    for (auto& hf : msh.hanging_faces)
+    {
+        const auto& cf = msh.faces[ hf[0] ];
+        const auto& ff = msh.faces[ hf[1] ];
+        if ( std::abs(2*measure(msh, ff) - measure(msh, cf)) > 1e-12 )
+            errors++;
+
+        auto pb = barycenter(msh, ff);
+        auto d0 = msh.points[cf.p0] - pb;
+        auto d1 = msh.points[cf.p1] - pb;
+        if ( std::abs(d0.x()*d1.y() - d0.y()*d1.x()) > 1e-12 )
+            errors++;
+
+        hanging[ hf[0] ]++;
+        hanging[ hf[1] ]++;
+    }
+
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fo = msh.face_owners[fc_id];
+        bool single = (fo[1] == NO_OWNER);
+        bool expected = msh.faces[fc_id].is_boundary or hanging[fc_id] > 0;
+        if (single != expected)
+            errors++;
+    }
+
+    return errors;
+}
+
+/* Refine repeatedly the cells close to the corner (0,0) */
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    using T = typename Mesh::coordinate_type;
+
+    Mesh msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 2);
+
+    size_t errors = 0;
+    std::cout << name << ":";
+    for (size_t step = 0; step < 4; step++)
+    {
+        std::vector<T> indicators;
+        for (auto& cl : msh.cells)
+        {
+            auto bar = barycenter(msh, cl);
+            indicators.push_back( 1.0/(bar.x()*bar.x() + bar.y()*bar.y()) );
+        }
+
+        auto marked = yaourt::doerfler_marking(indicators, T(0.3));
+        yaourt::refine_cells(msh, marked);
+        errors += check_mesh(msh);
+
+        /* The hanging faces must survive the reordering */
+        reorder_mesh(msh, yaourt::mesh_ordering::HILBERT);
+        errors += check_mesh(msh);
+
+        std::cout << " " << msh.cells.size() << "/" << msh.hanging_faces.size();
+    }
+
+    /* Refining all the cells splits each hanging face in two */
+    auto num_hanging = msh.hanging_faces.size();
+    yaourt::refine_cells(msh, std::vector<bool>(msh.cells.size(), true));
+    errors += check_mesh(msh);
+    if ( msh.hanging_faces.size() != 2*num_hanging )
+        errors++;
+
+    std::cout << ", errors: " << errors << std::endl;
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("Triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("Quadrangles");
+
+    return errors == 0 ? 0 : 1;
+}
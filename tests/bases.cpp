@@ -0,0 +1,140 @@
+#include <iostream>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/bases.hpp"
+
+/* Distance of the mass matrix of the orthonormal bases from the measure
+ * of the element times the identity, on the cells and on the faces. On
+ * the quads the cells must be rectangles aligned with the axes. */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_orthonormality(const Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    auto kind = yb::basis_kind::orthonormal;
+
+    T max_err = 0.0;
+    for (auto& cl : msh.cells)
+    {
+        auto basis = yb::make_basis(msh, cl, degree, kind);
+        blaze::DynamicMatrix<T> M(basis.size(), basis.size(), 0.0);
+
+        auto qps = yq::integrate(msh, cl, 2*degree);
+        for (auto& qp : qps)
+        {
+            auto phi = basis.eval(qp.point());
+            M += qp.weight() * phi * trans(phi);
+        }
+
+        M /= measure(msh, cl);
+        M -= blaze::IdentityMatrix<T>(basis.size());
+        max_err = std::max(max_err, blaze::max(blaze::abs(M)));
+    }
+
+    for (auto& fc : msh.faces)
+    {
+        auto basis = yb::make_basis(msh, fc, degree, kind);
+        blaze::DynamicMatrix<T> M(basis.size(), basis.size(), 0.0);
+
+        auto qps = yq::integrate(msh, fc, 2*degree);
+        for (auto& qp : qps)
+        {
+            auto phi = basis.eval(qp.point());
+            M += qp.weight() * phi * trans(phi);
+        }
+
+        M /= measure(msh, fc);
+        M -= blaze::IdentityMatrix<T>(basis.size());
+        max_err = std::max(max_err, blaze::max(blaze::abs(M)));
+    }
+
+    return max_err;
+}
+
+/* Both kinds span the same space: the L2 projection of a polynomial of
+ * degree 'degree' is the polynomial itself. The gradients are compared
+ * with finite differences, the compile-time degree basis with the
+ * dynamic one. */
+template<size_t K, typename Mesh>
+typename Mesh::coordinate_type
+check_span_and_grads(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    auto fun = [](const point_type& pt) -> T {
+        return yb::iexp_pow(pt.x(), K) - pt.x()*yb::iexp_pow(pt.y(), K-1) + 0.5;
+    };
+
+    T max_err = 0.0;
+    for (auto kind : {yb::basis_kind::monomial, yb::basis_kind::orthonormal})
+    {
+        for (auto& cl : msh.cells)
+        {
+            auto basis = yb::make_basis(msh, cl, K, kind);
+            auto sbasis = yb::make_basis<K>(msh, cl, kind);
+            auto proj = project(msh, cl, basis, fun);
+
+            const T h = 1e-7;
+            auto qps = yq::integrate(msh, cl, 2*K);
+            for (auto& qp : qps)
+            {
+                auto pt = qp.point();
+                max_err = std::max(max_err, std::abs(dot(proj, basis.eval(pt)) - fun(pt)));
+                max_err = std::max(max_err, norm(basis.eval(pt) - sbasis.eval(pt)));
+
+                auto dphi = basis.eval_grads(pt);
+                auto dx = (basis.eval(pt + point_type(h,T(0))) - basis.eval(pt - point_type(h,T(0))))/(2*h);
+                auto dy = (basis.eval(pt + point_type(T(0),h)) - basis.eval(pt - point_type(T(0),h)))/(2*h);
+                max_err = std::max(max_err, norm(column(dphi, 0) - dx));
+                max_err = std::max(max_err, norm(column(dphi, 1) - dy));
+            }
+        }
+    }
+
+    return max_err;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+
+    yaourt::simplicial_mesh<T> msh_tri;
+    auto mesher_tri = yaourt::get_mesher(msh_tri);
+    mesher_tri.create_mesh(msh_tri, 2);
+
+    yaourt::simplicial_mesh<T> msh_shat = msh_tri;
+    shatter_mesh(msh_shat, 0.2);
+
+    yaourt::quad_mesh<T> msh_quad;
+    auto mesher_quad = yaourt::get_mesher(msh_quad);
+    mesher_quad.create_mesh(msh_quad, 2);
+
+    for (size_t k = 0; k < 7; k++)
+    {
+        auto err_tri = check_orthonormality(msh_tri, k);
+        auto err_shat = check_orthonormality(msh_shat, k);
+        auto err_quad = check_orthonormality(msh_quad, k);
+        std::cout << "Orthonormality, degree " << k << ": " << err_tri << " ";
+        std::cout << err_shat << " " << err_quad << std::endl;
+        if (err_tri > 1e-12 or err_shat > 1e-12 or err_quad > 1e-12)
+            errors++;
+    }
+
+    auto err_span = std::max( check_span_and_grads<3>(msh_shat),
+                              check_span_and_grads<3>(msh_quad) );
+    std::cout << "Span and gradients: " << err_span << std::endl;
+    if (err_span > 1e-6)
+        errors++;
+
+    std::cout << "Errors: " << errors << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <random>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/batched_la.hpp"
+
+/* Random symmetric positive definite matrix */
+template<typename T>
+blaze::DynamicMatrix<T>
+random_spd(size_t n, std::mt19937& gen)
+{
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+
+    blaze::DynamicMatrix<T> B(n, n);
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            B(i,j) = dist(gen);
+
+    blaze::DynamicMatrix<T> A = B * trans(B);
+    for (size_t i = 0; i < n; i++)
+        A(i,i) += T(n);
+
+    return A;
+}
+
+/* Single and batched factorizations against the residuals of the
+ * solutions, also with more threads than matrices */
+template<typename T>
+T
+check_cholesky(size_t n, size_t count, size_t num_threads)
+{
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+
+    std::vector<blaze::DynamicMatrix<T>> As(count);
+    std::vector<blaze::DynamicVector<T>> bs(count);
+    yaourt::batched_cholesky<T> batch(n, count);
+    std::vector<T> b(n*count);
+
+    for (size_t k = 0; k < count; k++)
+    {
+        As[k] = random_spd<T>(n, gen);
+        bs[k].resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            bs[k][i] = dist(gen);
+            b[i*count + k] = bs[k][i];
+        }
+        batch.set_matrix(k, As[k]);
+    }
+
+    batch.factorize(num_threads);
+    batch.solve(b, num_threads);
+
+    T max_err = 0.0;
+    for (size_t k = 0; k < count; k++)
+    {
+        blaze::DynamicVector<T> x(n);
+        for (size_t i = 0; i < n; i++)
+            x[i] = b[i*count + k];
+        max_err = std::max(max_err, norm(As[k]*x - bs[k]));
+
+        yaourt::cholesky_factor<T> single(As[k]);
+        auto xs = single.solve(bs[k]);
+        max_err = std::max(max_err, norm(As[k]*xs - bs[k]));
+
+        auto xf = batch.factor(k).solve(bs[k]);
+        max_err = std::max(max_err, norm(xf - x));
+
+        blaze::DynamicMatrix<T> B(n, 3);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < 3; j++)
+                B(i,j) = dist(gen);
+        blaze::DynamicMatrix<T> R = As[k]*single.solve(B) - B;
+        for (size_t i = 0; i < n; i++)
+            max_err = std::max(max_err, norm(trans(row(R, i))));
+    }
+
+    return max_err;
+}
+
+/* The shared factorizations must give the same results as the solves
+ * with the mass matrices of the single cells */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_mass_factorizations(const Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    yaourt::mass_factorizations<Mesh> mf(msh, degree, 2);
+    auto tmf = yaourt::tabulated_mass_factorizations(msh, degree, 2*degree, 2);
+
+    auto bs = yb::scalar_basis_size(degree, 2);
+    blaze::DynamicVector<T> b(bs, 1.0);
+    blaze::DynamicVector<T> phi(bs);
+
+    T max_err = 0.0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto basis = yb::make_basis(msh, cl, degree);
+
+        blaze::DynamicMatrix<T> M(bs, bs, 0.0);
+        auto qps = yq::integrate(msh, cl, 2*degree);
+        for (auto& qp : qps)
+        {
+            basis.eval(qp.point(), phi);
+            M += qp.weight() * phi * trans(phi);
+        }
+
+        blaze::DynamicVector<T> x = mf.solve(cl_id, b);
+        max_err = std::max(max_err, norm(M*x - b)/norm(b));
+
+        auto tbasis = yb::make_tabulated_basis(msh, cl, degree, 2*degree);
+        blaze::DynamicMatrix<T> tM(bs, bs, 0.0);
+        auto tqps = tbasis.cell_quadrature();
+        for (size_t i = 0; i < tqps.size(); i++)
+            tM += tqps.weight(i) * tqps.phi(i) * trans( tqps.phi(i) );
+
+        blaze::DynamicVector<T> tx = tmf.solve(cl_id, b);
+        max_err = std::max(max_err, norm(tM*tx - b)/norm(b));
+    }
+
+    return max_err;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+
+    for (size_t n : {1, 6, 15})
+    {
+        for (size_t nt : {1, 4, 40})
+        {
+            auto err = check_cholesky<T>(n, 17, nt);
+            std::cout << "Cholesky n = " << n << ", threads = " << nt;
+            std::cout << ": " << err << std::endl;
+            if (err > 1e-12)
+                errors++;
+        }
+    }
+
+    yaourt::simplicial_mesh<T> msh_tri;
+    auto mesher_tri = yaourt::get_mesher(msh_tri);
+    mesher_tri.create_mesh(msh_tri, 3);
+
+    yaourt::quad_mesh<T> msh_quad;
+    auto mesher_quad = yaourt::get_mesher(msh_quad);
+    mesher_quad.create_mesh(msh_quad, 3);
+
+    /* The meshers make a few shapes only */
+    auto tri_shapes = yaourt::classify_cell_shapes(msh_tri);
+    auto quad_shapes = yaourt::classify_cell_shapes(msh_quad);
+    std::cout << "Shapes: " << tri_shapes.representative.size() << " ";
+    std::cout << quad_shapes.representative.size() << std::endl;
+    if (tri_shapes.representative.size() > 8 or quad_shapes.representative.size() != 1)
+        errors++;
+
+    /* Every cell is its own shape */
+    yaourt::simplicial_mesh<T> msh_shat = msh_tri;
+    shatter_mesh(msh_shat, 0.2);
+
+    for (size_t k = 0; k < 4; k++)
+    {
+        auto err_tri = check_mass_factorizations(msh_tri, k);
+        auto err_quad = check_mass_factorizations(msh_quad, k);
+        auto err_shat = check_mass_factorizations(msh_shat, k);
+        std::cout << "Mass degree " << k << ": " << err_tri << " ";
+        std::cout << err_quad << " " << err_shat << std::endl;
+        if (err_tri > 1e-10 or err_quad > 1e-10 or err_shat > 1e-10)
+            errors++;
+    }
+
+    std::cout << "Errors: " << errors << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <random>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/bases.hpp"
+#include "core/bsr_matrix.hpp"
+#include "core/blaze_sparse_init.hpp"
+#include "core/solvers.hpp"
+#include "methods/dg.hpp"
+
+/* Assemble random blocks on the DG pattern of the mesh both in scalar and
+ * block format, then compare the matrices and their products. */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_bsr(Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+
+    msh.compute_connectivity();
+
+    assembler<Mesh> sassm(msh, degree, false, 1, dg_assembly_mode::PATTERN);
+    assembler<Mesh> bassm(msh, degree, false, 1, dg_assembly_mode::BLOCKS);
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    auto random_block = [&]() {
+        blaze::DynamicMatrix<T> ret(bs, bs);
+        for (size_t i = 0; i < bs; i++)
+            for (size_t j = 0; j < bs; j++)
+                ret(i,j) = dist(gen);
+        return ret;
+    };
+
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            if (!has_neighbour)
+                continue;
+
+            auto blk = random_block();
+            sassm.assemble(msh, cl_id, ncl_id, blk);
+            bassm.assemble(msh, cl_id, ncl_id, blk);
+        }
+
+        auto blk = random_block();
+        blaze::DynamicVector<T> loc(bs, 0.0);
+        sassm.assemble(msh, cl_id, blk, loc);
+        bassm.assemble(msh, cl_id, blk, loc);
+    }
+
+    sassm.finalize();
+    bassm.finalize();
+
+    const auto& A = sassm.lhs;
+    const auto& B = bassm.lhs_blocks;
+
+    T max_err = 0.0;
+
+    auto C = B.to_compressed();
+    for (size_t i = 0; i < A.rows(); i++)
+        for (size_t j = 0; j < A.columns(); j++)
+            max_err = std::max(max_err, std::abs(A(i,j) - C(i,j)));
+
+    blaze::DynamicVector<T> x(A.columns());
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = dist(gen);
+
+    blaze::DynamicVector<T> Ax = A*x;
+    blaze::DynamicVector<T> Bx = B*x;
+    max_err = std::max(max_err, norm(Ax - Bx));
+
+    blaze::DynamicVector<T> Atx = trans(A)*x;
+    blaze::DynamicVector<T> Btx = trans(B)*x;
+    max_err = std::max(max_err, norm(Atx - Btx));
+
+    /* The solvers go through apply(), which must write in place when the
+     * result has already the right size */
+    static_assert(yaourt::detail::has_apply<yaourt::bsr_matrix<T>, T>::value);
+    static_assert(yaourt::detail::has_apply_transpose<yaourt::bsr_matrix<T>, T>::value);
+
+    blaze::DynamicVector<T> y(B.rows(), 1.0);
+    const T *y_data = y.data();
+    B.apply(x, y);
+    max_err = std::max(max_err, norm(Ax - y));
+    B.apply_transpose(x, y);
+    max_err = std::max(max_err, norm(Atx - y));
+    if (y.data() != y_data)
+        max_err = std::max(max_err, T(1));
+
+    return max_err;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    for (size_t k = 0; k < 4; k++)
+    {
+        yaourt::simplicial_mesh<T> msh_tri;
+        auto mesher_tri = yaourt::get_mesher(msh_tri);
+        mesher_tri.create_mesh(msh_tri, 2);
+
+        yaourt::quad_mesh<T> msh_quad;
+        auto mesher_quad = yaourt::get_mesher(msh_quad);
+        mesher_quad.create_mesh(msh_quad, 2);
+
+        auto err_tri = check_bsr(msh_tri, k);
+        auto err_quad = check_bsr(msh_quad, k);
+        if (err_tri > 1e-12 or err_quad > 1e-12)
+            errors++;
+
+        std::cout << "Degree " << k << ": ";
+        std::cout << err_tri << " " << err_quad << std::endl;
+    }
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/partitioning.hpp"
+#include "core/checkpoint.hpp"
+
+/* Write a mesh, one of its parts and some data, read them back and check
+ * that nothing changed. Returns the number of errors. */
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    namespace yc = yaourt::checkpoint;
+    using T = typename Mesh::coordinate_type;
+
+    Mesh msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 3);
+
+    auto parts = yaourt::partition_mesh(msh, 3);
+    Mesh local;
+    auto part = yaourt::extract_partition(msh, parts, 1, local);
+
+    blaze::DynamicVector<T> v(local.cells.size());
+    blaze::DynamicMatrix<T> m(local.cells.size(), 3);
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        v[i] = T(i)/3;
+        for (size_t j = 0; j < 3; j++)
+            m(i,j) = T(i) + T(j)/7;
+    }
+
+    std::string filename = std::string("checkpoint_test_") + name;
+    {
+        yc::writer w(filename);
+        yc::write_mesh(w, local);
+        yc::write_partition(w, part);
+        w.write("vector", v);
+        w.write("matrix", m);
+        w.write_value("step", uint64_t(42));
+        w.close();
+    }
+
+    size_t errors = 0;
+    {
+        yc::reader r(filename);
+
+        Mesh rmsh;
+        yc::read_mesh(r, rmsh);
+        auto rpart = yc::read_partition(r);
+
+        if (rmsh.points.size() != local.points.size() or
+            rmsh.cells.size() != local.cells.size() or
+            rmsh.faces.size() != local.faces.size())
+            errors++;
+
+        for (size_t i = 0; i < std::min(rmsh.points.size(), local.points.size()); i++)
+            if (rmsh.points[i].x() != local.points[i].x() or
+                rmsh.points[i].y() != local.points[i].y())
+                errors++;
+
+        for (size_t i = 0; i < std::min(rmsh.faces.size(), local.faces.size()); i++)
+            if ( !(rmsh.faces[i] == local.faces[i]) or
+                 rmsh.faces[i].is_boundary != local.faces[i].is_boundary or
+                 (local.faces[i].is_boundary and
+                  rmsh.faces[i].boundary_id != local.faces[i].boundary_id) )
+                errors++;
+
+        if (rmsh.face_owners != local.face_owners or
+            rmsh.cell_faces != local.cell_faces or
+            rmsh.sorted_cells != local.sorted_cells or
+            rmsh.sorted_faces != local.sorted_faces)
+            errors++;
+
+        /* The lookups work on the restored mesh */
+        for (size_t i = 0; i < rmsh.cells.size(); i++)
+            if (offset(rmsh, rmsh.cells[i]) != i)
+                errors++;
+
+        if (rpart.part != part.part or rpart.num_parts != part.num_parts or
+            rpart.num_owned != part.num_owned or
+            rpart.global_cell != part.global_cell or
+            rpart.interior_cells != part.interior_cells or
+            rpart.links.size() != part.links.size())
+            errors++;
+
+        for (size_t i = 0; i < std::min(rpart.links.size(), part.links.size()); i++)
+            if (rpart.links[i].part != part.links[i].part or
+                rpart.links[i].send != part.links[i].send or
+                rpart.links[i].recv != part.links[i].recv)
+                errors++;
+
+        blaze::DynamicVector<T> rv;
+        blaze::DynamicMatrix<T> rm;
+        r.read("vector", rv);
+        r.read("matrix", rm);
+        if (rv != v or rm != m)
+            errors++;
+
+        if (r.read_value<uint64_t>("step") != 42)
+            errors++;
+
+        /* Wrong type */
+        try {
+            r.read_value<float>("step");
+            errors++;
+        }
+        catch (const std::runtime_error&) {}
+    }
+
+    std::remove(filename.c_str());
+
+    std::cout << name << ": errors: " << errors << std::endl;
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("quadrangles");
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <mpi.h>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/distributed.hpp"
+#include "core/blaze_sparse_init.hpp"
+
+/* Two-point flux Laplacian with Dirichlet conditions on the cell
+ * averages. On a local mesh the faces of the ghost cells towards the
+ * cells of the other parts are skipped: only the rows of the owned cells
+ * are complete. */
+template<typename Mesh>
+blaze::CompressedMatrix<typename Mesh::coordinate_type>
+make_tpfa_laplacian(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+
+    std::vector<blaze::triplet<T>> triplets;
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fc = msh.faces[fc_id];
+        auto fo = msh.face_owners[fc_id];
+        auto bar0 = barycenter(msh, msh.cells[fo[0]]);
+
+        if (fo[1] == NO_OWNER)
+        {
+            if (!fc.is_boundary)
+                continue;
+            auto w = measure(msh, fc) / distance(bar0, barycenter(msh, fc));
+            triplets.push_back({fo[0], fo[0], w});
+            continue;
+        }
+
+        auto w = measure(msh, fc) / distance(bar0, barycenter(msh, msh.cells[fo[1]]));
+        triplets.push_back({fo[0], fo[0], w});
+        triplets.push_back({fo[1], fo[1], w});
+        triplets.push_back({fo[0], fo[1], -w});
+        triplets.push_back({fo[1], fo[0], -w});
+    }
+
+    blaze::CompressedMatrix<T> A(msh.cells.size(), msh.cells.size());
+    blaze::init_from_triplets(A, triplets.begin(), triplets.end());
+    return A;
+}
+
+/* The distributed operator, its dot products and the solvers running on
+ * it must give on the owned cells what the serial ones give on the whole
+ * mesh. Returns the number of errors of the calling process. */
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace ym = yaourt::mpi;
+
+    Mesh msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 4);
+
+    /* Serial reference, computed by all the processes */
+    auto A = make_tpfa_laplacian(msh);
+    blaze::DynamicVector<T> x(A.rows()), b(A.rows(), 1.0), xs(A.rows(), 0.0);
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = std::sin(T(i));
+    blaze::DynamicVector<T> y = A*x;
+
+    conjugated_gradient_params<T> cgp;
+    cgp.rr_tol = 1e-12;
+    cgp.max_iter = 1000;
+    conjugated_gradient_solver<T> scg(cgp);
+    scg.solve(A, b, xs);
+
+    Mesh local = msh;
+    auto part = ym::distribute_mesh(local);
+    auto Al = make_tpfa_laplacian(local);
+    auto dA = ym::make_distributed_operator<T>(Al, part, 1);
+
+    size_t errors = 0;
+    if (dA.rows() != part.num_owned)
+        errors++;
+
+    blaze::DynamicVector<T> xl(part.num_owned), bl(part.num_owned, 1.0);
+    for (size_t i = 0; i < part.num_owned; i++)
+        xl[i] = x[ part.global_cell[i] ];
+
+    blaze::DynamicVector<T> yl;
+    dA.apply(xl, yl);
+
+    T op_err = 0.0;
+    for (size_t i = 0; i < part.num_owned; i++)
+        op_err = std::max(op_err, std::abs(yl[i] - y[ part.global_cell[i] ]));
+
+    /* Dot products and norms are summed over the parts */
+    T dot_err = std::abs(yaourt::detail::global_dot(dA, xl, yl) - dot(x, y))/std::abs(dot(x, y));
+    dot_err = std::max(dot_err, std::abs(yaourt::detail::global_norm(dA, xl) - norm(x))/norm(x));
+
+    blaze::DynamicVector<T> xd(part.num_owned, 0.0);
+    conjugated_gradient_solver<T> dcg(cgp);
+    dcg.solve(dA, bl, xd);
+
+    blaze::DynamicVector<T> xb(part.num_owned, 0.0);
+    bicgstab(cgp, dA, bl, xb);
+
+    T sol_err = 0.0;
+    for (size_t i = 0; i < part.num_owned; i++)
+    {
+        auto ref = xs[ part.global_cell[i] ];
+        sol_err = std::max(sol_err, std::abs(xd[i] - ref));
+        sol_err = std::max(sol_err, std::abs(xb[i] - ref));
+    }
+
+    if (op_err > 1e-12 or dot_err > 1e-12 or sol_err > 1e-8)
+        errors++;
+
+    /* Without rounding differences CG takes the same path */
+    if (dcg.iterations() > scg.iterations() + 2 or
+        dcg.iterations() + 2 < scg.iterations())
+        errors++;
+
+    if (ym::comm_rank() == 0)
+    {
+        std::cout << name << ", " << ym::comm_size() << " processes: operator ";
+        std::cout << op_err << ", dot " << dot_err << ", solution " << sol_err;
+        std::cout << ", CG " << dcg.iterations() << "/" << scg.iterations();
+        std::cout << std::endl;
+    }
+
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    using T = double;
+
+    MPI_Init(&argc, &argv);
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("Triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("Quadrangles");
+
+    auto total = yaourt::mpi::allreduce_sum(double(errors));
+    if (yaourt::mpi::comm_rank() == 0)
+        std::cout << "Distributed operator: errors: " << total << std::endl;
+
+    MPI_Finalize();
+    return total == 0 ? 0 : 1;
+}
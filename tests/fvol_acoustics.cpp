@@ -0,0 +1,136 @@
+#include <iostream>
+#include <cmath>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "methods/fvol_acoustics.hpp"
+
+using yaourt::fvol::acoustics_fields;
+using yaourt::fvol::field_energies;
+
+/* The operator cell by cell, with the geometry computed on the fly */
+template<typename Mesh>
+acoustics_fields<typename Mesh::coordinate_type>
+reference_operator(const Mesh& msh, const acoustics_fields<typename Mesh::coordinate_type>& in)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yf = yaourt::fvol;
+
+    acoustics_fields<T> out(msh.cells.size(), 3);
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto ht = measure(msh, cl);
+
+        T flux_vx = 0.0, flux_vy = 0.0, flux_p = 0.0;
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            const auto& fc = msh.faces[fcid];
+            auto hf = measure(msh, fc);
+            auto [ngh, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            auto n = normal(msh, cl, fc);
+
+            auto vx = in(cl_id, yf::FIELD_VX);
+            auto vy = in(cl_id, yf::FIELD_VY);
+            auto p = in(cl_id, yf::FIELD_P);
+
+            if (not has_neighbour)
+            {
+                flux_p += (hf/ht) * ( n[0]*vx + n[1]*vy + p );
+                continue;
+            }
+
+            auto svx = vx + in(ngh, yf::FIELD_VX);
+            auto svy = vy + in(ngh, yf::FIELD_VY);
+            auto sp  = p + in(ngh, yf::FIELD_P);
+            auto jvx = vx - in(ngh, yf::FIELD_VX);
+            auto jvy = vy - in(ngh, yf::FIELD_VY);
+            auto jp  = p - in(ngh, yf::FIELD_P);
+
+            flux_vx += (0.5*hf/ht) * ( n[0]*sp + jvx );
+            flux_vy += (0.5*hf/ht) * ( n[1]*sp + jvy );
+            flux_p  += (0.5*hf/ht) * ( n[0]*svx + n[1]*svy + jp );
+        }
+
+        out(cl_id, yf::FIELD_VX) = -flux_vx;
+        out(cl_id, yf::FIELD_VY) = -flux_vy;
+        out(cl_id, yf::FIELD_P) = -flux_p;
+    }
+
+    return out;
+}
+
+/* Max difference between the face-based operator and the reference, and
+ * between the fused or separate energies and the ones computed directly */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_operator(Mesh& msh, size_t num_threads)
+{
+    using T = typename Mesh::coordinate_type;
+
+    acoustics_fields<T> in(msh.cells.size(), 3), out;
+    for (size_t i = 0; i < in.rows(); i++)
+        for (size_t j = 0; j < 3; j++)
+            in(i,j) = std::sin(1.0 + 3*i + j);
+
+    yaourt::fvol::acoustics_operator<Mesh> op(msh, 1.0, num_threads);
+    field_energies<T> fe;
+    op.apply(in, out, &fe);
+
+    auto ref = reference_operator(msh, in);
+    T err = blaze::max(blaze::abs(out - ref));
+
+    /* Again on the same threads */
+    acoustics_fields<T> out2;
+    op.apply(in, out2);
+    err = std::max(err, blaze::max(blaze::abs(out2 - ref)));
+
+    T Wvx = 0.0, Wvy = 0.0, Wp = 0.0;
+    for (size_t i = 0; i < in.rows(); i++)
+    {
+        auto ht = measure(msh, msh.cells[i]);
+        Wvx += 0.5*in(i,0)*in(i,0)*ht;
+        Wvy += 0.5*in(i,1)*in(i,1)*ht;
+        Wp += 0.5*in(i,2)*in(i,2)*ht;
+    }
+
+    err = std::max(err, std::abs(fe.Wvx - Wvx));
+    err = std::max(err, std::abs(fe.Wvy - Wvy));
+    err = std::max(err, std::abs(fe.Wp - Wp));
+
+    auto fe2 = op.energies(in);
+    err = std::max(err, std::abs(fe2.Wvx - Wvx));
+    err = std::max(err, std::abs(fe2.Wvy - Wvy));
+    err = std::max(err, std::abs(fe2.Wp - Wp));
+
+    std::cout << "Colours: " << op.num_colours() << ", threads: " << num_threads;
+    std::cout << ", error: " << err << std::endl;
+    return err;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+
+    yaourt::simplicial_mesh<T> msh_tri;
+    auto mesher_tri = yaourt::get_mesher(msh_tri);
+    mesher_tri.create_mesh(msh_tri, 3);
+    shatter_mesh(msh_tri, 0.2);
+
+    yaourt::quad_mesh<T> msh_quad;
+    auto mesher_quad = yaourt::get_mesher(msh_quad);
+    mesher_quad.create_mesh(msh_quad, 4);
+
+    for (size_t nt : {1, 3, 8})
+    {
+        if (check_operator(msh_tri, nt) > 1e-12)
+            errors++;
+        if (check_operator(msh_quad, nt) > 1e-12)
+            errors++;
+    }
+
+    std::cout << "Errors: " << errors << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -89,6 +89,91 @@ test_stabilization_hho(const Mesh& msh, size_t degree)
     return std::sqrt(err);
 }
 
+/* The cell unknowns recovered with the factorization kept by the
+ * condensation are the ones of the direct solution of the local system */
+template<typename Mesh>
+typename Mesh::coordinate_type
+test_condensation(const Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    using matr = blaze::DynamicMatrix<T>;
+    using vect = blaze::DynamicVector<T>;
+
+    auto f = [](const point<T,2>& pt) -> T {
+        return std::sin(3*M_PI*pt.x()) * std::sin(3*M_PI*pt.y());
+    };
+
+    hho_degree_info hdi( equal_order{degree} );
+    auto cbs = yaourt::bases::scalar_basis_size(hdi.cell_degree(), 2);
+
+    T err = 0.0;
+    for (auto& cl : msh.cells)
+    {
+        auto [GR, A] = make_hho_gradient_reconstruction(msh, cl, hdi);
+        auto S = make_hho_stabilization(msh, cl, GR, hdi);
+        matr L = A + S;
+        vect b = hho_reduce(msh, cl, hdi, f);
+
+        /* Fix the face unknowns to the reduction of f */
+        auto rs = L.rows() - cbs;
+        vect solF = subvector(b, cbs, rs);
+
+        hho_condensation_data<T> cdata;
+        auto [AC, bC] = static_condensation(hdi, L, b, cdata);
+        vect x = static_decondensation(cdata, solF);
+        vect y = static_decondensation_impl(hdi, L, b, solF);
+
+        err += dot(x-y, x-y);
+    }
+
+    return std::sqrt(err);
+}
+
+/* L2 error of the cell unknowns of the HHO solution of -lapl(u) = f */
+template<typename Mesh>
+typename Mesh::coordinate_type
+test_hho_diffusion(const Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto f = [](const point<T,2>& pt) -> T {
+        return 2.0 * M_PI * M_PI * std::sin(M_PI*pt.x()) * std::sin(M_PI*pt.y());
+    };
+    auto u = [](const point<T,2>& pt) -> T {
+        return std::sin(M_PI*pt.x()) * std::sin(M_PI*pt.y());
+    };
+
+    hho_degree_info hdi( equal_order{degree} );
+    auto cd = hdi.cell_degree();
+    auto cbs = yaourt::bases::scalar_basis_size(cd, 2);
+
+    conjugated_gradient_params<T> cgp;
+    cgp.rr_tol = 1e-12;
+    cgp.rr_max = 1e12;
+    cgp.max_iter = 100000;
+
+    auto sol = solve_hho_diffusion(msh, hdi, f, u, cgp, 4);
+
+    blaze::DynamicVector<T> phi(cbs);
+    T err = 0.0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto cb = yaourt::bases::make_basis(msh, cl, cd);
+        auto solT = subvector(sol[cl_id], 0, cbs);
+
+        auto qps = yaourt::quadratures::integrate(msh, cl, 2*cd+2);
+        for (auto& qp : qps)
+        {
+            cb.eval(qp.point(), phi);
+            auto diff = u(qp.point()) - dot(solT, phi);
+            err += qp.weight() * diff * diff;
+        }
+    }
+
+    return std::sqrt(err);
+}
+
 enum class convergence_status {
     OK,
     TOO_LOW,
@@ -132,12 +217,12 @@ rate_color(double actual, double expected)
 }
 
 template<typename Mesh, typename Function>
-int test(const Function& tf)
+int test(const Function& tf, size_t max_degree = 9)
 {
     using mesh_type = Mesh;
     using T = typename mesh_type::coordinate_type;
 
-    for (size_t degree = 0; degree < 9; degree++)
+    for (size_t degree = 0; degree < max_degree; degree++)
     {
         std::cout << "Testing order " << degree << ", expected rate is ";
         std::cout << degree+1 << std::endl;
@@ -200,6 +285,25 @@ int test()
 
     test<Mesh>(teststabhho);
 
+    std::cout << "Condensation" << std::endl;
+    for (size_t degree = 0; degree < 4; degree++)
+    {
+        Mesh msh;
+        auto mesher = yaourt::get_mesher(msh);
+        mesher.create_mesh(msh, 2);
+        auto err = test_condensation(msh, degree);
+        std::cout << "  order " << degree << ": " << err << std::endl;
+        if (err > 1e-10)
+            return 1;
+    }
+
+    std::cout << "HHO Diffusion" << std::endl;
+    auto testdiff = [](Mesh& msh, size_t degree) {
+        return test_hho_diffusion(msh, degree);
+    };
+
+    test<Mesh>(testdiff, 4);
+
     return 0;
 }
 
@@ -207,10 +311,12 @@ int main(int argc, char **argv)
 {
     using T = double;
     std::cout << "Simplicial meshes" << std::endl;
-    test<yaourt::simplicial_mesh<T>>();
+    if ( test<yaourt::simplicial_mesh<T>>() != 0 )
+        return 1;
             
     std::cout << "Quad meshes" << std::endl;
-    test<yaourt::quad_mesh<T>>();
+    if ( test<yaourt::quad_mesh<T>>() != 0 )
+        return 1;
 
     return 0;
 }
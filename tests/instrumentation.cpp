@@ -0,0 +1,70 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/instrumentation.hpp"
+
+namespace yi = yaourt::instrumentation;
+
+static void
+timed_work(size_t bytes)
+{
+    YAOURT_TIMED_SCOPE_VAR(timer, "test.work", false);
+    timer.add_bytes(bytes);
+    YAOURT_COUNT("test.items", 2);
+}
+
+int main(void)
+{
+    size_t errors = 0;
+    auto& reg = yi::registry::instance();
+
+    /* Nothing is recorded while disabled */
+    reg.enable(false);
+    timed_work(10);
+    auto& ph = reg.get_phase("test.work");
+    auto& cn = reg.get_counter("test.items");
+    if (ph.calls() != 0 or ph.bytes() != 0 or cn.value() != 0)
+        errors++;
+
+    /* The calls from all the threads are accumulated */
+    reg.enable(true);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; t++)
+        threads.emplace_back([]() {
+            for (size_t i = 0; i < 100; i++)
+                timed_work(8);
+        });
+    for (auto& th : threads)
+        th.join();
+
+#ifndef YAOURT_NO_INSTRUMENTATION
+    if (ph.calls() != 400 or ph.bytes() != 3200 or cn.value() != 800)
+        errors++;
+#endif
+
+    /* The timer measures also when disabled if asked to */
+    reg.enable(false);
+    {
+        YAOURT_TIMED_SCOPE_VAR(timer, "test.always", true);
+        if (timer.elapsed() < 0.0)
+            errors++;
+    }
+    if (reg.get_phase("test.always").calls() != 0)
+        errors++;
+
+#ifndef YAOURT_NO_INSTRUMENTATION
+    std::ostringstream summary, json;
+    reg.write_summary(summary);
+    reg.write_json(json);
+    if (summary.str().find("test.work") == std::string::npos or
+        json.str().find("\"test.work\"") == std::string::npos or
+        json.str().find("\"test.items\"") == std::string::npos)
+        errors++;
+#endif
+
+    std::cout << "instrumentation: errors: " << errors << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+
+#include "methods/dg_maxwell_2D.hpp"
+
+namespace ymax = yaourt::maxwell_2D;
+
+/* Run the Maxwell solver on a graded quadrilateral mesh, with the element
+ * size going from h/4 to 7h/4, and return the final DoFs. */
+template<typename T>
+blaze::DynamicVector<T>
+run(size_t lts_levels, T delta_t, size_t timesteps)
+{
+    using mesh_type = yaourt::quad_mesh<T>;
+    using point_type = typename mesh_type::point_type;
+
+    ymax::maxwell_config<T> cfg;
+    cfg.degree = 2;
+    cfg.mesh_levels = 4;
+    cfg.delta_t = delta_t;
+    cfg.upwind = true;
+    cfg.lts_levels = lts_levels;
+    cfg.num_threads = 2;
+
+    ymax::maxwell_context<mesh_type> ctx(cfg);
+    for (auto& pt : ctx.msh.points)
+    {
+        pt[0] = 0.25*pt[0] + 0.75*pt[0]*pt[0];
+        pt[1] = 0.25*pt[1] + 0.75*pt[1]*pt[1];
+    }
+
+    assemble(ctx);
+
+    auto zero = [](const point_type&, T) -> T { return 0.0; };
+    auto pulse = [](const point_type& pt, T) -> T {
+        auto x = pt[0] - 0.4;
+        auto y = pt[1] - 0.5;
+        return std::exp(-60*(x*x + y*y));
+    };
+    apply_initial_condition(ctx, zero, zero, pulse);
+
+    for (size_t i = 0; i < timesteps; i++)
+        do_timestep(ctx);
+
+    return ctx.gDofs;
+}
+
+int main(void)
+{
+    using T = double;
+
+    /* Global timestepping is unstable with dt = 0.002 on this mesh, the
+     * local timestepping takes steps of 0.004 on the largest elements. */
+    auto ref = run<T>(1, 0.00025, 1600);
+
+    for (size_t r = 1; r <= 4; r *= 2)
+    {
+        T dt = 0.004/r;
+        auto lts = run<T>(3, dt, 100*r);
+        std::cout << "dt = " << dt << ", relative difference with global RK4: ";
+        std::cout << norm(lts - ref)/norm(ref) << std::endl;
+    }
+
+    /* Same run in single precision, the difference should be at the level
+     * of the float rounding */
+    auto dbl = run<T>(1, 0.0005, 400);
+    blaze::DynamicVector<T> sgl = run<float>(1, 0.0005f, 400);
+    std::cout << "Relative difference of the single precision run: ";
+    std::cout << norm(sgl - dbl)/norm(dbl) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/mesh_io.hpp"
+
+/* Write 'msh' in the MSH 4.1 format. Each boundary id is a curve with
+ * the tag id+1 and the physical tag id. Every other cell is written in
+ * clockwise order. With 'quadratic' the boundary faces are 3-node lines,
+ * their midpoints are nodes not used by the cells. */
+template<typename Mesh>
+void
+write_gmsh(const std::string& filename, const Mesh& msh, bool binary,
+           bool quadratic = false)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+
+    auto put = [&](auto v) {
+        if (binary)
+            ofs.write(reinterpret_cast<const char *>(&v), sizeof(v));
+        else
+            ofs << v << " ";
+    };
+    auto newline = [&]() { if (!binary) ofs << "\n"; };
+
+    ofs << "$MeshFormat\n4.1 " << (binary ? 1 : 0) << " 8\n";
+    if (binary)
+    {
+        put(int32_t(1));
+        ofs << "\n";
+    }
+    ofs << "$EndMeshFormat\n";
+
+    std::map<size_t, std::vector<size_t>> bnd;
+    for (size_t i = 0; i < msh.faces.size(); i++)
+        if (msh.faces[i].is_boundary)
+            bnd[ msh.faces[i].boundary_id ].push_back(i);
+
+    ofs << "$Entities\n";
+    put(uint64_t(0)); put(uint64_t(bnd.size())); put(uint64_t(1)); put(uint64_t(0));
+    newline();
+    for (auto& b : bnd)
+    {
+        put(int32_t(b.first+1));
+        for (size_t i = 0; i < 6; i++)
+            put(double(0));
+        put(uint64_t(1)); put(int32_t(b.first)); put(uint64_t(0));
+        newline();
+    }
+    put(int32_t(1));
+    for (size_t i = 0; i < 6; i++)
+        put(double(0));
+    put(uint64_t(0)); put(uint64_t(0));
+    newline();
+    ofs << "\n$EndEntities\n";
+
+    std::vector<size_t> mid_tag(msh.faces.size(), 0);
+    size_t nm = 0;
+    for (auto& b : bnd)
+        for (auto& fcid : b.second)
+            mid_tag[fcid] = quadratic ? msh.points.size() + 1 + nm++ : 0;
+
+    /* Node tags start from 1 */
+    auto np = msh.points.size() + nm;
+    ofs << "$Nodes\n";
+    put(uint64_t(1)); put(uint64_t(np)); put(uint64_t(1)); put(uint64_t(np));
+    newline();
+    put(int32_t(2)); put(int32_t(1)); put(int32_t(0)); put(uint64_t(np));
+    newline();
+    for (size_t i = 0; i < np; i++)
+    {
+        put(uint64_t(i+1));
+        newline();
+    }
+    for (auto& pt : msh.points)
+    {
+        put(double(pt.x())); put(double(pt.y())); put(double(0));
+        newline();
+    }
+    for (auto& b : bnd)
+    {
+        for (auto& fcid : b.second)
+        {
+            if (!quadratic)
+                continue;
+            auto& fc = msh.faces[fcid];
+            auto mid = (msh.points[fc.p0] + msh.points[fc.p1]) * 0.5;
+            put(double(mid.x())); put(double(mid.y())); put(double(0));
+            newline();
+        }
+    }
+    ofs << "\n$EndNodes\n";
+
+    const size_t nf = Mesh::cell_type::num_faces;
+    size_t tag = 1;
+    ofs << "$Elements\n";
+    put(uint64_t(bnd.size() + 1)); put(uint64_t(msh.faces.size() + msh.cells.size()));
+    put(uint64_t(1)); put(uint64_t(msh.faces.size() + msh.cells.size()));
+    newline();
+    for (auto& b : bnd)
+    {
+        put(int32_t(1)); put(int32_t(b.first+1)); put(int32_t(quadratic ? 8 : 1));
+        put(uint64_t(b.second.size()));
+        newline();
+        for (auto& fcid : b.second)
+        {
+            put(uint64_t(tag++));
+            put(uint64_t(msh.faces[fcid].p1+1)); put(uint64_t(msh.faces[fcid].p0+1));
+            if (quadratic)
+                put(uint64_t(mid_tag[fcid]));
+            newline();
+        }
+    }
+    put(int32_t(2)); put(int32_t(1)); put(int32_t(nf == 3 ? 2 : 3)); put(uint64_t(msh.cells.size()));
+    newline();
+    for (size_t i = 0; i < msh.cells.size(); i++)
+    {
+        put(uint64_t(tag++));
+        auto p = msh.cells[i].p;
+        if (i % 2)
+            std::reverse(p.begin(), p.end());
+        for (auto& pt : p)
+            put(uint64_t(pt+1));
+        newline();
+    }
+    ofs << "\n$EndElements\n";
+}
+
+/* Check the faces and the connectivity of a loaded mesh against the mesh
+ * it was written from. Returns the number of errors. */
+template<typename Mesh>
+size_t
+check_loaded_mesh(const Mesh& msh, const Mesh& loaded)
+{
+    size_t errors = 0;
+
+    if (loaded.points.size() != msh.points.size() or
+        loaded.cells.size() != msh.cells.size() or
+        loaded.faces.size() != msh.faces.size() or
+        !loaded.has_connectivity())
+        return 1;
+
+    for (size_t i = 0; i < msh.cells.size(); i++)
+    {
+        auto bar = barycenter(msh, msh.cells[i]);
+        auto lbar = barycenter(loaded, loaded.cells[i]);
+        if ( std::abs(bar.x() - lbar.x()) > 1e-14 or
+             std::abs(bar.y() - lbar.y()) > 1e-14 )
+            errors++;
+
+        if ( measure(loaded, loaded.cells[i]) <= 0 )
+            errors++;
+    }
+
+    std::map<size_t, size_t> bnd, lbnd;
+    for (auto& fc : msh.faces)
+        if (fc.is_boundary)
+            bnd[fc.boundary_id]++;
+    for (auto& fc : loaded.faces)
+        if (fc.is_boundary)
+            lbnd[fc.boundary_id]++;
+    if (bnd != lbnd)
+        errors++;
+
+    /* Same connectivity as the one computed by searching the faces */
+    auto ref = loaded;
+    ref.compute_connectivity();
+    if (ref.face_owners != loaded.face_owners or
+        ref.cell_faces != loaded.cell_faces or
+        ref.sorted_faces != loaded.sorted_faces)
+        errors++;
+
+    for (size_t i = 0; i < loaded.faces.size(); i++)
+    {
+        bool single = (loaded.face_owners[i][1] == NO_OWNER);
+        if (single != loaded.faces[i].is_boundary)
+            errors++;
+    }
+
+    return errors;
+}
+
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    Mesh msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 3);
+
+    size_t errors = 0;
+    std::string filename = std::string("mesh_io_test_") + name + ".msh";
+    std::string bin_filename = std::string("mesh_io_test_") + name + ".bin";
+
+    Mesh loaded;
+    for (bool binary : {false, true})
+    {
+        write_gmsh(filename, msh, binary);
+
+        Mesh threaded;
+        yaourt::load_gmsh(filename, loaded);
+        yaourt::load_mesh(filename, threaded, 4);
+
+        errors += check_loaded_mesh(msh, loaded);
+
+        if (threaded.cells.size() != loaded.cells.size() or
+            threaded.faces.size() != loaded.faces.size() or
+            threaded.face_owners != loaded.face_owners or
+            threaded.cell_faces != loaded.cell_faces)
+            errors++;
+    }
+
+    /* The boundary ids are read also from the 3-node lines */
+    write_gmsh(filename, msh, false, true);
+    Mesh quadratic;
+    yaourt::load_gmsh(filename, quadratic);
+    errors += check_loaded_mesh(msh, quadratic);
+    std::remove(filename.c_str());
+
+    /* Native format round trip */
+    yaourt::save_binary_mesh(bin_filename, loaded);
+    Mesh rmsh;
+    yaourt::load_mesh(bin_filename, rmsh);
+    std::remove(bin_filename.c_str());
+
+    errors += check_loaded_mesh(msh, rmsh);
+    for (size_t i = 0; i < std::min(rmsh.points.size(), loaded.points.size()); i++)
+        if (rmsh.points[i].x() != loaded.points[i].x() or
+            rmsh.points[i].y() != loaded.points[i].y())
+            errors++;
+
+    if (rmsh.face_owners != loaded.face_owners or
+        rmsh.cell_faces != loaded.cell_faces or
+        rmsh.sorted_cells != loaded.sorted_cells)
+        errors++;
+
+    std::cout << name << ": errors: " << errors << std::endl;
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("quadrangles");
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <utility>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/reordering.hpp"
+
+/* Max and average distance between the numbers of two neighbouring
+ * cells */
+template<typename Mesh>
+std::pair<size_t, double>
+bandwidth(const Mesh& msh)
+{
+    size_t max = 0, sum = 0, count = 0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(msh, cl_id, fcid);
+            if (!has_neighbour)
+                continue;
+
+            auto dist = std::max(cl_id, ncl_id) - std::min(cl_id, ncl_id);
+            max = std::max(max, dist);
+            sum += dist;
+            count++;
+        }
+    }
+
+    return std::make_pair(max, double(sum)/count);
+}
+
+/* Check that the connectivity updated by reorder_mesh() is the one that
+ * compute_connectivity() computes on the reordered mesh, and that cells
+ * and faces are found by offset(). Returns the number of errors. */
+template<typename Mesh>
+size_t
+check_reordering(Mesh& msh, yaourt::mesh_ordering ordering)
+{
+    msh.compute_connectivity();
+    auto num_cells = msh.cells.size();
+    auto num_faces = msh.faces.size();
+    auto bw_before = bandwidth(msh);
+
+    reorder_mesh(msh, ordering);
+
+    size_t errors = 0;
+    if (msh.cells.size() != num_cells or msh.faces.size() != num_faces)
+        errors++;
+
+    for (size_t i = 0; i < msh.cells.size(); i++)
+        if (offset(msh, msh.cells[i]) != i)
+            errors++;
+
+    for (size_t i = 0; i < msh.faces.size(); i++)
+        if (offset(msh, msh.faces[i]) != i)
+            errors++;
+
+    auto face_owners = msh.face_owners;
+    auto cell_faces = msh.cell_faces;
+    msh.compute_connectivity();
+    if (face_owners != msh.face_owners or cell_faces != msh.cell_faces)
+        errors++;
+
+    auto bw_after = bandwidth(msh);
+    std::cout << "  max distance " << bw_before.first << " -> " << bw_after.first;
+    std::cout << ", avg distance " << bw_before.second << " -> " << bw_after.second;
+    return errors;
+}
+
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    size_t errors = 0;
+    for (auto ordering : { yaourt::mesh_ordering::HILBERT,
+                           yaourt::mesh_ordering::REVERSE_CUTHILL_MCKEE })
+    {
+        Mesh msh;
+        auto mesher = yaourt::get_mesher(msh);
+        mesher.create_mesh(msh, 4);
+
+        /* The mesher builds the connectivity level by level, it must be
+         * the same computed by compute_connectivity() */
+        size_t err = 0;
+        auto face_owners = msh.face_owners;
+        auto cell_faces = msh.cell_faces;
+        msh.compute_connectivity();
+        if (face_owners != msh.face_owners or cell_faces != msh.cell_faces)
+            err++;
+
+        std::cout << name << ":";
+        err += check_reordering(msh, ordering);
+        std::cout << ", errors: " << err << std::endl;
+        errors += err;
+
+        /* The reordered mesh can be refined further */
+        mesher.refine_mesh(msh, 1);
+        msh.compute_connectivity();
+        errors += check_reordering(msh, ordering);
+        std::cout << std::endl;
+    }
+
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("Triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("Quadrangles");
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,306 @@
+#include <iostream>
+#include <cmath>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/multigrid.hpp"
+#include "methods/dg.hpp"
+#include "methods/dg_assembly.hpp"
+
+/* L2 projection of 'fun' on the DG space of degree 'degree', with the
+ * tabulated bases of the assembly */
+template<typename Mesh, typename Function>
+blaze::DynamicVector<typename Mesh::coordinate_type>
+project(const Mesh& msh, size_t degree, const Function& fun)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+    blaze::DynamicVector<T> ret(msh.cells.size()*bs);
+
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        auto basis = yaourt::bases::make_tabulated_basis(msh, msh.cells[cl_id],
+                                                         degree, 2*degree);
+        blaze::DynamicMatrix<T> M(bs, bs, 0.0);
+        blaze::DynamicVector<T> rhs(bs, 0.0);
+
+        auto qps = basis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
+        {
+            M += qps.weight(iqp) * qps.phi(iqp) * trans(qps.phi(iqp));
+            rhs += qps.weight(iqp) * fun(qps.point(iqp)) * qps.phi(iqp);
+        }
+
+        subvector(ret, cl_id*bs, bs) = yaourt::cholesky_factor<T>(M).solve(rhs);
+    }
+
+    return ret;
+}
+
+/* Max error of the discrete function 'u' against 'fun' at the
+ * quadrature points */
+template<typename Mesh, typename Function>
+typename Mesh::coordinate_type
+max_error(const Mesh& msh, size_t degree,
+          const blaze::DynamicVector<typename Mesh::coordinate_type>& u,
+          const Function& fun)
+{
+    using T = typename Mesh::coordinate_type;
+
+    auto bs = yaourt::bases::scalar_basis_size(degree, 2);
+
+    T err = 0.0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        auto basis = yaourt::bases::make_tabulated_basis(msh, msh.cells[cl_id],
+                                                         degree, 2*degree);
+        auto qps = basis.cell_quadrature();
+        for (size_t iqp = 0; iqp < qps.size(); iqp++)
+        {
+            auto val = dot(subvector(u, cl_id*bs, bs), qps.phi(iqp));
+            err = std::max(err, std::abs(val - fun(qps.point(iqp))));
+        }
+    }
+
+    return err;
+}
+
+/* The coarse spaces are contained in the fine ones: the prolongation of
+ * a polynomial must be the same polynomial, also after the renumbering
+ * of the finest mesh */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_prolongations(size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+
+    yaourt::mesh_hierarchy<Mesh> hier(3, 2);
+    hier.reorder_finest(yaourt::mesh_ordering::HILBERT);
+
+    /* In the space: a constant for DG0 */
+    auto fun = [&](const point_type& pt) -> T {
+        if (degree == 0)
+            return 0.5;
+        return yaourt::bases::iexp_pow(pt.x(), degree) - 2.0*pt.y() + 0.5;
+    };
+
+    T max_err = 0.0;
+    for (size_t l = 1; l < hier.num_levels(); l++)
+    {
+        const auto& coarse = hier.mesh(l-1);
+        const auto& fine = hier.mesh(l);
+
+        auto P = yaourt::h_prolongation<T>(coarse, fine, hier.parents(l), degree, 2);
+        blaze::DynamicVector<T> u = P * project(coarse, degree, fun);
+        max_err = std::max(max_err, max_error(fine, degree, u, fun));
+    }
+
+    const auto& msh = hier.finest();
+    auto Pp = yaourt::p_prolongation<T>(msh, degree+1, degree);
+    blaze::DynamicVector<T> up = Pp * project(msh, degree, fun);
+    max_err = std::max(max_err, max_error(msh, degree+1, up, fun));
+
+    return max_err;
+}
+
+/* Two-point flux Laplacian with Dirichlet conditions on the cell
+ * averages, a symmetric positive definite DG0 system */
+template<typename Mesh>
+blaze::CompressedMatrix<typename Mesh::coordinate_type>
+make_tpfa_laplacian(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+
+    std::vector<blaze::triplet<T>> triplets;
+    for (size_t fc_id = 0; fc_id < msh.faces.size(); fc_id++)
+    {
+        const auto& fc = msh.faces[fc_id];
+        auto fo = msh.face_owners[fc_id];
+        auto bar0 = barycenter(msh, msh.cells[fo[0]]);
+
+        if (fo[1] == NO_OWNER)
+        {
+            auto w = measure(msh, fc) / distance(bar0, barycenter(msh, fc));
+            triplets.push_back({fo[0], fo[0], w});
+            continue;
+        }
+
+        auto w = measure(msh, fc) / distance(bar0, barycenter(msh, msh.cells[fo[1]]));
+        triplets.push_back({fo[0], fo[0], w});
+        triplets.push_back({fo[1], fo[1], w});
+        triplets.push_back({fo[0], fo[1], -w});
+        triplets.push_back({fo[1], fo[0], -w});
+    }
+
+    blaze::CompressedMatrix<T> A(msh.cells.size(), msh.cells.size());
+    blaze::init_from_triplets(A, triplets.begin(), triplets.end());
+    return A;
+}
+
+/* Multigrid-preconditioned CG must take less iterations than plain CG,
+ * the cycles alone must converge. With the piecewise constant
+ * prolongations of DG0 they need more than fifty. */
+template<typename Mesh>
+size_t
+check_solvers()
+{
+    using T = typename Mesh::coordinate_type;
+
+    yaourt::mesh_hierarchy<Mesh> hier(5);
+    const auto& msh = hier.finest();
+    auto A = make_tpfa_laplacian(msh);
+    blaze::DynamicVector<T> b(A.rows(), 1.0), x(A.rows(), 0.0);
+
+    conjugated_gradient_params<T> cgp;
+    cgp.rr_tol = 1e-8;
+    cgp.max_iter = 5000;
+
+    conjugated_gradient_solver<T> plain(cgp);
+    plain.solve(A, b, x);
+
+    yaourt::multigrid_params<T> mgp;
+    mgp.rr_tol = 1e-8;
+    mgp.max_cycles = 500;
+    auto mg = yaourt::make_dg_multigrid(msh, &hier, A, 0, mgp);
+
+    x = 0.0;
+    conjugated_gradient_solver<T> pcg(cgp);
+    pcg.solve(A, b, x, mg);
+    blaze::DynamicVector<T> res = b - A*x;
+    T pcg_rr = norm(res)/norm(b);
+
+    x = 0.0;
+    bool converged = mg.solve(b, x);
+
+    std::cout << "Levels: " << mg.num_levels() << ", CG: " << plain.iterations();
+    std::cout << ", MG-PCG: " << pcg.iterations() << " (" << pcg_rr << ")";
+    std::cout << ", cycles: " << mg.iterations() << " (";
+    std::cout << mg.relative_residual() << ")" << std::endl;
+
+    size_t errors = 0;
+    if (mg.num_levels() != hier.num_levels())
+        errors++;
+    if (pcg_rr > 1e-8 or pcg.iterations() >= plain.iterations())
+        errors++;
+    if (!converged)
+        errors++;
+
+    return errors;
+}
+
+/* Iterations of the multigrid-preconditioned CG on the SIP system of
+ * degree 'degree' on the finest mesh of 'hier' */
+template<typename Mesh>
+size_t
+sip_pcg_iterations(const yaourt::mesh_hierarchy<Mesh>& hier, size_t degree,
+                   const yaourt::multigrid_params<typename Mesh::coordinate_type>& mgp,
+                   bool use_hierarchy = true)
+{
+    using T = typename Mesh::coordinate_type;
+    using point_type = typename Mesh::point_type;
+
+    const auto& msh = hier.finest();
+    T eta = 3*(degree+1)*(degree+1);
+    auto one = [](const point_type&) -> T { return 1.0; };
+    auto zero = [](const point_type&) -> T { return 0.0; };
+
+    assembler<Mesh> assm(msh, degree, false, 1, dg_assembly_mode::PATTERN);
+    assemble_sip_diffusion(msh, assm, degree, eta, one, zero);
+    assm.finalize();
+
+    blaze::CompressedMatrix<T> A(assm.lhs);
+    auto mg = yaourt::make_dg_multigrid(msh, use_hierarchy ? &hier : nullptr,
+                                        A, degree, mgp);
+
+    conjugated_gradient_params<T> cgp;
+    cgp.rr_tol = 1e-8;
+    cgp.max_iter = 1000;
+
+    blaze::DynamicVector<T> x(A.rows(), 0.0);
+    conjugated_gradient_solver<T> pcg(cgp);
+    pcg.solve(A, assm.rhs, x, mg);
+
+    blaze::DynamicVector<T> res = assm.rhs - A*x;
+    if (norm(res)/norm(assm.rhs) > 1e-8)
+        return cgp.max_iter;
+
+    return pcg.iterations();
+}
+
+/* h/p multigrid on the SIP systems: the iterations must stay bounded
+ * over the refinements. With the W-cycle they level off, the last
+ * refinement adds at most a few (the V-cycle adds about half). The
+ * coarsest level of the p-only multigrid on a
+ * fine mesh is too large for the dense factorization and is solved with
+ * CG: the preconditioner must be as good as with the dense solver. */
+template<typename Mesh>
+size_t
+check_sip(const char *name)
+{
+    using T = typename Mesh::coordinate_type;
+
+    const size_t max_iterations = 45;
+    const size_t max_last_increase = 4;
+
+    size_t errors = 0;
+    yaourt::multigrid_params<T> mgp;
+    for (size_t degree = 1; degree <= 3; degree++)
+    {
+        size_t prev_iter = 0, iter = 0, max_iter = 0;
+        std::cout << name << ", SIP degree " << degree << ", MG-PCG:";
+        for (size_t levels = 3; levels <= 6; levels++)
+        {
+            yaourt::mesh_hierarchy<Mesh> hier(levels);
+            prev_iter = iter;
+            iter = sip_pcg_iterations(hier, degree, mgp);
+            std::cout << " " << iter;
+            max_iter = std::max(max_iter, iter);
+        }
+        std::cout << std::endl;
+
+        if (max_iter > max_iterations or iter > prev_iter + max_last_increase)
+            errors++;
+    }
+
+    yaourt::mesh_hierarchy<Mesh> hier(4);
+    auto dense_mgp = mgp;
+    dense_mgp.max_dense_coarse = hier.finest().cells.size()*3;
+    auto cg_mgp = mgp;
+    cg_mgp.max_dense_coarse = 0;
+    auto dense_iter = sip_pcg_iterations(hier, 2, dense_mgp, false);
+    auto cg_iter = sip_pcg_iterations(hier, 2, cg_mgp, false);
+    std::cout << name << ", p-multigrid, dense coarse solver: " << dense_iter;
+    std::cout << ", CG coarse solver: " << cg_iter << std::endl;
+    if (cg_iter > dense_iter + 1 or dense_iter >= max_iterations)
+        errors++;
+
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+
+    for (size_t k = 0; k < 4; k++)
+    {
+        auto err_tri = check_prolongations< yaourt::simplicial_mesh<T> >(k);
+        auto err_quad = check_prolongations< yaourt::quad_mesh<T> >(k);
+        std::cout << "Prolongations, degree " << k << ": " << err_tri << " ";
+        std::cout << err_quad << std::endl;
+        if (err_tri > 1e-10 or err_quad > 1e-10)
+            errors++;
+    }
+
+    errors += check_solvers< yaourt::simplicial_mesh<T> >();
+    errors += check_solvers< yaourt::quad_mesh<T> >();
+
+    errors += check_sip< yaourt::simplicial_mesh<T> >("Triangles");
+    errors += check_sip< yaourt::quad_mesh<T> >("Quadrangles");
+
+    std::cout << "Errors: " << errors << std::endl;
+    return errors == 0 ? 0 : 1;
+}
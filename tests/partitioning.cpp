@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/partitioning.hpp"
+#include "core/adaptivity.hpp"
+
+/* Check the local mesh of a part against the global mesh: the cells are
+ * the same, the owned cells have all their neighbours in the local mesh
+ * and the interior cells have no ghost neighbours. Returns the number of
+ * errors. */
+template<typename Mesh>
+size_t
+check_local_mesh(const Mesh& msh, const Mesh& local, const yaourt::mesh_partition& part)
+{
+    size_t errors = 0;
+
+    if (local.cells.size() != part.global_cell.size())
+        errors++;
+
+    for (size_t i = 0; i < local.cells.size(); i++)
+    {
+        auto gbar = barycenter(msh, msh.cells[ part.global_cell[i] ]);
+        auto lbar = barycenter(local, local.cells[i]);
+        if ( std::abs(gbar.x() - lbar.x()) > 1e-14 or
+             std::abs(gbar.y() - lbar.y()) > 1e-14 )
+            errors++;
+    }
+
+    for (size_t i = 0; i < part.num_owned; i++)
+    {
+        for (auto& fcid : face_ids(local, i))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(local, i, fcid);
+            if (!has_neighbour and !local.faces[fcid].is_boundary)
+                errors++;
+        }
+    }
+
+    for (auto& i : part.interior_cells)
+    {
+        for (auto& fcid : face_ids(local, i))
+        {
+            auto [ncl_id, has_neighbour] = neighbour_via(local, i, fcid);
+            if (has_neighbour and ncl_id >= part.num_owned)
+                errors++;
+        }
+    }
+
+    if (part.interior_cells.size() + part.interface_cells.size() != part.num_owned)
+        errors++;
+
+    return errors;
+}
+
+template<typename Mesh>
+size_t
+run_checks(const char *name)
+{
+    Mesh msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 4);
+
+    size_t errors = 0;
+    for (size_t num_parts : {1, 2, 3, 4, 7})
+    {
+        auto parts = yaourt::partition_mesh(msh, num_parts);
+
+        std::vector<size_t> sizes(num_parts, 0);
+        for (auto& p : parts)
+            sizes.at(p)++;
+
+        auto [min, max] = std::minmax_element(sizes.begin(), sizes.end());
+        if (*min == 0 or *max - *min > num_parts)
+            errors++;
+
+        std::vector<Mesh> locals(num_parts);
+        std::vector<yaourt::mesh_partition> descs;
+        size_t owned = 0, ghosts = 0;
+        for (size_t p = 0; p < num_parts; p++)
+        {
+            descs.push_back( yaourt::extract_partition(msh, parts, p, locals[p]) );
+            errors += check_local_mesh(msh, locals[p], descs[p]);
+            owned += descs[p].num_owned;
+            ghosts += descs[p].num_ghosts();
+        }
+
+        if (owned != msh.cells.size())
+            errors++;
+
+        /* What a part sends is what its neighbour receives */
+        for (size_t p = 0; p < num_parts; p++)
+        {
+            for (auto& l : descs[p].links)
+            {
+                auto& other = descs[l.part].links;
+                auto itor = std::find_if(other.begin(), other.end(),
+                    [&](const yaourt::mesh_partition::halo_link& ol) {
+                        return ol.part == p;
+                    });
+
+                if (itor == other.end() or itor->recv.size() != l.send.size())
+                {
+                    errors++;
+                    continue;
+                }
+
+                for (size_t i = 0; i < l.send.size(); i++)
+                    if (descs[p].global_cell[ l.send[i] ] !=
+                        descs[l.part].global_cell[ itor->recv[i] ])
+                        errors++;
+            }
+        }
+
+        std::cout << name << ", " << num_parts << " parts: sizes " << *min;
+        std::cout << " to " << *max << ", " << ghosts << " ghosts" << std::endl;
+    }
+
+    /* A nonconforming mesh must be refused, not split without its
+     * hanging faces */
+    std::vector<bool> marked(msh.cells.size(), false);
+    marked[0] = true;
+    yaourt::refine_cells(msh, marked);
+    std::vector<size_t> parts(msh.cells.size(), 0);
+    Mesh local;
+    try {
+        yaourt::extract_partition(msh, parts, 0, local);
+        errors++;
+    }
+    catch (const std::invalid_argument&) {}
+
+    std::cout << name << ": errors: " << errors << std::endl;
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    size_t errors = 0;
+    errors += run_checks< yaourt::simplicial_mesh<T> >("Triangles");
+    errors += run_checks< yaourt::quad_mesh<T> >("Quadrangles");
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <cmath>
+
+#include "core/blaze_sparse_init.hpp"
+#include "core/preconditioners.hpp"
+#include "core/solvers.hpp"
+
+/* 1D convection-diffusion matrix, tridiagonal and asymmetric */
+template<typename T>
+blaze::CompressedMatrix<T>
+make_tridiagonal(size_t N)
+{
+    std::vector<blaze::triplet<T>> triplets;
+    for (size_t i = 0; i < N; i++)
+    {
+        triplets.push_back({i, i, 2.0});
+        if (i > 0)
+            triplets.push_back({i, i-1, -1.3});
+        if (i+1 < N)
+            triplets.push_back({i, i+1, -0.7});
+    }
+
+    blaze::CompressedMatrix<T> A(N, N);
+    blaze::init_from_triplets(A, triplets.begin(), triplets.end());
+    return A;
+}
+
+/* Block diagonal matrix with asymmetric blocks of size 'bs' */
+template<typename T>
+blaze::CompressedMatrix<T>
+make_block_diagonal(size_t num_blocks, size_t bs)
+{
+    std::vector<blaze::triplet<T>> triplets;
+    for (size_t k = 0; k < num_blocks; k++)
+        for (size_t i = 0; i < bs; i++)
+            for (size_t j = 0; j < bs; j++)
+                triplets.push_back({k*bs+i, k*bs+j, (i == j) ? 4.0+k : 1.0/(1+i+2*j)});
+
+    blaze::CompressedMatrix<T> A(num_blocks*bs, num_blocks*bs);
+    blaze::init_from_triplets(A, triplets.begin(), triplets.end());
+    return A;
+}
+
+/* The preconditioner is exact for the given matrix: check that it
+ * inverts it and that its transpose inverts the transpose. */
+template<typename T, typename Precond>
+T
+check_exact(const blaze::CompressedMatrix<T>& A, const Precond& P)
+{
+    blaze::DynamicVector<T> r(A.rows()), z;
+    for (size_t i = 0; i < r.size(); i++)
+        r[i] = 1.0 + std::sin(i);
+
+    P.apply(r, z);
+    blaze::DynamicVector<T> Az = A*z;
+    T err = norm(Az - r);
+
+    P.apply_transpose(r, z);
+    blaze::DynamicVector<T> Atz = trans(A)*z;
+    err = std::max(err, norm(Atz - r));
+
+    return err;
+}
+
+int main(void)
+{
+    using T = double;
+
+    auto A = make_tridiagonal<T>(50);
+    yaourt::ilu0_preconditioner<T> ilu(A);
+    std::cout << "ILU(0) on tridiagonal: " << check_exact(A, ilu) << std::endl;
+
+    auto B = make_block_diagonal<T>(7, 4);
+    yaourt::block_jacobi_preconditioner<T> bj(B, 4);
+    std::cout << "Block-Jacobi on block diagonal: " << check_exact(B, bj) << std::endl;
+
+    blaze::DynamicVector<T> b(A.rows(), 1.0), x(A.rows(), 0.0);
+
+    conjugated_gradient_params<T> cgp;
+    cgp.max_iter = 1000;
+    bicgstab(cgp, A, b, x, ilu);
+    blaze::DynamicVector<T> res = b - A*x;
+    std::cout << "Preconditioned BiCGStab residual: " << norm(res) << std::endl;
+
+    x = 0.0;
+    yaourt::block_jacobi_preconditioner<T> bja(A, 5);
+    qmr(A, b, x, bja);
+    res = b - A*x;
+    std::cout << "Preconditioned QMR residual: " << norm(res) << std::endl;
+
+    /* Mixed precision: the inner solves in float only reach 1e-4, the
+     * refinement must still give the double precision residual */
+    using L = float;
+    blaze::CompressedMatrix<L> A_lo(A);
+    yaourt::ilu0_preconditioner<L> ilu_lo(A_lo);
+
+    cgp.rr_tol = 1e-12;
+    bool mixed_ok = bicgstab_mixed<L>(cgp, A, A_lo, b, x, ilu_lo);
+    res = b - A*x;
+    T mixed_rr = norm(res)/norm(b);
+    std::cout << "Mixed precision BiCGStab relative residual: " << mixed_rr << std::endl;
+
+    auto S = make_block_diagonal<T>(7, 4);
+    S = S + trans(S);
+    blaze::CompressedMatrix<L> S_lo(S);
+    blaze::DynamicVector<T> bs(S.rows(), 1.0), xs(S.rows(), 0.0);
+    mixed_ok = conjugated_gradient_mixed<L>(cgp, S, S_lo, bs, xs) and mixed_ok;
+    res = bs - S*xs;
+    T mixed_cg_rr = norm(res)/norm(bs);
+    std::cout << "Mixed precision CG relative residual: " << mixed_cg_rr << std::endl;
+
+    /* An inner solve that cannot converge stops the refinement */
+    auto fcgp = cgp;
+    fcgp.max_iter = 1;
+    xs = 0.0;
+    bool failed = !conjugated_gradient_mixed<L>(fcgp, S, S_lo, bs, xs);
+    x = 0.0;
+    failed = !bicgstab_mixed<L>(fcgp, A, A_lo, b, x) and failed;
+    std::cout << "Mixed precision failed inner solves reported: " << failed << std::endl;
+
+    return (mixed_ok and failed and mixed_rr < 1e-12 and mixed_cg_rr < 1e-12) ? 0 : 1;
+}
@@ -1,4 +1,6 @@
+#include <cmath>
 #include <iostream>
+#include <vector>
 
 #include "core/mesh.hpp"
 #include "core/meshers.hpp"
@@ -181,6 +183,87 @@ test_quadratures_on_monomials(Mesh& msh)
     }
 }
 
+/* The rules of the registry are exact up to their degree, and filling a
+ * buffer gives the same points as the version returning a new vector */
+template<typename Mesh>
+size_t
+test_buffered_quadratures(Mesh& msh)
+{
+    namespace yq = yaourt::quadratures;
+    namespace yb = yaourt::bases;
+    using T = typename Mesh::coordinate_type;
+
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 1);
+
+    size_t errors = 0;
+    std::vector<yq::quadrature_point<T,2>> buf;
+
+    for (size_t degree = 0; degree < 19; degree++)
+    {
+        T computed = 0.0;
+        for (auto& cl : msh.cells)
+        {
+            auto qps = yq::integrate(msh, cl, degree);
+            yq::integrate(msh, cl, degree, buf);
+            if (buf.size() != qps.size())
+            {
+                errors++;
+                continue;
+            }
+
+            for (size_t i = 0; i < qps.size(); i++)
+            {
+                if (buf[i].weight() != qps[i].weight() or
+                    buf[i].point().x() != qps[i].point().x() or
+                    buf[i].point().y() != qps[i].point().y())
+                    errors++;
+
+                auto ep = buf[i].point();
+                computed += buf[i].weight() * yb::iexp_pow(ep.x(), degree);
+            }
+        }
+
+        /* x^k on the unit square */
+        T expected = 1./(degree+1);
+        if ( std::abs(computed - expected) > 1e-12 )
+        {
+            std::cout << "Cell rule of degree " << degree << ": expected ";
+            std::cout << expected << ", computed " << computed << std::endl;
+            errors++;
+        }
+
+        /* x^k along a segment from x = a to x = b, of length L */
+        computed = 0.0;
+        expected = 0.0;
+        for (auto& fc : msh.faces)
+        {
+            yq::integrate(msh, fc, degree, buf);
+            for (auto& qp : buf)
+                computed += qp.weight() * yb::iexp_pow(qp.point().x(), degree);
+
+            auto pts = points(msh, fc);
+            auto xa = pts[0].x();
+            auto xb = pts[1].x();
+            auto L = measure(msh, fc);
+            if ( std::abs(xb - xa) < 1e-14 )
+                expected += L * yb::iexp_pow(xa, degree);
+            else
+                expected += L * (yb::iexp_pow(xb, degree+1) - yb::iexp_pow(xa, degree+1))
+                              / ((degree+1) * (xb - xa));
+        }
+
+        if ( std::abs(computed - expected) > 1e-12 )
+        {
+            std::cout << "Face rule of degree " << degree << ": expected ";
+            std::cout << expected << ", computed " << computed << std::endl;
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
 int main(void)
 {
     using T = double;
@@ -189,10 +272,17 @@ int main(void)
     //shatter_mesh(msh_s, 0.15);
     test_quadratures_on_monomials(msh_s);
 
+    size_t errors = 0;
+    yaourt::simplicial_mesh<T> msh_b;
+    errors += test_buffered_quadratures(msh_b);
+    yaourt::quad_mesh<T> msh_bq;
+    errors += test_buffered_quadratures(msh_bq);
+    std::cout << "Buffered quadratures: errors: " << errors << std::endl;
+
     //yaourt::quad_mesh<T> msh_q;
     //shatter_mesh(msh_q, 0.15);
     //test_quadratures(msh_q);
 
-    return 0;
+    return errors == 0 ? 0 : 1;
 }
 
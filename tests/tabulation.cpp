@@ -0,0 +1,207 @@
+#include <iostream>
+
+#include "core/mesh.hpp"
+#include "core/meshers.hpp"
+#include "core/tabulation.hpp"
+
+/* Compare the tabulated values with the direct evaluation of the basis,
+ * on the cells and on the faces (seen from both the owners). */
+template<typename Mesh>
+typename Mesh::coordinate_type
+check_tabulation(Mesh& msh, size_t degree)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    msh.compute_connectivity();
+
+    T max_err = 0.0;
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto tb = yb::make_tabulated_basis(msh, cl, degree, 2*degree);
+
+        T meas = 0.0;
+        auto qps = tb.cell_quadrature();
+        for (size_t i = 0; i < qps.size(); i++)
+        {
+            meas += qps.weight(i);
+            max_err = std::max(max_err, norm(qps.phi(i) - tb.eval(qps.point(i))));
+
+            blaze::DynamicMatrix<T> dphi_err = qps.grads(i) - tb.eval_grads(qps.point(i));
+            for (size_t j = 0; j < dphi_err.rows(); j++)
+                max_err = std::max(max_err, norm(trans(row(dphi_err, j))));
+        }
+        max_err = std::max(max_err, std::abs(meas - measure(msh, cl)));
+
+        for (auto& fcid : face_ids(msh, cl_id))
+        {
+            const auto& fc = msh.faces[fcid];
+            auto fqps = tb.face_quadrature(fc);
+            auto ref_fqps = yq::integrate(msh, fc, 2*degree);
+
+            for (size_t i = 0; i < fqps.size(); i++)
+            {
+                max_err = std::max(max_err, distance(fqps.point(i), ref_fqps[i].point()));
+                max_err = std::max(max_err, std::abs(fqps.weight(i) - ref_fqps[i].weight()));
+                max_err = std::max(max_err, norm(fqps.phi(i) - tb.eval(ref_fqps[i].point())));
+            }
+        }
+    }
+
+    return max_err;
+}
+
+/* Compare the allocation-free and the compile-time degree evaluations,
+ * also with the bases of fixed degree, with the plain ones */
+template<size_t K, typename Mesh>
+typename Mesh::coordinate_type
+check_buffer_eval(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yb = yaourt::bases;
+    namespace yq = yaourt::quadratures;
+
+    constexpr auto bs = yb::scalar_basis_size(K, 2);
+    std::array<T, bs> buf;
+    blaze::CustomVector<T, blaze::unaligned, blaze::unpadded> cphi(buf.data(), bs);
+    blaze::DynamicMatrix<T> dphi(bs, 2);
+
+    T max_err = 0.0;
+    for (auto& cl : msh.cells)
+    {
+        auto basis = yb::make_basis(msh, cl, K);
+        auto fbasis = yb::make_basis<K>(msh, cl);
+        auto qps = yq::integrate(msh, cl, 2*K);
+        for (auto& qp : qps)
+        {
+            auto phi = basis.eval(qp.point());
+            basis.eval(qp.point(), cphi);
+            basis.eval_grads(qp.point(), dphi);
+            auto sphi = basis.template eval<K>(qp.point());
+            auto sdphi = basis.template eval_grads<K>(qp.point());
+            auto fphi = fbasis.eval(qp.point());
+            auto fdphi = fbasis.eval_grads(qp.point());
+
+            max_err = std::max(max_err, norm(phi - cphi));
+            max_err = std::max(max_err, norm(phi - sphi));
+            max_err = std::max(max_err, norm(phi - fphi));
+
+            auto ref_dphi = basis.eval_grads(qp.point());
+            for (size_t j = 0; j < bs; j++)
+            {
+                for (size_t d = 0; d < 2; d++)
+                {
+                    max_err = std::max(max_err, std::abs(ref_dphi(j,d) - dphi(j,d)));
+                    max_err = std::max(max_err, std::abs(ref_dphi(j,d) - sdphi(j,d)));
+                    max_err = std::max(max_err, std::abs(ref_dphi(j,d) - fdphi(j,d)));
+                }
+            }
+        }
+    }
+
+    return max_err;
+}
+
+/* The tabulation of degree K fixed at compile time must have the values
+ * and gradients of the one of runtime degree */
+template<size_t K, typename Mesh>
+typename Mesh::coordinate_type
+check_static_tabulation(const Mesh& msh)
+{
+    using T = typename Mesh::coordinate_type;
+    namespace yb = yaourt::bases;
+
+    T max_err = 0.0;
+    auto compare = [&](const auto& sq, const auto& dq) {
+        for (size_t i = 0; i < sq.size(); i++)
+        {
+            max_err = std::max(max_err, norm(sq.phi(i) - dq.phi(i)));
+            max_err = std::max(max_err, blaze::max(blaze::abs(sq.grads(i) - dq.grads(i))));
+        }
+    };
+
+    for (size_t cl_id = 0; cl_id < msh.cells.size(); cl_id++)
+    {
+        const auto& cl = msh.cells[cl_id];
+        auto stb = yb::make_tabulated_basis<K>(msh, cl, K, 2*K);
+        auto dtb = yb::make_tabulated_basis(msh, cl, K, 2*K);
+
+        compare(stb.cell_quadrature(), dtb.cell_quadrature());
+        for (auto& fc : faces(msh, cl))
+            compare(stb.face_quadrature(fc), dtb.face_quadrature(fc));
+    }
+
+    return max_err;
+}
+
+/* The dispatch must give each degree up to YAOURT_MAX_STATIC_DEGREE at
+ * compile time and fall back to dynamic_degree above. Returns the number
+ * of errors. */
+size_t
+check_dispatch(void)
+{
+    namespace yb = yaourt::bases;
+
+    size_t errors = 0;
+    for (size_t k = 0; k <= YAOURT_MAX_STATIC_DEGREE+2; k++)
+    {
+        size_t calls = 0;
+        yb::dispatch_degree(k, [&](auto static_degree) {
+            constexpr size_t K = decltype(static_degree)::value;
+            calls++;
+            if (k <= YAOURT_MAX_STATIC_DEGREE and K != k)
+                errors++;
+            if (k > YAOURT_MAX_STATIC_DEGREE and K != yb::dynamic_degree)
+                errors++;
+        });
+
+        if (calls != 1)
+            errors++;
+    }
+
+    return errors;
+}
+
+int main(void)
+{
+    using T = double;
+
+    for (size_t k = 0; k < 5; k++)
+    {
+        yaourt::simplicial_mesh<T> msh_tri;
+        auto mesher_tri = yaourt::get_mesher(msh_tri);
+        mesher_tri.create_mesh(msh_tri, 2);
+        shatter_mesh(msh_tri, 0.2);
+
+        yaourt::quad_mesh<T> msh_quad;
+        auto mesher_quad = yaourt::get_mesher(msh_quad);
+        mesher_quad.create_mesh(msh_quad, 2);
+
+        std::cout << "Degree " << k << ": ";
+        std::cout << check_tabulation(msh_tri, k) << " ";
+        std::cout << check_tabulation(msh_quad, k) << std::endl;
+    }
+
+    yaourt::simplicial_mesh<T> msh;
+    auto mesher = yaourt::get_mesher(msh);
+    mesher.create_mesh(msh, 1);
+    std::cout << "Buffer evaluation: " << check_buffer_eval<3>(msh) << std::endl;
+
+    yaourt::quad_mesh<T> msh_quad;
+    auto mesher_quad = yaourt::get_mesher(msh_quad);
+    mesher_quad.create_mesh(msh_quad, 1);
+    auto static_err = std::max(check_static_tabulation<2>(msh),
+                               check_static_tabulation<2>(msh_quad));
+    std::cout << "Static tabulation: " << static_err << std::endl;
+
+    auto dispatch_errors = check_dispatch();
+    std::cout << "Degree dispatch errors: " << dispatch_errors << std::endl;
+
+    size_t errors = dispatch_errors;
+    if (static_err > 1e-14)
+        errors++;
+
+    return errors == 0 ? 0 : 1;
+}